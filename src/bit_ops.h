@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define RISCV_BIT_OPS_H
 
 #include "rvvm_types.h"
+#include "compiler.h"
 
 // Simple math operations (sign-extend int bits, etc) for internal usage
 
@@ -74,6 +75,78 @@ static inline maxlen_t bit_reverse(maxlen_t val, bitcnt_t bits)
     return ret;
 }
 
+// Count leading zero bits, returns 32/64 for zero
+static inline bitcnt_t bit_clz32(uint32_t val)
+{
+#ifdef GNU_EXTS
+    return val ? __builtin_clz(val) : 32;
+#else
+    bitcnt_t ret = 0;
+    while (ret < 32 && !(val & 0x80000000U)) {
+        val <<= 1;
+        ret++;
+    }
+    return ret;
+#endif
+}
+
+static inline bitcnt_t bit_clz64(uint64_t val)
+{
+#ifdef GNU_EXTS
+    return val ? __builtin_clzll(val) : 64;
+#else
+    if (val >> 32) return bit_clz32(val >> 32);
+    return 32 + bit_clz32(val);
+#endif
+}
+
+// Count trailing zero bits, returns 32/64 for zero
+static inline bitcnt_t bit_ctz32(uint32_t val)
+{
+#ifdef GNU_EXTS
+    return val ? __builtin_ctz(val) : 32;
+#else
+    bitcnt_t ret = 0;
+    while (ret < 32 && !(val & 0x1)) {
+        val >>= 1;
+        ret++;
+    }
+    return ret;
+#endif
+}
+
+static inline bitcnt_t bit_ctz64(uint64_t val)
+{
+#ifdef GNU_EXTS
+    return val ? __builtin_ctzll(val) : 64;
+#else
+    if ((uint32_t)val) return bit_ctz32(val);
+    return 32 + bit_ctz32(val >> 32);
+#endif
+}
+
+// Count set bits
+static inline bitcnt_t bit_popcnt32(uint32_t val)
+{
+#ifdef GNU_EXTS
+    return __builtin_popcount(val);
+#else
+    val = val - ((val >> 1) & 0x55555555);
+    val = (val & 0x33333333) + ((val >> 2) & 0x33333333);
+    val = (val + (val >> 4)) & 0x0F0F0F0F;
+    return (val * 0x01010101) >> 24;
+#endif
+}
+
+static inline bitcnt_t bit_popcnt64(uint64_t val)
+{
+#ifdef GNU_EXTS
+    return __builtin_popcountll(val);
+#else
+    return bit_popcnt32(val) + bit_popcnt32(val >> 32);
+#endif
+}
+
 static inline uint32_t byteswap_uint32(uint32_t val)
 {
     return (((val & 0xFF000000) >> 24) |
@@ -45,6 +45,42 @@ static void riscv_a_atomic_w(rvvm_hart_t *vm, const uint32_t instruction)
     xaddr_t addr = riscv_read_register(vm, rs1);
     uint32_t val = riscv_read_register(vm, rs2);
 
+    switch (op) {
+    case AMO_LR:
+        rvjit_lr_w(rds, rs1, 4);
+        break;
+    case AMO_SC:
+        rvjit_sc_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_SWAP:
+        rvjit_amoswap_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_ADD:
+        rvjit_amoadd_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_XOR:
+        rvjit_amoxor_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_AND:
+        rvjit_amoand_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_OR:
+        rvjit_amoor_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_MIN:
+        rvjit_amomin_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_MAX:
+        rvjit_amomax_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_MINU:
+        rvjit_amominu_w(rds, rs1, rs2, 4);
+        break;
+    case AMO_MAXU:
+        rvjit_amomaxu_w(rds, rs1, rs2, 4);
+        break;
+    }
+
     if (unlikely(addr & 3)) {
         riscv_trap(vm, TRAP_STORE_MISALIGN, 0);
         return;
@@ -63,12 +99,13 @@ static void riscv_a_atomic_w(rvvm_hart_t *vm, const uint32_t instruction)
         riscv_write_register(vm, rds, (int32_t)vm->lrsc_cas);
         break;
     case AMO_SC:
+        // Reservation is invalidated regardless of SC outcome
         if (vm->lrsc && atomic_cas_uint32_le(ptr, vm->lrsc_cas, val)) {
-            vm->lrsc = false;
             riscv_write_register(vm, rds, 0);
         } else {
             riscv_write_register(vm, rds, 1);
         }
+        vm->lrsc = false;
         break;
     case AMO_SWAP:
         riscv_write_register(vm, rds, (int32_t)atomic_swap_uint32_le(ptr, val));
@@ -113,6 +150,42 @@ static void riscv_a_atomic_d(rvvm_hart_t *vm, const uint32_t instruction)
     xaddr_t addr = riscv_read_register(vm, rs1);
     uint64_t val = riscv_read_register(vm, rs2);
 
+    switch (op) {
+    case AMO_LR:
+        rvjit_lr_d(rds, rs1, 4);
+        break;
+    case AMO_SC:
+        rvjit_sc_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_SWAP:
+        rvjit_amoswap_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_ADD:
+        rvjit_amoadd_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_XOR:
+        rvjit_amoxor_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_AND:
+        rvjit_amoand_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_OR:
+        rvjit_amoor_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_MIN:
+        rvjit_amomin_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_MAX:
+        rvjit_amomax_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_MINU:
+        rvjit_amominu_d(rds, rs1, rs2, 4);
+        break;
+    case AMO_MAXU:
+        rvjit_amomaxu_d(rds, rs1, rs2, 4);
+        break;
+    }
+
     if (unlikely(addr & 7)) {
         riscv_trap(vm, TRAP_STORE_MISALIGN, 0);
         return;
@@ -131,12 +204,13 @@ static void riscv_a_atomic_d(rvvm_hart_t *vm, const uint32_t instruction)
         vm->registers[rds] = vm->lrsc_cas;
         break;
     case AMO_SC:
+        // Reservation is invalidated regardless of SC outcome
         if (vm->lrsc && atomic_cas_uint64_le(ptr, vm->lrsc_cas, val)) {
-            vm->lrsc = false;
             riscv_write_register(vm, rds, 0);
         } else {
             riscv_write_register(vm, rds, 1);
         }
+        vm->lrsc = false;
         break;
     case AMO_SWAP:
         vm->registers[rds] = atomic_swap_uint64_le(ptr, val);
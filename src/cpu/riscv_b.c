@@ -0,0 +1,424 @@
+/*
+riscv_b.c - RISC-V B (Zba, Zbb, Zbc, Zbs) Decoder, Interpreter
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define RISCV_CPU_SOURCE
+
+#include "bit_ops.h"
+#include "riscv_cpu.h"
+
+/*
+ * Bitmanip instructions share decoder slots with base I/M instructions,
+ * the owners of those slots pass any unknown funct7 here.
+ * Anything still unknown is passed on to the scalar crypto decoder.
+ */
+
+#ifdef RV64
+#define XLEN_BITS 64
+#define riscv_b_clz(val)    bit_clz64(val)
+#define riscv_b_ctz(val)    bit_ctz64(val)
+#define riscv_b_cpop(val)   bit_popcnt64(val)
+#define riscv_b_rev8(val)   byteswap_uint64(val)
+#else
+#define XLEN_BITS 32
+#define riscv_b_clz(val)    bit_clz32(val)
+#define riscv_b_ctz(val)    bit_ctz32(val)
+#define riscv_b_cpop(val)   bit_popcnt32(val)
+#define riscv_b_rev8(val)   byteswap_uint32(val)
+#endif
+
+// Encodings of unary instructions in the immediate field
+#define RVB_CLZ     0x600
+#define RVB_CTZ     0x601
+#define RVB_CPOP    0x602
+#define RVB_SEXT_B  0x604
+#define RVB_SEXT_H  0x605
+#define RVB_ORC_B   0x287
+#ifdef RV64
+#define RVB_REV8    0x6B8
+#else
+#define RVB_REV8    0x698
+#endif
+
+static inline xlen_t riscv_b_rol(xlen_t val, bitcnt_t shamt)
+{
+    shamt &= XLEN_BITS - 1;
+    return shamt ? ((val << shamt) | (val >> (XLEN_BITS - shamt))) : val;
+}
+
+static inline xlen_t riscv_b_ror(xlen_t val, bitcnt_t shamt)
+{
+    shamt &= XLEN_BITS - 1;
+    return shamt ? ((val >> shamt) | (val << (XLEN_BITS - shamt))) : val;
+}
+
+static inline uint32_t riscv_b_rorw(uint32_t val, bitcnt_t shamt)
+{
+    shamt &= 31;
+    return shamt ? ((val >> shamt) | (val << (32 - shamt))) : val;
+}
+
+static inline xlen_t riscv_b_orc_b(xlen_t val)
+{
+    xlen_t ret = 0;
+    for (bitcnt_t i=0; i<XLEN_BITS; i += 8) {
+        if ((val >> i) & 0xFF) ret |= ((xlen_t)0xFF) << i;
+    }
+    return ret;
+}
+
+// Carry-less multiply, returns lower half of the product and stores upper half into hi
+static inline xlen_t riscv_b_clmul(xlen_t a, xlen_t b, xlen_t* hi)
+{
+    xlen_t lo = 0;
+    *hi = 0;
+    for (bitcnt_t i=0; i<XLEN_BITS; ++i) {
+        if ((b >> i) & 0x1) {
+            lo ^= a << i;
+            if (i) *hi ^= a >> (XLEN_BITS - i);
+        }
+    }
+    return lo;
+}
+
+static void riscv_b_op(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    regid_t rs2 = bit_cut(instruction, 20, 5);
+    xlen_t reg1 = riscv_read_register(vm, rs1);
+    xlen_t reg2 = riscv_read_register(vm, rs2);
+    bitcnt_t bit = reg2 & bit_mask(SHAMT_BITS);
+    xlen_t hi;
+
+    switch (bit_cut(instruction, 25, 7) << 3 | bit_cut(instruction, 12, 3)) {
+        case (0x20 << 3) | 0x7:
+            rvjit_andn(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 & ~reg2);
+            return;
+        case (0x20 << 3) | 0x6:
+            rvjit_orn(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 | ~reg2);
+            return;
+        case (0x20 << 3) | 0x4:
+            rvjit_xnor(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, ~(reg1 ^ reg2));
+            return;
+        case (0x05 << 3) | 0x4:
+            rvjit_min(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, ((sxlen_t)reg1 < (sxlen_t)reg2) ? reg1 : reg2);
+            return;
+        case (0x05 << 3) | 0x5:
+            rvjit_minu(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 < reg2) ? reg1 : reg2);
+            return;
+        case (0x05 << 3) | 0x6:
+            rvjit_max(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, ((sxlen_t)reg1 > (sxlen_t)reg2) ? reg1 : reg2);
+            return;
+        case (0x05 << 3) | 0x7:
+            rvjit_maxu(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 > reg2) ? reg1 : reg2);
+            return;
+        case (0x05 << 3) | 0x1:
+            rvjit_clmul(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, riscv_b_clmul(reg1, reg2, &hi));
+            return;
+        case (0x05 << 3) | 0x3:
+            rvjit_clmulh(rds, rs1, rs2, 4);
+            riscv_b_clmul(reg1, reg2, &hi);
+            riscv_write_register(vm, rds, hi);
+            return;
+        case (0x05 << 3) | 0x2:
+            rvjit_clmulr(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (riscv_b_clmul(reg1, reg2, &hi) >> (XLEN_BITS - 1)) | (hi << 1));
+            return;
+        case (0x30 << 3) | 0x1:
+            rvjit_rol(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, riscv_b_rol(reg1, bit));
+            return;
+        case (0x30 << 3) | 0x5:
+            rvjit_ror(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, riscv_b_ror(reg1, bit));
+            return;
+        case (0x10 << 3) | 0x2:
+            rvjit_sh1add(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 1) + reg2);
+            return;
+        case (0x10 << 3) | 0x4:
+            rvjit_sh2add(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 2) + reg2);
+            return;
+        case (0x10 << 3) | 0x6:
+            rvjit_sh3add(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 3) + reg2);
+            return;
+        case (0x14 << 3) | 0x1:
+            rvjit_bset(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 | ((xlen_t)1 << bit));
+            return;
+        case (0x24 << 3) | 0x1:
+            rvjit_bclr(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 & ~((xlen_t)1 << bit));
+            return;
+        case (0x34 << 3) | 0x1:
+            rvjit_binv(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 ^ ((xlen_t)1 << bit));
+            return;
+        case (0x24 << 3) | 0x5:
+            rvjit_bext(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 >> bit) & 0x1);
+            return;
+#ifndef RV64
+        case (0x04 << 3) | 0x4:
+            if (rs2 == 0) {
+                rvjit_zext_h(rds, rs1, 4);
+                riscv_write_register(vm, rds, (uint16_t)reg1);
+                return;
+            }
+            break;
+#endif
+    }
+    riscv_k_insn(vm, instruction);
+}
+
+static void riscv_b_slli(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    uint32_t imm = bit_cut(instruction, 20, 12);
+    bitcnt_t shamt = bit_cut(instruction, 20, SHAMT_BITS);
+    xlen_t src_reg = riscv_read_register(vm, rs1);
+
+    switch (imm) {
+        case RVB_CLZ:
+            rvjit_clz(rds, rs1, 4);
+            riscv_write_register(vm, rds, riscv_b_clz(src_reg));
+            return;
+        case RVB_CTZ:
+            rvjit_ctz(rds, rs1, 4);
+            riscv_write_register(vm, rds, riscv_b_ctz(src_reg));
+            return;
+        case RVB_CPOP:
+            rvjit_cpop(rds, rs1, 4);
+            riscv_write_register(vm, rds, riscv_b_cpop(src_reg));
+            return;
+        case RVB_SEXT_B:
+            rvjit_sext_b(rds, rs1, 4);
+            riscv_write_register(vm, rds, (int8_t)src_reg);
+            return;
+        case RVB_SEXT_H:
+            rvjit_sext_h(rds, rs1, 4);
+            riscv_write_register(vm, rds, (int16_t)src_reg);
+            return;
+    }
+
+    switch (imm >> SHAMT_BITS) {
+        case (0x280 >> SHAMT_BITS):
+            rvjit_bseti(rds, rs1, shamt, 4);
+            riscv_write_register(vm, rds, src_reg | ((xlen_t)1 << shamt));
+            return;
+        case (0x480 >> SHAMT_BITS):
+            rvjit_bclri(rds, rs1, shamt, 4);
+            riscv_write_register(vm, rds, src_reg & ~((xlen_t)1 << shamt));
+            return;
+        case (0x680 >> SHAMT_BITS):
+            rvjit_binvi(rds, rs1, shamt, 4);
+            riscv_write_register(vm, rds, src_reg ^ ((xlen_t)1 << shamt));
+            return;
+    }
+    riscv_k_insn(vm, instruction);
+}
+
+static void riscv_b_srli(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    uint32_t imm = bit_cut(instruction, 20, 12);
+    bitcnt_t shamt = bit_cut(instruction, 20, SHAMT_BITS);
+    xlen_t src_reg = riscv_read_register(vm, rs1);
+
+    switch (imm) {
+        case RVB_REV8:
+            rvjit_rev8(rds, rs1, 4);
+            riscv_write_register(vm, rds, riscv_b_rev8(src_reg));
+            return;
+        case RVB_ORC_B:
+            // Rare enough to be left for the interpreter
+            riscv_write_register(vm, rds, riscv_b_orc_b(src_reg));
+            return;
+    }
+
+    switch (imm >> SHAMT_BITS) {
+        case (0x600 >> SHAMT_BITS):
+            rvjit_rori(rds, rs1, shamt, 4);
+            riscv_write_register(vm, rds, riscv_b_ror(src_reg, shamt));
+            return;
+        case (0x480 >> SHAMT_BITS):
+            rvjit_bexti(rds, rs1, shamt, 4);
+            riscv_write_register(vm, rds, (src_reg >> shamt) & 0x1);
+            return;
+    }
+    riscv_k_insn(vm, instruction);
+}
+
+#ifdef RV64
+
+static void riscv64b_op32(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    regid_t rs2 = bit_cut(instruction, 20, 5);
+    uint64_t reg1 = (uint32_t)riscv_read_register(vm, rs1);
+    uint64_t reg2 = riscv_read_register(vm, rs2);
+
+    switch (bit_cut(instruction, 25, 7) << 3 | bit_cut(instruction, 12, 3)) {
+        case (0x04 << 3) | 0x0:
+            rvjit_add_uw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, reg1 + reg2);
+            return;
+        case (0x10 << 3) | 0x2:
+            rvjit_sh1add_uw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 1) + reg2);
+            return;
+        case (0x10 << 3) | 0x4:
+            rvjit_sh2add_uw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 2) + reg2);
+            return;
+        case (0x10 << 3) | 0x6:
+            rvjit_sh3add_uw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (reg1 << 3) + reg2);
+            return;
+        case (0x30 << 3) | 0x1:
+            rvjit_rolw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (int32_t)riscv_b_rorw(reg1, -reg2));
+            return;
+        case (0x30 << 3) | 0x5:
+            rvjit_rorw(rds, rs1, rs2, 4);
+            riscv_write_register(vm, rds, (int32_t)riscv_b_rorw(reg1, reg2));
+            return;
+        case (0x04 << 3) | 0x4:
+            if (rs2 == 0) {
+                rvjit_zext_h(rds, rs1, 4);
+                riscv_write_register(vm, rds, (uint16_t)reg1);
+                return;
+            }
+            break;
+    }
+    riscv_k_insn(vm, instruction);
+}
+
+static void riscv64b_slliw(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    uint32_t imm = bit_cut(instruction, 20, 12);
+    uint32_t src_reg = riscv_read_register(vm, rs1);
+
+    switch (imm) {
+        case RVB_CLZ:
+            rvjit_clzw(rds, rs1, 4);
+            riscv_write_register(vm, rds, bit_clz32(src_reg));
+            return;
+        case RVB_CTZ:
+            rvjit_ctzw(rds, rs1, 4);
+            riscv_write_register(vm, rds, bit_ctz32(src_reg));
+            return;
+        case RVB_CPOP:
+            rvjit_cpopw(rds, rs1, 4);
+            riscv_write_register(vm, rds, bit_popcnt32(src_reg));
+            return;
+    }
+
+    if ((imm >> 6) == 0x02) {
+        // slli.uw
+        rvjit_slli_uw(rds, rs1, imm & 0x3F, 4);
+        riscv_write_register(vm, rds, ((uint64_t)src_reg) << (imm & 0x3F));
+        return;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+static void riscv64b_srliw(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    bitcnt_t shamt = bit_cut(instruction, 20, 5);
+    uint32_t src_reg = riscv_read_register(vm, rs1);
+
+    if (bit_cut(instruction, 25, 7) == 0x30) {
+        rvjit_roriw(rds, rs1, shamt, 4);
+        riscv_write_register(vm, rds, (int32_t)riscv_b_rorw(src_reg, shamt));
+        return;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+#endif
+
+void riscv_b_insn(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    // Decoder slot without funct7 bit, i.e. funct3 + opcode
+    switch (((instruction >> 7) & 0xE0) | ((instruction >> 2) & 0x1F)) {
+        case RVI_SLLI:
+            riscv_b_slli(vm, instruction);
+            return;
+        case RVI_SRLI_SRAI:
+            riscv_b_srli(vm, instruction);
+            return;
+        case RVI_ADD_SUB:
+        case RVI_SLL:
+        case RVI_SLT:
+        case RVI_SLTU:
+        case RVI_XOR:
+        case RVI_SRL_SRA:
+        case RVI_OR:
+        case RVI_AND:
+            riscv_b_op(vm, instruction);
+            return;
+#ifdef RV64
+        case RV64I_SLLIW:
+            riscv64b_slliw(vm, instruction);
+            return;
+        case RV64I_SRLIW_SRAIW:
+            riscv64b_srliw(vm, instruction);
+            return;
+        case RV64I_ADDW_SUBW:
+        case RV64I_SLLW:
+        case RV64I_SRLW_SRAW:
+        case RV64B_SH1ADD_UW:
+        case RV64B_SH2ADD_UW:
+        case RV64B_SH3ADD_UW:
+            riscv64b_op32(vm, instruction);
+            return;
+#endif
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+void riscv_b_init(rvvm_hart_t* vm)
+{
+#ifdef RV64
+    // Slots not owned by any base instruction
+    riscv_install_opcode_R(vm, RV64B_SH1ADD_UW, riscv_b_insn);
+    riscv_install_opcode_R(vm, RV64B_SH2ADD_UW, riscv_b_insn);
+    riscv_install_opcode_R(vm, RV64B_SH3ADD_UW, riscv_b_insn);
+    riscv_install_opcode_R(vm, RV64B_SLLI_UW, riscv_b_insn);
+#else
+    UNUSED(vm);
+#endif
+}
@@ -63,6 +63,31 @@ typedef _Complex long double _C_ldouble_complex;
     #define fpu_ceil ceil
     #define fpu_round round
     #define fpu_rint rint
+
+    /* JIT tracing hooks */
+    #define rvjit_fload rvjit_fld
+    #define rvjit_fstore rvjit_fsd
+    #define rvjit_fadd rvjit_fadd_d
+    #define rvjit_fsub rvjit_fsub_d
+    #define rvjit_fmul rvjit_fmul_d
+    #define rvjit_fdiv rvjit_fdiv_d
+    #define rvjit_fsqrt rvjit_fsqrt_d
+    #define rvjit_fsgnj rvjit_fsgnj_d
+    #define rvjit_fsgnjn rvjit_fsgnjn_d
+    #define rvjit_fsgnjx rvjit_fsgnjx_d
+    #define rvjit_feq rvjit_feq_d
+    #define rvjit_flt rvjit_flt_d
+    #define rvjit_fle rvjit_fle_d
+    #define rvjit_fmadd rvjit_fmadd_d
+    #define rvjit_fmsub rvjit_fmsub_d
+    #define rvjit_fnmsub rvjit_fnmsub_d
+    #define rvjit_fnmadd rvjit_fnmadd_d
+    #define rvjit_fcvt_f_w rvjit_fcvt_d_w
+    #define rvjit_fcvt_f_wu rvjit_fcvt_d_wu
+    #define rvjit_fcvt_f_l rvjit_fcvt_d_l
+    #define rvjit_fcvt_w_f rvjit_fcvt_w_d
+    #define rvjit_fcvt_wu_f rvjit_fcvt_wu_d
+    #define rvjit_fcvt_l_f rvjit_fcvt_l_d
 #else
     #define SIGNIFICAND_SIZE FLT_MANT_DIG /* used for sNaN/qNaN classification */
     /* current native float type, might be replaced with softfloat later */
@@ -84,6 +109,31 @@ typedef _Complex long double _C_ldouble_complex;
     #define fpu_ceil ceilf
     #define fpu_round roundf
     #define fpu_rint rintf
+
+    /* JIT tracing hooks */
+    #define rvjit_fload rvjit_flw
+    #define rvjit_fstore rvjit_fsw
+    #define rvjit_fadd rvjit_fadd_s
+    #define rvjit_fsub rvjit_fsub_s
+    #define rvjit_fmul rvjit_fmul_s
+    #define rvjit_fdiv rvjit_fdiv_s
+    #define rvjit_fsqrt rvjit_fsqrt_s
+    #define rvjit_fsgnj rvjit_fsgnj_s
+    #define rvjit_fsgnjn rvjit_fsgnjn_s
+    #define rvjit_fsgnjx rvjit_fsgnjx_s
+    #define rvjit_feq rvjit_feq_s
+    #define rvjit_flt rvjit_flt_s
+    #define rvjit_fle rvjit_fle_s
+    #define rvjit_fmadd rvjit_fmadd_s
+    #define rvjit_fmsub rvjit_fmsub_s
+    #define rvjit_fnmsub rvjit_fnmsub_s
+    #define rvjit_fnmadd rvjit_fnmadd_s
+    #define rvjit_fcvt_f_w rvjit_fcvt_s_w
+    #define rvjit_fcvt_f_wu rvjit_fcvt_s_wu
+    #define rvjit_fcvt_f_l rvjit_fcvt_s_l
+    #define rvjit_fcvt_w_f rvjit_fcvt_w_s
+    #define rvjit_fcvt_wu_f rvjit_fcvt_wu_s
+    #define rvjit_fcvt_l_f rvjit_fcvt_l_s
 #endif
 
 /* handlers for FPU operations, to be replaced with JIT or softfpu? */
@@ -363,6 +413,8 @@ static void riscv_f_flw(rvvm_hart_t *vm, const uint32_t insn)
     regid_t rs1 = bit_cut(insn, 15, 5);
     sxlen_t offset = sign_extend(bit_cut(insn, 20, 12), 12);
 
+    rvjit_fload(rds, rs1, offset, 4);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_load_fnative(vm, addr, rds);
@@ -375,6 +427,8 @@ static void riscv_f_fsw(rvvm_hart_t *vm, const uint32_t insn)
     sxlen_t offset = sign_extend(bit_cut(insn, 7, 5) |
                                (bit_cut(insn, 25, 7) << 5), 12);
 
+    rvjit_fstore(rs2, rs1, offset, 4);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_store_fnative(vm, addr, rs2);
@@ -389,13 +443,16 @@ static void riscv_f_fmadd(rvvm_hart_t *vm, const uint32_t insn)
 
     regid_t rs1 = bit_cut(insn, 15, 5);
     regid_t rs2 = bit_cut(insn, 20, 5);
+    regid_t rd = bit_cut(insn, 7, 5);
+    regid_t rs3 = bit_cut(insn, 27, 5);
+    if (bit_cut(insn, 12, 3) == RM_DYN) {
+        rvjit_fmadd(rd, rs1, rs2, rs3, 4);
+    }
     rm_t rm = fpu_set_rm(vm, bit_cut(insn, 12, 3));
     if (unlikely(rm == RM_INVALID)) {
         riscv_illegal_insn(vm, insn);
         return;
     }
-    regid_t rd = bit_cut(insn, 7, 5);
-    regid_t rs3 = bit_cut(insn, 27, 5);
 
     fnative_t res = fpu_add(fpu_mul(fpu_read_register(vm, rs1), fpu_read_register(vm, rs2)), fpu_read_register(vm, rs3));
     fpu_write_register(vm, rd, res);
@@ -411,13 +468,16 @@ static void riscv_f_fmsub(rvvm_hart_t *vm, const uint32_t insn)
 
     regid_t rs1 = bit_cut(insn, 15, 5);
     regid_t rs2 = bit_cut(insn, 20, 5);
+    regid_t rd = bit_cut(insn, 7, 5);
+    regid_t rs3 = bit_cut(insn, 27, 5);
+    if (bit_cut(insn, 12, 3) == RM_DYN) {
+        rvjit_fmsub(rd, rs1, rs2, rs3, 4);
+    }
     rm_t rm = fpu_set_rm(vm, bit_cut(insn, 12, 3));
     if (unlikely(rm == RM_INVALID)) {
         riscv_illegal_insn(vm, insn);
         return;
     }
-    regid_t rd = bit_cut(insn, 7, 5);
-    regid_t rs3 = bit_cut(insn, 27, 5);
 
     fnative_t res = fpu_sub(fpu_mul(fpu_read_register(vm, rs1), fpu_read_register(vm, rs2)), fpu_read_register(vm, rs3));
     fpu_write_register(vm, rd, res);
@@ -433,13 +493,16 @@ static void riscv_f_fnmadd(rvvm_hart_t *vm, const uint32_t insn)
 
     regid_t rs1 = bit_cut(insn, 15, 5);
     regid_t rs2 = bit_cut(insn, 20, 5);
+    regid_t rd = bit_cut(insn, 7, 5);
+    regid_t rs3 = bit_cut(insn, 27, 5);
+    if (bit_cut(insn, 12, 3) == RM_DYN) {
+        rvjit_fnmadd(rd, rs1, rs2, rs3, 4);
+    }
     rm_t rm = fpu_set_rm(vm, bit_cut(insn, 12, 3));
     if (unlikely(rm == RM_INVALID)) {
         riscv_illegal_insn(vm, insn);
         return;
     }
-    regid_t rd = bit_cut(insn, 7, 5);
-    regid_t rs3 = bit_cut(insn, 27, 5);
 
     fnative_t res = fpu_sub(fpu_neg(fpu_mul(fpu_read_register(vm, rs1), fpu_read_register(vm, rs2))), fpu_read_register(vm, rs3));
     fpu_write_register(vm, rd, res);
@@ -455,13 +518,16 @@ static void riscv_f_fnmsub(rvvm_hart_t *vm, const uint32_t insn)
 
     regid_t rs1 = bit_cut(insn, 15, 5);
     regid_t rs2 = bit_cut(insn, 20, 5);
+    regid_t rd = bit_cut(insn, 7, 5);
+    regid_t rs3 = bit_cut(insn, 27, 5);
+    if (bit_cut(insn, 12, 3) == RM_DYN) {
+        rvjit_fnmsub(rd, rs1, rs2, rs3, 4);
+    }
     rm_t rm = fpu_set_rm(vm, bit_cut(insn, 12, 3));
     if (unlikely(rm == RM_INVALID)) {
         riscv_illegal_insn(vm, insn);
         return;
     }
-    regid_t rd = bit_cut(insn, 7, 5);
-    regid_t rs3 = bit_cut(insn, 27, 5);
 
     fnative_t res = fpu_add(fpu_neg(fpu_mul(fpu_read_register(vm, rs1), fpu_read_register(vm, rs2))), fpu_read_register(vm, rs3));
     fpu_write_register(vm, rd, res);
@@ -619,6 +685,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
 
     switch (rs3) {
         case FT7_FADD:
+            if (rm == RM_DYN) {
+                rvjit_fadd(rd, rs1, rs2, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -628,6 +697,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
             fpu_set_rm(vm, rm);
             break;
         case FT7_FSUB:
+            if (rm == RM_DYN) {
+                rvjit_fsub(rd, rs1, rs2, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -637,6 +709,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
             fpu_set_rm(vm, rm);
             break;
         case FT7_FMUL:
+            if (rm == RM_DYN) {
+                rvjit_fmul(rd, rs1, rs2, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -646,6 +721,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
             fpu_set_rm(vm, rm);
             break;
         case FT7_FDIV:
+            if (rm == RM_DYN) {
+                rvjit_fdiv(rd, rs1, rs2, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -660,6 +738,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
                 return;
             }
 
+            if (rm == RM_DYN) {
+                rvjit_fsqrt(rd, rs1, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -671,12 +752,15 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
         case FT7_FSGN:
             switch (rm) {
                 case 0:
+                    rvjit_fsgnj(rd, rs1, rs2, 4);
                     riscv_f_fsgnj(vm, rs1, rs2, rd);
                     break;
                 case 1:
+                    rvjit_fsgnjn(rd, rs1, rs2, 4);
                     riscv_f_fsgnjn(vm, rs1, rs2, rd);
                     break;
                 case 2:
+                    rvjit_fsgnjx(rd, rs1, rs2, 4);
                     riscv_f_fsgnjx(vm, rs1, rs2, rd);
                     break;
                 default:
@@ -704,8 +788,14 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
             if (likely(rs2 < 2)) {
 #endif
                 if (rs2 == 1) {
+                    if (rm == RM_DYN || rm == RM_RTZ) {
+                        rvjit_fcvt_wu_f(rd, rs1, rm == RM_RTZ, 4);
+                    }
                     riscv_write_register(vm, rd, fpu_fp2int_uint32_t(fpu_read_register(vm, rs1), rm));
                 } else {
+                    if (rm == RM_DYN || rm == RM_RTZ) {
+                        rvjit_fcvt_w_f(rd, rs1, rm == RM_RTZ, 4);
+                    }
                     riscv_write_register(vm, rd, fpu_fp2int_int32_t(fpu_read_register(vm, rs1), rm));
                 }
 #ifdef RV64
@@ -713,6 +803,9 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
                 if (rs2 == 3) {
                     riscv_write_register(vm, rd, fpu_fp2int_uint64_t(fpu_read_register(vm, rs1), rm));
                 } else {
+                    if (rm == RM_DYN || rm == RM_RTZ) {
+                        rvjit_fcvt_l_f(rd, rs1, rm == RM_RTZ, 4);
+                    }
                     riscv_write_register(vm, rd, fpu_fp2int_int64_t(fpu_read_register(vm, rs1), rm));
                 }
 #endif
@@ -732,8 +825,10 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
 
             if (rm == 0) {
 #ifndef RVD
+                rvjit_fmv_x_w(rd, rs1, 4);
                 riscv_f_fmv_x_w(vm, rs1, rd);
 #elif defined(RV64)
+                rvjit_fmv_x_d(rd, rs1, 4);
                 riscv_f_fmv_x_d(vm, rs1, rd);
 #else
                 riscv_illegal_insn(vm, insn);
@@ -749,12 +844,15 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
         case FT7_FCMP:
             switch (rm) {
                 case 0:
+                    rvjit_fle(rd, rs1, rs2, 4);
                     riscv_f_fle(vm, rs1, rs2, rd);
                     break;
                 case 1:
+                    rvjit_flt(rd, rs1, rs2, 4);
                     riscv_f_flt(vm, rs1, rs2, rd);
                     break;
                 case 2:
+                    rvjit_feq(rd, rs1, rs2, 4);
                     riscv_f_feq(vm, rs1, rs2, rd);
                     break;
                 default:
@@ -763,6 +861,25 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
             }
             break;
         case FT7_FCVT_S_W:
+#ifdef RVD
+            // Conversion from 32-bit integer is exact and ignores rounding mode
+            if (rs2 == 0 && (rm <= RM_RMM || rm == RM_DYN)) {
+                rvjit_fcvt_f_w(rd, rs1, 4);
+            } else if (rs2 == 1 && (rm <= RM_RMM || rm == RM_DYN)) {
+                rvjit_fcvt_f_wu(rd, rs1, 4);
+            }
+#else
+            if (rs2 == 0 && rm == RM_DYN) {
+                rvjit_fcvt_f_w(rd, rs1, 4);
+            } else if (rs2 == 1 && rm == RM_DYN) {
+                rvjit_fcvt_f_wu(rd, rs1, 4);
+            }
+#endif
+#ifdef RV64
+            if (rs2 == 2 && rm == RM_DYN) {
+                rvjit_fcvt_f_l(rd, rs1, 4);
+            }
+#endif
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -791,9 +908,13 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
                 return;
             }
 
+            rvjit_fmv_w_x(rd, rs1, 4);
             riscv_f_fmv_w_x(vm, rs1, rd);
             break;
         case FT7_FCVT_S_D:
+            if (rs2 == 1 && rm == RM_DYN) {
+                rvjit_fcvt_s_d(rd, rs1, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -814,10 +935,14 @@ static void riscv_f_other(rvvm_hart_t *vm, const uint32_t insn)
                 return;
             }
 
+            rvjit_fmv_d_x(rd, rs1, 4);
             riscv_f_fmv_d_x(vm, rs1, rd);
             break;
 #endif
         case FT7_FCVT_D_S:
+            if (rs2 == 0 && (rm <= RM_RMM || rm == RM_DYN)) {
+                rvjit_fcvt_d_s(rd, rs1, 4);
+            }
             rm = fpu_set_rm(vm, rm);
             if (unlikely(rm == RM_INVALID)) {
                 riscv_illegal_insn(vm, insn);
@@ -847,6 +972,8 @@ static void riscv_c_fld(rvvm_hart_t *vm, const uint16_t instruction)
     uint32_t offset = (bit_cut(instruction, 10, 3) << 3)
                     | (bit_cut(instruction, 5, 2)  << 6);
 
+    rvjit_fld(rds, rs1, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_load_double(vm, addr, rds);
@@ -860,6 +987,8 @@ static void riscv_c_fsd(rvvm_hart_t *vm, const uint16_t instruction)
     uint32_t offset = (bit_cut(instruction, 10, 3) << 3)
                     | (bit_cut(instruction, 5, 2)  << 6);
 
+    rvjit_fsd(rs2, rs1, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_store_double(vm, addr, rs2);
@@ -873,6 +1002,8 @@ static void riscv_c_fldsp(rvvm_hart_t *vm, const uint16_t instruction)
                     | (bit_cut(instruction, 12, 1) << 5)
                     | (bit_cut(instruction, 2, 3)  << 6);
 
+    rvjit_fld(rds, REGISTER_X2, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, REGISTER_X2) + offset;
 
     riscv_load_double(vm, addr, rds);
@@ -885,6 +1016,8 @@ static void riscv_c_fsdsp(rvvm_hart_t *vm, const uint16_t instruction)
     uint32_t offset = (bit_cut(instruction, 10, 3) << 3)
                     | (bit_cut(instruction, 7, 3) << 6);
 
+    rvjit_fsd(rs2, REGISTER_X2, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, REGISTER_X2) + offset;
 
     riscv_store_double(vm, addr, rs2);
@@ -941,6 +1074,8 @@ static void riscv_c_flw(rvvm_hart_t *vm, const uint16_t instruction)
                     | (bit_cut(instruction, 10, 3) << 3)
                     | (bit_cut(instruction, 5, 1)  << 6);
 
+    rvjit_flw(rds, rs1, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_load_float(vm, addr, rds);
@@ -955,6 +1090,8 @@ static void riscv_c_fsw(rvvm_hart_t *vm, const uint16_t instruction)
                     | (bit_cut(instruction, 10, 3) << 3)
                     | (bit_cut(instruction, 5, 1)  << 6);
 
+    rvjit_fsw(rs2, rs1, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, rs1) + offset;
 
     riscv_store_float(vm, addr, rs2);
@@ -968,6 +1105,8 @@ static void riscv_c_flwsp(rvvm_hart_t *vm, const uint16_t instruction)
                     | (bit_cut(instruction, 12, 1) << 5)
                     | (bit_cut(instruction, 2, 2)  << 6);
 
+    rvjit_flw(rds, REGISTER_X2, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, REGISTER_X2) + offset;
 
     riscv_load_float(vm, addr, rds);
@@ -980,6 +1119,8 @@ static void riscv_c_fswsp(rvvm_hart_t *vm, const uint16_t instruction)
     uint32_t offset = (bit_cut(instruction, 9, 4) << 2)
                     | (bit_cut(instruction, 7, 2) << 6);
 
+    rvjit_fsw(rs2, REGISTER_X2, offset, 2);
+
     xaddr_t addr = riscv_read_register(vm, REGISTER_X2) + offset;
 
     riscv_store_float(vm, addr, rs2);
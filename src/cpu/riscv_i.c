@@ -87,7 +87,7 @@ static void riscv_i_srli_srai(rvvm_hart_t *vm, const uint32_t instruction)
         rvjit_srli(rds, rs1, shamt, 4);
         riscv_write_register(vm, rds, src_reg >> shamt);
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
@@ -108,7 +108,7 @@ static void riscv_i_add_sub(rvvm_hart_t *vm, const uint32_t instruction)
         rvjit_add(rds, rs1, rs2, 4);
         riscv_write_register(vm, rds, reg1 + reg2);
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
@@ -130,7 +130,7 @@ static void riscv_i_srl_sra(rvvm_hart_t *vm, const uint32_t instruction)
         rvjit_srl(rds, rs1, rs2, 4);
         riscv_write_register(vm, rds, reg1 >> (reg2 & bit_mask(SHAMT_BITS)));
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
@@ -462,6 +462,12 @@ static void riscv_i_andi(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_slli(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> (20 + SHAMT_BITS))) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Left-shift rs1 by immediate, store to rds
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -475,6 +481,12 @@ static void riscv_i_slli(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_sll(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Left-shift rs1 by rs2, store to rds
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -489,6 +501,12 @@ static void riscv_i_sll(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_slt(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Set rds to 1 if rs1 < rs2 (signed)
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -503,6 +521,12 @@ static void riscv_i_slt(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_sltu(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Set rds to 1 if rs1 < rs2
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -517,6 +541,12 @@ static void riscv_i_sltu(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_xor(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // XOR rs1 with rs2, store to rds
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -531,6 +561,12 @@ static void riscv_i_xor(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_or(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // OR rs1 with rs2, store to rds
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -545,6 +581,12 @@ static void riscv_i_or(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_i_and(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // AND rs1 with rs2, store to rds
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -561,6 +603,12 @@ static void riscv_i_and(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv64i_slliw(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Left-shift rs1 by immediate, store to rds (32 bit + signext)
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -589,7 +637,7 @@ static void riscv64i_srliw_sraiw(rvvm_hart_t *vm, const uint32_t instruction)
         rvjit_srliw(rds, rs1, shamt, 4);
         vm->registers[rds] = (int32_t)(src_reg >> shamt);
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
@@ -611,12 +659,18 @@ static void riscv64i_addw_subw(rvvm_hart_t *vm, const uint32_t instruction)
         rvjit_addw(rds, rs1, rs2, 4);
         vm->registers[rds] = (int32_t)(reg1 + reg2);
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
 static void riscv64i_sllw(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(instruction >> 25)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     // Left-shift rs1 by rs2, store to rds (32 bit + signext)
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
@@ -640,14 +694,14 @@ static void riscv64i_srlw_sraw(rvvm_hart_t *vm, const uint32_t instruction)
 
     uint8_t funct7 = bit_cut(instruction, 25, 7);
     
-    if (instruction >> 25) {
+    if (funct7 == 0x20) {
         rvjit_sraw(rds, rs1, rs2, 4);
         riscv_write_register(vm, rds, ((int32_t)reg1) >> (reg2 & bit_mask(5)));
     } else if (likely(funct7 == 0x0)) {
         rvjit_srlw(rds, rs1, rs2, 4);
         riscv_write_register(vm, rds, (int32_t)(reg1 >> (reg2 & bit_mask(5))));
     } else {
-        riscv_illegal_insn(vm, instruction);
+        riscv_b_insn(vm, instruction);
     }
 }
 
@@ -0,0 +1,577 @@
+/*
+riscv_k.c - RISC-V K (Zkn, Zks) Decoder, Interpreter
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define RISCV_CPU_SOURCE
+
+#include "bit_ops.h"
+#include "compiler.h"
+#include "mem_ops.h"
+#include "riscv_cpu.h"
+
+/*
+ * Scalar crypto: Zbkb, Zbkx, Zknd, Zkne, Zknh, Zksed, Zksh.
+ * Zbkc and the rest of Zbkb are covered by the bitmanip decoder.
+ *
+ * All of these share decoder slots with base & bitmanip instructions,
+ * and reach here only when riscv_b_insn() doesn't recognize them.
+ * They are never traced by RVJIT.
+ */
+
+#ifdef RV64
+#define XLEN_BITS 64
+#else
+#define XLEN_BITS 32
+#endif
+
+// Encodings in the immediate field of OP-IMM
+#define RVK_SHA256SUM0  0x100
+#define RVK_SHA256SUM1  0x101
+#define RVK_SHA256SIG0  0x102
+#define RVK_SHA256SIG1  0x103
+#define RVK_SHA512SUM0  0x104
+#define RVK_SHA512SUM1  0x105
+#define RVK_SHA512SIG0  0x106
+#define RVK_SHA512SIG1  0x107
+#define RVK_SM3P0       0x108
+#define RVK_SM3P1       0x109
+#define RVK_AES64IM     0x300
+#define RVK_AES64KS1I   0x31  // imm >> 4, rnum in low bits
+#define RVK_ZIP         0x08F
+#define RVK_BREV8       0x687
+
+// AES64 state operations
+#define RVK_AES_ES      0
+#define RVK_AES_ESM     1
+#define RVK_AES_DS      2
+#define RVK_AES_DSM     3
+#define RVK_AES_IM      4
+
+static const uint8_t riscv_k_aes_sbox[256] = {
+    0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+    0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+    0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+    0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+    0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+    0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+    0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+    0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+    0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+    0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+    0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+    0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+    0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+    0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+    0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+    0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+static const uint8_t riscv_k_aes_inv_sbox[256] = {
+    0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38, 0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
+    0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87, 0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
+    0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D, 0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
+    0x08, 0x2E, 0xA1, 0x66, 0x28, 0xD9, 0x24, 0xB2, 0x76, 0x5B, 0xA2, 0x49, 0x6D, 0x8B, 0xD1, 0x25,
+    0x72, 0xF8, 0xF6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xD4, 0xA4, 0x5C, 0xCC, 0x5D, 0x65, 0xB6, 0x92,
+    0x6C, 0x70, 0x48, 0x50, 0xFD, 0xED, 0xB9, 0xDA, 0x5E, 0x15, 0x46, 0x57, 0xA7, 0x8D, 0x9D, 0x84,
+    0x90, 0xD8, 0xAB, 0x00, 0x8C, 0xBC, 0xD3, 0x0A, 0xF7, 0xE4, 0x58, 0x05, 0xB8, 0xB3, 0x45, 0x06,
+    0xD0, 0x2C, 0x1E, 0x8F, 0xCA, 0x3F, 0x0F, 0x02, 0xC1, 0xAF, 0xBD, 0x03, 0x01, 0x13, 0x8A, 0x6B,
+    0x3A, 0x91, 0x11, 0x41, 0x4F, 0x67, 0xDC, 0xEA, 0x97, 0xF2, 0xCF, 0xCE, 0xF0, 0xB4, 0xE6, 0x73,
+    0x96, 0xAC, 0x74, 0x22, 0xE7, 0xAD, 0x35, 0x85, 0xE2, 0xF9, 0x37, 0xE8, 0x1C, 0x75, 0xDF, 0x6E,
+    0x47, 0xF1, 0x1A, 0x71, 0x1D, 0x29, 0xC5, 0x89, 0x6F, 0xB7, 0x62, 0x0E, 0xAA, 0x18, 0xBE, 0x1B,
+    0xFC, 0x56, 0x3E, 0x4B, 0xC6, 0xD2, 0x79, 0x20, 0x9A, 0xDB, 0xC0, 0xFE, 0x78, 0xCD, 0x5A, 0xF4,
+    0x1F, 0xDD, 0xA8, 0x33, 0x88, 0x07, 0xC7, 0x31, 0xB1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xEC, 0x5F,
+    0x60, 0x51, 0x7F, 0xA9, 0x19, 0xB5, 0x4A, 0x0D, 0x2D, 0xE5, 0x7A, 0x9F, 0x93, 0xC9, 0x9C, 0xEF,
+    0xA0, 0xE0, 0x3B, 0x4D, 0xAE, 0x2A, 0xF5, 0xB0, 0xC8, 0xEB, 0xBB, 0x3C, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2B, 0x04, 0x7E, 0xBA, 0x77, 0xD6, 0x26, 0xE1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0C, 0x7D,
+};
+
+static const uint8_t riscv_k_sm4_sbox[256] = {
+    0xD6, 0x90, 0xE9, 0xFE, 0xCC, 0xE1, 0x3D, 0xB7, 0x16, 0xB6, 0x14, 0xC2, 0x28, 0xFB, 0x2C, 0x05,
+    0x2B, 0x67, 0x9A, 0x76, 0x2A, 0xBE, 0x04, 0xC3, 0xAA, 0x44, 0x13, 0x26, 0x49, 0x86, 0x06, 0x99,
+    0x9C, 0x42, 0x50, 0xF4, 0x91, 0xEF, 0x98, 0x7A, 0x33, 0x54, 0x0B, 0x43, 0xED, 0xCF, 0xAC, 0x62,
+    0xE4, 0xB3, 0x1C, 0xA9, 0xC9, 0x08, 0xE8, 0x95, 0x80, 0xDF, 0x94, 0xFA, 0x75, 0x8F, 0x3F, 0xA6,
+    0x47, 0x07, 0xA7, 0xFC, 0xF3, 0x73, 0x17, 0xBA, 0x83, 0x59, 0x3C, 0x19, 0xE6, 0x85, 0x4F, 0xA8,
+    0x68, 0x6B, 0x81, 0xB2, 0x71, 0x64, 0xDA, 0x8B, 0xF8, 0xEB, 0x0F, 0x4B, 0x70, 0x56, 0x9D, 0x35,
+    0x1E, 0x24, 0x0E, 0x5E, 0x63, 0x58, 0xD1, 0xA2, 0x25, 0x22, 0x7C, 0x3B, 0x01, 0x21, 0x78, 0x87,
+    0xD4, 0x00, 0x46, 0x57, 0x9F, 0xD3, 0x27, 0x52, 0x4C, 0x36, 0x02, 0xE7, 0xA0, 0xC4, 0xC8, 0x9E,
+    0xEA, 0xBF, 0x8A, 0xD2, 0x40, 0xC7, 0x38, 0xB5, 0xA3, 0xF7, 0xF2, 0xCE, 0xF9, 0x61, 0x15, 0xA1,
+    0xE0, 0xAE, 0x5D, 0xA4, 0x9B, 0x34, 0x1A, 0x55, 0xAD, 0x93, 0x32, 0x30, 0xF5, 0x8C, 0xB1, 0xE3,
+    0x1D, 0xF6, 0xE2, 0x2E, 0x82, 0x66, 0xCA, 0x60, 0xC0, 0x29, 0x23, 0xAB, 0x0D, 0x53, 0x4E, 0x6F,
+    0xD5, 0xDB, 0x37, 0x45, 0xDE, 0xFD, 0x8E, 0x2F, 0x03, 0xFF, 0x6A, 0x72, 0x6D, 0x6C, 0x5B, 0x51,
+    0x8D, 0x1B, 0xAF, 0x92, 0xBB, 0xDD, 0xBC, 0x7F, 0x11, 0xD9, 0x5C, 0x41, 0x1F, 0x10, 0x5A, 0xD8,
+    0x0A, 0xC1, 0x31, 0x88, 0xA5, 0xCD, 0x7B, 0xBD, 0x2D, 0x74, 0xD0, 0x12, 0xB8, 0xE5, 0xB4, 0xB0,
+    0x89, 0x69, 0x97, 0x4A, 0x0C, 0x96, 0x77, 0x7E, 0x65, 0xB9, 0xF1, 0x09, 0xC5, 0x6E, 0xC6, 0x84,
+    0x18, 0xF0, 0x7D, 0xEC, 0x3A, 0xDC, 0x4D, 0x20, 0x79, 0xEE, 0x5F, 0x3E, 0xD7, 0xCB, 0x39, 0x48,
+};
+
+static inline uint32_t riscv_k_rol32(uint32_t val, bitcnt_t shamt)
+{
+    shamt &= 31;
+    return shamt ? ((val << shamt) | (val >> (32 - shamt))) : val;
+}
+
+static inline uint32_t riscv_k_ror32(uint32_t val, bitcnt_t shamt)
+{
+    return riscv_k_rol32(val, 32 - shamt);
+}
+
+static inline uint64_t riscv_k_ror64(uint64_t val, bitcnt_t shamt)
+{
+    return (val >> shamt) | (val << (64 - shamt));
+}
+
+static inline uint8_t riscv_k_xtime(uint8_t val)
+{
+    return (val << 1) ^ ((val & 0x80) ? 0x1B : 0);
+}
+
+// Multiply by a 4-bit constant in GF(2^8)
+static inline uint8_t riscv_k_gfmul(uint8_t val, uint8_t mul)
+{
+    uint8_t ret = 0;
+    for (; mul; mul >>= 1) {
+        if (mul & 1) ret ^= val;
+        val = riscv_k_xtime(val);
+    }
+    return ret;
+}
+
+// (Inv)MixColumns of a single column, row 0 in the lowest byte
+static uint32_t riscv_k_aes_mix(uint32_t col, bool inv)
+{
+    static const uint8_t fwd_mat[4] = { 2, 3, 1, 1 };
+    static const uint8_t inv_mat[4] = { 14, 11, 13, 9 };
+    const uint8_t* mat = inv ? inv_mat : fwd_mat;
+    uint32_t ret = 0;
+    for (size_t row=0; row<4; ++row) {
+        uint8_t tmp = 0;
+        for (size_t i=0; i<4; ++i) {
+            tmp ^= riscv_k_gfmul(col >> (i << 3), mat[(i - row) & 3]);
+        }
+        ret |= ((uint32_t)tmp) << (row << 3);
+    }
+    return ret;
+}
+
+// Single S-box byte of rs2 mixed into rs1, shared by aes32* and sm4*
+static inline uint32_t riscv_k_aes32(uint32_t rs1, uint32_t rs2, uint8_t bs, bool dec, bool mix)
+{
+    uint8_t shift = bs << 3;
+    uint8_t sb_in = rs2 >> shift;
+    uint32_t x = dec ? riscv_k_aes_inv_sbox[sb_in] : riscv_k_aes_sbox[sb_in];
+    if (mix) x = riscv_k_aes_mix(x, dec);
+    return rs1 ^ riscv_k_rol32(x, shift);
+}
+
+static inline uint32_t riscv_k_sm4(uint32_t rs1, uint32_t rs2, uint8_t bs, bool ks)
+{
+    uint8_t shift = bs << 3;
+    uint32_t x = riscv_k_sm4_sbox[(uint8_t)(rs2 >> shift)];
+    uint32_t y;
+    if (ks) {
+        y = x ^ riscv_k_rol32(x, 13) ^ riscv_k_rol32(x, 23);
+    } else {
+        y = x ^ riscv_k_rol32(x, 2) ^ riscv_k_rol32(x, 10) ^ riscv_k_rol32(x, 18) ^ riscv_k_rol32(x, 24);
+    }
+    return rs1 ^ riscv_k_rol32(y, shift);
+}
+
+#ifdef RV64
+
+/*
+ * AES64 operates on the 128-bit state {rs2:rs1} and returns the low half,
+ * which maps directly onto host AES round instructions with a zero round key.
+ */
+
+#if defined(GNU_EXTS) && defined(HOST_LITTLE_ENDIAN) && (defined(__x86_64__) || defined(__i386__))
+#define RVK_AESNI 1
+#include <wmmintrin.h>
+
+#define RVK_AESNI_TARGET __attribute__((target("aes,sse2")))
+
+static inline bool riscv_k_has_aesni(void)
+{
+    static int has_aesni = -1;
+    if (unlikely(has_aesni < 0)) {
+        __builtin_cpu_init();
+        has_aesni = !!__builtin_cpu_supports("aes");
+    }
+    return has_aesni;
+}
+
+RVK_AESNI_TARGET static uint64_t riscv_k_aes64_host(uint64_t lo, uint64_t hi, uint8_t op)
+{
+    __m128i state = _mm_set_epi64x(hi, lo);
+    __m128i zero = _mm_setzero_si128();
+    uint64_t ret;
+    switch (op) {
+        case RVK_AES_ES:  state = _mm_aesenclast_si128(state, zero); break;
+        case RVK_AES_ESM: state = _mm_aesenc_si128(state, zero); break;
+        case RVK_AES_DS:  state = _mm_aesdeclast_si128(state, zero); break;
+        case RVK_AES_DSM: state = _mm_aesdec_si128(state, zero); break;
+        default:          state = _mm_aesimc_si128(state); break;
+    }
+    _mm_storel_epi64((__m128i*)&ret, state);
+    return ret;
+}
+
+#elif defined(HOST_LITTLE_ENDIAN) && defined(__aarch64__) && \
+      (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define RVK_ARMV8_AES 1
+#include <arm_neon.h>
+
+static uint64_t riscv_k_aes64_host(uint64_t lo, uint64_t hi, uint8_t op)
+{
+    uint8x16_t state = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(lo), vcreate_u64(hi)));
+    uint8x16_t zero = vdupq_n_u8(0);
+    switch (op) {
+        case RVK_AES_ES:  state = vaeseq_u8(state, zero); break;
+        case RVK_AES_ESM: state = vaesmcq_u8(vaeseq_u8(state, zero)); break;
+        case RVK_AES_DS:  state = vaesdq_u8(state, zero); break;
+        case RVK_AES_DSM: state = vaesimcq_u8(vaesdq_u8(state, zero)); break;
+        default:          state = vaesimcq_u8(state); break;
+    }
+    return vgetq_lane_u64(vreinterpretq_u64_u8(state), 0);
+}
+
+#endif
+
+static uint64_t riscv_k_aes64_portable(uint64_t lo, uint64_t hi, uint8_t op)
+{
+    bool dec = op >= RVK_AES_DS;
+    uint8_t state[16], out[8];
+    uint32_t col0, col1;
+    if (op == RVK_AES_IM) {
+        col0 = riscv_k_aes_mix(lo, true);
+        col1 = riscv_k_aes_mix(lo >> 32, true);
+        return col0 | (((uint64_t)col1) << 32);
+    }
+    write_uint64_le_m(state, lo);
+    write_uint64_le_m(state + 8, hi);
+    // (Inv)ShiftRows & (Inv)SubBytes of columns 0 and 1
+    for (size_t i=0; i<8; ++i) {
+        size_t col = i >> 2, row = i & 3;
+        uint8_t tmp = state[(((dec ? col - row : col + row) & 3) << 2) | row];
+        out[i] = dec ? riscv_k_aes_inv_sbox[tmp] : riscv_k_aes_sbox[tmp];
+    }
+    col0 = read_uint32_le_m(out);
+    col1 = read_uint32_le_m(out + 4);
+    if (op == RVK_AES_ESM || op == RVK_AES_DSM) {
+        col0 = riscv_k_aes_mix(col0, dec);
+        col1 = riscv_k_aes_mix(col1, dec);
+    }
+    return col0 | (((uint64_t)col1) << 32);
+}
+
+static uint64_t riscv_k_aes64(uint64_t lo, uint64_t hi, uint8_t op)
+{
+#if defined(RVK_AESNI)
+    if (likely(riscv_k_has_aesni())) return riscv_k_aes64_host(lo, hi, op);
+#elif defined(RVK_ARMV8_AES)
+    return riscv_k_aes64_host(lo, hi, op);
+#endif
+    return riscv_k_aes64_portable(lo, hi, op);
+}
+
+static uint64_t riscv_k_aes64ks1i(uint64_t rs1, uint8_t rnum)
+{
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
+    uint32_t tmp = rs1 >> 32;
+    uint32_t ret = 0;
+    if (rnum != 0xA) tmp = riscv_k_ror32(tmp, 8);
+    for (size_t i=0; i<32; i += 8) {
+        ret |= ((uint32_t)riscv_k_aes_sbox[(uint8_t)(tmp >> i)]) << i;
+    }
+    if (rnum != 0xA) ret ^= rcon[rnum];
+    return ret | (((uint64_t)ret) << 32);
+}
+
+#endif
+
+// Reverse bits in each byte
+static inline xlen_t riscv_k_brev8(xlen_t val)
+{
+    val = ((val & (xlen_t)0x5555555555555555ULL) << 1) | ((val >> 1) & (xlen_t)0x5555555555555555ULL);
+    val = ((val & (xlen_t)0x3333333333333333ULL) << 2) | ((val >> 2) & (xlen_t)0x3333333333333333ULL);
+    return ((val & (xlen_t)0x0F0F0F0F0F0F0F0FULL) << 4) | ((val >> 4) & (xlen_t)0x0F0F0F0F0F0F0F0FULL);
+}
+
+// Crossbar permutation, rs2 holds indices of lanes of rs1
+static inline xlen_t riscv_k_xperm(xlen_t rs1, xlen_t rs2, bitcnt_t lane_bits)
+{
+    xlen_t mask = (((xlen_t)1) << lane_bits) - 1;
+    xlen_t ret = 0;
+    for (bitcnt_t i=0; i<XLEN_BITS; i += lane_bits) {
+        xlen_t pos = ((rs2 >> i) & mask) * lane_bits;
+        if (pos < XLEN_BITS) ret |= ((rs1 >> pos) & mask) << i;
+    }
+    return ret;
+}
+
+#ifndef RV64
+
+static inline uint32_t riscv_k_zip(uint32_t val)
+{
+    uint32_t ret = 0;
+    for (bitcnt_t i=0; i<16; ++i) {
+        ret |= ((val >> i) & 1) << (i << 1);
+        ret |= ((val >> (i + 16)) & 1) << ((i << 1) + 1);
+    }
+    return ret;
+}
+
+static inline uint32_t riscv_k_unzip(uint32_t val)
+{
+    uint32_t ret = 0;
+    for (bitcnt_t i=0; i<16; ++i) {
+        ret |= ((val >> (i << 1)) & 1) << i;
+        ret |= ((val >> ((i << 1) + 1)) & 1) << (i + 16);
+    }
+    return ret;
+}
+
+#endif
+
+static void riscv_k_op(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    xlen_t reg1 = riscv_read_register(vm, bit_cut(instruction, 15, 5));
+    xlen_t reg2 = riscv_read_register(vm, bit_cut(instruction, 20, 5));
+    uint8_t funct7 = bit_cut(instruction, 25, 7);
+    uint8_t bs = funct7 >> 5;
+
+    switch (bit_cut(instruction, 12, 3)) {
+        case 0x0:
+            // aes32*, sm4* carry byte select in funct7[6:5]
+            switch (funct7 & 0x1F) {
+                case 0x18:
+                    riscv_write_register(vm, rds, (int32_t)riscv_k_sm4(reg1, reg2, bs, false));
+                    return;
+                case 0x1A:
+                    riscv_write_register(vm, rds, (int32_t)riscv_k_sm4(reg1, reg2, bs, true));
+                    return;
+#ifndef RV64
+                case 0x11:
+                    riscv_write_register(vm, rds, riscv_k_aes32(reg1, reg2, bs, false, false));
+                    return;
+                case 0x13:
+                    riscv_write_register(vm, rds, riscv_k_aes32(reg1, reg2, bs, false, true));
+                    return;
+                case 0x15:
+                    riscv_write_register(vm, rds, riscv_k_aes32(reg1, reg2, bs, true, false));
+                    return;
+                case 0x17:
+                    riscv_write_register(vm, rds, riscv_k_aes32(reg1, reg2, bs, true, true));
+                    return;
+#endif
+            }
+            switch (funct7) {
+#ifdef RV64
+                case 0x19:
+                    riscv_write_register(vm, rds, riscv_k_aes64(reg1, reg2, RVK_AES_ES));
+                    return;
+                case 0x1B:
+                    riscv_write_register(vm, rds, riscv_k_aes64(reg1, reg2, RVK_AES_ESM));
+                    return;
+                case 0x1D:
+                    riscv_write_register(vm, rds, riscv_k_aes64(reg1, reg2, RVK_AES_DS));
+                    return;
+                case 0x1F:
+                    riscv_write_register(vm, rds, riscv_k_aes64(reg1, reg2, RVK_AES_DSM));
+                    return;
+                case 0x3F: {
+                    // aes64ks2
+                    uint32_t w0 = (reg1 >> 32) ^ reg2;
+                    uint32_t w1 = w0 ^ (reg2 >> 32);
+                    riscv_write_register(vm, rds, w0 | (((uint64_t)w1) << 32));
+                    return;
+                }
+#else
+                // SHA-512 on RV32 operates on register pairs
+                case 0x28: // sha512sum0r
+                    riscv_write_register(vm, rds, (reg1 << 25) ^ (reg1 << 30) ^ (reg1 >> 28)
+                                                ^ (reg2 >> 7) ^ (reg2 >> 2) ^ (reg2 << 4));
+                    return;
+                case 0x29: // sha512sum1r
+                    riscv_write_register(vm, rds, (reg1 << 23) ^ (reg1 >> 14) ^ (reg1 >> 18)
+                                                ^ (reg2 >> 9) ^ (reg2 << 18) ^ (reg2 << 14));
+                    return;
+                case 0x2A: // sha512sig0l
+                    riscv_write_register(vm, rds, (reg1 >> 1) ^ (reg1 >> 7) ^ (reg1 >> 8)
+                                                ^ (reg2 << 31) ^ (reg2 << 25) ^ (reg2 << 24));
+                    return;
+                case 0x2B: // sha512sig1l
+                    riscv_write_register(vm, rds, (reg1 << 3) ^ (reg1 >> 6) ^ (reg1 >> 19)
+                                                ^ (reg2 >> 29) ^ (reg2 << 26) ^ (reg2 << 13));
+                    return;
+                case 0x2E: // sha512sig0h
+                    riscv_write_register(vm, rds, (reg1 >> 1) ^ (reg1 >> 7) ^ (reg1 >> 8)
+                                                ^ (reg2 << 31) ^ (reg2 << 24));
+                    return;
+                case 0x2F: // sha512sig1h
+                    riscv_write_register(vm, rds, (reg1 << 3) ^ (reg1 >> 6) ^ (reg1 >> 19)
+                                                ^ (reg2 >> 29) ^ (reg2 << 13));
+                    return;
+#endif
+            }
+            break;
+        case 0x2:
+            if (funct7 == 0x14) {
+                // xperm4
+                riscv_write_register(vm, rds, riscv_k_xperm(reg1, reg2, 4));
+                return;
+            }
+            break;
+        case 0x4:
+            if (funct7 == 0x04) {
+                // pack
+                riscv_write_register(vm, rds, bit_cut(reg1, 0, XLEN_BITS / 2) | (reg2 << (XLEN_BITS / 2)));
+                return;
+            }
+            if (funct7 == 0x14) {
+                // xperm8
+                riscv_write_register(vm, rds, riscv_k_xperm(reg1, reg2, 8));
+                return;
+            }
+            break;
+        case 0x7:
+            if (funct7 == 0x04) {
+                // packh
+                riscv_write_register(vm, rds, (reg1 & 0xFF) | ((reg2 & 0xFF) << 8));
+                return;
+            }
+            break;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+static void riscv_k_slli(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    uint32_t imm = bit_cut(instruction, 20, 12);
+    xlen_t src_reg = riscv_read_register(vm, bit_cut(instruction, 15, 5));
+    uint32_t src32 = src_reg;
+
+    switch (imm) {
+        // SHA-256 & SM3 results are sign-extended on RV64
+        case RVK_SHA256SUM0:
+            riscv_write_register(vm, rds, (int32_t)(riscv_k_ror32(src32, 2)
+                               ^ riscv_k_ror32(src32, 13) ^ riscv_k_ror32(src32, 22)));
+            return;
+        case RVK_SHA256SUM1:
+            riscv_write_register(vm, rds, (int32_t)(riscv_k_ror32(src32, 6)
+                               ^ riscv_k_ror32(src32, 11) ^ riscv_k_ror32(src32, 25)));
+            return;
+        case RVK_SHA256SIG0:
+            riscv_write_register(vm, rds, (int32_t)(riscv_k_ror32(src32, 7)
+                               ^ riscv_k_ror32(src32, 18) ^ (src32 >> 3)));
+            return;
+        case RVK_SHA256SIG1:
+            riscv_write_register(vm, rds, (int32_t)(riscv_k_ror32(src32, 17)
+                               ^ riscv_k_ror32(src32, 19) ^ (src32 >> 10)));
+            return;
+        case RVK_SM3P0:
+            riscv_write_register(vm, rds, (int32_t)(src32 ^ riscv_k_rol32(src32, 9) ^ riscv_k_rol32(src32, 17)));
+            return;
+        case RVK_SM3P1:
+            riscv_write_register(vm, rds, (int32_t)(src32 ^ riscv_k_rol32(src32, 15) ^ riscv_k_rol32(src32, 23)));
+            return;
+#ifdef RV64
+        case RVK_SHA512SUM0:
+            riscv_write_register(vm, rds, riscv_k_ror64(src_reg, 28)
+                               ^ riscv_k_ror64(src_reg, 34) ^ riscv_k_ror64(src_reg, 39));
+            return;
+        case RVK_SHA512SUM1:
+            riscv_write_register(vm, rds, riscv_k_ror64(src_reg, 14)
+                               ^ riscv_k_ror64(src_reg, 18) ^ riscv_k_ror64(src_reg, 41));
+            return;
+        case RVK_SHA512SIG0:
+            riscv_write_register(vm, rds, riscv_k_ror64(src_reg, 1)
+                               ^ riscv_k_ror64(src_reg, 8) ^ (src_reg >> 7));
+            return;
+        case RVK_SHA512SIG1:
+            riscv_write_register(vm, rds, riscv_k_ror64(src_reg, 19)
+                               ^ riscv_k_ror64(src_reg, 61) ^ (src_reg >> 6));
+            return;
+        case RVK_AES64IM:
+            riscv_write_register(vm, rds, riscv_k_aes64(src_reg, 0, RVK_AES_IM));
+            return;
+#else
+        case RVK_ZIP:
+            riscv_write_register(vm, rds, riscv_k_zip(src_reg));
+            return;
+#endif
+    }
+
+#ifdef RV64
+    if ((imm >> 4) == RVK_AES64KS1I && (imm & 0xF) <= 0xA) {
+        riscv_write_register(vm, rds, riscv_k_aes64ks1i(src_reg, imm & 0xF));
+        return;
+    }
+#endif
+    riscv_illegal_insn(vm, instruction);
+}
+
+static void riscv_k_srli(rvvm_hart_t *vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    xlen_t src_reg = riscv_read_register(vm, bit_cut(instruction, 15, 5));
+
+    switch (bit_cut(instruction, 20, 12)) {
+        case RVK_BREV8:
+            riscv_write_register(vm, rds, riscv_k_brev8(src_reg));
+            return;
+#ifndef RV64
+        case RVK_ZIP:
+            // unzip
+            riscv_write_register(vm, rds, riscv_k_unzip(src_reg));
+            return;
+#endif
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+void riscv_k_insn(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    // Decoder slot without funct7 bit, i.e. funct3 + opcode
+    switch (((instruction >> 7) & 0xE0) | ((instruction >> 2) & 0x1F)) {
+        case RVI_SLLI:
+            riscv_k_slli(vm, instruction);
+            return;
+        case RVI_SRLI_SRAI:
+            riscv_k_srli(vm, instruction);
+            return;
+        case RVI_ADD_SUB:
+        case RVI_SLT:
+        case RVI_XOR:
+        case RVI_AND:
+            riscv_k_op(vm, instruction);
+            return;
+#ifdef RV64
+        case RV64B_SH2ADD_UW:
+            if (bit_cut(instruction, 25, 7) == 0x04) {
+                // packw
+                uint32_t lo = riscv_read_register(vm, bit_cut(instruction, 15, 5));
+                uint32_t hi = riscv_read_register(vm, bit_cut(instruction, 20, 5));
+                riscv_write_register(vm, bit_cut(instruction, 7, 5), (int32_t)((lo & 0xFFFF) | (hi << 16)));
+                return;
+            }
+            break;
+#endif
+    }
+    riscv_illegal_insn(vm, instruction);
+}
@@ -24,6 +24,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 static void riscv_m_mul(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Scalar crypto instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -37,6 +43,12 @@ static void riscv_m_mul(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_mulh(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -58,6 +70,12 @@ static void riscv_m_mulh(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_mulhsu(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -79,6 +97,12 @@ static void riscv_m_mulhsu(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_mulhu(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -100,6 +124,12 @@ static void riscv_m_mulhu(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_div(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -122,6 +152,12 @@ static void riscv_m_div(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_divu(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -141,6 +177,12 @@ static void riscv_m_divu(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_rem(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -163,6 +205,12 @@ static void riscv_m_rem(rvvm_hart_t *vm, const uint32_t instruction)
 
 static void riscv_m_remu(rvvm_hart_t *vm, const uint32_t instruction)
 {
+    if (unlikely(bit_cut(instruction, 25, 7) != 0x1)) {
+        // Bitmanip instruction in the same decoder slot
+        riscv_b_insn(vm, instruction);
+        return;
+    }
+
     regid_t rds = bit_cut(instruction, 7, 5);
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
@@ -0,0 +1,835 @@
+/*
+riscv_predecode.c - RISC-V Pre-decoded Instruction Handlers
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define RISCV_CPU_SOURCE
+
+#include "bit_ops.h"
+#include "riscv_cpu.h"
+#include "riscv_mmu.h"
+
+/*
+ * Fast handlers for the most common instructions, operands are
+ * extracted once when the instruction is placed into the icache.
+ * Compressed instructions share handlers with their base counterparts.
+ * Jumps leave PC off by instruction size, dispatch loop increments it.
+ * These aren't traced by JIT, so they're only used when it's disabled.
+ * Anything else is passed to regular handlers from the decoder tables.
+ */
+
+#define RVF_ARGS rvvm_hart_t* vm, const rvvm_icache_entry_t* entry
+
+#define RVF_RS1  riscv_read_register(vm, entry->rs1)
+#define RVF_RS2  riscv_read_register(vm, entry->rs2)
+#define RVF_IMM  ((sxlen_t)entry->imm)
+
+// Integer register-immediate operations
+
+static void riscv_fast_addi(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 + RVF_IMM);
+}
+
+static void riscv_fast_slti(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, ((sxlen_t)RVF_RS1 < RVF_IMM) ? 1 : 0);
+}
+
+static void riscv_fast_sltiu(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, (RVF_RS1 < (xlen_t)RVF_IMM) ? 1 : 0);
+}
+
+static void riscv_fast_xori(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 ^ RVF_IMM);
+}
+
+static void riscv_fast_ori(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 | RVF_IMM);
+}
+
+static void riscv_fast_andi(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 & RVF_IMM);
+}
+
+static void riscv_fast_slli(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 << entry->imm);
+}
+
+static void riscv_fast_srli(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 >> entry->imm);
+}
+
+static void riscv_fast_srai(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, ((sxlen_t)RVF_RS1) >> entry->imm);
+}
+
+static void riscv_fast_auipc(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, riscv_read_register(vm, REGISTER_PC) + RVF_IMM);
+}
+
+// Integer register-register operations
+
+static void riscv_fast_add(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 + RVF_RS2);
+}
+
+static void riscv_fast_sub(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 - RVF_RS2);
+}
+
+static void riscv_fast_sll(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 << (RVF_RS2 & bit_mask(SHAMT_BITS)));
+}
+
+static void riscv_fast_slt(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, ((sxlen_t)RVF_RS1 < (sxlen_t)RVF_RS2) ? 1 : 0);
+}
+
+static void riscv_fast_sltu(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, (RVF_RS1 < RVF_RS2) ? 1 : 0);
+}
+
+static void riscv_fast_xor(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 ^ RVF_RS2);
+}
+
+static void riscv_fast_srl(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 >> (RVF_RS2 & bit_mask(SHAMT_BITS)));
+}
+
+static void riscv_fast_sra(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, ((sxlen_t)RVF_RS1) >> (RVF_RS2 & bit_mask(SHAMT_BITS)));
+}
+
+static void riscv_fast_or(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 | RVF_RS2);
+}
+
+static void riscv_fast_and(RVF_ARGS)
+{
+    riscv_write_register(vm, entry->rds, RVF_RS1 & RVF_RS2);
+}
+
+#ifdef RV64
+
+// 32-bit operations on RV64
+
+static void riscv_fast_addiw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(RVF_RS1 + RVF_IMM);
+}
+
+static void riscv_fast_slliw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(((uint32_t)RVF_RS1) << entry->imm);
+}
+
+static void riscv_fast_srliw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(((uint32_t)RVF_RS1) >> entry->imm);
+}
+
+static void riscv_fast_sraiw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = ((int32_t)RVF_RS1) >> entry->imm;
+}
+
+static void riscv_fast_addw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(RVF_RS1 + RVF_RS2);
+}
+
+static void riscv_fast_subw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(RVF_RS1 - RVF_RS2);
+}
+
+static void riscv_fast_sllw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(((uint32_t)RVF_RS1) << (RVF_RS2 & 0x1F));
+}
+
+static void riscv_fast_srlw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = (int32_t)(((uint32_t)RVF_RS1) >> (RVF_RS2 & 0x1F));
+}
+
+static void riscv_fast_sraw(RVF_ARGS)
+{
+    vm->registers[entry->rds] = ((int32_t)RVF_RS1) >> (RVF_RS2 & 0x1F);
+}
+
+#endif
+
+// Loads & stores
+
+static void riscv_fast_lb(RVF_ARGS)
+{
+    riscv_load_s8(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_lh(RVF_ARGS)
+{
+    riscv_load_s16(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_lw(RVF_ARGS)
+{
+    riscv_load_s32(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_lbu(RVF_ARGS)
+{
+    riscv_load_u8(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_lhu(RVF_ARGS)
+{
+    riscv_load_u16(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_sb(RVF_ARGS)
+{
+    riscv_store_u8(vm, RVF_RS1 + RVF_IMM, entry->rs2);
+}
+
+static void riscv_fast_sh(RVF_ARGS)
+{
+    riscv_store_u16(vm, RVF_RS1 + RVF_IMM, entry->rs2);
+}
+
+static void riscv_fast_sw(RVF_ARGS)
+{
+    riscv_store_u32(vm, RVF_RS1 + RVF_IMM, entry->rs2);
+}
+
+#ifdef RV64
+
+static void riscv_fast_lwu(RVF_ARGS)
+{
+    riscv_load_u32(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_ld(RVF_ARGS)
+{
+    riscv_load_u64(vm, RVF_RS1 + RVF_IMM, entry->rds);
+}
+
+static void riscv_fast_sd(RVF_ARGS)
+{
+    riscv_store_u64(vm, RVF_RS1 + RVF_IMM, entry->rs2);
+}
+
+#endif
+
+// Jumps & branches
+
+static void riscv_fast_jal(RVF_ARGS)
+{
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    riscv_write_register(vm, entry->rds, pc + entry->size);
+    riscv_write_register(vm, REGISTER_PC, pc + RVF_IMM - entry->size);
+}
+
+static void riscv_fast_jalr(RVF_ARGS)
+{
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    xlen_t jmp_addr = RVF_RS1 + RVF_IMM;
+    riscv_write_register(vm, entry->rds, pc + entry->size);
+    riscv_write_register(vm, REGISTER_PC, (jmp_addr & (~(xlen_t)1)) - entry->size);
+}
+
+static inline void riscv_fast_branch(RVF_ARGS, bool taken)
+{
+    if (taken) {
+        xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+        riscv_write_register(vm, REGISTER_PC, pc + RVF_IMM - entry->size);
+    }
+}
+
+static void riscv_fast_beq(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, RVF_RS1 == RVF_RS2);
+}
+
+static void riscv_fast_bne(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, RVF_RS1 != RVF_RS2);
+}
+
+static void riscv_fast_blt(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, (sxlen_t)RVF_RS1 < (sxlen_t)RVF_RS2);
+}
+
+static void riscv_fast_bge(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, (sxlen_t)RVF_RS1 >= (sxlen_t)RVF_RS2);
+}
+
+static void riscv_fast_bltu(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, RVF_RS1 < RVF_RS2);
+}
+
+static void riscv_fast_bgeu(RVF_ARGS)
+{
+    riscv_fast_branch(vm, entry, RVF_RS1 >= RVF_RS2);
+}
+
+// Fused instruction pairs
+
+/*
+ * A fused entry keeps operands of the first instruction and takes size
+ * of the whole pair, the second one is read from the following entry,
+ * which is always decoded together with it.
+ * First instruction never writes x0, since it's only zeroed after the pair.
+ * The dispatcher counts a single retired instruction, fused handlers add one.
+ */
+
+#define RVF_NEXT_RS1 riscv_read_register(vm, next->rs1)
+#define RVF_NEXT_RS2 riscv_read_register(vm, next->rs2)
+
+static inline const rvvm_icache_entry_t* riscv_fused_next(const rvvm_icache_entry_t* entry)
+{
+    // Lowest bits of a 32-bit instruction are always set
+    return entry + (((entry->instruction & 3) == 3) ? 2 : 1);
+}
+
+// lui/li + addi: Load 32-bit constant
+static void riscv_fused_li(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    riscv_write_register(vm, entry->rds, (xlen_t)RVF_IMM + (sxlen_t)next->imm);
+}
+
+// auipc + addi: Load PC-relative address
+static void riscv_fused_la(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    riscv_write_register(vm, entry->rds, pc + RVF_IMM + (sxlen_t)next->imm);
+}
+
+// auipc + jalr: Far call or tail call
+static void riscv_fused_call(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    xlen_t jmp_addr = pc + RVF_IMM + (sxlen_t)next->imm;
+    riscv_write_register(vm, entry->rds, pc + RVF_IMM);
+    riscv_write_register(vm, next->rds, pc + entry->size);
+    riscv_write_register(vm, REGISTER_PC, (jmp_addr & (~(xlen_t)1)) - entry->size);
+}
+
+// auipc + load: PC-relative load, PC points to the load in case it traps
+static void riscv_fused_auipc_lw(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    riscv_write_register(vm, entry->rds, pc + RVF_IMM);
+    riscv_write_register(vm, REGISTER_PC, pc + entry->size - next->size);
+    riscv_load_s32(vm, pc + RVF_IMM + (sxlen_t)next->imm, next->rds);
+    riscv_write_register(vm, REGISTER_PC, pc);
+}
+
+#ifdef RV64
+
+static void riscv_fused_auipc_ld(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+    riscv_write_register(vm, entry->rds, pc + RVF_IMM);
+    riscv_write_register(vm, REGISTER_PC, pc + entry->size - next->size);
+    riscv_load_u64(vm, pc + RVF_IMM + (sxlen_t)next->imm, next->rds);
+    riscv_write_register(vm, REGISTER_PC, pc);
+}
+
+// lui + addiw: Load 32-bit constant on RV64
+static void riscv_fused_liw(RVF_ARGS)
+{
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry);
+    vm->instret++;
+    vm->registers[entry->rds] = (int32_t)((uint32_t)entry->imm + (uint32_t)next->imm);
+}
+
+#endif
+
+// slli + srli/srai by the same amount: Zero/sign extension
+static void riscv_fused_zext(RVF_ARGS)
+{
+    vm->instret++;
+    riscv_write_register(vm, entry->rds, (RVF_RS1 << entry->imm) >> entry->imm);
+}
+
+static void riscv_fused_sext(RVF_ARGS)
+{
+    vm->instret++;
+    riscv_write_register(vm, entry->rds, ((sxlen_t)(RVF_RS1 << entry->imm)) >> entry->imm);
+}
+
+// Compare-and-branch: Branch on the result of the first instruction
+static inline void riscv_fused_branch(rvvm_hart_t* vm, const rvvm_icache_entry_t* next, bool taken)
+{
+    // Branch offset is relative to the second instruction
+    if (taken) {
+        xlen_t pc = riscv_read_register(vm, REGISTER_PC);
+        riscv_write_register(vm, REGISTER_PC, pc + (sxlen_t)next->imm - next->size);
+    }
+}
+
+#define RVF_FUSED_BRANCH(first, op, branch, cond) \
+static void riscv_fused_##first##_##branch(RVF_ARGS) \
+{ \
+    const rvvm_icache_entry_t* next = riscv_fused_next(entry); \
+    vm->instret++; \
+    riscv_write_register(vm, entry->rds, op); \
+    riscv_fused_branch(vm, next, cond); \
+}
+
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, beq, RVF_NEXT_RS1 == RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, bne, RVF_NEXT_RS1 != RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, blt, (sxlen_t)RVF_NEXT_RS1 < (sxlen_t)RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, bge, (sxlen_t)RVF_NEXT_RS1 >= (sxlen_t)RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, bltu, RVF_NEXT_RS1 < RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(addi, RVF_RS1 + RVF_IMM, bgeu, RVF_NEXT_RS1 >= RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(andi, RVF_RS1 & RVF_IMM, beq, RVF_NEXT_RS1 == RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(andi, RVF_RS1 & RVF_IMM, bne, RVF_NEXT_RS1 != RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(slt, ((sxlen_t)RVF_RS1 < (sxlen_t)RVF_RS2) ? 1 : 0, beq, RVF_NEXT_RS1 == RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(slt, ((sxlen_t)RVF_RS1 < (sxlen_t)RVF_RS2) ? 1 : 0, bne, RVF_NEXT_RS1 != RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(sltu, (RVF_RS1 < RVF_RS2) ? 1 : 0, beq, RVF_NEXT_RS1 == RVF_NEXT_RS2)
+RVF_FUSED_BRANCH(sltu, (RVF_RS1 < RVF_RS2) ? 1 : 0, bne, RVF_NEXT_RS1 != RVF_NEXT_RS2)
+
+// Decoding
+
+static inline void riscv_fast_set(rvvm_icache_entry_t* entry, riscv_inst_fast_t func,
+                                  regid_t rds, regid_t rs1, regid_t rs2, int32_t imm)
+{
+    entry->func = func;
+    entry->rds = rds;
+    entry->rs1 = rs1;
+    entry->rs2 = rs2;
+    entry->imm = imm;
+}
+
+static void riscv_predecode_insn(rvvm_icache_entry_t* entry)
+{
+    const uint32_t insn = entry->instruction;
+    const regid_t rds = bit_cut(insn, 7, 5);
+    const regid_t rs1 = bit_cut(insn, 15, 5);
+    const regid_t rs2 = bit_cut(insn, 20, 5);
+    const uint32_t funct3 = bit_cut(insn, 12, 3);
+    const uint32_t funct7 = bit_cut(insn, 25, 7);
+    const uint32_t shamt_hi = bit_cut(insn, 20 + SHAMT_BITS, 12 - SHAMT_BITS);
+    const int32_t imm_i = sign_extend(bit_cut(insn, 20, 12), 12);
+    const int32_t imm_s = sign_extend(bit_cut(insn, 7, 5) | (bit_cut(insn, 25, 7) << 5), 12);
+    const int32_t imm_u = insn & 0xFFFFF000;
+    static const riscv_inst_fast_t alu_imm[8] = {
+        riscv_fast_addi, NULL, riscv_fast_slti, riscv_fast_sltiu,
+        riscv_fast_xori, NULL, riscv_fast_ori, riscv_fast_andi,
+    };
+    static const riscv_inst_fast_t alu[8] = {
+        riscv_fast_add, riscv_fast_sll, riscv_fast_slt, riscv_fast_sltu,
+        riscv_fast_xor, riscv_fast_srl, riscv_fast_or, riscv_fast_and,
+    };
+    static const riscv_inst_fast_t branch[8] = {
+        riscv_fast_beq, riscv_fast_bne, NULL, NULL,
+        riscv_fast_blt, riscv_fast_bge, riscv_fast_bltu, riscv_fast_bgeu,
+    };
+#ifdef RV64
+    static const riscv_inst_fast_t load[8] = {
+        riscv_fast_lb, riscv_fast_lh, riscv_fast_lw, riscv_fast_ld,
+        riscv_fast_lbu, riscv_fast_lhu, riscv_fast_lwu, NULL,
+    };
+    static const riscv_inst_fast_t store[8] = {
+        riscv_fast_sb, riscv_fast_sh, riscv_fast_sw, riscv_fast_sd,
+    };
+#else
+    static const riscv_inst_fast_t load[8] = {
+        riscv_fast_lb, riscv_fast_lh, riscv_fast_lw, NULL,
+        riscv_fast_lbu, riscv_fast_lhu, NULL, NULL,
+    };
+    static const riscv_inst_fast_t store[8] = {
+        riscv_fast_sb, riscv_fast_sh, riscv_fast_sw, NULL,
+    };
+#endif
+
+    switch (insn & 0x7F) {
+        case 0x13: // OP-IMM
+            if (funct3 == 0x1) {
+                if (shamt_hi == 0) {
+                    riscv_fast_set(entry, riscv_fast_slli, rds, rs1, 0, bit_cut(insn, 20, SHAMT_BITS));
+                }
+            } else if (funct3 == 0x5) {
+                if (shamt_hi == 0) {
+                    riscv_fast_set(entry, riscv_fast_srli, rds, rs1, 0, bit_cut(insn, 20, SHAMT_BITS));
+                } else if (shamt_hi == (0x400 >> SHAMT_BITS)) {
+                    riscv_fast_set(entry, riscv_fast_srai, rds, rs1, 0, bit_cut(insn, 20, SHAMT_BITS));
+                }
+            } else {
+                riscv_fast_set(entry, alu_imm[funct3], rds, rs1, 0, imm_i);
+            }
+            return;
+        case 0x33: // OP
+            if (funct7 == 0) {
+                riscv_fast_set(entry, alu[funct3], rds, rs1, rs2, 0);
+            } else if (funct7 == 0x20 && funct3 == 0x0) {
+                riscv_fast_set(entry, riscv_fast_sub, rds, rs1, rs2, 0);
+            } else if (funct7 == 0x20 && funct3 == 0x5) {
+                riscv_fast_set(entry, riscv_fast_sra, rds, rs1, rs2, 0);
+            }
+            return;
+        case 0x37: // LUI
+            riscv_fast_set(entry, riscv_fast_addi, rds, REGISTER_ZERO, 0, imm_u);
+            return;
+        case 0x17: // AUIPC
+            riscv_fast_set(entry, riscv_fast_auipc, rds, 0, 0, imm_u);
+            return;
+        case 0x03: // LOAD
+            if (load[funct3]) riscv_fast_set(entry, load[funct3], rds, rs1, 0, imm_i);
+            return;
+        case 0x23: // STORE
+            if (funct3 < 4 && store[funct3]) riscv_fast_set(entry, store[funct3], 0, rs1, rs2, imm_s);
+            return;
+        case 0x63: // BRANCH
+            if (branch[funct3]) {
+                int32_t imm = sign_extend((bit_cut(insn, 31, 1) << 12) |
+                                          (bit_cut(insn, 7, 1)  << 11) |
+                                          (bit_cut(insn, 25, 6) << 5)  |
+                                          (bit_cut(insn, 8, 4)  << 1), 13);
+                riscv_fast_set(entry, branch[funct3], 0, rs1, rs2, imm);
+            }
+            return;
+        case 0x6F: { // JAL
+            int32_t imm = sign_extend((bit_cut(insn, 31, 1) << 20) |
+                                      (bit_cut(insn, 12, 8) << 12) |
+                                      (bit_cut(insn, 20, 1) << 11) |
+                                      (bit_cut(insn, 21, 10) << 1), 21);
+            riscv_fast_set(entry, riscv_fast_jal, rds, 0, 0, imm);
+            return;
+        }
+        case 0x67: // JALR
+            if (funct3 == 0) riscv_fast_set(entry, riscv_fast_jalr, rds, rs1, 0, imm_i);
+            return;
+#ifdef RV64
+        case 0x1B: // OP-IMM-32
+            if (funct3 == 0x0) {
+                riscv_fast_set(entry, riscv_fast_addiw, rds, rs1, 0, imm_i);
+            } else if (funct3 == 0x1 && funct7 == 0) {
+                riscv_fast_set(entry, riscv_fast_slliw, rds, rs1, 0, rs2);
+            } else if (funct3 == 0x5 && funct7 == 0) {
+                riscv_fast_set(entry, riscv_fast_srliw, rds, rs1, 0, rs2);
+            } else if (funct3 == 0x5 && funct7 == 0x20) {
+                riscv_fast_set(entry, riscv_fast_sraiw, rds, rs1, 0, rs2);
+            }
+            return;
+        case 0x3B: // OP-32
+            if (funct3 == 0x0 && funct7 == 0) {
+                riscv_fast_set(entry, riscv_fast_addw, rds, rs1, rs2, 0);
+            } else if (funct3 == 0x0 && funct7 == 0x20) {
+                riscv_fast_set(entry, riscv_fast_subw, rds, rs1, rs2, 0);
+            } else if (funct3 == 0x1 && funct7 == 0) {
+                riscv_fast_set(entry, riscv_fast_sllw, rds, rs1, rs2, 0);
+            } else if (funct3 == 0x5 && funct7 == 0) {
+                riscv_fast_set(entry, riscv_fast_srlw, rds, rs1, rs2, 0);
+            } else if (funct3 == 0x5 && funct7 == 0x20) {
+                riscv_fast_set(entry, riscv_fast_sraw, rds, rs1, rs2, 0);
+            }
+            return;
+#endif
+    }
+}
+
+// Compressed instructions are mapped onto base handlers
+
+static void riscv_predecode_insn_c(rvvm_icache_entry_t* entry)
+{
+    const uint16_t insn = entry->instruction;
+    const regid_t rds = bit_cut(insn, 7, 5);
+    const regid_t rs2 = bit_cut(insn, 2, 5);
+    const regid_t rds_c = riscv_c_reg(bit_cut(insn, 7, 3));
+    const regid_t rs2_c = riscv_c_reg(bit_cut(insn, 2, 3));
+    const int32_t imm6 = sign_extend((bit_cut(insn, 12, 1) << 5) | bit_cut(insn, 2, 5), 6);
+#ifdef RV64
+    const uint32_t shamt = bit_cut(insn, 2, 5) | (bit_cut(insn, 12, 1) << 5);
+#else
+    const uint32_t shamt = bit_cut(insn, 2, 5);
+#endif
+    const int32_t imm_j = sign_extend((bit_cut(insn, 3, 3) << 1)  |
+                                      (bit_cut(insn, 11, 1) << 4) |
+                                      (bit_cut(insn, 2, 1) << 5)  |
+                                      (bit_cut(insn, 7, 1) << 6)  |
+                                      (bit_cut(insn, 6, 1) << 7)  |
+                                      (bit_cut(insn, 9, 2) << 8)  |
+                                      (bit_cut(insn, 8, 1) << 10) |
+                                      (bit_cut(insn, 12, 1) << 11), 12);
+    const int32_t imm_b = sign_extend((bit_cut(insn, 3, 2) << 1)  |
+                                      (bit_cut(insn, 10, 2) << 3) |
+                                      (bit_cut(insn, 2, 1) << 5)  |
+                                      (bit_cut(insn, 5, 2) << 6)  |
+                                      (bit_cut(insn, 12, 1) << 8), 9);
+    const uint32_t off_w = (bit_cut(insn, 6, 1)  << 2) |
+                           (bit_cut(insn, 10, 3) << 3) |
+                           (bit_cut(insn, 5, 1)  << 6);
+    static const riscv_inst_fast_t alu_c[4] = {
+        riscv_fast_sub, riscv_fast_xor, riscv_fast_or, riscv_fast_and,
+    };
+
+    switch (((insn >> 13) << 2) | (insn & 3)) {
+        case RVC_ADDI4SPN: {
+            uint32_t imm = (bit_cut(insn, 6, 1)  << 2) |
+                           (bit_cut(insn, 5, 1)  << 3) |
+                           (bit_cut(insn, 11, 2) << 4) |
+                           (bit_cut(insn, 7, 4)  << 6);
+            if (imm) riscv_fast_set(entry, riscv_fast_addi, rs2_c, REGISTER_X2, 0, imm);
+            return;
+        }
+        case RVC_ADDI:
+            riscv_fast_set(entry, riscv_fast_addi, rds, rds, 0, imm6);
+            return;
+        case RVC_LI:
+            riscv_fast_set(entry, riscv_fast_addi, rds, REGISTER_ZERO, 0, imm6);
+            return;
+        case RVC_ADDI16SP_LUI:
+            if (rds == REGISTER_X2) {
+                int32_t imm = sign_extend((bit_cut(insn, 6, 1) << 4) |
+                                          (bit_cut(insn, 2, 1) << 5) |
+                                          (bit_cut(insn, 5, 1) << 6) |
+                                          (bit_cut(insn, 3, 2) << 7) |
+                                          (bit_cut(insn, 12, 1) << 9), 10);
+                riscv_fast_set(entry, riscv_fast_addi, REGISTER_X2, REGISTER_X2, 0, imm);
+            } else {
+                riscv_fast_set(entry, riscv_fast_addi, rds, REGISTER_ZERO, 0, imm6 * 4096);
+            }
+            return;
+        case RVC_ALOPS1:
+            switch (bit_cut(insn, 10, 2)) {
+                case 0:
+                    riscv_fast_set(entry, riscv_fast_srli, rds_c, rds_c, 0, shamt);
+                    return;
+                case 1:
+                    riscv_fast_set(entry, riscv_fast_srai, rds_c, rds_c, 0, shamt);
+                    return;
+                case 2:
+                    riscv_fast_set(entry, riscv_fast_andi, rds_c, rds_c, 0, imm6);
+                    return;
+            }
+#ifdef RV64
+            if (bit_check(insn, 12)) {
+                if (bit_cut(insn, 5, 2) == 0) {
+                    riscv_fast_set(entry, riscv_fast_subw, rds_c, rds_c, rs2_c, 0);
+                } else if (bit_cut(insn, 5, 2) == 1) {
+                    riscv_fast_set(entry, riscv_fast_addw, rds_c, rds_c, rs2_c, 0);
+                }
+                return;
+            }
+#endif
+            riscv_fast_set(entry, alu_c[bit_cut(insn, 5, 2)], rds_c, rds_c, rs2_c, 0);
+            return;
+        case RVC_J:
+            riscv_fast_set(entry, riscv_fast_jal, REGISTER_ZERO, 0, 0, imm_j);
+            return;
+        case RVC_BEQZ:
+            riscv_fast_set(entry, riscv_fast_beq, 0, rds_c, REGISTER_ZERO, imm_b);
+            return;
+        case RVC_BNEZ:
+            riscv_fast_set(entry, riscv_fast_bne, 0, rds_c, REGISTER_ZERO, imm_b);
+            return;
+        case RVC_LW:
+            riscv_fast_set(entry, riscv_fast_lw, rs2_c, rds_c, 0, off_w);
+            return;
+        case RVC_SW:
+            riscv_fast_set(entry, riscv_fast_sw, 0, rds_c, rs2_c, off_w);
+            return;
+        case RVC_SLLI:
+            riscv_fast_set(entry, riscv_fast_slli, rds, rds, 0, shamt);
+            return;
+        case RVC_LWSP: {
+            uint32_t off = (bit_cut(insn, 4, 3)  << 2) |
+                           (bit_cut(insn, 12, 1) << 5) |
+                           (bit_cut(insn, 2, 2)  << 6);
+            riscv_fast_set(entry, riscv_fast_lw, rds, REGISTER_X2, 0, off);
+            return;
+        }
+        case RVC_SWSP: {
+            uint32_t off = (bit_cut(insn, 9, 4) << 2) |
+                           (bit_cut(insn, 7, 2) << 6);
+            riscv_fast_set(entry, riscv_fast_sw, 0, REGISTER_X2, rs2, off);
+            return;
+        }
+        case RVC_ALOPS2:
+            if (bit_check(insn, 12)) {
+                if (rds != 0 && rs2 != 0) {
+                    // c.add
+                    riscv_fast_set(entry, riscv_fast_add, rds, rds, rs2, 0);
+                } else if (rds != 0) {
+                    // c.jalr
+                    riscv_fast_set(entry, riscv_fast_jalr, REGISTER_X1, rds, 0, 0);
+                }
+            } else if (rs2 != 0) {
+                // c.mv
+                riscv_fast_set(entry, riscv_fast_addi, rds, rs2, 0, 0);
+            } else if (rds != 0) {
+                // c.jr
+                riscv_fast_set(entry, riscv_fast_jalr, REGISTER_ZERO, rds, 0, 0);
+            }
+            return;
+#ifdef RV64
+        case RV64C_ADDIW:
+            riscv_fast_set(entry, riscv_fast_addiw, rds, rds, 0, imm6);
+            return;
+        case RV64C_LD: {
+            uint32_t off = (bit_cut(insn, 10, 3) << 3) |
+                           (bit_cut(insn, 5, 2)  << 6);
+            riscv_fast_set(entry, riscv_fast_ld, rs2_c, rds_c, 0, off);
+            return;
+        }
+        case RV64C_SD: {
+            uint32_t off = (bit_cut(insn, 10, 3) << 3) |
+                           (bit_cut(insn, 5, 2)  << 6);
+            riscv_fast_set(entry, riscv_fast_sd, 0, rds_c, rs2_c, off);
+            return;
+        }
+        case RV64C_LDSP: {
+            uint32_t off = (bit_cut(insn, 5, 2)  << 3) |
+                           (bit_cut(insn, 12, 1) << 5) |
+                           (bit_cut(insn, 2, 3)  << 6);
+            riscv_fast_set(entry, riscv_fast_ld, rds, REGISTER_X2, 0, off);
+            return;
+        }
+        case RV64C_SDSP: {
+            uint32_t off = (bit_cut(insn, 10, 3) << 3) |
+                           (bit_cut(insn, 7, 3)  << 6);
+            riscv_fast_set(entry, riscv_fast_sd, 0, REGISTER_X2, rs2, off);
+            return;
+        }
+#else
+        case RVC_JAL:
+            riscv_fast_set(entry, riscv_fast_jal, REGISTER_X1, 0, 0, imm_j);
+            return;
+#endif
+    }
+}
+
+void riscv_predecode(rvvm_hart_t* vm, rvvm_icache_entry_t* entry)
+{
+    UNUSED(vm);
+    if (entry->size == 2) {
+        // Leave the decoder slot alone if compressed instructions are disabled
+        if (entry->handler_c != riscv_c_illegal_insn) riscv_predecode_insn_c(entry);
+    } else {
+        if (entry->handler != riscv_illegal_insn) riscv_predecode_insn(entry);
+    }
+}
+
+// Maps branch handlers to compare-and-branch pairs for the given first instruction
+static riscv_inst_fast_t riscv_fuse_branch(const rvvm_icache_entry_t* next, const riscv_inst_fast_t* pairs)
+{
+    if (next->func == riscv_fast_beq) return pairs[0];
+    if (next->func == riscv_fast_bne) return pairs[1];
+    if (next->func == riscv_fast_blt) return pairs[2];
+    if (next->func == riscv_fast_bge) return pairs[3];
+    if (next->func == riscv_fast_bltu) return pairs[4];
+    if (next->func == riscv_fast_bgeu) return pairs[5];
+    return NULL;
+}
+
+bool riscv_fuse(rvvm_icache_entry_t* entry, const rvvm_icache_entry_t* next)
+{
+    static const riscv_inst_fast_t addi_branch[6] = {
+        riscv_fused_addi_beq, riscv_fused_addi_bne, riscv_fused_addi_blt,
+        riscv_fused_addi_bge, riscv_fused_addi_bltu, riscv_fused_addi_bgeu,
+    };
+    static const riscv_inst_fast_t andi_branch[6] = {
+        riscv_fused_andi_beq, riscv_fused_andi_bne,
+    };
+    static const riscv_inst_fast_t slt_branch[6] = {
+        riscv_fused_slt_beq, riscv_fused_slt_bne,
+    };
+    static const riscv_inst_fast_t sltu_branch[6] = {
+        riscv_fused_sltu_beq, riscv_fused_sltu_bne,
+    };
+    riscv_inst_fast_t func = NULL;
+    // Second instruction should consume the result of the first one
+    bool chained = next->rs1 == entry->rds;
+    bool overwrite = chained && next->rds == entry->rds;
+
+    if (entry->rds == REGISTER_ZERO) return false;
+    if (entry->func == riscv_fast_addi) {
+        if (entry->rs1 == REGISTER_ZERO && overwrite && next->func == riscv_fast_addi) {
+            func = riscv_fused_li;
+#ifdef RV64
+        } else if (entry->rs1 == REGISTER_ZERO && overwrite && next->func == riscv_fast_addiw) {
+            func = riscv_fused_liw;
+#endif
+        } else if (chained) {
+            func = riscv_fuse_branch(next, addi_branch);
+        }
+    } else if (entry->func == riscv_fast_auipc) {
+        if (overwrite && next->func == riscv_fast_addi) {
+            func = riscv_fused_la;
+        } else if (chained && next->func == riscv_fast_jalr) {
+            func = riscv_fused_call;
+        } else if (chained && next->func == riscv_fast_lw) {
+            func = riscv_fused_auipc_lw;
+#ifdef RV64
+        } else if (chained && next->func == riscv_fast_ld) {
+            func = riscv_fused_auipc_ld;
+#endif
+        }
+    } else if (entry->func == riscv_fast_slli) {
+        if (overwrite && entry->imm == next->imm) {
+            if (next->func == riscv_fast_srli) func = riscv_fused_zext;
+            if (next->func == riscv_fast_srai) func = riscv_fused_sext;
+        }
+    } else if (chained && entry->func == riscv_fast_andi) {
+        func = riscv_fuse_branch(next, andi_branch);
+    } else if (chained && entry->func == riscv_fast_slt) {
+        func = riscv_fuse_branch(next, slt_branch);
+    } else if (chained && entry->func == riscv_fast_sltu) {
+        func = riscv_fuse_branch(next, sltu_branch);
+    }
+
+    if (func) {
+        entry->func = func;
+        entry->size += next->size;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,1913 @@
+/*
+riscv_v.c - RISC-V V (Vector) Decoder, Interpreter
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define RISCV_CPU_SOURCE
+
+#include "riscv_cpu.h"
+
+#ifdef USE_VECTOR
+#include "compiler.h"
+#include "bit_ops.h"
+#include "mem_ops.h"
+#include "riscv_mmu.h"
+#include "riscv_csr.h"
+#include "simd_ops.h"
+
+#ifdef USE_FPU
+#include <fenv.h>
+#include <math.h>
+#endif
+
+/*
+ * RVV 1.0 with VLEN=128, ELEN=64.
+ *
+ * Register groups are contiguous in vector_registers, so a group
+ * of any LMUL is a flat little-endian array of elements.
+ * Tail and masked-off elements are always left undisturbed, which
+ * is a valid implementation of both agnostic and undisturbed policies.
+ *
+ * Vector instructions are never traced by RVJIT, they end the block
+ * and are interpreted. Contiguous memory transfers and common integer
+ * arithmetic are offloaded to host SIMD kernels in simd_ops.h.
+ */
+
+#ifdef RV64
+#define XLEN_BITS 64
+#else
+#define XLEN_BITS 32
+#endif
+
+#define VLEN_BITS (VECTOR_REG_SIZE * 8)
+
+// Operand forms allowed for an opcode
+#define RVV_VV   0x1
+#define RVV_VX   0x2 // Also .vf for floating-point opcodes
+#define RVV_VI   0x4
+#define RVV_UIMM 0x8 // Immediate operand is unsigned
+
+// Internal operation IDs, first entries map directly onto SIMD kernels
+enum {
+    RVV_ADD = SIMD_ADD,
+    RVV_SUB = SIMD_SUB,
+    RVV_RSUB = SIMD_RSUB,
+    RVV_AND = SIMD_AND,
+    RVV_OR = SIMD_OR,
+    RVV_XOR = SIMD_XOR,
+    RVV_MINU = SIMD_MINU,
+    RVV_MIN = SIMD_MIN,
+    RVV_MAXU = SIMD_MAXU,
+    RVV_MAX = SIMD_MAX,
+    RVV_SADDU,
+    RVV_SADD,
+    RVV_SSUBU,
+    RVV_SSUB,
+    RVV_SLL,
+    RVV_SRL,
+    RVV_SRA,
+    RVV_SSRL,
+    RVV_SSRA,
+    RVV_SMUL,
+    RVV_AADDU,
+    RVV_AADD,
+    RVV_ASUBU,
+    RVV_ASUB,
+    RVV_DIVU,
+    RVV_DIV,
+    RVV_REMU,
+    RVV_REM,
+    RVV_MUL,
+    RVV_MULH,
+    RVV_MULHU,
+    RVV_MULHSU,
+    RVV_MACC,
+    RVV_NMSAC,
+    RVV_MADD,
+    RVV_NMSUB,
+    // Opcodes with special operand layout
+    RVV_ADC,
+    RVV_MADC,
+    RVV_SBC,
+    RVV_MSBC,
+    RVV_MERGE,
+    RVV_MSEQ,
+    RVV_MSNE,
+    RVV_MSLTU,
+    RVV_MSLT,
+    RVV_MSLEU,
+    RVV_MSLE,
+    RVV_MSGTU,
+    RVV_MSGT,
+    RVV_NSRL,
+    RVV_NSRA,
+    RVV_NCLIPU,
+    RVV_NCLIP,
+    RVV_WADDU,
+    RVV_WADD,
+    RVV_WSUBU,
+    RVV_WSUB,
+    RVV_WADDU_W,
+    RVV_WADD_W,
+    RVV_WSUBU_W,
+    RVV_WSUB_W,
+    RVV_WMULU,
+    RVV_WMULSU,
+    RVV_WMUL,
+    RVV_WMACCU,
+    RVV_WMACC,
+    RVV_WMACCUS,
+    RVV_WMACCSU,
+    RVV_REDSUM,
+    RVV_REDAND,
+    RVV_REDOR,
+    RVV_REDXOR,
+    RVV_REDMINU,
+    RVV_REDMIN,
+    RVV_REDMAXU,
+    RVV_REDMAX,
+    RVV_WREDSUMU,
+    RVV_WREDSUM,
+    RVV_GATHER,
+    RVV_SLIDEUP,
+    RVV_SLIDEDOWN,
+    RVV_SLIDE1UP,
+    RVV_SLIDE1DOWN,
+    RVV_SMUL_MVNR,
+    RVV_WXUNARY0,
+    RVV_XUNARY0,
+    RVV_MUNARY0,
+    RVV_COMPRESS,
+    RVV_MASK_LOGIC,
+};
+
+typedef struct {
+    uint8_t op;
+    uint8_t forms;
+} rvv_opcode_t;
+
+static const rvv_opcode_t riscv_v_opi_table[64] = {
+    [0x00] = { RVV_ADD,        RVV_VV | RVV_VX | RVV_VI },
+    [0x02] = { RVV_SUB,        RVV_VV | RVV_VX },
+    [0x03] = { RVV_RSUB,       RVV_VX | RVV_VI },
+    [0x04] = { RVV_MINU,       RVV_VV | RVV_VX },
+    [0x05] = { RVV_MIN,        RVV_VV | RVV_VX },
+    [0x06] = { RVV_MAXU,       RVV_VV | RVV_VX },
+    [0x07] = { RVV_MAX,        RVV_VV | RVV_VX },
+    [0x09] = { RVV_AND,        RVV_VV | RVV_VX | RVV_VI },
+    [0x0A] = { RVV_OR,         RVV_VV | RVV_VX | RVV_VI },
+    [0x0B] = { RVV_XOR,        RVV_VV | RVV_VX | RVV_VI },
+    [0x0C] = { RVV_GATHER,     RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x0E] = { RVV_SLIDEUP,    RVV_VV | RVV_VX | RVV_VI | RVV_UIMM }, // .vv is vrgatherei16
+    [0x0F] = { RVV_SLIDEDOWN,  RVV_VX | RVV_VI | RVV_UIMM },
+    [0x10] = { RVV_ADC,        RVV_VV | RVV_VX | RVV_VI },
+    [0x11] = { RVV_MADC,       RVV_VV | RVV_VX | RVV_VI },
+    [0x12] = { RVV_SBC,        RVV_VV | RVV_VX },
+    [0x13] = { RVV_MSBC,       RVV_VV | RVV_VX },
+    [0x17] = { RVV_MERGE,      RVV_VV | RVV_VX | RVV_VI },
+    [0x18] = { RVV_MSEQ,       RVV_VV | RVV_VX | RVV_VI },
+    [0x19] = { RVV_MSNE,       RVV_VV | RVV_VX | RVV_VI },
+    [0x1A] = { RVV_MSLTU,      RVV_VV | RVV_VX },
+    [0x1B] = { RVV_MSLT,       RVV_VV | RVV_VX },
+    [0x1C] = { RVV_MSLEU,      RVV_VV | RVV_VX | RVV_VI },
+    [0x1D] = { RVV_MSLE,       RVV_VV | RVV_VX | RVV_VI },
+    [0x1E] = { RVV_MSGTU,      RVV_VX | RVV_VI },
+    [0x1F] = { RVV_MSGT,       RVV_VX | RVV_VI },
+    [0x20] = { RVV_SADDU,      RVV_VV | RVV_VX | RVV_VI },
+    [0x21] = { RVV_SADD,       RVV_VV | RVV_VX | RVV_VI },
+    [0x22] = { RVV_SSUBU,      RVV_VV | RVV_VX },
+    [0x23] = { RVV_SSUB,       RVV_VV | RVV_VX },
+    [0x25] = { RVV_SLL,        RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x27] = { RVV_SMUL_MVNR,  RVV_VV | RVV_VX | RVV_VI | RVV_UIMM }, // .vi is vmv<nr>r
+    [0x28] = { RVV_SRL,        RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x29] = { RVV_SRA,        RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2A] = { RVV_SSRL,       RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2B] = { RVV_SSRA,       RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2C] = { RVV_NSRL,       RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2D] = { RVV_NSRA,       RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2E] = { RVV_NCLIPU,     RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x2F] = { RVV_NCLIP,      RVV_VV | RVV_VX | RVV_VI | RVV_UIMM },
+    [0x30] = { RVV_WREDSUMU,   RVV_VV },
+    [0x31] = { RVV_WREDSUM,    RVV_VV },
+};
+
+static const rvv_opcode_t riscv_v_opm_table[64] = {
+    [0x00] = { RVV_REDSUM,     RVV_VV },
+    [0x01] = { RVV_REDAND,     RVV_VV },
+    [0x02] = { RVV_REDOR,      RVV_VV },
+    [0x03] = { RVV_REDXOR,     RVV_VV },
+    [0x04] = { RVV_REDMINU,    RVV_VV },
+    [0x05] = { RVV_REDMIN,     RVV_VV },
+    [0x06] = { RVV_REDMAXU,    RVV_VV },
+    [0x07] = { RVV_REDMAX,     RVV_VV },
+    [0x08] = { RVV_AADDU,      RVV_VV | RVV_VX },
+    [0x09] = { RVV_AADD,       RVV_VV | RVV_VX },
+    [0x0A] = { RVV_ASUBU,      RVV_VV | RVV_VX },
+    [0x0B] = { RVV_ASUB,       RVV_VV | RVV_VX },
+    [0x0E] = { RVV_SLIDE1UP,   RVV_VX },
+    [0x0F] = { RVV_SLIDE1DOWN, RVV_VX },
+    [0x10] = { RVV_WXUNARY0,   RVV_VV | RVV_VX },
+    [0x12] = { RVV_XUNARY0,    RVV_VV },
+    [0x14] = { RVV_MUNARY0,    RVV_VV },
+    [0x17] = { RVV_COMPRESS,   RVV_VV },
+    [0x18] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x19] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1A] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1B] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1C] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1D] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1E] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x1F] = { RVV_MASK_LOGIC, RVV_VV },
+    [0x20] = { RVV_DIVU,       RVV_VV | RVV_VX },
+    [0x21] = { RVV_DIV,        RVV_VV | RVV_VX },
+    [0x22] = { RVV_REMU,       RVV_VV | RVV_VX },
+    [0x23] = { RVV_REM,        RVV_VV | RVV_VX },
+    [0x24] = { RVV_MULHU,      RVV_VV | RVV_VX },
+    [0x25] = { RVV_MUL,        RVV_VV | RVV_VX },
+    [0x26] = { RVV_MULHSU,     RVV_VV | RVV_VX },
+    [0x27] = { RVV_MULH,       RVV_VV | RVV_VX },
+    [0x29] = { RVV_MADD,       RVV_VV | RVV_VX },
+    [0x2B] = { RVV_NMSUB,      RVV_VV | RVV_VX },
+    [0x2D] = { RVV_MACC,       RVV_VV | RVV_VX },
+    [0x2F] = { RVV_NMSAC,      RVV_VV | RVV_VX },
+    [0x30] = { RVV_WADDU,      RVV_VV | RVV_VX },
+    [0x31] = { RVV_WADD,       RVV_VV | RVV_VX },
+    [0x32] = { RVV_WSUBU,      RVV_VV | RVV_VX },
+    [0x33] = { RVV_WSUB,       RVV_VV | RVV_VX },
+    [0x34] = { RVV_WADDU_W,    RVV_VV | RVV_VX },
+    [0x35] = { RVV_WADD_W,     RVV_VV | RVV_VX },
+    [0x36] = { RVV_WSUBU_W,    RVV_VV | RVV_VX },
+    [0x37] = { RVV_WSUB_W,     RVV_VV | RVV_VX },
+    [0x38] = { RVV_WMULU,      RVV_VV | RVV_VX },
+    [0x3A] = { RVV_WMULSU,     RVV_VV | RVV_VX },
+    [0x3B] = { RVV_WMUL,       RVV_VV | RVV_VX },
+    [0x3C] = { RVV_WMACCU,     RVV_VV | RVV_VX },
+    [0x3D] = { RVV_WMACC,      RVV_VV | RVV_VX },
+    [0x3E] = { RVV_WMACCUS,    RVV_VX },
+    [0x3F] = { RVV_WMACCSU,    RVV_VV | RVV_VX },
+};
+
+// Decoded vtype & masking state of the current instruction
+typedef struct {
+    size_t vl;
+    size_t vstart;
+    size_t vlmax;
+    uint8_t sew;   // Element width in bytes
+    int8_t lmul;   // Log2 of the register group multiplier
+    bool masked;
+    uint8_t mask[VECTOR_REG_SIZE]; // Snapshot of v0
+} rvv_ctx_t;
+
+/*
+ * Register file & element access
+ */
+
+static inline uint8_t* riscv_v_reg(rvvm_hart_t* vm, regid_t reg)
+{
+    return &vm->vector_registers[0][0] + (size_t)reg * VECTOR_REG_SIZE;
+}
+
+static inline uint64_t riscv_v_get(const uint8_t* group, size_t i, uint8_t esize)
+{
+    const uint8_t* ptr = group + i * esize;
+    switch (esize) {
+        case 1: return ptr[0];
+        case 2: return read_uint16_le_m(ptr);
+        case 4: return read_uint32_le_m(ptr);
+        default: return read_uint64_le_m(ptr);
+    }
+}
+
+static inline void riscv_v_set(uint8_t* group, size_t i, uint8_t esize, uint64_t val)
+{
+    uint8_t* ptr = group + i * esize;
+    switch (esize) {
+        case 1: ptr[0] = val; break;
+        case 2: write_uint16_le_m(ptr, val); break;
+        case 4: write_uint32_le_m(ptr, val); break;
+        default: write_uint64_le_m(ptr, val); break;
+    }
+}
+
+static inline bool riscv_v_bit(const uint8_t* mask, size_t i)
+{
+    return (mask[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void riscv_v_set_bit(uint8_t* mask, size_t i, bool val)
+{
+    mask[i >> 3] = (mask[i >> 3] & ~(1 << (i & 7))) | (val << (i & 7));
+}
+
+static inline uint64_t riscv_v_emask(uint8_t esize)
+{
+    return esize >= 8 ? ~0ULL : ((1ULL << (esize << 3)) - 1);
+}
+
+static inline int64_t riscv_v_sext(uint64_t val, uint8_t esize)
+{
+    uint8_t shift = 64 - (esize << 3);
+    return ((int64_t)(val << shift)) >> shift;
+}
+
+static inline uint8_t riscv_v_log2(size_t val)
+{
+    return bit_ctz32(val);
+}
+
+static inline bool riscv_v_aligned(regid_t reg, int8_t emul)
+{
+    return emul <= 0 || (reg & ((1 << emul) - 1)) == 0;
+}
+
+static inline size_t riscv_v_group_regs(int8_t emul)
+{
+    return emul > 0 ? (1 << emul) : 1;
+}
+
+// Copy a register group aside when the instruction may overwrite it midway
+static inline const uint8_t* riscv_v_snapshot(rvvm_hart_t* vm, regid_t reg, int8_t emul, uint8_t* buf)
+{
+    memcpy(buf, riscv_v_reg(vm, reg), riscv_v_group_regs(emul) * VECTOR_REG_SIZE);
+    return buf;
+}
+
+static inline bool riscv_v_active(const rvv_ctx_t* ctx, size_t i)
+{
+    return !ctx->masked || riscv_v_bit(ctx->mask, i);
+}
+
+static inline bool riscv_v_vill(rvvm_hart_t* vm)
+{
+    return (vm->csr.vtype >> (XLEN_BITS - 1)) & 1;
+}
+
+static inline size_t riscv_v_vlmax(uint8_t vsew, int8_t lmul)
+{
+    size_t vlmax = VLEN_BITS >> (vsew + 3);
+    return lmul >= 0 ? vlmax << lmul : vlmax >> -lmul;
+}
+
+// Checks that vector unit is usable and decodes current vtype
+static bool riscv_v_begin(rvvm_hart_t* vm, const uint32_t instruction, rvv_ctx_t* ctx)
+{
+    if (unlikely(!vector_is_enabled(vm) || riscv_v_vill(vm))) {
+        riscv_illegal_insn(vm, instruction);
+        return false;
+    }
+    uint8_t vsew = bit_cut(vm->csr.vtype, 3, 3);
+    uint8_t vlmul = bit_cut(vm->csr.vtype, 0, 3);
+    ctx->sew = 1 << vsew;
+    ctx->lmul = vlmul < 4 ? vlmul : vlmul - 8;
+    ctx->vlmax = riscv_v_vlmax(vsew, ctx->lmul);
+    ctx->vl = vm->csr.vl;
+    ctx->vstart = vm->csr.vstart;
+    ctx->masked = !bit_cut(instruction, 25, 1);
+    if (ctx->masked) memcpy(ctx->mask, riscv_v_reg(vm, 0), VECTOR_REG_SIZE);
+    return true;
+}
+
+/*
+ * Configuration-setting instructions
+ */
+
+static void riscv_v_vsetvl(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    xlen_t vtype, avl;
+
+    if (unlikely(!vector_is_enabled(vm))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    if (!bit_check(instruction, 31)) {
+        // vsetvli
+        vtype = bit_cut(instruction, 20, 11);
+    } else if (bit_cut(instruction, 30, 2) == 0x3) {
+        // vsetivli
+        vtype = bit_cut(instruction, 20, 10);
+    } else if (bit_cut(instruction, 25, 7) == 0x40) {
+        // vsetvl
+        vtype = riscv_read_register(vm, bit_cut(instruction, 20, 5));
+    } else {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t vsew = bit_cut(vtype, 3, 3);
+    uint8_t vlmul = bit_cut(vtype, 0, 3);
+    // Fractional LMUL must still hold at least one ELEN=64 element
+    bool vill = vsew > 3 || vlmul == 4 || (vlmul > 4 && vsew > vlmul - 5) || (vtype >> 8);
+    if (vill) {
+        vm->csr.vtype = ((xlen_t)1) << (XLEN_BITS - 1);
+        vm->csr.vl = 0;
+    } else {
+        size_t vlmax = riscv_v_vlmax(vsew, vlmul < 4 ? vlmul : vlmul - 8);
+        if (bit_cut(instruction, 30, 2) == 0x3) {
+            avl = rs1;
+        } else if (rs1) {
+            avl = riscv_read_register(vm, rs1);
+        } else if (rds) {
+            avl = vlmax;
+        } else {
+            // Keep existing vl
+            avl = vm->csr.vl;
+        }
+        vm->csr.vtype = vtype;
+        vm->csr.vl = avl < vlmax ? avl : vlmax;
+    }
+    vm->csr.vstart = 0;
+    riscv_write_register(vm, rds, vm->csr.vl);
+}
+
+/*
+ * Loads & stores
+ */
+
+#define RVV_MOP_UNIT     0x0
+#define RVV_MOP_INDEX_U  0x1
+#define RVV_MOP_STRIDE   0x2
+#define RVV_MOP_INDEX_O  0x3
+
+#define RVV_UMOP_UNIT    0x00
+#define RVV_UMOP_WHOLE   0x08
+#define RVV_UMOP_MASK    0x0B
+#define RVV_UMOP_FF      0x10
+
+static inline uint8_t riscv_v_width_eew(uint8_t width)
+{
+    // 0 -> 8, 5 -> 16, 6 -> 32, 7 -> 64 bits
+    return width ? (1 << (width - 4)) : 1;
+}
+
+static inline bool riscv_v_mem_elem(rvvm_hart_t* vm, xlen_t addr, uint8_t* elem, uint8_t size, bool store)
+{
+    vmptr_t ptr = store ? riscv_vma_translate_w(vm, addr) : riscv_vma_translate_r(vm, addr);
+    if (likely(ptr && riscv_block_in_page(addr, size))) {
+        if (store) {
+            memcpy(ptr, elem, size);
+        } else {
+            memcpy(elem, ptr, size);
+        }
+        return true;
+    }
+    return store ? riscv_mmu_store_buf(vm, addr, elem, size) : riscv_mmu_load_buf(vm, addr, elem, size);
+}
+
+/*
+ * Contiguous transfer of elements [start, end), whole page-sized
+ * chunks hitting the TLB are moved at once.
+ * Fault-only-first loads trim vl instead of faulting past element 0.
+ */
+static void riscv_v_contiguous(rvvm_hart_t* vm, xlen_t base, regid_t reg, uint8_t esize,
+                               size_t start, size_t end, bool store, bool ff)
+{
+    uint8_t* group = riscv_v_reg(vm, reg);
+    size_t i = start;
+    while (i < end) {
+        xlen_t addr = base + i * esize;
+        vmptr_t ptr = store ? riscv_vma_translate_w(vm, addr) : riscv_vma_translate_r(vm, addr);
+        size_t count = (PAGE_SIZE - (addr & PAGE_MASK)) / esize;
+        if (count > end - i) count = end - i;
+        if (likely(ptr && count)) {
+            if (store) {
+                simd_copy(ptr, group + i * esize, count * esize);
+            } else {
+                simd_copy(group + i * esize, ptr, count * esize);
+            }
+            i += count;
+        } else if (ff && i) {
+            vm->csr.vl = i;
+            break;
+        } else {
+            vm->csr.vstart = i;
+            if (store) {
+                if (!riscv_mmu_store_buf(vm, addr, group + i * esize, esize)) return;
+            } else {
+                if (!riscv_mmu_load_buf(vm, addr, group + i * esize, esize)) return;
+            }
+            i++;
+        }
+    }
+    vm->csr.vstart = 0;
+}
+
+static void riscv_v_memop(rvvm_hart_t* vm, const uint32_t instruction, bool store)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t mop = bit_cut(instruction, 26, 2);
+    size_t nfields = bit_cut(instruction, 29, 3) + 1;
+    uint8_t eew = riscv_v_width_eew(bit_cut(instruction, 12, 3));
+    xlen_t base = riscv_read_register(vm, bit_cut(instruction, 15, 5));
+    rvv_ctx_t ctx;
+
+    if (unlikely(!vector_is_enabled(vm) || bit_check(instruction, 28))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    if (mop == RVV_MOP_UNIT && vs2 == RVV_UMOP_WHOLE) {
+        // Whole register transfers don't depend on vtype
+        if (!bit_check(instruction, 25) || (nfields & (nfields - 1)) || (vd & (nfields - 1)) || (store && eew != 1)) {
+            riscv_illegal_insn(vm, instruction);
+            return;
+        }
+        riscv_v_contiguous(vm, base, vd, eew, vm->csr.vstart, nfields * VECTOR_REG_SIZE / eew, store, false);
+        return;
+    }
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+
+    if (mop == RVV_MOP_UNIT && vs2 == RVV_UMOP_MASK) {
+        // vlm.v / vsm.v, EEW=8 with evl=ceil(vl/8)
+        if (ctx.masked || eew != 1 || nfields != 1) {
+            riscv_illegal_insn(vm, instruction);
+            return;
+        }
+        riscv_v_contiguous(vm, base, vd, 1, ctx.vstart, (ctx.vl + 7) >> 3, store, false);
+        return;
+    }
+
+    bool indexed = mop & 1;
+    bool ff = mop == RVV_MOP_UNIT && vs2 == RVV_UMOP_FF;
+    if (mop == RVV_MOP_UNIT && vs2 != RVV_UMOP_UNIT && (store || !ff)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    // Data EMUL, indexed operations use EEW for the index vector only
+    int8_t ieew_emul = riscv_v_log2(eew) - riscv_v_log2(ctx.sew) + ctx.lmul;
+    int8_t emul = indexed ? ctx.lmul : ieew_emul;
+    uint8_t esize = indexed ? ctx.sew : eew;
+    size_t regs = riscv_v_group_regs(emul);
+    if (ieew_emul < -3 || ieew_emul > 3 || nfields * regs > 8 || vd + nfields * regs > 32
+     || !riscv_v_aligned(vd, emul) || (indexed && !riscv_v_aligned(vs2, ieew_emul))
+     || (!store && ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    if (mop == RVV_MOP_UNIT && nfields == 1 && !ctx.masked) {
+        riscv_v_contiguous(vm, base, vd, esize, ctx.vstart, ctx.vl, store, ff);
+        return;
+    }
+
+    sxlen_t stride = mop == RVV_MOP_STRIDE ? riscv_read_register_s(vm, vs2) : 0;
+    const uint8_t* index = riscv_v_reg(vm, vs2);
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        xlen_t addr;
+        switch (mop) {
+            case RVV_MOP_UNIT:
+                addr = base + i * nfields * esize;
+                break;
+            case RVV_MOP_STRIDE:
+                addr = base + i * stride;
+                break;
+            default:
+                addr = base + riscv_v_get(index, i, eew);
+                break;
+        }
+        vm->csr.vstart = i;
+        for (size_t f=0; f<nfields; ++f) {
+            uint8_t* elem = riscv_v_reg(vm, vd + f * regs) + i * esize;
+            xlen_t faddr = addr + f * esize;
+            if (ff && i) {
+                // Trim vl instead of taking a fault past the first element
+                vmptr_t ptr = riscv_vma_translate_r(vm, faddr);
+                if (!ptr || !riscv_block_in_page(faddr, esize)) {
+                    vm->csr.vl = i;
+                    vm->csr.vstart = 0;
+                    return;
+                }
+            }
+            if (!riscv_v_mem_elem(vm, faddr, elem, esize, store)) return;
+        }
+    }
+    vm->csr.vstart = 0;
+}
+
+static void riscv_v_load(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_memop(vm, instruction, false);
+}
+
+static void riscv_v_store(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_memop(vm, instruction, true);
+}
+
+/*
+ * Integer arithmetic helpers
+ */
+
+static inline uint64_t riscv_v_mulhu64(uint64_t a, uint64_t b)
+{
+#ifdef INT128_SUPPORT
+    return ((uint128_t)a * (uint128_t)b) >> 64;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t mid = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (mid >> 32);
+#endif
+}
+
+static inline uint64_t riscv_v_mulh64(int64_t a, int64_t b)
+{
+    return riscv_v_mulhu64(a, b) - (a < 0 ? (uint64_t)b : 0) - (b < 0 ? (uint64_t)a : 0);
+}
+
+static inline uint64_t riscv_v_mulhsu64(int64_t a, uint64_t b)
+{
+    return riscv_v_mulhu64(a, b) - (a < 0 ? b : 0);
+}
+
+// Rounding increment for a right shift of val by shift bits, according to vxrm
+static inline uint64_t riscv_v_round(rvvm_hart_t* vm, uint64_t val, uint8_t shift)
+{
+    if (shift == 0) return 0;
+    bool half = (val >> (shift - 1)) & 1;
+    bool sticky = shift > 1 && (val & ((1ULL << (shift - 1)) - 1));
+    bool lsb = shift < 64 && ((val >> shift) & 1);
+    switch (bit_cut(vm->csr.vcsr, 1, 2)) {
+        case 0: return half;                       // rnu
+        case 1: return half && (sticky || lsb);    // rne
+        case 2: return 0;                          // rdn
+        default: return !lsb && (half || sticky);  // rod
+    }
+}
+
+static inline uint64_t riscv_v_saturate(rvvm_hart_t* vm, uint64_t val)
+{
+    vm->csr.vcsr |= 1;
+    return val;
+}
+
+// Averaging add/sub: floor of the SEW+1 bit result and the shifted-out bit
+static inline uint64_t riscv_v_average(rvvm_hart_t* vm, uint64_t floor, bool half)
+{
+    return floor + riscv_v_round(vm, (floor << 1) | half, 1);
+}
+
+static uint64_t riscv_v_alu(rvvm_hart_t* vm, uint8_t op, uint64_t a, uint64_t b, uint64_t d, uint8_t esize)
+{
+    uint8_t bits = esize << 3;
+    uint64_t umax = riscv_v_emask(esize);
+    int64_t smax = umax >> 1;
+    int64_t smin = -smax - 1;
+    int64_t sa = riscv_v_sext(a, esize);
+    int64_t sb = riscv_v_sext(b, esize);
+    uint8_t shamt = b & (bits - 1);
+    uint64_t tmp;
+
+    switch (op) {
+        case RVV_ADD:  return a + b;
+        case RVV_SUB:  return a - b;
+        case RVV_RSUB: return b - a;
+        case RVV_AND:  return a & b;
+        case RVV_OR:   return a | b;
+        case RVV_XOR:  return a ^ b;
+        case RVV_MINU: return a < b ? a : b;
+        case RVV_MIN:  return sa < sb ? a : b;
+        case RVV_MAXU: return a > b ? a : b;
+        case RVV_MAX:  return sa > sb ? a : b;
+        case RVV_SADDU:
+            tmp = (a + b) & umax;
+            return tmp < a ? riscv_v_saturate(vm, umax) : tmp;
+        case RVV_SADD:
+            tmp = (a + b) & umax;
+            if ((sa < 0) == (sb < 0) && (riscv_v_sext(tmp, esize) < 0) != (sa < 0)) {
+                return riscv_v_saturate(vm, sa < 0 ? smin : smax);
+            }
+            return tmp;
+        case RVV_SSUBU:
+            return a < b ? riscv_v_saturate(vm, 0) : a - b;
+        case RVV_SSUB:
+            tmp = (a - b) & umax;
+            if ((sa < 0) != (sb < 0) && (riscv_v_sext(tmp, esize) < 0) != (sa < 0)) {
+                return riscv_v_saturate(vm, sa < 0 ? smin : smax);
+            }
+            return tmp;
+        case RVV_SLL:  return a << shamt;
+        case RVV_SRL:  return a >> shamt;
+        case RVV_SRA:  return sa >> shamt;
+        case RVV_SSRL: return (a >> shamt) + riscv_v_round(vm, a, shamt);
+        case RVV_SSRA: return (sa >> shamt) + riscv_v_round(vm, a, shamt);
+        case RVV_SMUL: {
+            if (sa == smin && sb == smin) return riscv_v_saturate(vm, smax);
+            // Fixed-point product is (a * b) >> (SEW - 1)
+            uint64_t lo = (uint64_t)sa * (uint64_t)sb;
+            uint64_t hi = riscv_v_mulh64(sa, sb);
+            return ((lo >> (bits - 1)) | (hi << (65 - bits))) + riscv_v_round(vm, lo, bits - 1);
+        }
+        case RVV_AADDU:
+            return riscv_v_average(vm, (a >> 1) + (b >> 1) + (a & b & 1), (a ^ b) & 1);
+        case RVV_AADD:
+            return riscv_v_average(vm, (sa >> 1) + (sb >> 1) + (sa & sb & 1), (a ^ b) & 1);
+        case RVV_ASUBU:
+            return riscv_v_average(vm, (a >> 1) - (b >> 1) - (~a & b & 1), (a ^ b) & 1);
+        case RVV_ASUB:
+            return riscv_v_average(vm, (sa >> 1) - (sb >> 1) - (~sa & sb & 1), (a ^ b) & 1);
+        case RVV_DIVU: return b ? a / b : umax;
+        case RVV_DIV:
+            if (b == 0) return umax;
+            if (sa == smin && sb == -1) return a;
+            return sa / sb;
+        case RVV_REMU: return b ? a % b : a;
+        case RVV_REM:
+            if (b == 0) return a;
+            if (sa == smin && sb == -1) return 0;
+            return sa % sb;
+        case RVV_MUL:  return a * b;
+        case RVV_MULH:
+            if (esize == 8) return riscv_v_mulh64(sa, sb);
+            return (sa * sb) >> bits;
+        case RVV_MULHU:
+            if (esize == 8) return riscv_v_mulhu64(a, b);
+            return (a * b) >> bits;
+        case RVV_MULHSU:
+            if (esize == 8) return riscv_v_mulhsu64(sa, b);
+            return (sa * (int64_t)b) >> bits;
+        case RVV_MACC:  return b * a + d;
+        case RVV_NMSAC: return d - b * a;
+        case RVV_MADD:  return b * d + a;
+        case RVV_NMSUB: return a - b * d;
+    }
+    return 0;
+}
+
+/*
+ * Integer instruction classes
+ */
+
+// vd[i] = vs2[i] op (vs1[i] | scalar), single-width
+static void riscv_v_int_op(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, bool vx, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (!riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul)
+     || (!vx && !riscv_v_aligned(vs1, ctx.lmul)) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_reg(vm, vs2);
+    const uint8_t* src1 = riscv_v_reg(vm, vs1);
+    uint8_t esize = ctx.sew;
+    size_t i = ctx.vstart;
+    scalar &= riscv_v_emask(esize);
+
+    if (op <= RVV_MAX && !ctx.masked && i == 0) {
+        // Host SIMD fast path, finish the remainder below
+        uint8_t splat[32];
+        if (vx) {
+            for (size_t j=0; j<sizeof(splat) / esize; ++j) riscv_v_set(splat, j, esize, scalar);
+        }
+        i = simd_int_op(op, esize, dst, src2, vx ? splat : src1, vx, ctx.vl * esize) / esize;
+    }
+
+    for (; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t b = vx ? scalar : riscv_v_get(src1, i, esize);
+        uint64_t d = riscv_v_get(dst, i, esize);
+        riscv_v_set(dst, i, esize, riscv_v_alu(vm, op, riscv_v_get(src2, i, esize), b, d, esize));
+    }
+    vm->csr.vstart = 0;
+}
+
+// vadc, vsbc, vmadc, vmsbc, vmerge & vmv.v.*
+static void riscv_v_carry_op(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, bool vx, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    bool mask_dst = op == RVV_MADC || op == RVV_MSBC;
+    bool reserved = !riscv_v_aligned(vs2, ctx.lmul) || (!vx && !riscv_v_aligned(vs1, ctx.lmul));
+    if (mask_dst) {
+        // Carry-in is taken from v0 when vm=0, the operation itself is unmasked
+    } else if (op == RVV_MERGE) {
+        // vmv.v.* requires vs2=0
+        reserved |= !riscv_v_aligned(vd, ctx.lmul) || (!ctx.masked && vs2);
+    } else {
+        reserved |= !riscv_v_aligned(vd, ctx.lmul) || !ctx.masked || vd == 0;
+    }
+    if (reserved) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    const uint8_t* src1 = vx ? NULL : riscv_v_snapshot(vm, vs1, ctx.lmul, buf1);
+    uint8_t esize = ctx.sew;
+    uint64_t umax = riscv_v_emask(esize);
+    scalar &= umax;
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        uint64_t a = riscv_v_get(src2, i, esize);
+        uint64_t b = vx ? scalar : riscv_v_get(src1, i, esize);
+        uint64_t c = ctx.masked && riscv_v_bit(ctx.mask, i);
+        uint64_t sum;
+        switch (op) {
+            case RVV_ADC:
+                riscv_v_set(dst, i, esize, a + b + c);
+                break;
+            case RVV_SBC:
+                riscv_v_set(dst, i, esize, a - b - c);
+                break;
+            case RVV_MADC:
+                sum = (a + b + c) & umax;
+                riscv_v_set_bit(dst, i, sum < a || (c && sum == a));
+                break;
+            case RVV_MSBC:
+                riscv_v_set_bit(dst, i, a < b || (c && a == b));
+                break;
+            default:
+                riscv_v_set(dst, i, esize, (ctx.masked && !c) ? a : b);
+                break;
+        }
+    }
+    vm->csr.vstart = 0;
+}
+
+static void riscv_v_compare(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, bool vx, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (!riscv_v_aligned(vs2, ctx.lmul) || (!vx && !riscv_v_aligned(vs1, ctx.lmul))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    const uint8_t* src1 = vx ? NULL : riscv_v_snapshot(vm, vs1, ctx.lmul, buf1);
+    uint8_t esize = ctx.sew;
+    scalar &= riscv_v_emask(esize);
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t a = riscv_v_get(src2, i, esize);
+        uint64_t b = vx ? scalar : riscv_v_get(src1, i, esize);
+        int64_t sa = riscv_v_sext(a, esize), sb = riscv_v_sext(b, esize);
+        bool res;
+        switch (op) {
+            case RVV_MSEQ:  res = a == b; break;
+            case RVV_MSNE:  res = a != b; break;
+            case RVV_MSLTU: res = a < b; break;
+            case RVV_MSLT:  res = sa < sb; break;
+            case RVV_MSLEU: res = a <= b; break;
+            case RVV_MSLE:  res = sa <= sb; break;
+            case RVV_MSGTU: res = a > b; break;
+            default:        res = sa > sb; break;
+        }
+        riscv_v_set_bit(dst, i, res);
+    }
+    vm->csr.vstart = 0;
+}
+
+// 2*SEW-wide vs2 shifted into SEW-wide vd
+static void riscv_v_narrow(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, bool vx, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (ctx.sew > 4 || ctx.lmul > 2 || !riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul + 1)
+     || (!vx && !riscv_v_aligned(vs1, ctx.lmul)) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul + 1, buf2);
+    const uint8_t* src1 = vx ? NULL : riscv_v_snapshot(vm, vs1, ctx.lmul, buf1);
+    uint8_t esize = ctx.sew;
+    uint64_t umax = riscv_v_emask(esize);
+    int64_t smax = umax >> 1;
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t a = riscv_v_get(src2, i, esize << 1);
+        int64_t sa = riscv_v_sext(a, esize << 1);
+        uint8_t shamt = (vx ? scalar : riscv_v_get(src1, i, esize)) & ((esize << 4) - 1);
+        uint64_t res;
+        int64_t sres;
+        switch (op) {
+            case RVV_NSRL:
+                res = a >> shamt;
+                break;
+            case RVV_NSRA:
+                res = sa >> shamt;
+                break;
+            case RVV_NCLIPU:
+                res = (a >> shamt) + riscv_v_round(vm, a, shamt);
+                if (res > umax) res = riscv_v_saturate(vm, umax);
+                break;
+            default:
+                sres = (sa >> shamt) + riscv_v_round(vm, a, shamt);
+                if (sres > smax) sres = riscv_v_saturate(vm, smax);
+                if (sres < -smax - 1) sres = riscv_v_saturate(vm, -smax - 1);
+                res = sres;
+                break;
+        }
+        riscv_v_set(dst, i, esize, res);
+    }
+    vm->csr.vstart = 0;
+}
+
+// SEW-wide sources into 2*SEW-wide vd, .w forms take 2*SEW-wide vs2
+static void riscv_v_widen(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, bool vx, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    bool wide_vs2 = op >= RVV_WADDU_W && op <= RVV_WSUB_W;
+    int8_t vs2_emul = wide_vs2 ? ctx.lmul + 1 : ctx.lmul;
+    if (ctx.sew > 4 || ctx.lmul > 2 || !riscv_v_aligned(vd, ctx.lmul + 1) || !riscv_v_aligned(vs2, vs2_emul)
+     || (!vx && !riscv_v_aligned(vs1, ctx.lmul)) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, vs2_emul, buf2);
+    const uint8_t* src1 = vx ? NULL : riscv_v_snapshot(vm, vs1, ctx.lmul, buf1);
+    uint8_t esize = ctx.sew;
+    uint8_t wsize = esize << 1;
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t a = riscv_v_get(src2, i, wide_vs2 ? wsize : esize);
+        uint64_t b = (vx ? scalar : riscv_v_get(src1, i, esize)) & riscv_v_emask(esize);
+        uint64_t d = riscv_v_get(dst, i, wsize);
+        int64_t sa = riscv_v_sext(a, esize), sb = riscv_v_sext(b, esize);
+        uint64_t res;
+        switch (op) {
+            case RVV_WADDU:   res = a + b; break;
+            case RVV_WADD:    res = sa + sb; break;
+            case RVV_WSUBU:   res = a - b; break;
+            case RVV_WSUB:    res = sa - sb; break;
+            case RVV_WADDU_W: res = a + b; break;
+            case RVV_WADD_W:  res = a + sb; break;
+            case RVV_WSUBU_W: res = a - b; break;
+            case RVV_WSUB_W:  res = a - sb; break;
+            case RVV_WMULU:   res = a * b; break;
+            case RVV_WMULSU:  res = sa * (int64_t)b; break;
+            case RVV_WMUL:    res = sa * sb; break;
+            case RVV_WMACCU:  res = d + b * a; break;
+            case RVV_WMACC:   res = d + sb * sa; break;
+            case RVV_WMACCUS: res = d + b * sa; break;
+            default:          res = d + sb * (int64_t)a; break; // vwmaccsu
+        }
+        riscv_v_set(dst, i, wsize, res);
+    }
+    vm->csr.vstart = 0;
+}
+
+static void riscv_v_reduce(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    bool wide = op == RVV_WREDSUMU || op == RVV_WREDSUM;
+    if (ctx.vstart || !riscv_v_aligned(vs2, ctx.lmul) || (wide && (ctx.sew > 4 || ctx.lmul > 2))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+    if (ctx.vl == 0) return;
+
+    const uint8_t* src2 = riscv_v_reg(vm, vs2);
+    uint8_t esize = ctx.sew;
+    uint8_t asize = wide ? esize << 1 : esize;
+    uint64_t acc = riscv_v_get(riscv_v_reg(vm, vs1), 0, asize);
+    uint8_t alu_op = op == RVV_REDSUM ? RVV_ADD : op - RVV_REDAND + RVV_AND;
+
+    for (size_t i=0; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t a = riscv_v_get(src2, i, esize);
+        if (wide) {
+            acc += op == RVV_WREDSUM ? (uint64_t)riscv_v_sext(a, esize) : a;
+        } else if (op == RVV_REDSUM) {
+            acc += a;
+        } else {
+            acc = riscv_v_alu(vm, alu_op, a, acc, 0, esize);
+        }
+        acc &= riscv_v_emask(asize);
+    }
+    riscv_v_set(riscv_v_reg(vm, vd), 0, asize, acc);
+}
+
+static void riscv_v_gather(rvvm_hart_t* vm, const uint32_t instruction, bool vx, uint64_t scalar, bool ei16)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    uint8_t isize = ei16 ? 2 : ctx.sew;
+    int8_t iemul = ei16 ? 1 - riscv_v_log2(ctx.sew) + ctx.lmul : ctx.lmul;
+    if (iemul < -3 || iemul > 3 || !riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul)
+     || (!vx && !riscv_v_aligned(vs1, iemul)) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    const uint8_t* src1 = vx ? NULL : riscv_v_snapshot(vm, vs1, iemul, buf1);
+    uint8_t esize = ctx.sew;
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t idx = vx ? (xlen_t)scalar : riscv_v_get(src1, i, isize);
+        riscv_v_set(dst, i, esize, idx < ctx.vlmax ? riscv_v_get(src2, idx, esize) : 0);
+    }
+    vm->csr.vstart = 0;
+}
+
+// vslideup, vslidedown, vslide1up, vslide1down (scalar is the inserted value for slide1)
+static void riscv_v_slide(rvvm_hart_t* vm, const uint32_t instruction, uint8_t op, uint64_t scalar)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (!riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    uint8_t esize = ctx.sew;
+    xlen_t offset = scalar;
+
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        switch (op) {
+            case RVV_SLIDEUP:
+                if (i >= offset) riscv_v_set(dst, i, esize, riscv_v_get(src2, i - offset, esize));
+                break;
+            case RVV_SLIDEDOWN:
+                riscv_v_set(dst, i, esize, offset < ctx.vlmax - i ? riscv_v_get(src2, i + offset, esize) : 0);
+                break;
+            case RVV_SLIDE1UP:
+                riscv_v_set(dst, i, esize, i ? riscv_v_get(src2, i - 1, esize) : scalar);
+                break;
+            default:
+                riscv_v_set(dst, i, esize, i + 1 < ctx.vl ? riscv_v_get(src2, i + 1, esize) : scalar);
+                break;
+        }
+    }
+    vm->csr.vstart = 0;
+}
+
+// vmv1r.v, vmv2r.v, vmv4r.v, vmv8r.v
+static void riscv_v_move_whole(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    size_t nregs = bit_cut(instruction, 15, 5) + 1;
+    size_t esize = riscv_v_vill(vm) ? 1 : (1 << bit_cut(vm->csr.vtype, 3, 3));
+
+    if (!vector_is_enabled(vm) || !bit_check(instruction, 25) || (nregs & (nregs - 1))
+     || (vd & (nregs - 1)) || (vs2 & (nregs - 1))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+    size_t start = vm->csr.vstart * esize;
+    size_t size = nregs * VECTOR_REG_SIZE;
+    if (start < size && vd != vs2) {
+        memmove(riscv_v_reg(vm, vd) + start, riscv_v_reg(vm, vs2) + start, size - start);
+    }
+    vm->csr.vstart = 0;
+}
+
+// vmv.x.s, vcpop.m, vfirst.m, vmv.s.x
+static void riscv_v_wxunary0(rvvm_hart_t* vm, const uint32_t instruction, bool vx)
+{
+    regid_t rds = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (vx) {
+        // vmv.s.x
+        if (vs2 || ctx.masked) {
+            riscv_illegal_insn(vm, instruction);
+            return;
+        }
+        if (ctx.vstart < ctx.vl) {
+            riscv_v_set(riscv_v_reg(vm, rds), 0, ctx.sew, riscv_read_register_s(vm, vs1));
+        }
+        vm->csr.vstart = 0;
+        return;
+    }
+
+    const uint8_t* src2 = riscv_v_reg(vm, vs2);
+    size_t count = 0;
+    switch (vs1) {
+        case 0x00: // vmv.x.s
+            if (ctx.masked) break;
+            riscv_write_register(vm, rds, riscv_v_sext(riscv_v_get(src2, 0, ctx.sew), ctx.sew));
+            vm->csr.vstart = 0;
+            return;
+        case 0x10: // vcpop.m
+            if (ctx.vstart) break;
+            for (size_t i=0; i<ctx.vl; ++i) {
+                if (riscv_v_active(&ctx, i) && riscv_v_bit(src2, i)) count++;
+            }
+            riscv_write_register(vm, rds, count);
+            return;
+        case 0x11: // vfirst.m
+            if (ctx.vstart) break;
+            for (size_t i=0; i<ctx.vl; ++i) {
+                if (riscv_v_active(&ctx, i) && riscv_v_bit(src2, i)) {
+                    riscv_write_register(vm, rds, i);
+                    return;
+                }
+            }
+            riscv_write_register(vm, rds, -1);
+            return;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+// vzext.vf2/4/8, vsext.vf2/4/8
+static void riscv_v_extend(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t sel = bit_cut(instruction, 15, 5);
+    uint8_t buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    // vs1 = 2..7: vf8, vf4, vf2 in pairs of zext/sext
+    uint8_t factor = 4 - (sel >> 1);
+    bool sign = sel & 1;
+    int8_t emul = ctx.lmul - factor;
+    if (sel < 2 || sel > 7 || ctx.sew >> factor == 0 || emul < -3 || !riscv_v_aligned(vd, ctx.lmul)
+     || !riscv_v_aligned(vs2, emul) || (ctx.masked && vd == 0)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, emul, buf2);
+    uint8_t esize = ctx.sew, ssize = ctx.sew >> factor;
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        if (!riscv_v_active(&ctx, i)) continue;
+        uint64_t a = riscv_v_get(src2, i, ssize);
+        riscv_v_set(dst, i, esize, sign ? (uint64_t)riscv_v_sext(a, ssize) : a);
+    }
+    vm->csr.vstart = 0;
+}
+
+// vmsbf.m, vmsof.m, vmsif.m, viota.m, vid.v
+static void riscv_v_munary0(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t sel = bit_cut(instruction, 15, 5);
+    uint8_t src2[VECTOR_REG_SIZE];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    memcpy(src2, riscv_v_reg(vm, vs2), VECTOR_REG_SIZE);
+    bool found = false;
+    size_t count = 0;
+
+    switch (sel) {
+        case 0x01: // vmsbf.m
+        case 0x02: // vmsof.m
+        case 0x03: // vmsif.m
+            if (ctx.vstart || vd == vs2 || (ctx.masked && vd == 0)) break;
+            for (size_t i=0; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                bool first = !found && riscv_v_bit(src2, i);
+                found |= first;
+                switch (sel) {
+                    case 0x01: riscv_v_set_bit(dst, i, !found); break;
+                    case 0x02: riscv_v_set_bit(dst, i, first); break;
+                    default:   riscv_v_set_bit(dst, i, !found || first); break;
+                }
+            }
+            return;
+        case 0x10: // viota.m
+            if (ctx.vstart || !riscv_v_aligned(vd, ctx.lmul) || (ctx.masked && vd == 0)) break;
+            for (size_t i=0; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                riscv_v_set(dst, i, ctx.sew, count);
+                if (riscv_v_bit(src2, i)) count++;
+            }
+            return;
+        case 0x11: // vid.v
+            if (vs2 || !riscv_v_aligned(vd, ctx.lmul) || (ctx.masked && vd == 0)) break;
+            for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+                if (riscv_v_active(&ctx, i)) riscv_v_set(dst, i, ctx.sew, i);
+            }
+            vm->csr.vstart = 0;
+            return;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+static void riscv_v_compress(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    uint8_t buf1[VECTOR_REG_SIZE], buf2[VECTOR_REG_SIZE * 8];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (ctx.masked || ctx.vstart || !riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src1 = riscv_v_snapshot(vm, vs1, 0, buf1);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    size_t j = 0;
+    for (size_t i=0; i<ctx.vl; ++i) {
+        if (riscv_v_bit(src1, i)) riscv_v_set(dst, j++, ctx.sew, riscv_v_get(src2, i, ctx.sew));
+    }
+}
+
+static void riscv_v_mask_logic(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    regid_t vd = bit_cut(instruction, 7, 5);
+    uint8_t src1[VECTOR_REG_SIZE], src2[VECTOR_REG_SIZE];
+    rvv_ctx_t ctx;
+
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    if (ctx.masked) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    memcpy(src1, riscv_v_reg(vm, bit_cut(instruction, 15, 5)), VECTOR_REG_SIZE);
+    memcpy(src2, riscv_v_reg(vm, bit_cut(instruction, 20, 5)), VECTOR_REG_SIZE);
+    for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+        bool a = riscv_v_bit(src2, i), b = riscv_v_bit(src1, i), res;
+        switch (bit_cut(instruction, 26, 3)) {
+            case 0x0: res = a & !b; break;    // vmandn
+            case 0x1: res = a & b; break;     // vmand
+            case 0x2: res = a | b; break;     // vmor
+            case 0x3: res = a ^ b; break;     // vmxor
+            case 0x4: res = a | !b; break;    // vmorn
+            case 0x5: res = !(a & b); break;  // vmnand
+            case 0x6: res = !(a | b); break;  // vmnor
+            default:  res = !(a ^ b); break;  // vmxnor
+        }
+        riscv_v_set_bit(dst, i, res);
+    }
+    vm->csr.vstart = 0;
+}
+
+static void riscv_v_int_dispatch(rvvm_hart_t* vm, const uint32_t instruction, const rvv_opcode_t* table, uint8_t form)
+{
+    const rvv_opcode_t* opcode = &table[bit_cut(instruction, 26, 6)];
+    regid_t rs1 = bit_cut(instruction, 15, 5);
+    bool vx = form != RVV_VV;
+    uint64_t scalar = 0;
+
+    if (!(opcode->forms & form)) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+    if (form == RVV_VX) {
+        scalar = (int64_t)riscv_read_register_s(vm, rs1);
+    } else if (form == RVV_VI) {
+        scalar = (opcode->forms & RVV_UIMM) ? rs1 : (uint64_t)(int64_t)sign_extend(rs1, 5);
+    }
+
+    switch (opcode->op) {
+        case RVV_ADC:
+        case RVV_MADC:
+        case RVV_SBC:
+        case RVV_MSBC:
+        case RVV_MERGE:
+            riscv_v_carry_op(vm, instruction, opcode->op, vx, scalar);
+            return;
+        case RVV_MSEQ:
+        case RVV_MSNE:
+        case RVV_MSLTU:
+        case RVV_MSLT:
+        case RVV_MSLEU:
+        case RVV_MSLE:
+        case RVV_MSGTU:
+        case RVV_MSGT:
+            riscv_v_compare(vm, instruction, opcode->op, vx, scalar);
+            return;
+        case RVV_NSRL:
+        case RVV_NSRA:
+        case RVV_NCLIPU:
+        case RVV_NCLIP:
+            riscv_v_narrow(vm, instruction, opcode->op, vx, scalar);
+            return;
+        case RVV_WADDU:
+        case RVV_WADD:
+        case RVV_WSUBU:
+        case RVV_WSUB:
+        case RVV_WADDU_W:
+        case RVV_WADD_W:
+        case RVV_WSUBU_W:
+        case RVV_WSUB_W:
+        case RVV_WMULU:
+        case RVV_WMULSU:
+        case RVV_WMUL:
+        case RVV_WMACCU:
+        case RVV_WMACC:
+        case RVV_WMACCUS:
+        case RVV_WMACCSU:
+            riscv_v_widen(vm, instruction, opcode->op, vx, scalar);
+            return;
+        case RVV_REDSUM:
+        case RVV_REDAND:
+        case RVV_REDOR:
+        case RVV_REDXOR:
+        case RVV_REDMINU:
+        case RVV_REDMIN:
+        case RVV_REDMAXU:
+        case RVV_REDMAX:
+        case RVV_WREDSUMU:
+        case RVV_WREDSUM:
+            riscv_v_reduce(vm, instruction, opcode->op);
+            return;
+        case RVV_GATHER:
+            riscv_v_gather(vm, instruction, vx, scalar, false);
+            return;
+        case RVV_SLIDEUP:
+            if (form == RVV_VV) {
+                riscv_v_gather(vm, instruction, false, 0, true);
+            } else {
+                riscv_v_slide(vm, instruction, RVV_SLIDEUP, scalar);
+            }
+            return;
+        case RVV_SLIDEDOWN:
+        case RVV_SLIDE1UP:
+        case RVV_SLIDE1DOWN:
+            riscv_v_slide(vm, instruction, opcode->op, scalar);
+            return;
+        case RVV_SMUL_MVNR:
+            if (form == RVV_VI) {
+                riscv_v_move_whole(vm, instruction);
+            } else {
+                riscv_v_int_op(vm, instruction, RVV_SMUL, vx, scalar);
+            }
+            return;
+        case RVV_WXUNARY0:
+            riscv_v_wxunary0(vm, instruction, vx);
+            return;
+        case RVV_XUNARY0:
+            riscv_v_extend(vm, instruction);
+            return;
+        case RVV_MUNARY0:
+            riscv_v_munary0(vm, instruction);
+            return;
+        case RVV_COMPRESS:
+            riscv_v_compress(vm, instruction);
+            return;
+        case RVV_MASK_LOGIC:
+            riscv_v_mask_logic(vm, instruction);
+            return;
+        default:
+            riscv_v_int_op(vm, instruction, opcode->op, vx, scalar);
+            return;
+    }
+}
+
+static void riscv_v_opivv(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_int_dispatch(vm, instruction, riscv_v_opi_table, RVV_VV);
+}
+
+static void riscv_v_opivx(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_int_dispatch(vm, instruction, riscv_v_opi_table, RVV_VX);
+}
+
+static void riscv_v_opivi(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_int_dispatch(vm, instruction, riscv_v_opi_table, RVV_VI);
+}
+
+static void riscv_v_opmvv(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_int_dispatch(vm, instruction, riscv_v_opm_table, RVV_VV);
+}
+
+static void riscv_v_opmvx(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_int_dispatch(vm, instruction, riscv_v_opm_table, RVV_VX);
+}
+
+/*
+ * Floating-point instructions (SEW=32 and SEW=64)
+ */
+
+#ifdef USE_FPU
+
+enum {
+    RVV_FADD,
+    RVV_FSUB,
+    RVV_FRSUB,
+    RVV_FMUL,
+    RVV_FDIV,
+    RVV_FRDIV,
+    RVV_FMIN,
+    RVV_FMAX,
+    RVV_FSGNJ,
+    RVV_FSGNJN,
+    RVV_FSGNJX,
+    RVV_FMACC,
+    RVV_FNMACC,
+    RVV_FMSAC,
+    RVV_FNMSAC,
+    RVV_FMADD,
+    RVV_FNMADD,
+    RVV_FMSUB,
+    RVV_FNMSUB,
+    // Opcodes with special operand layout
+    RVV_FREDSUM,
+    RVV_FREDMIN,
+    RVV_FREDMAX,
+    RVV_MFEQ,
+    RVV_MFLE,
+    RVV_MFLT,
+    RVV_MFNE,
+    RVV_MFGT,
+    RVV_MFGE,
+    RVV_FSLIDE1UP,
+    RVV_FSLIDE1DOWN,
+    RVV_FWUNARY0,
+    RVV_FUNARY0,
+    RVV_FUNARY1,
+    RVV_FMERGE,
+};
+
+static const rvv_opcode_t riscv_v_opf_table[64] = {
+    [0x00] = { RVV_FADD,        RVV_VV | RVV_VX },
+    [0x01] = { RVV_FREDSUM,     RVV_VV }, // vfredusum
+    [0x02] = { RVV_FSUB,        RVV_VV | RVV_VX },
+    [0x03] = { RVV_FREDSUM,     RVV_VV }, // vfredosum
+    [0x04] = { RVV_FMIN,        RVV_VV | RVV_VX },
+    [0x05] = { RVV_FREDMIN,     RVV_VV },
+    [0x06] = { RVV_FMAX,        RVV_VV | RVV_VX },
+    [0x07] = { RVV_FREDMAX,     RVV_VV },
+    [0x08] = { RVV_FSGNJ,       RVV_VV | RVV_VX },
+    [0x09] = { RVV_FSGNJN,      RVV_VV | RVV_VX },
+    [0x0A] = { RVV_FSGNJX,      RVV_VV | RVV_VX },
+    [0x0E] = { RVV_FSLIDE1UP,   RVV_VX },
+    [0x0F] = { RVV_FSLIDE1DOWN, RVV_VX },
+    [0x10] = { RVV_FWUNARY0,    RVV_VV | RVV_VX },
+    [0x12] = { RVV_FUNARY0,     RVV_VV },
+    [0x13] = { RVV_FUNARY1,     RVV_VV },
+    [0x17] = { RVV_FMERGE,      RVV_VX },
+    [0x18] = { RVV_MFEQ,        RVV_VV | RVV_VX },
+    [0x19] = { RVV_MFLE,        RVV_VV | RVV_VX },
+    [0x1B] = { RVV_MFLT,        RVV_VV | RVV_VX },
+    [0x1C] = { RVV_MFNE,        RVV_VV | RVV_VX },
+    [0x1D] = { RVV_MFGT,        RVV_VX },
+    [0x1F] = { RVV_MFGE,        RVV_VX },
+    [0x20] = { RVV_FDIV,        RVV_VV | RVV_VX },
+    [0x21] = { RVV_FRDIV,       RVV_VX },
+    [0x24] = { RVV_FMUL,        RVV_VV | RVV_VX },
+    [0x27] = { RVV_FRSUB,       RVV_VX },
+    [0x28] = { RVV_FMADD,       RVV_VV | RVV_VX },
+    [0x29] = { RVV_FNMADD,      RVV_VV | RVV_VX },
+    [0x2A] = { RVV_FMSUB,       RVV_VV | RVV_VX },
+    [0x2B] = { RVV_FNMSUB,      RVV_VV | RVV_VX },
+    [0x2C] = { RVV_FMACC,       RVV_VV | RVV_VX },
+    [0x2D] = { RVV_FNMACC,      RVV_VV | RVV_VX },
+    [0x2E] = { RVV_FMSAC,       RVV_VV | RVV_VX },
+    [0x2F] = { RVV_FNMSAC,      RVV_VV | RVV_VX },
+};
+
+static inline float riscv_v_f32(uint64_t bits)
+{
+    uint32_t tmp = bits;
+    float ret;
+    memcpy(&ret, &tmp, sizeof(ret));
+    return ret;
+}
+
+static inline uint64_t riscv_v_f32_bits(float val)
+{
+    uint32_t ret;
+    memcpy(&ret, &val, sizeof(ret));
+    return ret;
+}
+
+static inline double riscv_v_f64(uint64_t bits)
+{
+    double ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+static inline uint64_t riscv_v_f64_bits(double val)
+{
+    uint64_t ret;
+    memcpy(&ret, &val, sizeof(ret));
+    return ret;
+}
+
+static inline uint64_t riscv_v_fp_sign(uint8_t esize)
+{
+    return 1ULL << ((esize << 3) - 1);
+}
+
+static inline bool riscv_v_fp_isnan(uint64_t val, uint8_t esize)
+{
+    if (esize == 4) return (val & 0x7FFFFFFF) > 0x7F800000;
+    return (val & 0x7FFFFFFFFFFFFFFFULL) > 0x7FF0000000000000ULL;
+}
+
+static inline bool riscv_v_fp_issnan(uint64_t val, uint8_t esize)
+{
+    if (esize == 4) return riscv_v_fp_isnan(val, esize) && !bit_check(val, 22);
+    return riscv_v_fp_isnan(val, esize) && !((val >> 51) & 1);
+}
+
+static inline uint64_t riscv_v_fp_canonize(uint64_t val, uint8_t esize)
+{
+    if (unlikely(riscv_v_fp_isnan(val, esize))) {
+        return esize == 4 ? 0x7FC00000 : 0x7FF8000000000000ULL;
+    }
+    return val;
+}
+
+static inline bool riscv_v_fp_lt(uint64_t a, uint64_t b, uint8_t esize)
+{
+    return esize == 4 ? riscv_v_f32(a) < riscv_v_f32(b) : riscv_v_f64(a) < riscv_v_f64(b);
+}
+
+static inline bool riscv_v_fp_eq(uint64_t a, uint64_t b, uint8_t esize)
+{
+    return esize == 4 ? riscv_v_f32(a) == riscv_v_f32(b) : riscv_v_f64(a) == riscv_v_f64(b);
+}
+
+// IEEE 754-2019 minimumNumber/maximumNumber, -0.0 is less than +0.0
+static uint64_t riscv_v_fp_minmax(uint64_t a, uint64_t b, uint8_t esize, bool max)
+{
+    bool a_nan = riscv_v_fp_isnan(a, esize), b_nan = riscv_v_fp_isnan(b, esize);
+    if (unlikely(a_nan || b_nan)) {
+        if (riscv_v_fp_issnan(a, esize) || riscv_v_fp_issnan(b, esize)) feraiseexcept(FE_INVALID);
+        if (a_nan && b_nan) return riscv_v_fp_canonize(a, esize);
+        return a_nan ? b : a;
+    }
+    if (riscv_v_fp_eq(a, b, esize)) {
+        bool a_neg = a & riscv_v_fp_sign(esize);
+        return (a_neg != max) ? a : b;
+    }
+    return (riscv_v_fp_lt(a, b, esize) != max) ? a : b;
+}
+
+#define RVV_FP_ARITH(fma_fn) \
+    switch (op) { \
+        case RVV_FADD:   return a + b; \
+        case RVV_FSUB:   return a - b; \
+        case RVV_FRSUB:  return b - a; \
+        case RVV_FMUL:   return a * b; \
+        case RVV_FDIV:   return a / b; \
+        case RVV_FRDIV:  return b / a; \
+        case RVV_FMACC:  return fma_fn(b, a, d); \
+        case RVV_FNMACC: return fma_fn(-b, a, -d); \
+        case RVV_FMSAC:  return fma_fn(b, a, -d); \
+        case RVV_FNMSAC: return fma_fn(-b, a, d); \
+        case RVV_FMADD:  return fma_fn(b, d, a); \
+        case RVV_FNMADD: return fma_fn(-b, d, -a); \
+        case RVV_FMSUB:  return fma_fn(b, d, -a); \
+        case RVV_FNMSUB: return fma_fn(-b, d, a); \
+    } \
+    return a;
+
+static float riscv_v_f32_arith(uint8_t op, float a, float b, float d)
+{
+    RVV_FP_ARITH(fmaf)
+}
+
+static double riscv_v_f64_arith(uint8_t op, double a, double b, double d)
+{
+    RVV_FP_ARITH(fma)
+}
+
+// a = vs2 element, b = vs1 element or scalar, d = old vd element
+static uint64_t riscv_v_fp_alu(uint8_t op, uint64_t a, uint64_t b, uint64_t d, uint8_t esize)
+{
+    uint64_t sign = riscv_v_fp_sign(esize);
+    switch (op) {
+        case RVV_FSGNJ:  return (a & ~sign) | (b & sign);
+        case RVV_FSGNJN: return (a & ~sign) | (~b & sign);
+        case RVV_FSGNJX: return a ^ (b & sign);
+        case RVV_FMIN:   return riscv_v_fp_minmax(a, b, esize, false);
+        case RVV_FMAX:   return riscv_v_fp_minmax(a, b, esize, true);
+    }
+    if (esize == 4) {
+        return riscv_v_fp_canonize(riscv_v_f32_bits(riscv_v_f32_arith(op, riscv_v_f32(a),
+                                   riscv_v_f32(b), riscv_v_f32(d))), esize);
+    }
+    return riscv_v_fp_canonize(riscv_v_f64_bits(riscv_v_f64_arith(op, riscv_v_f64(a),
+                               riscv_v_f64(b), riscv_v_f64(d))), esize);
+}
+
+static bool riscv_v_fp_compare(uint8_t op, uint64_t a, uint64_t b, uint8_t esize)
+{
+    bool nan = riscv_v_fp_isnan(a, esize) || riscv_v_fp_isnan(b, esize);
+    if (nan) {
+        // Ordered comparisons signal on any NaN, equality only on sNaN
+        if ((op != RVV_MFEQ && op != RVV_MFNE) || riscv_v_fp_issnan(a, esize) || riscv_v_fp_issnan(b, esize)) {
+            feraiseexcept(FE_INVALID);
+        }
+        return op == RVV_MFNE;
+    }
+    switch (op) {
+        case RVV_MFEQ: return riscv_v_fp_eq(a, b, esize);
+        case RVV_MFNE: return !riscv_v_fp_eq(a, b, esize);
+        case RVV_MFLT: return riscv_v_fp_lt(a, b, esize);
+        case RVV_MFLE: return riscv_v_fp_lt(a, b, esize) || riscv_v_fp_eq(a, b, esize);
+        case RVV_MFGT: return riscv_v_fp_lt(b, a, esize);
+        default:       return riscv_v_fp_lt(b, a, esize) || riscv_v_fp_eq(a, b, esize);
+    }
+}
+
+static uint16_t riscv_v_fp_class(uint64_t val, uint8_t esize)
+{
+    bool neg = val & riscv_v_fp_sign(esize);
+    int cls = esize == 4 ? fpclassify(riscv_v_f32(val)) : fpclassify(riscv_v_f64(val));
+    switch (cls) {
+        case FP_INFINITE:  return neg ? (1 << 0) : (1 << 7);
+        case FP_NORMAL:    return neg ? (1 << 1) : (1 << 6);
+        case FP_SUBNORMAL: return neg ? (1 << 2) : (1 << 5);
+        case FP_ZERO:      return neg ? (1 << 3) : (1 << 4);
+    }
+    return riscv_v_fp_issnan(val, esize) ? (1 << 8) : (1 << 9);
+}
+
+// Same-width float <-> integer conversions, selected by vs1 field of VFUNARY0
+static uint64_t riscv_v_fp_convert(uint8_t sel, uint64_t val, uint8_t esize)
+{
+    bool sign = sel & 1;
+    if (sel == 0x2 || sel == 0x3) {
+        // vfcvt.f.xu.v, vfcvt.f.x.v, rounded by the host according to frm
+        if (esize == 4) {
+            return riscv_v_f32_bits(sign ? (float)(int32_t)val : (float)(uint32_t)val);
+        }
+        return riscv_v_f64_bits(sign ? (double)(int64_t)val : (double)val);
+    }
+
+    // vfcvt.xu.f.v, vfcvt.x.f.v, vfcvt.rtz.*
+    double x = esize == 4 ? riscv_v_f32(val) : riscv_v_f64(val);
+    double ret = sel >= 0x6 ? trunc(x) : nearbyint(x);
+    double lo = sign ? -ldexp(1.0, (esize << 3) - 1) : 0.0;
+    double hi = ldexp(1.0, (esize << 3) - !!sign);
+    if (unlikely(isnan(x) || ret < lo || ret >= hi)) {
+        feraiseexcept(FE_INVALID);
+        if (isnan(x) || !signbit(x)) {
+            return riscv_v_emask(esize) >> sign;
+        }
+        return sign ? riscv_v_fp_sign(esize) : 0;
+    }
+    if (ret != x) feraiseexcept(FE_INEXACT);
+    return sign ? (uint64_t)(int64_t)ret : (uint64_t)ret;
+}
+
+static inline uint64_t riscv_v_fp_sqrt(uint64_t val, uint8_t esize)
+{
+    if (riscv_v_fp_isnan(val, esize) ? riscv_v_fp_issnan(val, esize) : (val & riscv_v_fp_sign(esize)) && (val << 1)) {
+        // sqrt of sNaN or a negative non-zero value
+        feraiseexcept(FE_INVALID);
+    }
+    if (esize == 4) return riscv_v_fp_canonize(riscv_v_f32_bits(sqrtf(riscv_v_f32(val))), esize);
+    return riscv_v_fp_canonize(riscv_v_f64_bits(sqrt(riscv_v_f64(val))), esize);
+}
+
+static void riscv_v_fp_dispatch(rvvm_hart_t* vm, const uint32_t instruction, uint8_t form)
+{
+    const rvv_opcode_t* opcode = &riscv_v_opf_table[bit_cut(instruction, 26, 6)];
+    regid_t vd = bit_cut(instruction, 7, 5);
+    regid_t vs1 = bit_cut(instruction, 15, 5);
+    regid_t vs2 = bit_cut(instruction, 20, 5);
+    bool vf = form == RVV_VX;
+    uint8_t buf1[VECTOR_REG_SIZE * 8], buf2[VECTOR_REG_SIZE * 8];
+    uint64_t scalar = 0;
+    rvv_ctx_t ctx;
+
+    if (!(opcode->forms & form) || !fpu_is_enabled(vm) || bit_cut(vm->csr.fcsr, 5, 3) > RM_RMM) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+    if (!riscv_v_begin(vm, instruction, &ctx)) return;
+    uint8_t esize = ctx.sew;
+    uint8_t op = opcode->op;
+    if (esize < 4 || !riscv_v_aligned(vd, ctx.lmul) || !riscv_v_aligned(vs2, ctx.lmul)
+     || (!vf && !riscv_v_aligned(vs1, ctx.lmul))) {
+        riscv_illegal_insn(vm, instruction);
+        return;
+    }
+    if (vf) {
+        if (esize == 4) {
+            scalar = riscv_v_f32_bits(fpu_read_register32(vm, vs1));
+        } else {
+            scalar = riscv_v_f64_bits(fpu_read_register64(vm, vs1));
+        }
+    }
+
+    uint8_t* dst = riscv_v_reg(vm, vd);
+    const uint8_t* src2 = riscv_v_snapshot(vm, vs2, ctx.lmul, buf2);
+    const uint8_t* src1 = vf ? NULL : riscv_v_snapshot(vm, vs1, ctx.lmul, buf1);
+    bool mask_dst = op >= RVV_MFEQ && op <= RVV_MFGE;
+
+    switch (op) {
+        case RVV_FREDSUM:
+        case RVV_FREDMIN:
+        case RVV_FREDMAX: {
+            // Ordered sum is a valid implementation of unordered one
+            if (ctx.vstart) break;
+            if (ctx.vl == 0) return;
+            uint64_t acc = riscv_v_get(src1, 0, esize);
+            for (size_t i=0; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                uint64_t a = riscv_v_get(src2, i, esize);
+                switch (op) {
+                    case RVV_FREDSUM: acc = riscv_v_fp_alu(RVV_FADD, acc, a, 0, esize); break;
+                    case RVV_FREDMIN: acc = riscv_v_fp_minmax(acc, a, esize, false); break;
+                    default:          acc = riscv_v_fp_minmax(acc, a, esize, true); break;
+                }
+            }
+            riscv_v_set(dst, 0, esize, acc);
+            fpu_set_fs(vm, FS_DIRTY);
+            return;
+        }
+        case RVV_FWUNARY0:
+            if (ctx.masked) break;
+            if (vf) {
+                // vfmv.s.f
+                if (vs2) break;
+                if (ctx.vstart < ctx.vl) riscv_v_set(dst, 0, esize, scalar);
+            } else {
+                // vfmv.f.s
+                if (vs1) break;
+                uint64_t val = riscv_v_get(src2, 0, esize);
+                if (esize == 4) {
+                    fpu_write_register32(vm, vd, riscv_v_f32(val));
+                } else {
+                    fpu_write_register64(vm, vd, riscv_v_f64(val));
+                }
+            }
+            vm->csr.vstart = 0;
+            return;
+        case RVV_FUNARY0:
+            // Only single-width conversions are implemented
+            if (vs1 > 0x7 || vs1 == 0x4 || vs1 == 0x5 || (ctx.masked && vd == 0)) break;
+            for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                riscv_v_set(dst, i, esize, riscv_v_fp_convert(vs1, riscv_v_get(src2, i, esize), esize));
+            }
+            vm->csr.vstart = 0;
+            fpu_set_fs(vm, FS_DIRTY);
+            return;
+        case RVV_FUNARY1:
+            // vfsqrt.v & vfclass.v, estimate instructions are not implemented
+            if ((vs1 != 0x00 && vs1 != 0x10) || (ctx.masked && vd == 0)) break;
+            for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                uint64_t a = riscv_v_get(src2, i, esize);
+                riscv_v_set(dst, i, esize, vs1 ? riscv_v_fp_class(a, esize) : riscv_v_fp_sqrt(a, esize));
+            }
+            vm->csr.vstart = 0;
+            fpu_set_fs(vm, FS_DIRTY);
+            return;
+        case RVV_FMERGE:
+            if (!ctx.masked && vs2) break;
+            for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+                riscv_v_set(dst, i, esize, riscv_v_active(&ctx, i) ? scalar : riscv_v_get(src2, i, esize));
+            }
+            vm->csr.vstart = 0;
+            return;
+        case RVV_FSLIDE1UP:
+        case RVV_FSLIDE1DOWN:
+            riscv_v_slide(vm, instruction, op == RVV_FSLIDE1UP ? RVV_SLIDE1UP : RVV_SLIDE1DOWN, scalar);
+            return;
+        default:
+            if (ctx.masked && vd == 0 && !mask_dst) break;
+            for (size_t i=ctx.vstart; i<ctx.vl; ++i) {
+                if (!riscv_v_active(&ctx, i)) continue;
+                uint64_t a = riscv_v_get(src2, i, esize);
+                uint64_t b = vf ? scalar : riscv_v_get(src1, i, esize);
+                if (mask_dst) {
+                    riscv_v_set_bit(dst, i, riscv_v_fp_compare(op, a, b, esize));
+                } else {
+                    riscv_v_set(dst, i, esize, riscv_v_fp_alu(op, a, b, riscv_v_get(dst, i, esize), esize));
+                }
+            }
+            vm->csr.vstart = 0;
+            fpu_set_fs(vm, FS_DIRTY);
+            return;
+    }
+    riscv_illegal_insn(vm, instruction);
+}
+
+static void riscv_v_opfvv(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_fp_dispatch(vm, instruction, RVV_VV);
+}
+
+static void riscv_v_opfvf(rvvm_hart_t* vm, const uint32_t instruction)
+{
+    riscv_v_fp_dispatch(vm, instruction, RVV_VX);
+}
+
+#endif
+
+void riscv_v_init(rvvm_hart_t* vm)
+{
+    // vtype layout depends on XLEN, start with vill set
+    vm->csr.vtype = ((xlen_t)1) << (XLEN_BITS - 1);
+    vm->csr.vl = 0;
+
+    riscv_install_opcode_ISB(vm, RVV_LOAD_E8, riscv_v_load);
+    riscv_install_opcode_ISB(vm, RVV_LOAD_E16, riscv_v_load);
+    riscv_install_opcode_ISB(vm, RVV_LOAD_E32, riscv_v_load);
+    riscv_install_opcode_ISB(vm, RVV_LOAD_E64, riscv_v_load);
+    riscv_install_opcode_ISB(vm, RVV_STORE_E8, riscv_v_store);
+    riscv_install_opcode_ISB(vm, RVV_STORE_E16, riscv_v_store);
+    riscv_install_opcode_ISB(vm, RVV_STORE_E32, riscv_v_store);
+    riscv_install_opcode_ISB(vm, RVV_STORE_E64, riscv_v_store);
+
+    riscv_install_opcode_ISB(vm, RVV_OPIVV, riscv_v_opivv);
+    riscv_install_opcode_ISB(vm, RVV_OPMVV, riscv_v_opmvv);
+    riscv_install_opcode_ISB(vm, RVV_OPIVI, riscv_v_opivi);
+    riscv_install_opcode_ISB(vm, RVV_OPIVX, riscv_v_opivx);
+    riscv_install_opcode_ISB(vm, RVV_OPMVX, riscv_v_opmvx);
+#ifdef USE_FPU
+    riscv_install_opcode_ISB(vm, RVV_OPFVV, riscv_v_opfvv);
+    riscv_install_opcode_ISB(vm, RVV_OPFVF, riscv_v_opfvf);
+#endif
+    riscv_install_opcode_ISB(vm, RVV_OPCFG, riscv_v_vsetvl);
+}
+
+#else
+
+void riscv_v_init(rvvm_hart_t* vm)
+{
+    UNUSED(vm);
+}
+
+#endif
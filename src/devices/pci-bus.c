@@ -275,17 +275,7 @@ static bool pci_bus_write(rvvm_mmio_dev_t *mmio_dev, void *dest, paddr_t offset,
                     addr = -len;
                 }
 
-                rvvm_mmio_dev_t *bar_dev = rvvm_get_mmio(mmio_dev->machine,
-                        func->bar_mapping[bar_num]);
-                if (bar_dev == NULL) {
-                    goto out;
-                }
-
-                /* must be atomic... */
-                paddr_t mmio_len = bar_dev->end - bar_dev->begin;
-                bar_dev->begin = (paddr_t)addr;
-                bar_dev->end = (paddr_t)addr + mmio_len;
-                /* ...up to this point. But no way to make it... */
+                rvvm_remap_mmio(mmio_dev->machine, func->bar_mapping[bar_num], (paddr_t)addr);
                 goto out;
             }
         case PCI_REG_IRQ_PIN_LINE:
@@ -259,3 +259,212 @@ bool riscv32_elf_load_by_path(rvvm_hart_t *vm, const char *path, bool use_mmu, p
 
 #endif
 #endif
+
+/*
+ * Symbol tables for profiling & diagnostics
+ */
+
+#include "elf_load.h"
+#include "mem_ops.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ELF_SHT_SYMTAB 2
+#define ELF_SHT_DYNSYM 11
+#define ELF_STT_NOTYPE 0
+#define ELF_STT_FUNC   2
+
+static void elf_symtab_add(elf_symtab_t* symtab, size_t* cap, uint64_t addr, uint64_t size, const char* name, size_t len)
+{
+    // Skip mapping symbols & local labels, those are noise in profiles
+    if (len == 0 || name[0] == '$' || (len > 1 && name[0] == '.' && name[1] == 'L')) return;
+    if (symtab->count == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        symtab->syms = safe_realloc(symtab->syms, *cap * sizeof(elf_symbol_t));
+    }
+    elf_symbol_t* sym = &symtab->syms[symtab->count++];
+    sym->addr = addr;
+    sym->size = size;
+    sym->name = safe_malloc(len + 1);
+    memcpy(sym->name, name, len);
+    sym->name[len] = 0;
+}
+
+static void elf_parse_symtab(elf_symtab_t* symtab, size_t* cap, const uint8_t* elf, size_t elf_size, uint32_t sh_type)
+{
+    bool elf64 = elf[4] == 2;
+    uint64_t shoff = elf64 ? read_uint64_le(elf + 0x28) : read_uint32_le(elf + 0x20);
+    size_t shentsize = read_uint16_le(elf + (elf64 ? 0x3A : 0x2E));
+    size_t shnum = read_uint16_le(elf + (elf64 ? 0x3C : 0x30));
+    size_t symentsize = elf64 ? 24 : 16;
+
+    if (shentsize < (elf64 ? 0x40U : 0x28U) || shoff > elf_size
+     || shnum > (elf_size - shoff) / shentsize) return;
+
+    for (size_t i=0; i<shnum; ++i) {
+        const uint8_t* sh = elf + shoff + i * shentsize;
+        if (read_uint32_le(sh + 4) != sh_type) continue;
+        uint64_t off  = elf64 ? read_uint64_le(sh + 0x18) : read_uint32_le(sh + 0x10);
+        uint64_t size = elf64 ? read_uint64_le(sh + 0x20) : read_uint32_le(sh + 0x14);
+        uint32_t link = read_uint32_le(sh + (elf64 ? 0x28 : 0x18));
+        if (link >= shnum || off > elf_size || size > elf_size - off) continue;
+
+        // Linked section holds the symbol names
+        const uint8_t* strsh = elf + shoff + link * shentsize;
+        uint64_t str_off  = elf64 ? read_uint64_le(strsh + 0x18) : read_uint32_le(strsh + 0x10);
+        uint64_t str_size = elf64 ? read_uint64_le(strsh + 0x20) : read_uint32_le(strsh + 0x14);
+        if (str_off > elf_size || str_size > elf_size - str_off) continue;
+        const char* strtab = (const char*)elf + str_off;
+
+        for (uint64_t j=0; j + symentsize <= size; j += symentsize) {
+            const uint8_t* sym = elf + off + j;
+            uint32_t name = read_uint32_le(sym);
+            uint8_t info  = sym[elf64 ? 4 : 12];
+            uint16_t shndx = read_uint16_le(sym + (elf64 ? 6 : 14));
+            uint64_t addr = elf64 ? read_uint64_le(sym + 8) : read_uint32_le(sym + 4);
+            uint64_t sym_size = elf64 ? read_uint64_le(sym + 16) : read_uint32_le(sym + 8);
+            uint8_t type = info & 0xF;
+
+            if (shndx == 0 || name >= str_size) continue;
+            if (type != ELF_STT_FUNC && type != ELF_STT_NOTYPE) continue;
+            const char* str = strtab + name;
+            elf_symtab_add(symtab, cap, addr, sym_size, str, strnlen(str, str_size - name));
+        }
+    }
+}
+
+static void elf_parse_symbol_map(elf_symtab_t* symtab, size_t* cap, const char* map, size_t map_size)
+{
+    const char* end = map + map_size;
+    while (map < end) {
+        const char* line_end = memchr(map, '\n', end - map);
+        if (line_end == NULL) line_end = end;
+
+        // "<hex address> <type> <name>"
+        uint64_t addr = 0;
+        const char* ptr = map;
+        while (ptr < line_end) {
+            char c = *ptr;
+            if (c >= '0' && c <= '9') addr = (addr << 4) | (c - '0');
+            else if (c >= 'a' && c <= 'f') addr = (addr << 4) | (c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') addr = (addr << 4) | (c - 'A' + 10);
+            else break;
+            ptr++;
+        }
+        if (ptr != map && line_end - ptr > 3 && ptr[0] == ' ' && ptr[2] == ' ') {
+            char type = ptr[1];
+            const char* name = ptr + 3;
+            size_t len = line_end - name;
+            while (len && (name[len - 1] == '\r' || name[len - 1] == ' ')) len--;
+            if (type == 't' || type == 'T' || type == 'w' || type == 'W') {
+                elf_symtab_add(symtab, cap, addr, 0, name, len);
+            }
+        }
+        map = line_end + 1;
+    }
+}
+
+static int elf_symbol_cmp(const void* a, const void* b)
+{
+    const elf_symbol_t* sa = a;
+    const elf_symbol_t* sb = b;
+    if (sa->addr != sb->addr) return sa->addr < sb->addr ? -1 : 1;
+    // Prefer sized symbols on aliases
+    if (sa->size != sb->size) return sa->size > sb->size ? -1 : 1;
+    return 0;
+}
+
+bool elf_load_symbols(elf_symtab_t* symtab, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    size_t cap = 0, fsize;
+    uint8_t* buffer;
+
+    symtab->syms = NULL;
+    symtab->count = 0;
+    if (file == NULL) {
+        rvvm_error("Cannot open symbol file %s", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    fsize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buffer = safe_malloc(fsize + 1);
+    if (fread(buffer, 1, fsize, file) != fsize) {
+        rvvm_error("Symbol file %s read error", path);
+        fclose(file);
+        free(buffer);
+        return false;
+    }
+    fclose(file);
+
+    if (fsize >= 0x40 && memcmp(buffer, "\x7F" "ELF", 4) == 0) {
+        if ((buffer[4] != 1 && buffer[4] != 2) || buffer[5] != 1) {
+            rvvm_error("Unsupported ELF class in %s", path);
+            free(buffer);
+            return false;
+        }
+        elf_parse_symtab(symtab, &cap, buffer, fsize, ELF_SHT_SYMTAB);
+        // Stripped binaries may still have dynamic symbols
+        if (symtab->count == 0) elf_parse_symtab(symtab, &cap, buffer, fsize, ELF_SHT_DYNSYM);
+    } else {
+        elf_parse_symbol_map(symtab, &cap, (const char*)buffer, fsize);
+    }
+    free(buffer);
+
+    if (symtab->count == 0) {
+        rvvm_error("No symbols found in %s", path);
+        elf_symtab_free(symtab);
+        return false;
+    }
+
+    // Sort by address, drop aliases, extend unsized symbols up to the next one
+    qsort(symtab->syms, symtab->count, sizeof(elf_symbol_t), elf_symbol_cmp);
+    size_t count = 1;
+    for (size_t i=1; i<symtab->count; ++i) {
+        if (symtab->syms[i].addr == symtab->syms[count - 1].addr) {
+            free(symtab->syms[i].name);
+        } else {
+            symtab->syms[count++] = symtab->syms[i];
+        }
+    }
+    symtab->count = count;
+    for (size_t i=0; i+1<count; ++i) {
+        if (symtab->syms[i].size == 0) {
+            symtab->syms[i].size = symtab->syms[i + 1].addr - symtab->syms[i].addr;
+        }
+    }
+    rvvm_info("Loaded %u symbols from %s", (uint32_t)count, path);
+    return true;
+}
+
+const elf_symbol_t* elf_symtab_lookup(const elf_symtab_t* symtab, uint64_t addr)
+{
+    size_t low = 0, high = symtab->count;
+    if (symtab->count == 0 || addr < symtab->syms[0].addr) return NULL;
+    // Find the last symbol starting at or below addr
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (symtab->syms[mid].addr <= addr) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    const elf_symbol_t* sym = &symtab->syms[low];
+    // Last unsized symbol covers the rest of the address space
+    if (sym->size && addr - sym->addr >= sym->size) return NULL;
+    return sym;
+}
+
+void elf_symtab_free(elf_symtab_t* symtab)
+{
+    for (size_t i=0; i<symtab->count; ++i) {
+        free(symtab->syms[i].name);
+    }
+    free(symtab->syms);
+    symtab->syms = NULL;
+    symtab->count = 0;
+}
@@ -18,6 +18,27 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
-#include "riscv32.h"
+#include "rvvm.h"
+
+typedef struct {
+    uint64_t addr;
+    uint64_t size;
+    char* name;
+} elf_symbol_t;
+
+// Sorted by address, sizes of unsized symbols extend up to the next one
+typedef struct {
+    elf_symbol_t* syms;
+    size_t count;
+} elf_symtab_t;
+
+/*
+ * Loads function symbols from an ELF file (.symtab or .dynsym),
+ * or from a text symbol map in nm/System.map format
+ */
+bool elf_load_symbols(elf_symtab_t* symtab, const char* path);
+// Returns the symbol containing addr, or NULL
+const elf_symbol_t* elf_symtab_lookup(const elf_symtab_t* symtab, uint64_t addr);
+void elf_symtab_free(elf_symtab_t* symtab);
 
 bool riscv32_elf_load_by_path(rvvm_hart_t *vm, const char *path, bool use_mmu, ptrdiff_t offset);
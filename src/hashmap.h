@@ -114,19 +114,30 @@ static inline size_t hashmap_get(const hashmap_t* map, size_t key)
 static inline void hashmap_remove(hashmap_t* map, size_t key)
 {
     size_t hash = hashmap_hash(key);
-    size_t index;
+    size_t index, next, home;
     for (size_t i=0; i<HASHMAP_MAX_PROBES; ++i) {
         index = (hash + i) & map->size;
+        if (map->buckets[index].val == 0) {
+            // No such key in the map
+            return;
+        }
         if (map->buckets[index].key == key) {
             map->buckets[index].val = 0;
             map->entries--;
 
-            // Rebalance colliding trailing entries
-            for (size_t j=index; j<HASHMAP_MAX_PROBES; ++j) {
-                if (map->buckets[j & map->size].key == key && map->buckets[j & map->size].val) {
-                    map->buckets[index] = map->buckets[j & map->size];
-                    map->buckets[j & map->size].val = 0;
-                    break;;
+            /*
+             * Shift back colliding trailing entries, so there are
+             * no holes in probe sequences of the remaining keys
+             */
+            for (size_t j=1; j<HASHMAP_MAX_PROBES; ++j) {
+                next = (index + j) & map->size;
+                if (map->buckets[next].val == 0) break;
+                home = hashmap_hash(map->buckets[next].key) & map->size;
+                if (((next - home) & map->size) >= j) {
+                    map->buckets[index] = map->buckets[next];
+                    map->buckets[next].val = 0;
+                    index = next;
+                    j = 0;
                 }
             }
             break;
@@ -55,11 +55,18 @@ typedef struct {
     const char* dtb;
     const char* dumpdtb;
     const char* image;
+    const char* jitcache;
+    const char* jitstats;
+    const char* profile;
+    const char* symbols;
     size_t mem;
     uint32_t smp;
+    uint32_t tlb;
     uint32_t fb_x;
     uint32_t fb_y;
     bool rv64;
+    bool perfmap;
+    bool jitdump;
     bool sbi_align_fix;
     bool nogui;
 } vm_args_t;
@@ -139,6 +146,7 @@ static void print_help()
 #ifdef USE_RV64
            "    -rv64            Enable 64-bit RISC-V, 32-bit by default\n"
 #endif
+           "    -tlb <entries>   TLB size per core, default: 512\n"
            "    -kernel <file>   Load kernel Image as SBI payload\n"
            "    -image <file>    Attach hard drive with raw image\n"
 #ifdef USE_FB
@@ -149,6 +157,14 @@ static void print_help()
 #ifdef USE_FDT
            "    -dumpdtb <file>  Dump autogenerated DTB to file\n"
 #endif
+#ifdef USE_JIT
+           "    -jitcache <file> Keep translated code in file between runs\n"
+           "    -jitstats <file> Write execution counts of JIT blocks to file\n"
+           "    -perfmap         Describe JIT blocks in /tmp/perf-<pid>.map\n"
+           "    -jitdump         Also write /tmp/jit-<pid>.dump for perf inject\n"
+#endif
+           "    -profile <file>  Sample guest PCs, write folded stacks to file\n"
+           "    -symbols <file>  Symbolize profile by ELF or System.map\n"
            "    -verbose         Enable verbose logging\n"
            "    -help            Show this help message\n"
            "    [bootrom]        Machine bootrom (SBI, BBL, etc)\n"
@@ -186,6 +202,8 @@ static bool parse_args(int argc, const char** argv, vm_args_t* args)
         } else if (cmp_arg(arg_name, "mem")) {
             if (strlen(arg_val))
                 args->mem = ((size_t)atoi(arg_val)) << mem_suffix_shift(arg_val[strlen(arg_val)-1]);
+        } else if (cmp_arg(arg_name, "tlb")) {
+            args->tlb = atoi(arg_val);
         } else if (cmp_arg(arg_name, "smp")) {
             args->smp = atoi(arg_val);
             if (args->smp > 1024) {
@@ -203,9 +221,23 @@ static bool parse_args(int argc, const char** argv, vm_args_t* args)
             args->fb_y = atoi(arg_val + i + 1);
         } else if (cmp_arg(arg_name, "dumpdtb")) {
             args->dumpdtb = arg_val;
+        } else if (cmp_arg(arg_name, "jitcache")) {
+            args->jitcache = arg_val;
+        } else if (cmp_arg(arg_name, "jitstats")) {
+            args->jitstats = arg_val;
+        } else if (cmp_arg(arg_name, "profile")) {
+            args->profile = arg_val;
+        } else if (cmp_arg(arg_name, "symbols")) {
+            args->symbols = arg_val;
         } else if (cmp_arg(arg_name, "rv64")) {
             args->rv64 = true;
             if (argpair == 2) i--;
+        } else if (cmp_arg(arg_name, "perfmap")) {
+            args->perfmap = true;
+            if (argpair == 2) i--;
+        } else if (cmp_arg(arg_name, "jitdump")) {
+            args->jitdump = true;
+            if (argpair == 2) i--;
         } else if (cmp_arg(arg_name, "nogui")) {
             args->nogui = true;
             if (argpair == 2) i--;
@@ -272,6 +304,22 @@ static bool rvvm_run_with_args(vm_args_t args)
         return false;
     }
 
+    if (args.tlb && !rvvm_set_tlb_size(machine, args.tlb)) {
+        rvvm_warn("Invalid TLB size, should be a power of 2 in 32-65536 range");
+    }
+    if (args.jitcache && !rvvm_set_jit_cache(machine, args.jitcache)) {
+        rvvm_warn("JIT cache is not supported in this build");
+    }
+    if (args.jitstats && !rvvm_enable_jit_stats(machine, args.jitstats)) {
+        rvvm_warn("JIT is not supported in this build");
+    }
+    if ((args.perfmap || args.jitdump) && !rvvm_enable_jit_perf(machine, args.jitdump)) {
+        rvvm_warn("JIT perf maps are not supported in this build");
+    }
+    if (args.profile && !rvvm_enable_profiler(machine, args.profile, args.symbols)) {
+        rvvm_warn("Failed to enable the profiler");
+    }
+
     if (args.dtb) {
         paddr_t dtb_addr = machine->mem.begin + (machine->mem.size >> 1);
 
@@ -19,7 +19,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "riscv_cpu.h"
 #include "riscv_mmu.h"
+#include "atomics.h"
+#include "utils.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void riscv_illegal_insn(rvvm_hart_t* vm, const uint32_t instruction)
 {
@@ -77,11 +81,43 @@ void riscv_install_opcode_C(rvvm_hart_t* vm, uint32_t opcode, riscv_inst_c_t fun
 
 static inline void riscv_jit_tlb_put(rvvm_hart_t* vm, vaddr_t vaddr, rvjit_func_t block)
 {
-    vaddr_t entry = (vaddr >> 1) & TLB_MASK;
+    vaddr_t entry = (vaddr >> 1) & (TLB_SIZE - 1);
     vm->jtlb[entry].pc = vaddr;
     vm->jtlb[entry].block = block;
 }
 
+/*
+ * Attach the page of vaddr to the block being compiled.
+ * Stores to it invalidate the block, and a guard is emitted
+ * to check the guest still maps it the same way upon execution.
+ */
+static bool riscv_jit_add_page(rvvm_hart_t* vm, vaddr_t vaddr)
+{
+    if (rvjit_block_has_page(&vm->jit, vaddr)) return true;
+    // The instruction was fetched from there already
+    vmptr_t ptr = riscv_vma_translate_e(vm, vaddr);
+    if (ptr == NULL) return false;
+    paddr_t paddr = (size_t)(ptr - vm->mem.data) + vm->mem.begin;
+    if (!rvjit_block_add_page(&vm->jit, vaddr, paddr, ptr)) return false;
+    riscv_mark_code(vm, paddr);
+    return true;
+}
+
+// Starts tracing a new block at the current PC
+static void riscv_jit_start(rvvm_hart_t* vm, vaddr_t virt_pc, paddr_t phys_pc)
+{
+    rvjit_block_init(&vm->jit);
+    vm->jit.pc_off = 0;
+    vm->jit.insns = 0;
+    vm->jit.virt_pc = virt_pc;
+    vm->jit.phys_pc = phys_pc;
+    // Stores to this page should invalidate the block from now on
+    riscv_mark_code(vm, phys_pc);
+
+    vm->jit_compiling = true;
+    vm->block_ends = false;
+}
+
 NOINLINE bool riscv_jit_lookup(rvvm_hart_t* vm)
 {
     /*
@@ -94,28 +130,58 @@ NOINLINE bool riscv_jit_lookup(rvvm_hart_t* vm)
     // Lookup in the hashmap, cache in JTLB
     if (ptr) {
         paddr_t phys_pc = (size_t)(ptr - vm->mem.data) + vm->mem.begin;
+        if (rvjit_cache_pending(&vm->jit, phys_pc)) {
+            // Blocks from a previous run are verified upon first execution of their page
+            riscv_mark_code(vm, phys_pc);
+            rvjit_cache_install(&vm->jit, phys_pc);
+        }
+        // Interpret cold code, boot & init code is mostly executed once
+        if (!rvjit_block_hot(&vm->jit, phys_pc)) return false;
         rvjit_func_t block = rvjit_block_lookup(&vm->jit, phys_pc);
         if (block) {
             riscv_jit_tlb_put(vm, virt_pc, block);
             block(vm);
+            riscv_hpm_event(vm, HPM_EVENT_JIT_EXIT);
+            rvjit_stats_exit(&vm->jit_exit);
             return true;
         }
 
+        /*
+         * Don't start blocks with a 4-byte instruction scattered between pages,
+         * a failing page guard before the very first instruction makes no progress
+         */
+        if ((virt_pc & 0xFFF) == 0xFFE && (ptr[0] & 3) == 3) return false;
+
         /*
          * No valid block compiled for this location,
          * make a new one and enable compiler
          */
-        rvjit_block_init(&vm->jit);
-        vm->jit.pc_off = 0;
-        vm->jit.virt_pc = virt_pc;
-        vm->jit.phys_pc = phys_pc;
-
-        vm->jit_compiling = true;
-        vm->block_ends = false;
+        riscv_jit_start(vm, virt_pc, phys_pc);
     }
     return false;
 }
 
+void riscv_jit_sample(rvvm_hart_t* vm)
+{
+    vaddr_t virt_pc = vm->registers[REGISTER_PC];
+    vaddr_t vpn = virt_pc >> PAGE_SHIFT;
+    paddr_t phys_pc;
+    vmptr_t ptr;
+
+    if (!vm->jit_enabled || vm->jit_compiling) return;
+    // Only sample code the hart is executing already, a TLB miss here would trap
+    if (vm->tlb[vpn & vm->tlb_mask].e != vpn) return;
+    ptr = (vmptr_t)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(virt_pc));
+    phys_pc = (size_t)(ptr - vm->mem.data) + vm->mem.begin;
+
+    if (rvjit_block_sample(&vm->jit, phys_pc)) {
+        if ((virt_pc & 0xFFF) == 0xFFE && (ptr[0] & 3) == 3) return;
+        // Block entry is hot, recompile it with the optimizing tier
+        riscv_jit_start(vm, virt_pc, phys_pc);
+        rvjit_block_optimize(&vm->jit);
+    }
+}
+
 static void riscv_jit_finalize(rvvm_hart_t* vm)
 {
     if (rvjit_block_nonempty(&vm->jit)) {
@@ -123,33 +189,107 @@ static void riscv_jit_finalize(rvvm_hart_t* vm)
 
         if (block) {
             riscv_jit_tlb_put(vm, vm->jit.virt_pc, block);
-        } else {
-            // Our cache is full, flush it
-            riscv_jit_tlb_flush(vm);
-            rvjit_flush_cache(&vm->jit);
+        }
+        if (rvjit_reclaim_pending(&vm->jit)) {
+            // Oldest cache region was evicted, reclaim it
+            riscv_jit_reclaim(vm);
         }
     }
 
     vm->jit_compiling = false;
 }
 
+/*
+ * The code cache is shared between harts, so it's only safe
+ * to reuse an evicted heap region after each hart left JIT code
+ * and dropped it's JTLB. Harts acknowledge the reclaim from their
+ * event loop, the last one actually releases the region.
+ * The counter is set to harts + 1 so it stays nonzero until
+ * the region is released, new requests are ignored meanwhile.
+ */
+void riscv_jit_reclaim(rvvm_hart_t* vm)
+{
+    rvvm_machine_t* machine = vm->machine;
+    if (vector_size(machine->harts) == 1) {
+        // No other harts to wait for, reclaim immediately
+        riscv_jit_tlb_flush(vm);
+        rvjit_reclaim(&vm->jit);
+        return;
+    }
+    spin_lock(&machine->jit_reclaim_lock);
+    // Harts are being paused, riscv_jit_reclaim_paused() takes over
+    if (!(atomic_load_uint32(&vm->pending_events) & EXT_EVENT_PAUSE)
+     && atomic_cas_uint32(&machine->jit_reclaim_acks, 0, vector_size(machine->harts) + 1)) {
+        vector_foreach(machine->harts, i) {
+            riscv_hart_queue_event(&vector_at(machine->harts, i), EXT_EVENT_JIT_RECLAIM);
+        }
+    }
+    spin_unlock(&machine->jit_reclaim_lock);
+}
+
+void riscv_jit_reclaim_ack(rvvm_hart_t* vm)
+{
+    riscv_jit_tlb_flush(vm);
+    if (atomic_sub_uint32(&vm->machine->jit_reclaim_acks, 1) == 2) {
+        rvjit_reclaim(&vm->jit);
+        atomic_store_uint32(&vm->machine->jit_reclaim_acks, 0);
+    }
+}
+
+void riscv_jit_reclaim_paused(rvvm_machine_t* machine)
+{
+    /*
+     * Paused harts never reach their event loop to acknowledge,
+     * but they also don't run JIT code, so finish the reclaim here.
+     * Stale reclaim events are dropped, otherwise the harts would
+     * acknowledge a reclaim that is already done upon resume.
+     */
+    vector_foreach(machine->harts, i) {
+        rvvm_hart_t* vm = &vector_at(machine->harts, i);
+        atomic_and_uint32(&vm->pending_events, ~EXT_EVENT_JIT_RECLAIM);
+        riscv_jit_tlb_flush(vm);
+    }
+    rvjit_reclaim(&vector_at(machine->harts, 0).jit);
+    atomic_store_uint32(&machine->jit_reclaim_acks, 0);
+}
+
 #endif
 
-static inline void riscv_emulate(rvvm_hart_t *vm, uint32_t instruction)
+static inline void riscv_jit_trace(rvvm_hart_t *vm, uint32_t instruction)
 {
 #ifdef USE_JIT
     if (unlikely(vm->jit_compiling)) {
         /*
-         * If we hit non-compilable instruction or cross page boundaries,
-         * the block is finalized.
+         * If we hit non-compilable instruction, the block is finalized.
+         * Upon crossing page boundaries, the block is extended onto the
+         * next page, unless it spans too many pages already.
          */
-        if (vm->block_ends
-        || (vm->jit.virt_pc >> PAGE_SHIFT) != (vm->registers[REGISTER_PC] >> PAGE_SHIFT)) {
+        vaddr_t pc = vm->registers[REGISTER_PC];
+        vaddr_t end = pc + (((instruction & RV_OPCODE_MASK) == RV_OPCODE_MASK) ? 3 : 1);
+        if (vm->block_ends) {
             riscv_jit_finalize(vm);
+        } else if (((vm->jit.virt_pc ^ pc) >> PAGE_SHIFT) || ((vm->jit.virt_pc ^ end) >> PAGE_SHIFT)) {
+            if (!riscv_jit_add_page(vm, pc) || !riscv_jit_add_page(vm, end)) {
+                riscv_jit_finalize(vm);
+            }
         }
         vm->block_ends = true;
     }
+#else
+    UNUSED(vm);
+    UNUSED(instruction);
 #endif
+}
+
+/*
+ * Retired instructions are batched in the dispatch loop and flushed
+ * into instret before any handler which may observe it runs
+ */
+static inline void riscv_emulate(rvvm_hart_t *vm, uint32_t instruction, uint32_t* retired)
+{
+    vm->instret += *retired;
+    *retired = 1;
+    riscv_jit_trace(vm, instruction);
     if ((instruction & RV_OPCODE_MASK) != RV_OPCODE_MASK) {
         vm->decoder.opcodes_c[riscv_c_funcid(instruction)](vm, instruction);
         // FYI: Any jump instruction implementation should take care of PC increment
@@ -160,13 +300,175 @@ static inline void riscv_emulate(rvvm_hart_t *vm, uint32_t instruction)
     }
 }
 
+// Pre-decoded instruction cache
+
+/*
+ * Pages mixing code & frequently written data would be flushed
+ * on each store, those are executed without decoding instead
+ */
+#define ICACHE_FLUSH_LIMIT 16
+
+static uint32_t riscv_icache_gen(rvvm_icache_t* icache)
+{
+    if (unlikely(icache->gen == (uint32_t)-1)) {
+        // Generation counter wrapped around, stale entries could match again
+        for (size_t i=0; i<ICACHE_PAGES; ++i) {
+            memset(icache->pages[i].insn, 0, sizeof(icache->pages[i].insn));
+            icache->pages[i].gen = i + 1;
+        }
+        icache->gen = ICACHE_PAGES;
+    }
+    return ++icache->gen;
+}
+
+void riscv_icache_init(rvvm_hart_t* vm)
+{
+    vm->icache = safe_calloc(sizeof(rvvm_icache_t), 1);
+    for (size_t i=0; i<ICACHE_PAGES; ++i) {
+        vm->icache->pages[i].page = -1;
+    }
+    riscv_icache_flush(vm);
+}
+
+void riscv_icache_free(rvvm_hart_t* vm)
+{
+    free(vm->icache);
+    vm->icache = NULL;
+}
+
+void riscv_icache_flush(rvvm_hart_t* vm)
+{
+    // Pages keep their tags, so the dispatch loop may continue on current page
+    for (size_t i=0; i<ICACHE_PAGES; ++i) {
+        vm->icache->pages[i].gen = riscv_icache_gen(vm->icache);
+    }
+}
+
+void riscv_icache_flush_page(rvvm_hart_t* vm, paddr_t paddr)
+{
+    size_t page = (paddr - vm->mem.begin) >> PAGE_SHIFT;
+    rvvm_icache_page_t* entry = &vm->icache->pages[page & (ICACHE_PAGES - 1)];
+    if (entry->page == page) {
+        entry->gen = riscv_icache_gen(vm->icache);
+        entry->flushes++;
+    }
+}
+
+/*
+ * Page is kept marked as code while it has decoded entries.
+ * Stores from other harts unmark it, in such case
+ * the entries are dropped without waiting for FENCE.I
+ */
+static void riscv_icache_validate(rvvm_hart_t* vm, rvvm_icache_page_t* page)
+{
+    if (unlikely(!riscv_page_is_code(vm, page->page))) {
+        page->gen = riscv_icache_gen(vm->icache);
+        riscv_mark_code(vm, vm->mem.begin + (page->page << PAGE_SHIFT));
+    }
+}
+
+// Returns decoded page for the instruction pointer, NULL if it shouldn't be decoded
+static NOINLINE rvvm_icache_page_t* riscv_icache_lookup(rvvm_hart_t* vm, vmptr_t ptr)
+{
+    rvvm_icache_page_t* page;
+    size_t page_id;
+    if (ptr < vm->mem.data || ptr >= vm->mem.data + vm->mem.size) return NULL;
+    page_id = (ptr - vm->mem.data) >> PAGE_SHIFT;
+    page = &vm->icache->pages[page_id & (ICACHE_PAGES - 1)];
+    if (page->page != page_id) {
+        page->page = page_id;
+        page->gen = riscv_icache_gen(vm->icache);
+        page->flushes = 0;
+    }
+    if (page->flushes > ICACHE_FLUSH_LIMIT) return NULL;
+    riscv_icache_validate(vm, page);
+    return page;
+}
+
+static void riscv_icache_insn(rvvm_hart_t* vm, const rvvm_icache_entry_t* entry)
+{
+    entry->handler(vm, entry->instruction);
+}
+
+static void riscv_icache_insn_c(rvvm_hart_t* vm, const rvvm_icache_entry_t* entry)
+{
+    entry->handler_c(vm, entry->instruction);
+}
+
+static inline void riscv_emulate_decoded(rvvm_hart_t *vm, const rvvm_icache_entry_t* entry, uint32_t* retired)
+{
+    // Entry may be dropped by the instruction itself, keep it's size
+    uint8_t size = entry->size;
+#ifndef USE_SJLJ
+    // Fast handlers never observe counters, and their traps leave the dispatch loop
+    if (unlikely(entry->func == riscv_icache_insn || entry->func == riscv_icache_insn_c))
+#endif
+    {
+        vm->instret += *retired;
+        *retired = 0;
+    }
+    riscv_jit_trace(vm, entry->instruction);
+    entry->func(vm, entry);
+    vm->registers[REGISTER_PC] += size;
+    // Fused pairs account for their second instruction themselves
+    *retired += 1;
+}
+
+static void riscv_icache_decode_insn(rvvm_hart_t* vm, rvvm_icache_page_t* page, rvvm_icache_entry_t* entry, vmptr_t ptr)
+{
+    uint32_t instruction = read_uint32_le_m(ptr);
+    if ((instruction & RV_OPCODE_MASK) != RV_OPCODE_MASK) {
+        instruction &= 0xFFFF;
+        entry->handler_c = vm->decoder.opcodes_c[riscv_c_funcid(instruction)];
+        entry->func = riscv_icache_insn_c;
+        entry->size = 2;
+    } else {
+        entry->handler = vm->decoder.opcodes[riscv_funcid(instruction)];
+        entry->func = riscv_icache_insn;
+        entry->size = 4;
+    }
+    entry->instruction = instruction;
+    entry->gen = page->gen;
+}
+
+static NOINLINE void riscv_icache_decode(rvvm_hart_t* vm, rvvm_icache_page_t* page, rvvm_icache_entry_t* entry, vmptr_t ptr)
+{
+    rvvm_icache_entry_t* next;
+    riscv_icache_validate(vm, page);
+    riscv_icache_decode_insn(vm, page, entry, ptr);
+#ifdef USE_JIT
+    // Fast handlers don't trace into JIT blocks
+    if (vm->jit_enabled) return;
+#endif
+    vm->decoder.predecode(vm, entry);
+    // Pairs are fused only within a page, next instruction is decoded along
+    if ((size_t)(entry - page->insn) * 2 + entry->size + 4 <= PAGE_SIZE) {
+        next = entry + (entry->size >> 1);
+        if (next->gen == page->gen) {
+            vm->decoder.fuse(entry, next);
+        } else {
+            riscv_icache_decode_insn(vm, page, next, ptr + entry->size);
+            vm->decoder.predecode(vm, next);
+            // Unless fused, next instruction is decoded again to be paired with it's successor
+            if (!vm->decoder.fuse(entry, next)) next->gen = 0;
+        }
+    }
+}
+
 #ifdef USE_RV64
 void riscv_decoder_init_rv64(rvvm_hart_t* vm)
 {
+    riscv_icache_flush(vm);
+    vm->decoder.predecode = riscv64_predecode;
+    vm->decoder.fuse = riscv64_fuse;
     riscv64i_init(vm);
     riscv64c_init(vm);
     riscv64m_init(vm);
     riscv64a_init(vm);
+    riscv64b_init(vm);
+#ifdef USE_VECTOR
+    riscv64v_init(vm);
+#endif
 #ifdef USE_FPU
     if (fpu_is_enabled(vm)) {
         riscv64f_enable(vm, true);
@@ -178,10 +480,17 @@ void riscv_decoder_init_rv64(rvvm_hart_t* vm)
 
 void riscv_decoder_init_rv32(rvvm_hart_t* vm)
 {
+    riscv_icache_flush(vm);
+    vm->decoder.predecode = riscv32_predecode;
+    vm->decoder.fuse = riscv32_fuse;
     riscv32i_init(vm);
     riscv32c_init(vm);
     riscv32m_init(vm);
     riscv32a_init(vm);
+    riscv32b_init(vm);
+#ifdef USE_VECTOR
+    riscv32v_init(vm);
+#endif
 #ifdef USE_FPU
     if (fpu_is_enabled(vm)) {
         riscv32f_enable(vm, true);
@@ -192,6 +501,8 @@ void riscv_decoder_init_rv32(rvvm_hart_t* vm)
 
 void riscv_decoder_enable_fpu(rvvm_hart_t* vm, bool enable)
 {
+    // Decoded entries may point to old FPU handlers
+    riscv_icache_flush(vm);
 #ifdef USE_RV64
     if (vm->rv64) {
         riscv64f_enable(vm, enable);
@@ -209,13 +520,18 @@ void riscv_decoder_enable_fpu(rvvm_hart_t* vm, bool enable)
  * Optimized dispatch loop that does not fetch each instruction,
  * and invokes MMU on page change instead.
  * This gains us about 40-60% more performance depending on workload.
+ * Instructions in RAM are decoded once into the per-hart icache,
+ * common ones get a fast handler with operands extracted upfront.
  * Attention: Any TLB flush must clear vm->wait_event to
  * restart dispatch loop, otherwise it will continue executing current page
  */
 void riscv_run_till_event(rvvm_hart_t* vm)
 {
-    size_t inst_ptr = 0;  // Updated before any read
+    rvvm_icache_page_t* page = NULL;
+    rvvm_icache_entry_t* entry;
+    vmptr_t page_ptr = NULL;
     uint32_t instruction;
+    uint32_t retired = 0;
     // page_addr should always mismatch pc by at least 1 page before execution
     vaddr_t inst_addr, page_addr = vm->registers[REGISTER_PC] + 0x1000;
 
@@ -224,14 +540,24 @@ void riscv_run_till_event(rvvm_hart_t* vm)
         vm->registers[REGISTER_ZERO] = 0;
         inst_addr = vm->registers[REGISTER_PC];
         if (likely(inst_addr - page_addr < 0xFFD)) {
-            riscv_emulate(vm, read_uint32_le_m((vmptr_t)(size_t)(inst_ptr + TLB_VADDR(inst_addr))));
+            if (likely(page)) {
+                entry = &page->insn[(inst_addr & PAGE_MASK) >> 1];
+                if (unlikely(entry->gen != page->gen)) {
+                    riscv_icache_decode(vm, page, entry, page_ptr + (inst_addr & PAGE_MASK));
+                }
+                riscv_emulate_decoded(vm, entry, &retired);
+            } else {
+                riscv_emulate(vm, read_uint32_le_m(page_ptr + (inst_addr & PAGE_MASK)), &retired);
+            }
         } else {
             if (likely(riscv_fetch_inst(vm, inst_addr, &instruction))) {
                 // Update pointer to the current page in real memory
-                inst_ptr = vm->tlb[(inst_addr >> PAGE_SHIFT) & TLB_MASK].ptr;
+                page_ptr = (vmptr_t)(size_t)(vm->tlb[(inst_addr >> PAGE_SHIFT) & vm->tlb_mask].ptr + TLB_VADDR(inst_addr & ~(vaddr_t)PAGE_MASK));
                 // If we are executing code from MMIO, direct memory fetch fails
-                page_addr = vm->tlb[(inst_addr >> PAGE_SHIFT) & TLB_MASK].e << PAGE_SHIFT;
-                riscv_emulate(vm, instruction);
+                page_addr = vm->tlb[(inst_addr >> PAGE_SHIFT) & vm->tlb_mask].e << PAGE_SHIFT;
+                page = (page_addr >> PAGE_SHIFT) == (inst_addr >> PAGE_SHIFT) ? riscv_icache_lookup(vm, page_ptr) : NULL;
+                // Leave it to the decoded path if possible, so it may be fused
+                if (!page || inst_addr - page_addr >= 0xFFD) riscv_emulate(vm, instruction, &retired);
             } else break;
         }
 #ifndef DISABLE_DISPATCH_UNROLL
@@ -241,16 +567,24 @@ void riscv_run_till_event(rvvm_hart_t* vm)
         vm->registers[REGISTER_ZERO] = 0;
         inst_addr = vm->registers[REGISTER_PC];
         if (likely(inst_addr - page_addr < 0xFFD)) {
-            riscv_emulate(vm, read_uint32_le_m((vmptr_t)(size_t)(inst_ptr + TLB_VADDR(inst_addr))));
+            if (likely(page)) {
+                entry = &page->insn[(inst_addr & PAGE_MASK) >> 1];
+                if (unlikely(entry->gen != page->gen)) {
+                    riscv_icache_decode(vm, page, entry, page_ptr + (inst_addr & PAGE_MASK));
+                }
+                riscv_emulate_decoded(vm, entry, &retired);
+            } else {
+                riscv_emulate(vm, read_uint32_le_m(page_ptr + (inst_addr & PAGE_MASK)), &retired);
+            }
         } else {
             if (likely(riscv_fetch_inst(vm, inst_addr, &instruction))) {
-                // Update pointer to the current page in real memory
-                inst_ptr = vm->tlb[(inst_addr >> PAGE_SHIFT) & TLB_MASK].ptr;
-                // If we are executing code from MMIO, direct memory fetch fails
-                page_addr = vm->tlb[(inst_addr >> PAGE_SHIFT) & TLB_MASK].e << PAGE_SHIFT;
-                riscv_emulate(vm, instruction);
+                page_ptr = (vmptr_t)(size_t)(vm->tlb[(inst_addr >> PAGE_SHIFT) & vm->tlb_mask].ptr + TLB_VADDR(inst_addr & ~(vaddr_t)PAGE_MASK));
+                page_addr = vm->tlb[(inst_addr >> PAGE_SHIFT) & vm->tlb_mask].e << PAGE_SHIFT;
+                page = (page_addr >> PAGE_SHIFT) == (inst_addr >> PAGE_SHIFT) ? riscv_icache_lookup(vm, page_ptr) : NULL;
+                if (!page || inst_addr - page_addr >= 0xFFD) riscv_emulate(vm, instruction, &retired);
             } else break;
         }
 #endif
     }
+    vm->instret += retired;
 }
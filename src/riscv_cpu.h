@@ -36,15 +36,33 @@ void riscv_decoder_init_rv32(rvvm_hart_t* vm);
 void riscv_decoder_enable_fpu(rvvm_hart_t* vm, bool enable);
 void riscv_run_till_event(rvvm_hart_t* vm);
 
+// Pre-decoded instruction cache, whole cache is dropped upon FENCE.I or decoder change
+void riscv_icache_init(rvvm_hart_t* vm);
+void riscv_icache_free(rvvm_hart_t* vm);
+void riscv_icache_flush(rvvm_hart_t* vm);
+void riscv_icache_flush_page(rvvm_hart_t* vm, paddr_t paddr);
+
 void riscv32i_init(rvvm_hart_t* vm);
 void riscv32c_init(rvvm_hart_t* vm);
 void riscv32m_init(rvvm_hart_t* vm);
 void riscv32a_init(rvvm_hart_t* vm);
+void riscv32b_init(rvvm_hart_t* vm);
+void riscv32v_init(rvvm_hart_t* vm);
 
 void riscv64i_init(rvvm_hart_t* vm);
 void riscv64c_init(rvvm_hart_t* vm);
 void riscv64m_init(rvvm_hart_t* vm);
 void riscv64a_init(rvvm_hart_t* vm);
+void riscv64b_init(rvvm_hart_t* vm);
+void riscv64v_init(rvvm_hart_t* vm);
+
+// Installs fast handlers for common base & compressed instructions into icache entry
+void riscv32_predecode(rvvm_hart_t* vm, rvvm_icache_entry_t* entry);
+void riscv64_predecode(rvvm_hart_t* vm, rvvm_icache_entry_t* entry);
+
+// Fuses entry with the following one, size of the entry becomes size of the pair
+bool riscv32_fuse(rvvm_icache_entry_t* entry, const rvvm_icache_entry_t* next);
+bool riscv64_fuse(rvvm_icache_entry_t* entry, const rvvm_icache_entry_t* next);
 
 void riscv32f_enable(rvvm_hart_t* vm, bool enable);
 void riscv32d_enable(rvvm_hart_t* vm, bool enable);
@@ -55,6 +73,28 @@ void riscv64d_enable(rvvm_hart_t* vm, bool enable);
 void riscv_illegal_insn(rvvm_hart_t* vm, const uint32_t instruction);
 void riscv_c_illegal_insn(rvvm_hart_t* vm, const uint16_t instruction);
 
+// Decodes bitmanip instructions sharing decoder slots with base instructions
+void riscv32b_insn(rvvm_hart_t* vm, const uint32_t instruction);
+void riscv64b_insn(rvvm_hart_t* vm, const uint32_t instruction);
+
+// Decodes scalar crypto instructions, bitmanip decoder passes unknown encodings here
+void riscv32k_insn(rvvm_hart_t* vm, const uint32_t instruction);
+void riscv64k_insn(rvvm_hart_t* vm, const uint32_t instruction);
+
+#ifdef USE_JIT
+// Reclaims evicted region of the JIT cache shared between harts of the machine
+void riscv_jit_reclaim(rvvm_hart_t* vm);
+
+// Acknowledges pending cache reclaim, should be called outside of JIT code
+void riscv_jit_reclaim_ack(rvvm_hart_t* vm);
+
+// Finishes pending cache reclaim once all harts of the machine are paused
+void riscv_jit_reclaim_paused(rvvm_machine_t* machine);
+
+// Profiles guest PC upon timer events, hot blocks are recompiled by the optimizing tier
+void riscv_jit_sample(rvvm_hart_t* vm);
+#endif
+
 static inline void riscv_jit_discard(rvvm_hart_t* vm)
 {
 #ifdef USE_JIT
@@ -81,6 +121,13 @@ static inline void riscv_jit_compile(rvvm_hart_t* vm)
 
 NOINLINE bool riscv_jit_lookup(rvvm_hart_t* vm);
 
+// Account a return from JIT code to the dispatcher
+static inline void riscv_jit_exit(rvvm_hart_t* vm)
+{
+    riscv_hpm_event(vm, HPM_EVENT_JIT_EXIT);
+    rvjit_stats_exit(&vm->jit_exit);
+}
+
 static inline bool riscv_jit_tlb_lookup(rvvm_hart_t* vm)
 {
     vaddr_t pc, tpc, entry;
@@ -95,6 +142,7 @@ static inline bool riscv_jit_tlb_lookup(rvvm_hart_t* vm)
     tpc = vm->jtlb[entry].pc;
     if (likely(pc == tpc)) {
         vm->jtlb[entry].block(vm);
+        riscv_jit_exit(vm);
         if (likely(tries++ < 10)) goto trace;
         return true;
     } else if (tries == 0) {
@@ -110,11 +158,13 @@ static inline bool riscv_jit_tlb_lookup(rvvm_hart_t* vm)
 do { \
     if (!vm->jit_compiling && riscv_jit_tlb_lookup(vm)) { \
         vm->registers[REGISTER_PC] -= inst_size; \
+        vm->instret--; \
         return; \
     } \
     if (vm->jit_compiling) { \
         intrinsic; \
         vm->jit.pc_off += inst_size; \
+        vm->jit.insns++; \
         vm->block_ends = false; \
     } \
 } while (0)
@@ -133,12 +183,14 @@ do { \
     if (!vm->jit_compiling && vm->ldst_trace && riscv_jit_tlb_lookup(vm)) { \
         vm->ldst_trace = pc != vm->registers[REGISTER_PC]; \
         vm->registers[REGISTER_PC] -= inst_size; \
+        vm->instret--; \
         return; \
     } \
     vm->ldst_trace = true; \
     if (vm->jit_compiling) { \
         intrinsic; \
         vm->jit.pc_off += inst_size; \
+        vm->jit.insns++; \
         vm->block_ends = false; \
     } \
 } while (0)
@@ -149,11 +201,13 @@ do { \
 do { \
     if (!vm->jit_compiling && riscv_jit_tlb_lookup(vm)) { \
         vm->registers[REGISTER_PC] -= inst_size; \
+        vm->instret--; \
         return; \
     } \
     if (vm->jit_compiling) { \
         intrinsic; \
         vm->jit.pc_off += offset; \
+        vm->jit.insns++; \
         vm->block_ends = vm->jit.size > BRANCH_MAX_BLOCK_SIZE; \
     } \
 } while (0)
@@ -162,6 +216,7 @@ do { \
 #define RVVM_RVJIT_COMPILE_JALR(intrinsic) \
 do { \
     if (vm->jit_compiling) { \
+        vm->jit.insns++; \
         intrinsic; \
     } \
 } while (0)
@@ -171,10 +226,12 @@ do { \
 do { \
     if (!vm->jit_compiling && riscv_jit_tlb_lookup(vm)) { \
         vm->registers[REGISTER_PC] -= inst_size; \
+        vm->instret--; \
         return; \
     } \
     if (vm->jit_compiling) { \
         vm->jit.pc_off += falthrough_off; \
+        vm->jit.insns++; \
         intrinsic; \
         vm->jit.pc_off += (target_off - falthrough_off); \
         vm->block_ends = vm->jit.size > BRANCH_MAX_BLOCK_SIZE; \
@@ -204,7 +261,7 @@ do { \
 #define rvjit_sltu(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE(rvjit64_sltu(&vm->jit, rds, rs1, rs2), size)
 #define rvjit_li(rds, imm, size)         RVVM_RVJIT_TRACE(rvjit64_li(&vm->jit, rds, imm), size)
 #define rvjit_auipc(rds, imm, size)      RVVM_RVJIT_TRACE(rvjit64_auipc(&vm->jit, rds, imm), size)
-#define rvjit_jal(rds, imm, size)        RVVM_RVJIT_TRACE_JAL(rvjit64_auipc(&vm->jit, rds, size), imm, size)
+#define rvjit_jal(rds, imm, size)        RVVM_RVJIT_TRACE_JAL(rvjit64_jal(&vm->jit, rds, size), imm, size)
 #define rvjit_jalr(rds, rs, imm, size)   RVVM_RVJIT_COMPILE_JALR(rvjit64_jalr(&vm->jit, rds, rs, imm, size))
 
 #define rvjit_addw(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE(rvjit64_addw(&vm->jit, rds, rs1, rs2), size)
@@ -274,7 +331,7 @@ do { \
 #define rvjit_sltu(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE(rvjit32_sltu(&vm->jit, rds, rs1, rs2), size)
 #define rvjit_li(rds, imm, size)         RVVM_RVJIT_TRACE(rvjit32_li(&vm->jit, rds, imm), size)
 #define rvjit_auipc(rds, imm, size)      RVVM_RVJIT_TRACE(rvjit32_auipc(&vm->jit, rds, imm), size)
-#define rvjit_jal(rds, imm, size)        RVVM_RVJIT_TRACE_JAL(rvjit32_auipc(&vm->jit, rds, size), imm, size)
+#define rvjit_jal(rds, imm, size)        RVVM_RVJIT_TRACE_JAL(rvjit32_jal(&vm->jit, rds, size), imm, size)
 #define rvjit_jalr(rds, rs, imm, size)   RVVM_RVJIT_COMPILE_JALR(rvjit32_jalr(&vm->jit, rds, rs, imm, size))
 
 #define rvjit_sb(rds, rs1, off, size)    RVVM_RVJIT_TRACE_LDST(rvjit32_sb(&vm->jit, rds, rs1, off), size)
@@ -380,6 +437,287 @@ do { \
 
 #endif
 
+// Atomics are traced like loads/stores, backend has to provide native atomic ops
+#if defined(USE_JIT) && defined(RVJIT_NATIVE_ATOMICS) && (defined(RVJIT_NATIVE_64BIT) || !defined(RV64))
+#ifdef RV64
+#define rvjit_lr_w(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit64_lrw(&vm->jit, rds, rs1), size)
+#define rvjit_sc_w(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit64_scw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoswap_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amoswapw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoadd_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoaddw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoand_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoandw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoor_w(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE_LDST(rvjit64_amoorw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoxor_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoxorw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomin_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amominw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomax_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amomaxw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amominu_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amominuw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomaxu_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amomaxuw(&vm->jit, rds, rs1, rs2), size)
+
+#define rvjit_lr_d(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit64_lr(&vm->jit, rds, rs1), size)
+#define rvjit_sc_d(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit64_sc(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoswap_d(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amoswap(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoadd_d(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoadd(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoand_d(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoand(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoor_d(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE_LDST(rvjit64_amoor(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoxor_d(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amoxor(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomin_d(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amomin(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomax_d(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit64_amomax(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amominu_d(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amominu(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomaxu_d(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit64_amomaxu(&vm->jit, rds, rs1, rs2), size)
+#else
+#define rvjit_lr_w(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit32_lr(&vm->jit, rds, rs1), size)
+#define rvjit_sc_w(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit32_sc(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoswap_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit32_amoswap(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoadd_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit32_amoadd(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoand_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit32_amoand(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoor_w(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE_LDST(rvjit32_amoor(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amoxor_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit32_amoxor(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomin_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit32_amomin(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomax_w(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_LDST(rvjit32_amomax(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amominu_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit32_amominu(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_amomaxu_w(rds, rs1, rs2, size)RVVM_RVJIT_TRACE_LDST(rvjit32_amomaxu(&vm->jit, rds, rs1, rs2), size)
+#endif
+#else
+#define rvjit_lr_w(rds, rs1, size)
+#define rvjit_sc_w(rds, rs1, rs2, size)
+#define rvjit_amoswap_w(rds, rs1, rs2, size)
+#define rvjit_amoadd_w(rds, rs1, rs2, size)
+#define rvjit_amoand_w(rds, rs1, rs2, size)
+#define rvjit_amoor_w(rds, rs1, rs2, size)
+#define rvjit_amoxor_w(rds, rs1, rs2, size)
+#define rvjit_amomin_w(rds, rs1, rs2, size)
+#define rvjit_amomax_w(rds, rs1, rs2, size)
+#define rvjit_amominu_w(rds, rs1, rs2, size)
+#define rvjit_amomaxu_w(rds, rs1, rs2, size)
+
+#define rvjit_lr_d(rds, rs1, size)
+#define rvjit_sc_d(rds, rs1, rs2, size)
+#define rvjit_amoswap_d(rds, rs1, rs2, size)
+#define rvjit_amoadd_d(rds, rs1, rs2, size)
+#define rvjit_amoand_d(rds, rs1, rs2, size)
+#define rvjit_amoor_d(rds, rs1, rs2, size)
+#define rvjit_amoxor_d(rds, rs1, rs2, size)
+#define rvjit_amomin_d(rds, rs1, rs2, size)
+#define rvjit_amomax_d(rds, rs1, rs2, size)
+#define rvjit_amominu_d(rds, rs1, rs2, size)
+#define rvjit_amomaxu_d(rds, rs1, rs2, size)
+#endif
+
+// Bitmanip ops are traced only when the host has a native lowering for them
+#define RVVM_RVJIT_TRACE_IF(cond, intrinsic, inst_size) \
+do { \
+    if (cond) RVVM_RVJIT_TRACE(intrinsic, inst_size); \
+} while (0)
+
+#if defined(USE_JIT) && defined(RVJIT_NATIVE_BITMANIP) && (defined(RVJIT_NATIVE_64BIT) || !defined(RV64))
+#ifdef RV64
+#define RVVM_RVJIT_B(instr) rvjit64_##instr
+#else
+#define RVVM_RVJIT_B(instr) rvjit32_##instr
+#endif
+#define rvjit_andn(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(andn)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_orn(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(RVVM_RVJIT_B(orn)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_xnor(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(xnor)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_min(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(RVVM_RVJIT_B(min)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_minu(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(minu)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_max(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(RVVM_RVJIT_B(max)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_maxu(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(maxu)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_rol(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(RVVM_RVJIT_B(rol)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_ror(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(RVVM_RVJIT_B(ror)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh1add(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(RVVM_RVJIT_B(sh1add)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh2add(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(RVVM_RVJIT_B(sh2add)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh3add(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(RVVM_RVJIT_B(sh3add)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_bset(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bset)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_bclr(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bclr)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_binv(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(binv)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_bext(rds, rs1, rs2, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bext)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_clmul(rds, rs1, rs2, size)  RVVM_RVJIT_TRACE_IF(rvjit_clmul_native(), RVVM_RVJIT_B(clmul)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_clmulh(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_IF(rvjit_clmul_native(), RVVM_RVJIT_B(clmulh)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_clmulr(rds, rs1, rs2, size) RVVM_RVJIT_TRACE_IF(rvjit_clmul_native(), RVVM_RVJIT_B(clmulr)(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_clz(rds, rs1, size)         RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), RVVM_RVJIT_B(clz)(&vm->jit, rds, rs1), size)
+#define rvjit_ctz(rds, rs1, size)         RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), RVVM_RVJIT_B(ctz)(&vm->jit, rds, rs1), size)
+#define rvjit_cpop(rds, rs1, size)        RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), RVVM_RVJIT_B(cpop)(&vm->jit, rds, rs1), size)
+#define rvjit_sext_b(rds, rs1, size)      RVVM_RVJIT_TRACE(RVVM_RVJIT_B(sext_b)(&vm->jit, rds, rs1), size)
+#define rvjit_sext_h(rds, rs1, size)      RVVM_RVJIT_TRACE(RVVM_RVJIT_B(sext_h)(&vm->jit, rds, rs1), size)
+#define rvjit_zext_h(rds, rs1, size)      RVVM_RVJIT_TRACE(RVVM_RVJIT_B(zext_h)(&vm->jit, rds, rs1), size)
+#define rvjit_rev8(rds, rs1, size)        RVVM_RVJIT_TRACE(RVVM_RVJIT_B(rev8)(&vm->jit, rds, rs1), size)
+#define rvjit_rori(rds, rs1, imm, size)   RVVM_RVJIT_TRACE(RVVM_RVJIT_B(rori)(&vm->jit, rds, rs1, imm), size)
+#define rvjit_bseti(rds, rs1, imm, size)  RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bseti)(&vm->jit, rds, rs1, imm), size)
+#define rvjit_bclri(rds, rs1, imm, size)  RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bclri)(&vm->jit, rds, rs1, imm), size)
+#define rvjit_binvi(rds, rs1, imm, size)  RVVM_RVJIT_TRACE(RVVM_RVJIT_B(binvi)(&vm->jit, rds, rs1, imm), size)
+#define rvjit_bexti(rds, rs1, imm, size)  RVVM_RVJIT_TRACE(RVVM_RVJIT_B(bexti)(&vm->jit, rds, rs1, imm), size)
+#ifdef RV64
+#define rvjit_add_uw(rds, rs1, rs2, size)    RVVM_RVJIT_TRACE(rvjit64_add_uw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh1add_uw(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(rvjit64_sh1add_uw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh2add_uw(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(rvjit64_sh2add_uw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_sh3add_uw(rds, rs1, rs2, size) RVVM_RVJIT_TRACE(rvjit64_sh3add_uw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_rolw(rds, rs1, rs2, size)      RVVM_RVJIT_TRACE(rvjit64_rolw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_rorw(rds, rs1, rs2, size)      RVVM_RVJIT_TRACE(rvjit64_rorw(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_clzw(rds, rs1, size)           RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), rvjit64_clzw(&vm->jit, rds, rs1), size)
+#define rvjit_ctzw(rds, rs1, size)           RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), rvjit64_ctzw(&vm->jit, rds, rs1), size)
+#define rvjit_cpopw(rds, rs1, size)          RVVM_RVJIT_TRACE_IF(rvjit_bitcnt_native(), rvjit64_cpopw(&vm->jit, rds, rs1), size)
+#define rvjit_slli_uw(rds, rs1, imm, size)   RVVM_RVJIT_TRACE(rvjit64_slli_uw(&vm->jit, rds, rs1, imm), size)
+#define rvjit_roriw(rds, rs1, imm, size)     RVVM_RVJIT_TRACE(rvjit64_roriw(&vm->jit, rds, rs1, imm), size)
+#endif
+#else
+#define rvjit_andn(rds, rs1, rs2, size)
+#define rvjit_orn(rds, rs1, rs2, size)
+#define rvjit_xnor(rds, rs1, rs2, size)
+#define rvjit_min(rds, rs1, rs2, size)
+#define rvjit_minu(rds, rs1, rs2, size)
+#define rvjit_max(rds, rs1, rs2, size)
+#define rvjit_maxu(rds, rs1, rs2, size)
+#define rvjit_rol(rds, rs1, rs2, size)
+#define rvjit_ror(rds, rs1, rs2, size)
+#define rvjit_sh1add(rds, rs1, rs2, size)
+#define rvjit_sh2add(rds, rs1, rs2, size)
+#define rvjit_sh3add(rds, rs1, rs2, size)
+#define rvjit_bset(rds, rs1, rs2, size)
+#define rvjit_bclr(rds, rs1, rs2, size)
+#define rvjit_binv(rds, rs1, rs2, size)
+#define rvjit_bext(rds, rs1, rs2, size)
+#define rvjit_clmul(rds, rs1, rs2, size)
+#define rvjit_clmulh(rds, rs1, rs2, size)
+#define rvjit_clmulr(rds, rs1, rs2, size)
+#define rvjit_clz(rds, rs1, size)
+#define rvjit_ctz(rds, rs1, size)
+#define rvjit_cpop(rds, rs1, size)
+#define rvjit_sext_b(rds, rs1, size)
+#define rvjit_sext_h(rds, rs1, size)
+#define rvjit_zext_h(rds, rs1, size)
+#define rvjit_rev8(rds, rs1, size)
+#define rvjit_rori(rds, rs1, imm, size)
+#define rvjit_bseti(rds, rs1, imm, size)
+#define rvjit_bclri(rds, rs1, imm, size)
+#define rvjit_binvi(rds, rs1, imm, size)
+#define rvjit_bexti(rds, rs1, imm, size)
+#define rvjit_add_uw(rds, rs1, rs2, size)
+#define rvjit_sh1add_uw(rds, rs1, rs2, size)
+#define rvjit_sh2add_uw(rds, rs1, rs2, size)
+#define rvjit_sh3add_uw(rds, rs1, rs2, size)
+#define rvjit_rolw(rds, rs1, rs2, size)
+#define rvjit_rorw(rds, rs1, rs2, size)
+#define rvjit_clzw(rds, rs1, size)
+#define rvjit_ctzw(rds, rs1, size)
+#define rvjit_cpopw(rds, rs1, size)
+#define rvjit_slli_uw(rds, rs1, imm, size)
+#define rvjit_roriw(rds, rs1, imm, size)
+#endif
+
+// FPU instructions are traced like loads/stores, since they may exit the block
+#if defined(USE_JIT) && defined(USE_FPU) && defined(RVJIT_NATIVE_FPU)
+#define rvjit_flw(rds, rs1, off, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_flw(&vm->jit, rds, rs1, off), size)
+#define rvjit_fsw(rds, rs1, off, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsw(&vm->jit, rds, rs1, off), size)
+#define rvjit_fld(rds, rs1, off, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fld(&vm->jit, rds, rs1, off), size)
+#define rvjit_fsd(rds, rs1, off, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsd(&vm->jit, rds, rs1, off), size)
+
+#define rvjit_fadd_s(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fadd_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsub_s(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsub_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fmul_s(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmul_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fdiv_s(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fdiv_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnj_s(rds, rs1, rs2, size)      RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnj_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnjn_s(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnjn_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnjx_s(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnjx_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_feq_s(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_feq_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_flt_s(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_flt_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fle_s(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fle_s(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fmadd_s(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmadd_s(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fmsub_s(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmsub_s(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fnmsub_s(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fnmsub_s(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fnmadd_s(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fnmadd_s(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fsqrt_s(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsqrt_s(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_s_w(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_s_w(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_s_wu(rds, rs1, size)         RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_s_wu(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_s_l(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_s_l(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_w_s(rds, rs1, rtz, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_w_s(&vm->jit, rds, rs1, rtz), size)
+#define rvjit_fcvt_wu_s(rds, rs1, rtz, size)    RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_wu_s(&vm->jit, rds, rs1, rtz), size)
+#define rvjit_fcvt_l_s(rds, rs1, rtz, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_l_s(&vm->jit, rds, rs1, rtz), size)
+
+#define rvjit_fadd_d(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fadd_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsub_d(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsub_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fmul_d(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmul_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fdiv_d(rds, rs1, rs2, size)       RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fdiv_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnj_d(rds, rs1, rs2, size)      RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnj_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnjn_d(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnjn_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fsgnjx_d(rds, rs1, rs2, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsgnjx_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_feq_d(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_feq_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_flt_d(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_flt_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fle_d(rds, rs1, rs2, size)        RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fle_d(&vm->jit, rds, rs1, rs2), size)
+#define rvjit_fmadd_d(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmadd_d(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fmsub_d(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmsub_d(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fnmsub_d(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fnmsub_d(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fnmadd_d(rds, rs1, rs2, rs3, size) RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fnmadd_d(&vm->jit, rds, rs1, rs2, rs3), size)
+#define rvjit_fsqrt_d(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fsqrt_d(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_d_w(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_d_w(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_d_wu(rds, rs1, size)         RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_d_wu(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_d_l(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_d_l(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_w_d(rds, rs1, rtz, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_w_d(&vm->jit, rds, rs1, rtz), size)
+#define rvjit_fcvt_wu_d(rds, rs1, rtz, size)    RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_wu_d(&vm->jit, rds, rs1, rtz), size)
+#define rvjit_fcvt_l_d(rds, rs1, rtz, size)     RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_l_d(&vm->jit, rds, rs1, rtz), size)
+
+#define rvjit_fcvt_s_d(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_s_d(&vm->jit, rds, rs1), size)
+#define rvjit_fcvt_d_s(rds, rs1, size)          RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fcvt_d_s(&vm->jit, rds, rs1), size)
+#define rvjit_fmv_x_w(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmv_x_w(&vm->jit, rds, rs1), size)
+#define rvjit_fmv_w_x(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmv_w_x(&vm->jit, rds, rs1), size)
+#define rvjit_fmv_x_d(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmv_x_d(&vm->jit, rds, rs1), size)
+#define rvjit_fmv_d_x(rds, rs1, size)           RVVM_RVJIT_TRACE_LDST(rvjit_fpu_fmv_d_x(&vm->jit, rds, rs1), size)
+#else
+#define rvjit_flw(rds, rs1, off, size)
+#define rvjit_fsw(rds, rs1, off, size)
+#define rvjit_fld(rds, rs1, off, size)
+#define rvjit_fsd(rds, rs1, off, size)
+
+#define rvjit_fadd_s(rds, rs1, rs2, size)
+#define rvjit_fsub_s(rds, rs1, rs2, size)
+#define rvjit_fmul_s(rds, rs1, rs2, size)
+#define rvjit_fdiv_s(rds, rs1, rs2, size)
+#define rvjit_fsgnj_s(rds, rs1, rs2, size)
+#define rvjit_fsgnjn_s(rds, rs1, rs2, size)
+#define rvjit_fsgnjx_s(rds, rs1, rs2, size)
+#define rvjit_feq_s(rds, rs1, rs2, size)
+#define rvjit_flt_s(rds, rs1, rs2, size)
+#define rvjit_fle_s(rds, rs1, rs2, size)
+#define rvjit_fmadd_s(rds, rs1, rs2, rs3, size)
+#define rvjit_fmsub_s(rds, rs1, rs2, rs3, size)
+#define rvjit_fnmsub_s(rds, rs1, rs2, rs3, size)
+#define rvjit_fnmadd_s(rds, rs1, rs2, rs3, size)
+#define rvjit_fsqrt_s(rds, rs1, size)
+#define rvjit_fcvt_s_w(rds, rs1, size)
+#define rvjit_fcvt_s_wu(rds, rs1, size)
+#define rvjit_fcvt_s_l(rds, rs1, size)
+#define rvjit_fcvt_w_s(rds, rs1, rtz, size)
+#define rvjit_fcvt_wu_s(rds, rs1, rtz, size)
+#define rvjit_fcvt_l_s(rds, rs1, rtz, size)
+
+#define rvjit_fadd_d(rds, rs1, rs2, size)
+#define rvjit_fsub_d(rds, rs1, rs2, size)
+#define rvjit_fmul_d(rds, rs1, rs2, size)
+#define rvjit_fdiv_d(rds, rs1, rs2, size)
+#define rvjit_fsgnj_d(rds, rs1, rs2, size)
+#define rvjit_fsgnjn_d(rds, rs1, rs2, size)
+#define rvjit_fsgnjx_d(rds, rs1, rs2, size)
+#define rvjit_feq_d(rds, rs1, rs2, size)
+#define rvjit_flt_d(rds, rs1, rs2, size)
+#define rvjit_fle_d(rds, rs1, rs2, size)
+#define rvjit_fmadd_d(rds, rs1, rs2, rs3, size)
+#define rvjit_fmsub_d(rds, rs1, rs2, rs3, size)
+#define rvjit_fnmsub_d(rds, rs1, rs2, rs3, size)
+#define rvjit_fnmadd_d(rds, rs1, rs2, rs3, size)
+#define rvjit_fsqrt_d(rds, rs1, size)
+#define rvjit_fcvt_d_w(rds, rs1, size)
+#define rvjit_fcvt_d_wu(rds, rs1, size)
+#define rvjit_fcvt_d_l(rds, rs1, size)
+#define rvjit_fcvt_w_d(rds, rs1, rtz, size)
+#define rvjit_fcvt_wu_d(rds, rs1, rtz, size)
+#define rvjit_fcvt_l_d(rds, rs1, rtz, size)
+
+#define rvjit_fcvt_s_d(rds, rs1, size)
+#define rvjit_fcvt_d_s(rds, rs1, size)
+#define rvjit_fmv_x_w(rds, rs1, size)
+#define rvjit_fmv_w_x(rds, rs1, size)
+#define rvjit_fmv_x_d(rds, rs1, size)
+#define rvjit_fmv_d_x(rds, rs1, size)
+#endif
+
 #ifdef RV64
     typedef uint64_t xlen_t;
     typedef int64_t sxlen_t;
@@ -390,6 +728,12 @@ do { \
     #define riscv_c_init riscv64c_init
     #define riscv_m_init riscv64m_init
     #define riscv_a_init riscv64a_init
+    #define riscv_b_init riscv64b_init
+    #define riscv_b_insn riscv64b_insn
+    #define riscv_k_insn riscv64k_insn
+    #define riscv_predecode riscv64_predecode
+    #define riscv_fuse riscv64_fuse
+    #define riscv_v_init riscv64v_init
     #define riscv_f_enable riscv64f_enable
     #define riscv_d_enable riscv64d_enable
 #else
@@ -402,6 +746,12 @@ do { \
     #define riscv_c_init riscv32c_init
     #define riscv_m_init riscv32m_init
     #define riscv_a_init riscv32a_init
+    #define riscv_b_init riscv32b_init
+    #define riscv_b_insn riscv32b_insn
+    #define riscv_k_insn riscv32k_insn
+    #define riscv_predecode riscv32_predecode
+    #define riscv_fuse riscv32_fuse
+    #define riscv_v_init riscv32v_init
     #define riscv_f_enable riscv32f_enable
     #define riscv_d_enable riscv32d_enable
 #endif
@@ -524,6 +874,16 @@ static inline regid_t riscv_c_reg(regid_t reg)
 #define RV64I_LD          0x60
 #define RV64I_SD          0x68
 
+/*
+ * RV64B-only instructions
+ */
+
+// R-type instructions
+#define RV64B_SLLI_UW     0x126
+#define RV64B_SH1ADD_UW   0x4E
+#define RV64B_SH2ADD_UW   0x8E
+#define RV64B_SH3ADD_UW   0xCE
+
 /*
  * RVC Compressed instructions
  */
@@ -616,5 +976,25 @@ static inline regid_t riscv_c_reg(regid_t reg)
 /* except FCVT.S.D */
 #define RVD_OTHER        0x114 /* R + funct3 + funct7 a bunch */
 
+/*
+ * RVV Vector instructions
+ */
+#define RVV_LOAD_E8      0x01 /* ISB */
+#define RVV_LOAD_E16     0xA1 /* ISB */
+#define RVV_LOAD_E32     0xC1 /* ISB */
+#define RVV_LOAD_E64     0xE1 /* ISB */
+#define RVV_STORE_E8     0x09 /* ISB */
+#define RVV_STORE_E16    0xA9 /* ISB */
+#define RVV_STORE_E32    0xC9 /* ISB */
+#define RVV_STORE_E64    0xE9 /* ISB */
+#define RVV_OPIVV        0x15 /* ISB */
+#define RVV_OPFVV        0x35 /* ISB */
+#define RVV_OPMVV        0x55 /* ISB */
+#define RVV_OPIVI        0x75 /* ISB */
+#define RVV_OPIVX        0x95 /* ISB */
+#define RVV_OPFVF        0xB5 /* ISB */
+#define RVV_OPMVX        0xD5 /* ISB */
+#define RVV_OPCFG        0xF5 /* ISB */
+
 #endif
 #endif
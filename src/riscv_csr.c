@@ -32,10 +32,11 @@ riscv_csr_handler_t riscv_csr_list[4096];
 #define CSR_MARCHID 0x5256564D // 'RVVM'
 
 // no N extension, U_x bits are hardwired to 0
-#define CSR_MSTATUS_MASK 0x7E79AA
-#define CSR_SSTATUS_MASK 0x0C6122
+#define CSR_MSTATUS_MASK 0x7E7FAA
+#define CSR_SSTATUS_MASK 0x0C6722
 
 #define CSR_STATUS_FS_MASK 0x6000
+#define CSR_STATUS_VS_MASK 0x600
 
 #define CSR_MEIP_MASK    0xAAA
 #define CSR_SEIP_MASK    0x222
@@ -77,6 +78,17 @@ static inline void csr_helper_masked(maxlen_t* csr, maxlen_t* dest, maxlen_t mas
 
 static inline void csr_status_helper(rvvm_hart_t* vm, maxlen_t* dest, maxlen_t mask, uint8_t op)
 {
+#if defined(USE_FPU) || defined(USE_VECTOR)
+    bool sd_dirty = false;
+    maxlen_t sd_mask = 0x80000000U;
+#ifdef USE_RV64
+    if (vm->rv64) {
+        sd_mask = 0x8000000000000000ULL;
+    }
+#endif
+    mask |= sd_mask;
+#endif
+
 #ifdef USE_FPU
     bool fpu_was_enabled = bit_cut(vm->csr.status, 13, 2) != FS_OFF;
 #ifndef USE_PRECISE_FS
@@ -84,22 +96,28 @@ static inline void csr_status_helper(rvvm_hart_t* vm, maxlen_t* dest, maxlen_t m
         vm->csr.status = bit_replace(vm->csr.status, 13, 2, FS_DIRTY);
     }
 #endif
-    maxlen_t sd_mask = 0x80000000U;
-#ifdef USE_RV64
-    if (vm->rv64) {
-        sd_mask = 0x8000000000000000ULL;
+    sd_dirty = bit_cut(vm->csr.status, 13, 2) == FS_DIRTY;
+#else
+    mask = bit_replace(mask, 13, 2, 0);
+#endif
+
+#ifdef USE_VECTOR
+    // Vector state is not tracked precisely, enabled unit is always dirty
+    if (vector_is_enabled(vm)) {
+        vm->csr.status = bit_replace(vm->csr.status, 9, 2, VS_DIRTY);
+        sd_dirty = true;
     }
+#else
+    mask = bit_replace(mask, 9, 2, 0);
 #endif
-    mask |= sd_mask;
-    
+
+#if defined(USE_FPU) || defined(USE_VECTOR)
     // Set SD bit
-    if (bit_cut(vm->csr.status, 13, 2) == FS_DIRTY) {
+    if (sd_dirty) {
         vm->csr.status |= sd_mask;
     } else {
         vm->csr.status &= ~sd_mask;
     }
-#else
-    mask = bit_replace(mask, 13, 2, 0);
 #endif
 
 #ifdef USE_RV64
@@ -217,10 +235,9 @@ static bool riscv_csr_misa(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
         riscv_update_xlen(vm);
     }
 #endif
+    *dest = vm->csr.isa | riscv_mkmisa("IMACBSU");
 #ifdef USE_FPU
-    *dest = vm->csr.isa | riscv_mkmisa("IMAFDCSU");
-#else
-    *dest = vm->csr.isa | riscv_mkmisa("IMACSU");
+    *dest |= riscv_mkmisa("FD");
 #endif
     return true;
 }
@@ -342,27 +359,26 @@ static bool riscv_csr_sip(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
 static bool riscv_csr_satp(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
 {
     uint8_t prev_mmu = vm->mmu_mode;
+    uint32_t prev_asid = vm->asid;
 #ifdef USE_RV64
     if (vm->rv64) {
-        maxlen_t satp = (((maxlen_t)vm->mmu_mode) << 60) | (vm->root_page_table >> PAGE_SHIFT);
+        maxlen_t satp = (((maxlen_t)vm->mmu_mode) << 60) | (((maxlen_t)vm->asid) << 44) | (vm->root_page_table >> PAGE_SHIFT);
         csr_helper(&satp, dest, op);
         vm->mmu_mode = satp >> 60;
+        vm->asid = bit_cut(satp, 44, 16);
         vm->root_page_table = (satp & bit_mask(44)) << PAGE_SHIFT;
     } else {
 #endif
-        maxlen_t satp = (((maxlen_t)vm->mmu_mode) << 31) | (vm->root_page_table >> PAGE_SHIFT);
+        maxlen_t satp = (((maxlen_t)vm->mmu_mode) << 31) | (((maxlen_t)vm->asid) << 22) | (vm->root_page_table >> PAGE_SHIFT);
         csr_helper(&satp, dest, op);
         vm->mmu_mode = satp >> 31;
+        vm->asid = bit_cut(satp, 22, 9);
         vm->root_page_table = (satp & bit_mask(22)) << PAGE_SHIFT;
 #ifdef USE_RV64
     }
 #endif
-    /*
-    * We currently cache physical addresses in TLB as well, so switching
-    * between bare/virtual modes will pollute the address space with illegal entries
-    * Hence, a TLB flush is required on switch
-    */
-    if (!!vm->mmu_mode != !!prev_mmu) riscv_tlb_flush(vm);
+    // Each address space has its own TLB context, see riscv_mmu.c
+    if (vm->mmu_mode != prev_mmu || vm->asid != prev_asid) riscv_tlb_switch(vm);
     return true;
 }
 
@@ -489,6 +505,81 @@ static bool riscv_csr_fcsr(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
 
 #endif
 
+#ifdef USE_VECTOR
+
+// Read-only vector state, any write attempt is illegal
+static inline bool csr_vector_ro_helper(maxlen_t val, maxlen_t* dest, uint8_t op)
+{
+    bool csr_read = op != CSR_SWAP && *dest == 0;
+    *dest = val;
+    return csr_read;
+}
+
+static bool riscv_csr_vstart(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    // Enough bits to index any element of a register group
+    csr_helper_masked(&vm->csr.vstart, dest, VECTOR_REG_SIZE * 8 - 1, op);
+    return true;
+}
+
+static bool riscv_csr_vxsat(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    csr_helper_masked(&vm->csr.vcsr, dest, 0x1, op);
+    return true;
+}
+
+static bool riscv_csr_vxrm(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    maxlen_t val = bit_cut(vm->csr.vcsr, 1, 2);
+    csr_helper_masked(&val, dest, 0x3, op);
+    vm->csr.vcsr = bit_replace(vm->csr.vcsr, 1, 2, val);
+    return true;
+}
+
+static bool riscv_csr_vcsr(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    csr_helper_masked(&vm->csr.vcsr, dest, 0x7, op);
+    return true;
+}
+
+static bool riscv_csr_vl(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    return csr_vector_ro_helper(vm->csr.vl, dest, op);
+}
+
+static bool riscv_csr_vtype(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    return csr_vector_ro_helper(vm->csr.vtype, dest, op);
+}
+
+static bool riscv_csr_vlenb(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    if (!vector_is_enabled(vm)) {
+        return false;
+    }
+    return csr_vector_ro_helper(VECTOR_REG_SIZE, dest, op);
+}
+
+#endif
+
 static bool riscv_csr_time(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
 {
     UNUSED(op);
@@ -504,6 +595,181 @@ static bool riscv_csr_timeh(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
     return true;
 }
 
+/*
+ * Counters
+ * There is no cycle model, so mcycle counts retired instructions as well
+ */
+
+static int riscv_hpm_event_id(maxlen_t sel)
+{
+    switch (sel) {
+        case HPM_SEL_DTLB_LOAD_MISS:  return HPM_EVENT_DTLB_LOAD_MISS;
+        case HPM_SEL_DTLB_STORE_MISS: return HPM_EVENT_DTLB_STORE_MISS;
+        case HPM_SEL_ITLB_MISS:       return HPM_EVENT_ITLB_MISS;
+        case HPM_SEL_MMIO:            return HPM_EVENT_MMIO;
+        case HPM_SEL_TRAP:            return HPM_EVENT_TRAP;
+        case HPM_SEL_JIT_EXIT:        return HPM_EVENT_JIT_EXIT;
+    }
+    return -1;
+}
+
+static uint64_t riscv_counter_source(rvvm_hart_t* vm, uint32_t id)
+{
+    if (id < 3) return vm->instret;
+    int event = riscv_hpm_event_id(vm->csr.hpmevent[id]);
+    return event >= 0 ? vm->hpm_events[event] : 0;
+}
+
+static uint64_t riscv_counter_get(rvvm_hart_t* vm, uint32_t id)
+{
+    if (vm->csr.countinhibit & (1U << id)) return vm->csr.hpmcounter[id];
+    return riscv_counter_source(vm, id) + vm->csr.hpmcounter[id];
+}
+
+static void riscv_counter_set(rvvm_hart_t* vm, uint32_t id, uint64_t val)
+{
+    if (vm->csr.countinhibit & (1U << id)) {
+        vm->csr.hpmcounter[id] = val;
+    } else {
+        vm->csr.hpmcounter[id] = val - riscv_counter_source(vm, id);
+    }
+}
+
+static bool csr_counter_helper(rvvm_hart_t* vm, uint32_t id, maxlen_t* dest, uint8_t op, bool high)
+{
+    if (high && vm->rv64) return false;
+    uint64_t val = riscv_counter_get(vm, id);
+    maxlen_t tmp = high ? (val >> 32) : val;
+    if (!vm->rv64) tmp = (uint32_t)tmp;
+    maxlen_t old = tmp;
+    csr_helper(&tmp, dest, op);
+    if (tmp != old) {
+        if (high) {
+            val = (val & 0xFFFFFFFFU) | (((uint64_t)tmp) << 32);
+        } else if (!vm->rv64) {
+            val = (val & ~(uint64_t)0xFFFFFFFFU) | tmp;
+        } else {
+            val = tmp;
+        }
+        // Written value is observed after the writing instruction retires
+        if (id < 3 && !(vm->csr.countinhibit & (1U << id))) val--;
+        riscv_counter_set(vm, id, val);
+    }
+    return true;
+}
+
+static bool csr_counter_ro_helper(rvvm_hart_t* vm, uint32_t id, maxlen_t* dest, uint8_t op, bool high)
+{
+    // Lower privilege modes are allowed to read counters via [m|s]counteren
+    if (vm->priv_mode < PRIVILEGE_MACHINE && !(vm->csr.counteren[PRIVILEGE_MACHINE] & (1U << id))) return false;
+    if (vm->priv_mode < PRIVILEGE_SUPERVISOR && !(vm->csr.counteren[PRIVILEGE_SUPERVISOR] & (1U << id))) return false;
+    if (high && vm->rv64) return false;
+    // Read-only, any write attempt is illegal
+    bool csr_read = op != CSR_SWAP && *dest == 0;
+    uint64_t val = riscv_counter_get(vm, id);
+    *dest = high ? (val >> 32) : val;
+    if (!vm->rv64) *dest = (uint32_t)*dest;
+    return csr_read;
+}
+
+static bool csr_hpmevent_helper(rvvm_hart_t* vm, uint32_t id, maxlen_t* dest, uint8_t op)
+{
+    maxlen_t sel = vm->csr.hpmevent[id];
+    uint64_t val = riscv_counter_get(vm, id);
+    csr_helper(&sel, dest, op);
+    // mhpmevent is WARL, unknown events are not counted
+    vm->csr.hpmevent[id] = riscv_hpm_event_id(sel) >= 0 ? sel : 0;
+    // Keep the counter value across event change
+    riscv_counter_set(vm, id, val);
+    return true;
+}
+
+static bool riscv_csr_mcounteren(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    maxlen_t counteren = vm->csr.counteren[PRIVILEGE_MACHINE];
+    csr_helper_masked(&counteren, dest, 0xFFFFFFFFU, op);
+    vm->csr.counteren[PRIVILEGE_MACHINE] = counteren;
+    return true;
+}
+
+static bool riscv_csr_scounteren(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    maxlen_t counteren = vm->csr.counteren[PRIVILEGE_SUPERVISOR];
+    csr_helper_masked(&counteren, dest, 0xFFFFFFFFU, op);
+    vm->csr.counteren[PRIVILEGE_SUPERVISOR] = counteren;
+    return true;
+}
+
+static bool riscv_csr_mcountinhibit(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op)
+{
+    maxlen_t inhibit = vm->csr.countinhibit;
+    // Bit 1 stands for time, which can't be inhibited
+    csr_helper_masked(&inhibit, dest, 0xFFFFFFFDU, op);
+    for (uint32_t id=0; id<HPM_COUNTERS; ++id) {
+        if ((inhibit ^ vm->csr.countinhibit) & (1U << id)) {
+            // Freeze or resume the counter at it's current value
+            uint64_t val = riscv_counter_get(vm, id);
+            vm->csr.countinhibit ^= (1U << id);
+            riscv_counter_set(vm, id, val);
+        }
+    }
+    return true;
+}
+
+// Handlers don't know their CSR number, so make a set per counter
+#define RISCV_CSR_COUNTER(id) \
+static bool riscv_csr_mhpmcounter##id(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op) \
+{ \
+    return csr_counter_helper(vm, id, dest, op, false); \
+} \
+static bool riscv_csr_mhpmcounterh##id(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op) \
+{ \
+    return csr_counter_helper(vm, id, dest, op, true); \
+} \
+static bool riscv_csr_hpmcounter##id(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op) \
+{ \
+    return csr_counter_ro_helper(vm, id, dest, op, false); \
+} \
+static bool riscv_csr_hpmcounterh##id(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op) \
+{ \
+    return csr_counter_ro_helper(vm, id, dest, op, true); \
+} \
+static bool riscv_csr_mhpmevent##id(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op) \
+{ \
+    return csr_hpmevent_helper(vm, id, dest, op); \
+}
+
+RISCV_CSR_COUNTER(0)  RISCV_CSR_COUNTER(1)  RISCV_CSR_COUNTER(2)  RISCV_CSR_COUNTER(3)
+RISCV_CSR_COUNTER(4)  RISCV_CSR_COUNTER(5)  RISCV_CSR_COUNTER(6)  RISCV_CSR_COUNTER(7)
+RISCV_CSR_COUNTER(8)  RISCV_CSR_COUNTER(9)  RISCV_CSR_COUNTER(10) RISCV_CSR_COUNTER(11)
+RISCV_CSR_COUNTER(12) RISCV_CSR_COUNTER(13) RISCV_CSR_COUNTER(14) RISCV_CSR_COUNTER(15)
+RISCV_CSR_COUNTER(16) RISCV_CSR_COUNTER(17) RISCV_CSR_COUNTER(18) RISCV_CSR_COUNTER(19)
+RISCV_CSR_COUNTER(20) RISCV_CSR_COUNTER(21) RISCV_CSR_COUNTER(22) RISCV_CSR_COUNTER(23)
+RISCV_CSR_COUNTER(24) RISCV_CSR_COUNTER(25) RISCV_CSR_COUNTER(26) RISCV_CSR_COUNTER(27)
+RISCV_CSR_COUNTER(28) RISCV_CSR_COUNTER(29) RISCV_CSR_COUNTER(30) RISCV_CSR_COUNTER(31)
+
+#define RISCV_CSR_COUNTER_ENTRY(id) { \
+    riscv_csr_mhpmcounter##id, riscv_csr_mhpmcounterh##id, \
+    riscv_csr_hpmcounter##id, riscv_csr_hpmcounterh##id, riscv_csr_mhpmevent##id, \
+}
+
+static const struct {
+    riscv_csr_handler_t mcounter;
+    riscv_csr_handler_t mcounterh;
+    riscv_csr_handler_t counter;
+    riscv_csr_handler_t counterh;
+    riscv_csr_handler_t mevent;
+} riscv_csr_counters[HPM_COUNTERS] = {
+    RISCV_CSR_COUNTER_ENTRY(0),  RISCV_CSR_COUNTER_ENTRY(1),  RISCV_CSR_COUNTER_ENTRY(2),  RISCV_CSR_COUNTER_ENTRY(3),
+    RISCV_CSR_COUNTER_ENTRY(4),  RISCV_CSR_COUNTER_ENTRY(5),  RISCV_CSR_COUNTER_ENTRY(6),  RISCV_CSR_COUNTER_ENTRY(7),
+    RISCV_CSR_COUNTER_ENTRY(8),  RISCV_CSR_COUNTER_ENTRY(9),  RISCV_CSR_COUNTER_ENTRY(10), RISCV_CSR_COUNTER_ENTRY(11),
+    RISCV_CSR_COUNTER_ENTRY(12), RISCV_CSR_COUNTER_ENTRY(13), RISCV_CSR_COUNTER_ENTRY(14), RISCV_CSR_COUNTER_ENTRY(15),
+    RISCV_CSR_COUNTER_ENTRY(16), RISCV_CSR_COUNTER_ENTRY(17), RISCV_CSR_COUNTER_ENTRY(18), RISCV_CSR_COUNTER_ENTRY(19),
+    RISCV_CSR_COUNTER_ENTRY(20), RISCV_CSR_COUNTER_ENTRY(21), RISCV_CSR_COUNTER_ENTRY(22), RISCV_CSR_COUNTER_ENTRY(23),
+    RISCV_CSR_COUNTER_ENTRY(24), RISCV_CSR_COUNTER_ENTRY(25), RISCV_CSR_COUNTER_ENTRY(26), RISCV_CSR_COUNTER_ENTRY(27),
+    RISCV_CSR_COUNTER_ENTRY(28), RISCV_CSR_COUNTER_ENTRY(29), RISCV_CSR_COUNTER_ENTRY(30), RISCV_CSR_COUNTER_ENTRY(31),
+};
+
 void riscv_csr_global_init()
 {
     for (size_t i=0; i<4096; ++i) riscv_csr_list[i] = riscv_csr_illegal;
@@ -521,7 +787,7 @@ void riscv_csr_global_init()
     riscv_csr_list[0x303] = riscv_csr_mideleg;  // mideleg
     riscv_csr_list[0x304] = riscv_csr_mie;      // mie
     riscv_csr_list[0x305] = riscv_csr_mtvec;    // mtvec
-    riscv_csr_list[0x306] = riscv_csr_zero_rw;  // mcounteren
+    riscv_csr_list[0x306] = riscv_csr_mcounteren; // mcounteren
 
     // Machine Trap Handling
     riscv_csr_list[0x340] = riscv_csr_mscratch; // mscratch
@@ -537,19 +803,17 @@ void riscv_csr_global_init()
         riscv_csr_list[i] = riscv_csr_zero_rw;  // pmpaddr
 
     // Machine Counter/Timers
-    riscv_csr_list[0xB00] = riscv_csr_zero;     // mcycle
-    riscv_csr_list[0xB02] = riscv_csr_zero;     // minstret
-    riscv_csr_list[0xB80] = riscv_csr_zero;     // mcycleh
-    riscv_csr_list[0xB82] = riscv_csr_zero;     // minstreth
-    for (size_t i=0xB03; i<0xB20; ++i)
-        riscv_csr_list[i] = riscv_csr_zero;     // mhpmcounter
-    for (size_t i=0xB83; i<0xBA0; ++i)
-        riscv_csr_list[i] = riscv_csr_zero;     // mhpmcounterh
+    for (size_t i=0; i<HPM_COUNTERS; ++i) {
+        // There is no mtime CSR, it's memory-mapped
+        if (i == 1) continue;
+        riscv_csr_list[0xB00 + i] = riscv_csr_counters[i].mcounter;  // mcycle, minstret, mhpmcounter
+        riscv_csr_list[0xB80 + i] = riscv_csr_counters[i].mcounterh; // mcycleh, minstreth, mhpmcounterh
+    }
 
     // Machine Counter Setup
-    riscv_csr_list[0x320] = riscv_csr_zero_rw;  // mcountinhibit
-    for (size_t i=0x323; i<0x340; ++i)
-        riscv_csr_list[i] = riscv_csr_zero;     // mhpmevent
+    riscv_csr_list[0x320] = riscv_csr_mcountinhibit; // mcountinhibit
+    for (size_t i=3; i<HPM_COUNTERS; ++i)
+        riscv_csr_list[0x320 + i] = riscv_csr_counters[i].mevent; // mhpmevent
 
 
 
@@ -559,7 +823,7 @@ void riscv_csr_global_init()
     riscv_csr_list[0x103] = riscv_csr_illegal;  // sideleg
     riscv_csr_list[0x104] = riscv_csr_sie;      // sie
     riscv_csr_list[0x105] = riscv_csr_stvec;    // stvec
-    riscv_csr_list[0x106] = riscv_csr_zero_rw;  // scounteren
+    riscv_csr_list[0x106] = riscv_csr_scounteren; // scounteren
 
     // Supervisor Trap Handling
     riscv_csr_list[0x140] = riscv_csr_sscratch; // sscratch
@@ -592,16 +856,22 @@ void riscv_csr_global_init()
     riscv_csr_list[0x003] = riscv_csr_fcsr;     // fcsr
 #endif
 
+#ifdef USE_VECTOR
+    // User Vector CSRs
+    riscv_csr_list[0x008] = riscv_csr_vstart;   // vstart
+    riscv_csr_list[0x009] = riscv_csr_vxsat;    // vxsat
+    riscv_csr_list[0x00A] = riscv_csr_vxrm;     // vxrm
+    riscv_csr_list[0x00F] = riscv_csr_vcsr;     // vcsr
+    riscv_csr_list[0xC20] = riscv_csr_vl;       // vl
+    riscv_csr_list[0xC21] = riscv_csr_vtype;    // vtype
+    riscv_csr_list[0xC22] = riscv_csr_vlenb;    // vlenb
+#endif
+
     // User Counter/Timers
-    riscv_csr_list[0xC00] = riscv_csr_zero;     // cycle
+    for (size_t i=0; i<HPM_COUNTERS; ++i) {
+        riscv_csr_list[0xC00 + i] = riscv_csr_counters[i].counter;   // cycle, instret, hpmcounter
+        riscv_csr_list[0xC80 + i] = riscv_csr_counters[i].counterh;  // cycleh, instreth, hpmcounterh
+    }
     riscv_csr_list[0xC01] = riscv_csr_time;     // time
-    riscv_csr_list[0xC02] = riscv_csr_zero;     // instret
-    riscv_csr_list[0xC80] = riscv_csr_zero;     // cycleh
     riscv_csr_list[0xC81] = riscv_csr_timeh;    // timeh
-    riscv_csr_list[0xC82] = riscv_csr_zero;     // instreth
-
-    for (size_t i=0xC03; i<0xC20; ++i)
-        riscv_csr_list[i] = riscv_csr_zero;     // hpmcounter
-    for (size_t i=0xC83; i<0xCA0; ++i)
-        riscv_csr_list[i] = riscv_csr_zero;     // hpmcounterh
 }
@@ -82,6 +82,36 @@ static inline void fpu_set_fs(rvvm_hart_t* vm, uint8_t value)
 
 #endif
 
+#ifdef USE_VECTOR
+// Vector unit state in mstatus.VS
+#define VS_OFF      0
+#define VS_INITIAL  1
+#define VS_CLEAN    2
+#define VS_DIRTY    3
+
+static inline bool vector_is_enabled(rvvm_hart_t* vm)
+{
+    return bit_cut(vm->csr.status, 9, 2) != VS_OFF;
+}
+#endif
+
+/*
+ * mhpmevent selectors, hardware cache events match their SBI PMU event index,
+ * emulator-specific events are exposed to the supervisor as raw events
+ */
+#define HPM_SEL_DTLB_LOAD_MISS  0x10019
+#define HPM_SEL_DTLB_STORE_MISS 0x1001B
+#define HPM_SEL_ITLB_MISS       0x10021
+#define HPM_SEL_MMIO            0x100
+#define HPM_SEL_TRAP            0x101
+#define HPM_SEL_JIT_EXIT        0x102
+
+// Counts an emulator event for mhpmcounters
+static inline void riscv_hpm_event(rvvm_hart_t* vm, uint32_t event)
+{
+    vm->hpm_events[event]++;
+}
+
 typedef bool (*riscv_csr_handler_t)(rvvm_hart_t* vm, maxlen_t* dest, uint8_t op);
 
 extern riscv_csr_handler_t riscv_csr_list[4096];
@@ -21,14 +21,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "riscv_csr.h"
 #include "riscv_priv.h"
 #include "riscv_cpu.h"
+#include "rvprof.h"
 #include "threading.h"
 #include "atomics.h"
 #include "bit_ops.h"
 
-void riscv_hart_init(rvvm_hart_t* vm, bool rv64)
+void riscv_hart_init(rvvm_hart_t* vm, rvvm_machine_t* machine, bool rv64)
 {
     memset(vm, 0, sizeof(rvvm_hart_t));
-    riscv_tlb_flush(vm);
+    vm->machine = machine;
+    riscv_icache_init(vm);
     vm->priv_mode = PRIVILEGE_MACHINE;
     // Delegate exceptions from M to S
     vm->csr.edeleg[PRIVILEGE_HYPERVISOR] = 0xFFFFFFFF;
@@ -38,10 +40,11 @@ void riscv_hart_init(rvvm_hart_t* vm, bool rv64)
     for (size_t i=0; i<32; ++i) vm->decoder.opcodes_c[i] = riscv_c_illegal_insn;
 
 #ifdef USE_JIT
-    // 16M JIT cache per hart
-    rvjit_ctx_init(&vm->jit, 16 << 20);
+    // JIT cache is shared between harts
+    rvjit_ctx_init(&vm->jit, &machine->jit_heap);
     vm->jit_enabled = true;
 #endif
+    riscv_tlb_init(vm, TLB_SIZE * TLB_WAYS);
 
 #ifdef USE_RV64
     vm->rv64 = rv64;
@@ -65,6 +68,15 @@ void riscv_hart_init(rvvm_hart_t* vm, bool rv64)
     riscv_priv_init(vm);
 }
 
+void riscv_hart_free(rvvm_hart_t* vm)
+{
+    riscv_icache_free(vm);
+    riscv_tlb_free(vm);
+#ifdef USE_JIT
+    rvjit_ctx_free(&vm->jit);
+#endif
+}
+
 void riscv_hart_run(rvvm_hart_t* vm)
 {
     uint32_t events;
@@ -95,6 +107,19 @@ void riscv_hart_run(rvvm_hart_t* vm)
             riscv_interrupt_clear(vm, INTERRUPT_MTIMER);
         }
 
+#ifdef USE_JIT
+        if (events & EXT_EVENT_JIT_RECLAIM) {
+            riscv_jit_reclaim_ack(vm);
+        }
+        if (events & EXT_EVENT_TIMER) {
+            riscv_jit_sample(vm);
+        }
+#endif
+
+        if (events & EXT_EVENT_PROFILE) {
+            rvprof_sample(vm);
+        }
+
         if (events & EXT_EVENT_PAUSE) {
             rvvm_info("Hart %p stopped", vm);
             return;
@@ -156,7 +181,7 @@ void riscv_switch_priv(rvvm_hart_t* vm, uint8_t priv_mode)
 #endif
     
     // May unwind to dispatch
-    if (mmu_toggle) riscv_tlb_flush(vm);
+    if (mmu_toggle) riscv_tlb_switch(vm);
 }
 
 // Save current priv to xPP, xIE to xPIE, disable interrupts for target priv
@@ -189,6 +214,7 @@ void riscv_trap(rvvm_hart_t* vm, bitcnt_t cause, maxlen_t tval)
 {
     // Target privilege mode
     uint8_t priv = PRIVILEGE_MACHINE;
+    riscv_hpm_event(vm, HPM_EVENT_TRAP);
     // Delegate to lower privilege mode if needed
     while ((priv > vm->priv_mode) && (vm->csr.edeleg[priv] & (1 << cause))) priv--;
     //rvvm_info("Hart %p trap at %08"PRIxXLEN" -> %08"PRIxXLEN", cause %x, tval %08"PRIxXLEN"\n", vm, vm->registers[REGISTER_PC], vm->csr.tvec[priv] & (~3UL), cause, tval);
@@ -321,16 +347,14 @@ void riscv_hart_check_timer(rvvm_hart_t* vm)
     riscv_hart_notify(vm);
 }
 
-void riscv_hart_pause(rvvm_hart_t* vm)
+void riscv_hart_queue_pause(rvvm_hart_t* vm)
 {
-    atomic_or_uint32(&vm->pending_events, EXT_EVENT_PAUSE);
-    riscv_hart_notify(vm);
-    thread_join(vm->thread);
+    riscv_hart_queue_event(vm, EXT_EVENT_PAUSE);
 }
 
-void riscv_hart_queue_pause(rvvm_hart_t* vm)
+void riscv_hart_queue_event(rvvm_hart_t* vm, uint32_t event)
 {
-    atomic_or_uint32(&vm->pending_events, EXT_EVENT_PAUSE);
+    atomic_or_uint32(&vm->pending_events, event);
     riscv_hart_notify(vm);
 }
 
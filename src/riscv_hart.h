@@ -25,7 +25,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define HART_RUNNING 1
 
 // Set up initial hart context
-void riscv_hart_init(rvvm_hart_t* vm, bool rv64);
+void riscv_hart_init(rvvm_hart_t* vm, rvvm_machine_t* machine, bool rv64);
+
+// Free hart resources
+void riscv_hart_free(rvvm_hart_t* vm);
 
 /* Hart-thread routines */
 
@@ -57,6 +60,9 @@ void riscv_restart_dispatch(rvvm_hart_t* vm);
 // Requests the hart to be paused as soon as possible
 void riscv_hart_queue_pause(rvvm_hart_t* vm);
 
+// Delivers EXT_EVENT_* to the hart, returns immediately
+void riscv_hart_queue_event(rvvm_hart_t* vm, uint32_t event);
+
 /* External-thread routines */
 
 // Spawns thread for hart execution, returns immediately
@@ -71,8 +77,4 @@ void riscv_interrupt_clear(rvvm_hart_t* vm, bitcnt_t irq_mask);
 // Forces hart to check timecmp register for interrupts
 void riscv_hart_check_timer(rvvm_hart_t* vm);
 
-// Pauses hart in a consistent state, terminates executing thread
-// This function is blocking
-void riscv_hart_pause(rvvm_hart_t* vm);
-
 #endif
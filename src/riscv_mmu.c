@@ -19,6 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "riscv_mmu.h"
 #include "riscv_csr.h"
 #include "riscv_hart.h"
+#include "riscv_cpu.h"
 #include "bit_ops.h"
 #include "atomics.h"
 #include "utils.h"
@@ -39,6 +40,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define SV48_LEVELS       4
 #define SV57_LEVELS       5
 
+#define SV64_NAPOT_PTE    (1ULL << 63)
+#define SV64_NAPOT_BITS   4 // Svnapot 64K pages
+
+#define TLB_ASID_MASK     0xFFFF
+
+// Translation properties found by the page walk
+typedef struct {
+    // Page offset mask, wider than PAGE_MASK for superpages
+    vaddr_t mask;
+    // Mapping is present in every address space
+    bool global;
+} riscv_walk_t;
+
 bool riscv_init_ram(rvvm_ram_t* mem, paddr_t begin, paddr_t size)
 {
     // Memory boundaries should be always aligned to page size
@@ -71,37 +85,363 @@ void riscv_jit_tlb_flush(rvvm_hart_t* vm)
 {
     memset(vm->jtlb, 0, sizeof(vm->jtlb));
     vm->jtlb[0].pc = -1;
+    // Return stubs may link to dropped blocks as well
+    for (size_t i=0; i<RAS_SIZE; ++i) {
+        vm->ras[i].block = NULL;
+        vm->ras[i].pc = -1;
+    }
+    vm->ras_top = 0;
 }
 #endif
 
-void riscv_tlb_flush(rvvm_hart_t* vm)
+bool riscv_page_is_code(rvvm_hart_t* vm, size_t page)
+{
+    return atomic_load_uint32(&vm->machine->code_pages[page >> 5]) & (1U << (page & 31));
+}
+
+static inline size_t riscv_tlb_ctx_size(rvvm_hart_t* vm)
+{
+    return (vm->tlb_mask + 1) * TLB_WAYS;
+}
+
+static inline rvvm_tlb_entry_t* riscv_tlb_ctx(rvvm_hart_t* vm, size_t ctx)
+{
+    return vm->tlb_ctx + (ctx * riscv_tlb_ctx_size(vm));
+}
+
+static inline rvvm_tlb_entry_t* riscv_tlb_way(rvvm_hart_t* vm, rvvm_tlb_entry_t* tlb, vaddr_t vpn, size_t way)
+{
+    return &tlb[(vpn & vm->tlb_mask) + (way * (vm->tlb_mask + 1))];
+}
+
+/*
+ * Write tags are also revoked by other harts, see riscv_mark_code().
+ * A stale revoke only drops write permission of an unrelated entry,
+ * entries which gain it are checked again via riscv_tlb_check_code().
+ */
+static inline vaddr_t riscv_tlb_load_w(const rvvm_tlb_entry_t* entry)
+{
+#ifdef USE_RV64
+    return atomic_load_uint64(&entry->w);
+#else
+    return atomic_load_uint32(&entry->w);
+#endif
+}
+
+static inline void riscv_tlb_store_w(rvvm_tlb_entry_t* entry, vaddr_t vpn)
+{
+#ifdef USE_RV64
+    atomic_store_uint64(&entry->w, vpn);
+#else
+    atomic_store_uint32(&entry->w, vpn);
+#endif
+}
+
+static inline void riscv_tlb_copy(rvvm_tlb_entry_t* dest, const rvvm_tlb_entry_t* src)
+{
+    dest->ptr = src->ptr;
+    dest->r = src->r;
+    dest->e = src->e;
+    riscv_tlb_store_w(dest, riscv_tlb_load_w(src));
+}
+
+/*
+ * Drop write permission for a physical page from the TLB of
+ * every address space, may be called from other threads as well
+ */
+static void riscv_tlb_revoke_write(rvvm_hart_t* vm, vmptr_t page_ptr)
 {
+    rvvm_tlb_entry_t* tlb = vm->tlb_ctx;
+    vaddr_t vpn;
+    for (size_t i=0; i<riscv_tlb_ctx_size(vm) * TLB_CONTEXTS; ++i) {
+        vpn = riscv_tlb_load_w(&tlb[i]);
+        if ((vpn & vm->tlb_mask) == (i & vm->tlb_mask) && tlb[i].ptr + TLB_VADDR(vpn << PAGE_SHIFT) == (size_t)page_ptr) {
+            riscv_tlb_store_w(&tlb[i], vpn - 1);
+        }
+    }
+}
+
+/*
+ * Pages containing translated or pre-decoded code are never
+ * writable via TLB, so any store to them goes through riscv_mmu_op(),
+ * which invalidates the code.
+ */
+void riscv_mark_code(rvvm_hart_t* vm, paddr_t paddr)
+{
+    size_t page = (paddr - vm->mem.begin) >> PAGE_SHIFT;
+    if (!riscv_page_is_code(vm, page)) {
+        atomic_or_uint32(&vm->machine->code_pages[page >> 5], 1U << (page & 31));
+        vector_foreach(vm->machine->harts, i) {
+            riscv_tlb_revoke_write(&vector_at(vm->machine->harts, i), vm->mem.data + (page << PAGE_SHIFT));
+        }
+    }
+}
+
+// Pair with riscv_mark_code(), which may run on another hart
+static void riscv_tlb_check_code(rvvm_hart_t* vm, rvvm_tlb_entry_t* entry, vaddr_t set)
+{
+    vaddr_t vpn = riscv_tlb_load_w(entry);
+    vmptr_t ptr = (vmptr_t)(size_t)(entry->ptr + TLB_VADDR(vpn << PAGE_SHIFT));
+    if ((vpn & vm->tlb_mask) == set && ptr >= vm->mem.data && ptr < vm->mem.data + vm->mem.size) {
+        atomic_fence();
+        if (riscv_page_is_code(vm, (ptr - vm->mem.data) >> PAGE_SHIFT)) {
+            riscv_tlb_store_w(entry, vpn - 1);
+        }
+    }
+}
+
+void riscv_tlb_init(rvvm_hart_t* vm, size_t entries)
+{
+    free(vm->tlb_ctx);
+    vm->tlb_ctx = safe_calloc(sizeof(rvvm_tlb_entry_t), entries * TLB_CONTEXTS);
+    vm->tlb_mask = (entries / TLB_WAYS) - 1;
+#ifdef USE_JIT
+    rvjit_set_tlb_bits(&vm->jit, bit_ctz64(entries / TLB_WAYS));
+#endif
+    for (size_t i=0; i<TLB_CONTEXTS; ++i) {
+        vm->tlb_ctx_tag[i] = 0;
+        vm->tlb_ctx_used[i] = 0;
+    }
+    vm->tlb_ctx_stamp = 0;
+    vm->tlb_ctx_cur = 0;
+    vm->tlb = vm->tlb_ctx;
+    riscv_tlb_flush(vm);
+    riscv_tlb_switch(vm);
+}
+
+void riscv_tlb_free(rvvm_hart_t* vm)
+{
+    free(vm->tlb_ctx);
+    vm->tlb_ctx = NULL;
+    vm->tlb = NULL;
+}
+
+/*
+ * Per-hart translation caches, and when they are invalidated:
+ * - TLB contexts, tagged by satp mode & ASID. A satp write only selects
+ *   another context (see riscv_tlb_switch()), it is never a fence by itself.
+ *   Contexts are cleared on SFENCE.VMA (all, by ASID, or by page) and when
+ *   the least recently used one is evicted for a new address space.
+ * - Superpage TLB (stlb) and non-leaf PTE cache (pwc), tagged by context,
+ *   are dropped together with their context. A page fence drops the entries
+ *   covering that page, and the whole superpage range from the main TLB.
+ * - MMIO TLB, JTLB and return stubs only hold the current address space,
+ *   so riscv_tlb_reload() flushes them upon every fence or context switch.
+ * Page table writes alone invalidate nothing, as the spec requires a fence.
+ */
+static void riscv_tlb_clear(rvvm_hart_t* vm, size_t ctx)
+{
+    rvvm_tlb_entry_t* tlb = riscv_tlb_ctx(vm, ctx);
     // Any lookup to nonzero page fails as VPN is zero
-    memset(vm->tlb, 0, sizeof(vm->tlb));
+    memset(tlb, 0, sizeof(rvvm_tlb_entry_t) * riscv_tlb_ctx_size(vm));
     // For zero page, place nonzero VPN
-    vm->tlb[0].r = -1;
-    vm->tlb[0].w = -1;
-    vm->tlb[0].e = -1;
+    for (size_t i=0; i<TLB_WAYS; ++i) {
+        riscv_tlb_way(vm, tlb, 0, i)->r = -1;
+        riscv_tlb_way(vm, tlb, 0, i)->w = -1;
+        riscv_tlb_way(vm, tlb, 0, i)->e = -1;
+    }
+    vm->tlb_ctx_smask[ctx] = 0;
+    for (size_t i=0; i<STLB_SIZE; ++i) {
+        if (vm->stlb[i].ctx == ctx) vm->stlb[i].access = 0;
+    }
+    for (size_t i=0; i<PWC_SIZE; ++i) {
+        if (vm->pwc[i].ctx == ctx) vm->pwc[i].shift = 0;
+    }
+}
+
+// Invalidate a VPN field if it's valid for its set and lies in the region
+static inline void riscv_tlb_clear_vpn(rvvm_hart_t* vm, vaddr_t* field, size_t set, vaddr_t vpn, vaddr_t vpn_mask)
+{
+    if ((*field & vm->tlb_mask) == set && ((*field ^ vpn) & ~vpn_mask) == 0) {
+        *field -= 1;
+    }
+}
+
+static void riscv_tlb_clear_page(rvvm_hart_t* vm, size_t ctx, vaddr_t vpn)
+{
+    rvvm_tlb_entry_t* tlb = riscv_tlb_ctx(vm, ctx);
+    vaddr_t addr = vpn << PAGE_SHIFT;
+    // Non-leaf PTEs need a full fence, but guests may rely on this
+    for (size_t i=0; i<PWC_SIZE; ++i) {
+        if (vm->pwc[i].shift && vm->pwc[i].ctx == ctx && vm->pwc[i].prefix == (addr >> vm->pwc[i].shift)) {
+            vm->pwc[i].shift = 0;
+        }
+    }
+    if (vm->tlb_ctx_smask[ctx]) {
+        /*
+         * Entries filled from a superpage covering this page
+         * may be anywhere, drop the whole superpage range
+         */
+        vaddr_t vpn_mask = vm->tlb_ctx_smask[ctx] >> PAGE_SHIFT;
+        for (size_t i=0; i<riscv_tlb_ctx_size(vm); ++i) {
+            riscv_tlb_clear_vpn(vm, &tlb[i].r, i & vm->tlb_mask, vpn, vpn_mask);
+            // Write tag is stored only if changed, not to undo a concurrent revoke
+            vaddr_t w = riscv_tlb_load_w(&tlb[i]), prev = w;
+            riscv_tlb_clear_vpn(vm, &w, i & vm->tlb_mask, vpn, vpn_mask);
+            if (w != prev) riscv_tlb_store_w(&tlb[i], w);
+            riscv_tlb_clear_vpn(vm, &tlb[i].e, i & vm->tlb_mask, vpn, vpn_mask);
+        }
+        for (size_t i=0; i<STLB_SIZE; ++i) {
+            if (vm->stlb[i].ctx == ctx && (addr & ~vm->stlb[i].mask) == vm->stlb[i].vaddr) {
+                vm->stlb[i].access = 0;
+            }
+        }
+    }
+    // VPN is off by 1, thus invalidating the entry
+    for (size_t i=0; i<TLB_WAYS; ++i) {
+        riscv_tlb_way(vm, tlb, vpn, i)->r = vpn - 1;
+        riscv_tlb_store_w(riscv_tlb_way(vm, tlb, vpn, i), vpn - 1);
+        riscv_tlb_way(vm, tlb, vpn, i)->e = vpn - 1;
+    }
+}
+
+void riscv_mmio_tlb_flush(rvvm_hart_t* vm)
+{
+    memset(vm->mmio_tlb, 0, sizeof(vm->mmio_tlb));
+    // For zero page, place nonzero VPN
+    vm->mmio_tlb[0].r = -1;
+    vm->mmio_tlb[0].w = -1;
+    vm->mmio_tlb[0].e = -1;
+}
+
+static void riscv_tlb_reload(rvvm_hart_t* vm)
+{
+    riscv_mmio_tlb_flush(vm);
 #ifdef USE_JIT
     riscv_jit_tlb_flush(vm);
 #endif
     riscv_restart_dispatch(vm);
 }
 
+void riscv_tlb_flush(rvvm_hart_t* vm)
+{
+    for (size_t i=0; i<TLB_CONTEXTS; ++i) {
+        riscv_tlb_clear(vm, i);
+    }
+    riscv_tlb_reload(vm);
+}
+
 void riscv_tlb_flush_page(rvvm_hart_t* vm, vaddr_t addr)
 {
-    vaddr_t vpn = (addr >> PAGE_SHIFT);
-    // VPN is off by 1, thus invalidating the entry
-    vm->tlb[vpn & TLB_MASK].r = vpn - 1;
-    vm->tlb[vpn & TLB_MASK].w = vpn - 1;
-    vm->tlb[vpn & TLB_MASK].e = vpn - 1;
-    riscv_restart_dispatch(vm);
+    for (size_t i=0; i<TLB_CONTEXTS; ++i) {
+        riscv_tlb_clear_page(vm, i, addr >> PAGE_SHIFT);
+    }
+    riscv_tlb_reload(vm);
 }
 
-static void riscv_tlb_put(rvvm_hart_t* vm, vaddr_t vaddr, vmptr_t ptr, uint8_t op)
+/*
+ * Global mappings are copied into each address space, so they are
+ * dropped as well, which is allowed. The bare context may hold
+ * translations made via MPRV, so it is always flushed.
+ */
+void riscv_tlb_flush_asid(rvvm_hart_t* vm, uint32_t asid)
 {
+    riscv_tlb_clear(vm, 0);
+    for (size_t i=1; i<TLB_CONTEXTS; ++i) {
+        if (vm->tlb_ctx_tag[i] && (vm->tlb_ctx_tag[i] & TLB_ASID_MASK) == (asid & TLB_ASID_MASK)) {
+            riscv_tlb_clear(vm, i);
+        }
+    }
+    riscv_tlb_reload(vm);
+}
+
+void riscv_tlb_flush_asid_page(rvvm_hart_t* vm, uint32_t asid, vaddr_t addr)
+{
+    riscv_tlb_clear_page(vm, 0, addr >> PAGE_SHIFT);
+    for (size_t i=1; i<TLB_CONTEXTS; ++i) {
+        if (vm->tlb_ctx_tag[i] && (vm->tlb_ctx_tag[i] & TLB_ASID_MASK) == (asid & TLB_ASID_MASK)) {
+            riscv_tlb_clear_page(vm, i, addr >> PAGE_SHIFT);
+        }
+    }
+    riscv_tlb_reload(vm);
+}
+
+/*
+ * Bare translations (M-mode or satp mode Bare) live in context 0,
+ * which is flushed upon entry since MPRV may pollute it.
+ */
+void riscv_tlb_switch(rvvm_hart_t* vm)
+{
+    bool reload = false;
+    size_t ctx = 0;
+    if (vm->mmu_mode && vm->priv_mode <= PRIVILEGE_SUPERVISOR) {
+        uint32_t tag = vm->asid | (((uint32_t)vm->mmu_mode) << 16);
+        // Find the address space, or evict the least recently used one
+        ctx = 1;
+        for (size_t i=1; i<TLB_CONTEXTS; ++i) {
+            if (vm->tlb_ctx_tag[i] == tag) {
+                ctx = i;
+                break;
+            }
+            if (vm->tlb_ctx_used[i] < vm->tlb_ctx_used[ctx]) ctx = i;
+        }
+        if (vm->tlb_ctx_tag[ctx] != tag) {
+            vm->tlb_ctx_tag[ctx] = tag;
+            riscv_tlb_clear(vm, ctx);
+            reload = true;
+        }
+        vm->tlb_ctx_used[ctx] = ++vm->tlb_ctx_stamp;
+    } else {
+        riscv_tlb_clear(vm, 0);
+        reload = true;
+    }
+    if (reload || ctx != vm->tlb_ctx_cur) {
+        vm->tlb_ctx_cur = ctx;
+        vm->tlb = riscv_tlb_ctx(vm, ctx);
+        riscv_tlb_reload(vm);
+    }
+}
+
+/*
+ * Entries evicted from the first way are kept in the next ones,
+ * a hit there is swapped back to be found inline, sparing a page walk
+ */
+static bool riscv_tlb_lookup_ways(rvvm_hart_t* vm, vaddr_t vaddr, uint8_t op)
+{
+    vaddr_t vpn = vaddr >> PAGE_SHIFT;
+    rvvm_tlb_entry_t* first = riscv_tlb_way(vm, vm->tlb, vpn, 0);
+    rvvm_tlb_entry_t* entry;
+    rvvm_tlb_entry_t tmp;
+    for (size_t i=1; i<TLB_WAYS; ++i) {
+        entry = riscv_tlb_way(vm, vm->tlb, vpn, i);
+        if ((op == MMU_READ && entry->r == vpn)
+         || (op == MMU_WRITE && riscv_tlb_load_w(entry) == vpn)
+         || (op == MMU_EXEC && entry->e == vpn)) {
+            riscv_tlb_copy(&tmp, entry);
+            riscv_tlb_copy(entry, first);
+            riscv_tlb_copy(first, &tmp);
+            riscv_tlb_check_code(vm, first, vpn & vm->tlb_mask);
+            riscv_tlb_check_code(vm, entry, vpn & vm->tlb_mask);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void riscv_tlb_put_ctx(rvvm_hart_t* vm, size_t ctx, vaddr_t vaddr, vmptr_t ptr, uint8_t op, vaddr_t mask)
+{
+    rvvm_tlb_entry_t* tlb = riscv_tlb_ctx(vm, ctx);
+    // Remember that this page may be flushed via any address in the superpage
+    if (mask > PAGE_MASK) vm->tlb_ctx_smask[ctx] |= mask;
     vaddr_t vpn = vaddr >> PAGE_SHIFT;
-    rvvm_tlb_entry_t* entry = &vm->tlb[vpn & TLB_MASK];
+    rvvm_tlb_entry_t* entry = riscv_tlb_way(vm, tlb, vpn, 0);
+
+    if (entry->r != vpn && riscv_tlb_load_w(entry) != vpn && entry->e != vpn) {
+        // Demote the previous entries of the set, the last one is dropped
+        for (size_t i=TLB_WAYS-1; i>0; --i) {
+            riscv_tlb_copy(riscv_tlb_way(vm, tlb, vpn, i), riscv_tlb_way(vm, tlb, vpn, i - 1));
+            riscv_tlb_check_code(vm, riscv_tlb_way(vm, tlb, vpn, i), vpn & vm->tlb_mask);
+        }
+    }
+    for (size_t i=1; i<TLB_WAYS; ++i) {
+        // Don't keep stale permissions for this VPN in other ways
+        rvvm_tlb_entry_t* way = riscv_tlb_way(vm, tlb, vpn, i);
+        if (way->r == vpn || riscv_tlb_load_w(way) == vpn || way->e == vpn) {
+            way->r = vpn - 1;
+            riscv_tlb_store_w(way, vpn - 1);
+            way->e = vpn - 1;
+        }
+    }
     
     /*
     * Add only requested access bits for correct access/dirty flags
@@ -113,46 +453,143 @@ static void riscv_tlb_put(rvvm_hart_t* vm, vaddr_t vaddr, vmptr_t ptr, uint8_t o
             entry->r = vpn;
             // If same tlb entry contains different VPNs,
             // they should be invalidated
-            if (entry->w != vpn) entry->w = vpn - 1;
+            if (riscv_tlb_load_w(entry) != vpn) riscv_tlb_store_w(entry, vpn - 1);
             if (entry->e != vpn) entry->e = vpn - 1;
             break;
         case MMU_WRITE:
             entry->r = vpn;
-            entry->w = vpn;
+            riscv_tlb_store_w(entry, vpn);
             if (entry->e != vpn) entry->e = vpn - 1;
             break;
         case MMU_EXEC:
             if (entry->r != vpn) entry->r = vpn - 1;
-            if (entry->w != vpn) entry->w = vpn - 1;
+            if (riscv_tlb_load_w(entry) != vpn) riscv_tlb_store_w(entry, vpn - 1);
             entry->e = vpn;
             break;
         default:
             // (???) lets just complain and flush the entry
             rvvm_error("Unknown MMU op in riscv_tlb_put");
             entry->r = vpn - 1;
-            entry->w = vpn - 1;
+            riscv_tlb_store_w(entry, vpn - 1);
             entry->e = vpn - 1;
             break;
     }
 
     entry->ptr = ((size_t)ptr) - TLB_VADDR(vaddr);
+    riscv_tlb_check_code(vm, entry, vpn & vm->tlb_mask);
+}
+
+static void riscv_tlb_put(rvvm_hart_t* vm, vaddr_t vaddr, vmptr_t ptr, uint8_t op, const riscv_walk_t* walk)
+{
+    riscv_tlb_put_ctx(vm, vm->tlb_ctx_cur, vaddr, ptr, op, walk->mask);
+    if (walk->global && vm->tlb_ctx_cur) {
+        // Global mappings are present in every address space of this mode
+        for (size_t i=1; i<TLB_CONTEXTS; ++i) {
+            if (i != vm->tlb_ctx_cur && (vm->tlb_ctx_tag[i] >> 16) == vm->mmu_mode) {
+                riscv_tlb_put_ctx(vm, i, vaddr, ptr, op, walk->mask);
+            }
+        }
+    }
+}
+
+static bool riscv_stlb_lookup(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, riscv_walk_t* walk, uint8_t op)
+{
+    for (size_t i=0; i<STLB_SIZE; ++i) {
+        rvvm_stlb_entry_t* entry = &vm->stlb[i];
+        if ((entry->access & op) && entry->ctx == vm->tlb_ctx_cur && (vaddr & ~entry->mask) == entry->vaddr) {
+            *paddr = entry->paddr | (vaddr & entry->mask);
+            walk->mask = entry->mask;
+            walk->global = entry->global;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void riscv_stlb_put(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t paddr, const riscv_walk_t* walk, uint8_t op)
+{
+    rvvm_stlb_entry_t* entry = NULL;
+    vaddr &= ~walk->mask;
+    for (size_t i=0; i<STLB_SIZE; ++i) {
+        if (vm->stlb[i].access && vm->stlb[i].ctx == vm->tlb_ctx_cur
+         && vm->stlb[i].vaddr == vaddr && vm->stlb[i].mask == walk->mask) {
+            entry = &vm->stlb[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        // Replace entries in round-robin fashion
+        entry = &vm->stlb[vm->stlb_next];
+        vm->stlb_next = (vm->stlb_next + 1) & (STLB_SIZE - 1);
+        entry->access = 0;
+    }
+    entry->vaddr = vaddr;
+    entry->mask = walk->mask;
+    entry->paddr = paddr & ~(paddr_t)walk->mask;
+    entry->ctx = vm->tlb_ctx_cur;
+    entry->global = walk->global;
+    // Stores set the dirty bit, so reads are allowed as well
+    entry->access |= (op == MMU_WRITE) ? (MMU_READ | MMU_WRITE) : op;
+    vm->tlb_ctx_smask[vm->tlb_ctx_cur] |= walk->mask;
+}
+
+static inline rvvm_pwc_entry_t* riscv_pwc_entry(rvvm_hart_t* vm, vaddr_t prefix, bitcnt_t shift)
+{
+    return &vm->pwc[(prefix ^ shift) & (PWC_SIZE - 1)];
+}
+
+/*
+ * Find the deepest cached page table for an address, the walk resumes from it.
+ * Returns the VPN bit offset indexing into that page table, or zero on a miss.
+ */
+static bitcnt_t riscv_pwc_lookup(rvvm_hart_t* vm, vaddr_t vaddr, bitcnt_t bit_off, bitcnt_t vpn_bits, paddr_t* pagetable, riscv_walk_t* walk)
+{
+    for (bitcnt_t off = PAGE_SHIFT; off < bit_off; off += vpn_bits) {
+        bitcnt_t shift = off + vpn_bits;
+        rvvm_pwc_entry_t* entry = riscv_pwc_entry(vm, vaddr >> shift, shift);
+        if (entry->shift == shift && entry->ctx == vm->tlb_ctx_cur && entry->prefix == (vaddr >> shift)) {
+            *pagetable = entry->pagetable;
+            walk->global = entry->global;
+            return off;
+        }
+    }
+    return 0;
+}
+
+static void riscv_pwc_put(rvvm_hart_t* vm, vaddr_t vaddr, bitcnt_t shift, paddr_t pagetable, bool global)
+{
+    rvvm_pwc_entry_t* entry = riscv_pwc_entry(vm, vaddr >> shift, shift);
+    entry->prefix = vaddr >> shift;
+    entry->pagetable = pagetable;
+    entry->shift = shift;
+    entry->ctx = vm->tlb_ctx_cur;
+    entry->global = global;
 }
 
 // Virtual memory addressing mode (SV32)
-static bool riscv_mmu_translate_sv32(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, uint8_t priv, uint8_t access)
+static bool riscv_mmu_translate_sv32(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, riscv_walk_t* walk, uint8_t priv, uint8_t access)
 {
     // Pagetable is always aligned to PAGE_SIZE
     paddr_t pagetable = vm->root_page_table;
     paddr_t pte, pgt_off;
     vmptr_t pte_addr;
     bitcnt_t bit_off = SV32_VPN_BITS + PAGE_SHIFT;
+    bitcnt_t pwc_off = riscv_pwc_lookup(vm, vaddr, bit_off, SV32_VPN_BITS, &pagetable, walk);
+    size_t i = 0;
+
+    if (pwc_off) {
+        i = (bit_off - pwc_off) / SV32_VPN_BITS;
+        bit_off = pwc_off;
+    }
 
-    for (size_t i=0; i<SV32_LEVELS; ++i) {
+    for (; i<SV32_LEVELS; ++i) {
         pgt_off = ((vaddr >> bit_off) & SV32_VPN_MASK) << 2;
         pte_addr = riscv_phys_translate(vm, pagetable + pgt_off);
         if (pte_addr) {
             pte = read_uint32_le(pte_addr);
             if (pte & MMU_VALID_PTE) {
+                // Global bit of a pointer PTE applies to all subsequent mappings
+                if (pte & MMU_GLOBAL_MAP) walk->global = true;
                 if (pte & MMU_LEAF_PTE) {
                     // PGT entry is a leaf, check permissions
                     // Check U bit != priv mode, otherwise do extended check
@@ -177,11 +614,13 @@ static bool riscv_mmu_translate_sv32(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
                         if (pte != pte_flags) atomic_cas_uint32_le(pte_addr, pte, pte_flags);
                         // Combine ppn & vpn & pgoff
                         *paddr = (pte_shift & pmask) | (vaddr & vmask);
+                        walk->mask = vmask;
                         return true;
                     }
                 } else if ((pte & MMU_WRITE) == 0) {
                     // PGT entry is a pointer to next pagetable
                     pagetable = (pte >> 10) << PAGE_SHIFT;
+                    riscv_pwc_put(vm, vaddr, bit_off, pagetable, walk->global);
                     bit_off -= SV32_VPN_BITS;
                     continue;
                 }
@@ -196,7 +635,7 @@ static bool riscv_mmu_translate_sv32(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
 #ifdef USE_RV64
 
 // Virtual memory addressing mode (RV64 MMU template)
-static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, uint8_t priv, uint8_t access, uint8_t sv_levels)
+static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, riscv_walk_t* walk, uint8_t priv, uint8_t access, uint8_t sv_levels)
 {
     // Pagetable is always aligned to PAGE_SIZE
     paddr_t pagetable = vm->root_page_table;
@@ -204,15 +643,27 @@ static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
     vmptr_t pte_addr;
     bitcnt_t bit_off = (sv_levels * SV64_VPN_BITS) + PAGE_SHIFT - SV64_VPN_BITS;
     
+    bitcnt_t pwc_off;
+    size_t i = 0;
+    
     if (unlikely(vaddr != (vaddr_t)sign_extend(vaddr, bit_off+SV64_VPN_BITS)))
         return false;
 
-    for (size_t i=0; i<sv_levels; ++i) {
+    // Skip the levels already walked for this address region
+    pwc_off = riscv_pwc_lookup(vm, vaddr, bit_off, SV64_VPN_BITS, &pagetable, walk);
+    if (pwc_off) {
+        i = (bit_off - pwc_off) / SV64_VPN_BITS;
+        bit_off = pwc_off;
+    }
+
+    for (; i<sv_levels; ++i) {
         pgt_off = ((vaddr >> bit_off) & SV64_VPN_MASK) << 3;
         pte_addr = riscv_phys_translate(vm, pagetable + pgt_off);
         if (pte_addr) {
             pte = read_uint64_le(pte_addr);
             if (pte & MMU_VALID_PTE) {
+                // Global bit of a pointer PTE applies to all subsequent mappings
+                if (pte & MMU_GLOBAL_MAP) walk->global = true;
                 if (pte & MMU_LEAF_PTE) {
                     // PGT entry is a leaf, check permissions
                     // Check U bit != priv mode, otherwise do extended check
@@ -230,6 +681,13 @@ static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
                         paddr_t pmask = bit_mask(SV64_PHYS_BITS - bit_off) << bit_off;
                         paddr_t pte_flags = pte | MMU_PAGE_ACCESSED | ((access & MMU_WRITE) << 5);
                         paddr_t pte_shift = pte << 2;
+                        if (pte & SV64_NAPOT_PTE) {
+                            // Svnapot 64K page, only valid at last level with PPN[3:0] = 0b1000
+                            if (bit_off != PAGE_SHIFT || bit_cut(pte, 10, SV64_NAPOT_BITS) != 0x8)
+                                return false;
+                            vmask = bit_mask(PAGE_SHIFT + SV64_NAPOT_BITS);
+                            pte_shift &= ~(paddr_t)vmask;
+                        }
                         // Check that PPN[i-1:0] is 0, otherwise the page is misaligned
                         if (unlikely(pte_shift & vmask & PAGE_PNMASK))
                             return false;
@@ -237,11 +695,13 @@ static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
                         if (pte != pte_flags) atomic_cas_uint64_le(pte_addr, pte, pte_flags);
                         // Combine ppn & vpn & pgoff
                         *paddr = (pte_shift & pmask) | (vaddr & vmask);
+                        walk->mask = vmask;
                         return true;
                     }
-                } else if ((pte & MMU_WRITE) == 0) {
+                } else if ((pte & MMU_WRITE) == 0 && !(pte & SV64_NAPOT_PTE)) {
                     // PGT entry is a pointer to next pagetable
                     pagetable = ((pte >> 10) << PAGE_SHIFT) & SV64_PHYS_MASK;
+                    riscv_pwc_put(vm, vaddr, bit_off, pagetable, walk->global);
                     bit_off -= SV64_VPN_BITS;
                     continue;
                 }
@@ -256,42 +716,62 @@ static bool riscv_mmu_translate_rv64(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* pa
 #endif
 
 // Translate virtual address to physical with respect to current CPU mode
-static inline bool riscv_mmu_translate(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, uint8_t access)
+static inline bool riscv_mmu_translate(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, riscv_walk_t* walk, uint8_t access)
 {
     uint8_t priv = vm->priv_mode;
+    uint8_t op = access;
+    bool ret = false;
+    walk->mask = PAGE_MASK;
+    walk->global = false;
+    // Any translation here missed the TLB, MMIO is never cached there
+    if (access == MMU_EXEC) {
+        riscv_hpm_event(vm, HPM_EVENT_ITLB_MISS);
+    } else if (access == MMU_WRITE) {
+        riscv_hpm_event(vm, HPM_EVENT_DTLB_STORE_MISS);
+    } else {
+        riscv_hpm_event(vm, HPM_EVENT_DTLB_LOAD_MISS);
+    }
     // If MPRV is enabled, and we aren't fetching an instruction,
     // change effective privilege mode to STATUS.MPP
     if ((vm->csr.status & CSR_STATUS_MPRV) && (access != MMU_EXEC)) {
         priv = bit_cut(vm->csr.status, 11, 2);
     }
+    if (priv > PRIVILEGE_SUPERVISOR || vm->mmu_mode == CSR_SATP_MODE_PHYS) {
+        *paddr = vaddr;
+        return true;
+    }
+    // Superpages are cached separately, and consulted before walking
+    if (riscv_stlb_lookup(vm, vaddr, paddr, walk, op)) {
+        return true;
+    }
     // If MXR is enabled, reads from pages marked as executable-only should succeed
     if ((vm->csr.status & CSR_STATUS_MXR) && (access == MMU_READ)) {
         access |= MMU_EXEC;
     }
-    if (priv <= PRIVILEGE_SUPERVISOR) {
-        switch (vm->mmu_mode) {
-            case CSR_SATP_MODE_PHYS:
-                *paddr = vaddr;
-                return true;
-            case CSR_SATP_MODE_SV32:
-                return riscv_mmu_translate_sv32(vm, vaddr, paddr, priv, access);
+    switch (vm->mmu_mode) {
+        case CSR_SATP_MODE_SV32:
+            ret = riscv_mmu_translate_sv32(vm, vaddr, paddr, walk, priv, access);
+            break;
 #ifdef USE_RV64
-            case CSR_SATP_MODE_SV39:
-                return riscv_mmu_translate_rv64(vm, vaddr, paddr, priv, access, SV39_LEVELS);
-            case CSR_SATP_MODE_SV48:
-                return riscv_mmu_translate_rv64(vm, vaddr, paddr, priv, access, SV48_LEVELS);
-            case CSR_SATP_MODE_SV57:
-                return riscv_mmu_translate_rv64(vm, vaddr, paddr, priv, access, SV57_LEVELS);
+        case CSR_SATP_MODE_SV39:
+            ret = riscv_mmu_translate_rv64(vm, vaddr, paddr, walk, priv, access, SV39_LEVELS);
+            break;
+        case CSR_SATP_MODE_SV48:
+            ret = riscv_mmu_translate_rv64(vm, vaddr, paddr, walk, priv, access, SV48_LEVELS);
+            break;
+        case CSR_SATP_MODE_SV57:
+            ret = riscv_mmu_translate_rv64(vm, vaddr, paddr, walk, priv, access, SV57_LEVELS);
+            break;
 #endif
-            default:
-                // satp is a WARL field
-                rvvm_error("Unknown MMU mode in riscv_mmu_translate");
-                return false;
-        }
-    } else {
-        *paddr = vaddr;
-        return true;
+        default:
+            // satp is a WARL field
+            rvvm_error("Unknown MMU mode in riscv_mmu_translate");
+            return false;
+    }
+    if (ret && walk->mask > PAGE_MASK) {
+        riscv_stlb_put(vm, vaddr, *paddr, walk, op);
     }
+    return ret;
 }
 
 static bool riscv_mmio_unaligned_op(rvvm_mmio_dev_t* dev, rvvm_mmio_handler_t rwfunc, void* dest, paddr_t offset, uint8_t size)
@@ -328,60 +808,118 @@ static bool riscv_mmio_unaligned_op(rvvm_mmio_dev_t* dev, rvvm_mmio_handler_t rw
     return rwfunc(dev, dest, offset, size);
 }
 
-// Receives any operation on physical address space out of RAM region
-static bool riscv_mmio_scan(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t paddr, void* dest, uint8_t size, uint8_t access)
+// Find the device at a physical address via binary search over device ranges
+static rvvm_mmio_dev_t* riscv_mmio_find(rvvm_machine_t* machine, paddr_t paddr)
 {
     rvvm_mmio_dev_t* dev;
-    rvvm_mmio_handler_t rwfunc;
+    size_t low = 0, high = vector_size(machine->mmio_sorted), mid;
+    while (low < high) {
+        mid = (low + high) >> 1;
+        if (vector_at(machine->mmio, vector_at(machine->mmio_sorted, mid)).begin <= paddr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    // The last device beginning at or below the address
+    if (low) {
+        dev = &vector_at(machine->mmio, vector_at(machine->mmio_sorted, low - 1));
+        if (paddr >= dev->begin && paddr < dev->end) return dev;
+    }
+    // Devices may overlap, or be moved right now
+    vector_foreach(machine->mmio, i) {
+        dev = &vector_at(machine->mmio, i);
+        if (paddr >= dev->begin && paddr < dev->end) return dev;
+    }
+    return NULL;
+}
+
+static bool riscv_mmio_dev_op(rvvm_hart_t* vm, rvvm_mmio_dev_t* dev, paddr_t paddr, void* dest, uint8_t size, uint8_t access)
+{
+    rvvm_mmio_handler_t rwfunc = (access == MMU_WRITE) ? dev->write : dev->read;
+    paddr_t offset = paddr - dev->begin;
+    riscv_hpm_event(vm, HPM_EVENT_MMIO);
+    if (unlikely(size > dev->max_op_size || size < dev->min_op_size || (offset & (dev->min_op_size-1)))) {
+        rvvm_info("Hart %p accessing unaligned MMIO at 0x%08"PRIxXLEN, vm, paddr);
+        return riscv_mmio_unaligned_op(dev, rwfunc, dest, offset, size);
+    }
+    return rwfunc(dev, dest, offset, size);
+}
+
+// Find a cached device mapping, repeated register accesses skip the page walk
+static rvvm_mmio_dev_t* riscv_mmio_tlb_lookup(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t* paddr, uint8_t access)
+{
+    vaddr_t vpn = vaddr >> PAGE_SHIFT;
+    rvvm_mmio_tlb_t* entry = &vm->mmio_tlb[vpn & (MMIO_TLB_SIZE - 1)];
+    if ((access == MMU_READ && entry->r == vpn) || (access == MMU_WRITE && entry->w == vpn)) {
+        *paddr = entry->phys | (vaddr & PAGE_MASK);
+        // The device may have been moved since (PCI BARs)
+        if (*paddr >= entry->mmio->begin && *paddr < entry->mmio->end) {
+            return entry->mmio;
+        }
+    }
+    return NULL;
+}
+
+static void riscv_mmio_tlb_put(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t paddr, rvvm_mmio_dev_t* dev, uint8_t access)
+{
+    vaddr_t vpn = vaddr >> PAGE_SHIFT;
+    rvvm_mmio_tlb_t* entry = &vm->mmio_tlb[vpn & (MMIO_TLB_SIZE - 1)];
+    if (entry->mmio != dev || entry->phys != (paddr & ~(paddr_t)PAGE_MASK)) {
+        entry->r = vpn - 1;
+        entry->w = vpn - 1;
+        entry->e = vpn - 1;
+    }
+    // Only the requested op passed the page walk
+    if (access == MMU_WRITE) {
+        entry->w = vpn;
+    } else if (access == MMU_READ) {
+        entry->r = vpn;
+    }
+    entry->phys = paddr & ~(paddr_t)PAGE_MASK;
+    entry->mmio = dev;
+}
+
+// Receives any operation on physical address space out of RAM region
+static bool riscv_mmio_scan(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t paddr, const riscv_walk_t* walk, void* dest, uint8_t size, uint8_t access)
+{
+    rvvm_mmio_dev_t* dev = riscv_mmio_find(vm->machine, paddr);
     paddr_t offset;
     
-    //rvvm_info("Scanning MMIO at 0x%08"PRIxXLEN, paddr);
-    
-    vector_foreach(vm->machine->mmio, i) {
-        dev = &vector_at(vm->machine->mmio, i);
-        if (paddr >= dev->begin && paddr < dev->end) {
-            //rvvm_info("Hart %p accessing MMIO at 0x%08x", vm, paddr);
-            // Found the device
-            offset = paddr - dev->begin;
-            if (access == MMU_WRITE) {
-                rwfunc = dev->write;
-            } else {
-                rwfunc = dev->read;
-            }
-            
-            if (rwfunc == NULL) {
-                // Missing handler, this is a direct memory region
-                // Copy the data, cache translation in TLB if possible
-                if (access == MMU_WRITE) {
-                    memcpy(((vmptr_t)dev->data) + offset, dest, size);
-                } else {
-                    memcpy(dest, ((vmptr_t)dev->data) + offset, size);
-                }
-                if ((offset >= PAGE_SIZE || riscv_block_aligned(dev->begin, PAGE_SIZE)) && 
-                    (dev->end - paddr >= PAGE_SIZE || riscv_block_aligned(dev->end + 1, PAGE_SIZE))) {
-                    riscv_tlb_put(vm, vaddr, ((vmptr_t)dev->data) + offset, access);
-                }
-                return true;
-            }
-            
-            if (unlikely(size > dev->max_op_size || size < dev->min_op_size || (offset & (dev->min_op_size-1)))) {
-                rvvm_info("Hart %p accessing unaligned MMIO at 0x%08"PRIxXLEN, vm, paddr);
-                return riscv_mmio_unaligned_op(dev, rwfunc, dest, offset, size);
-            }
-            return rwfunc(dev, dest, offset, size);
+    if (dev == NULL) return false;
+    //rvvm_info("Hart %p accessing MMIO at 0x%08x", vm, paddr);
+    offset = paddr - dev->begin;
+    if ((access == MMU_WRITE ? dev->write : dev->read) == NULL) {
+        // Missing handler, this is a direct memory region
+        // Copy the data, cache translation in TLB if possible
+        if (access == MMU_WRITE) {
+            memcpy(((vmptr_t)dev->data) + offset, dest, size);
+        } else {
+            memcpy(dest, ((vmptr_t)dev->data) + offset, size);
+        }
+        if ((offset >= PAGE_SIZE || riscv_block_aligned(dev->begin, PAGE_SIZE)) && 
+            (dev->end - paddr >= PAGE_SIZE || riscv_block_aligned(dev->end + 1, PAGE_SIZE))) {
+            riscv_tlb_put(vm, vaddr, ((vmptr_t)dev->data) + offset, access, walk);
         }
+        return true;
     }
-    
-    return false;
+    riscv_mmio_tlb_put(vm, vaddr, paddr, dev, access);
+    return riscv_mmio_dev_op(vm, dev, paddr, dest, size, access);
 }
 
-// Stub
-static inline void riscv_jit_flush(rvvm_hart_t* vm, vaddr_t vaddr, paddr_t paddr, size_t size)
+// Invalidate translated & pre-decoded code on a written page
+static inline void riscv_code_flush(rvvm_hart_t* vm, paddr_t paddr)
 {
-    UNUSED(vm);
-    UNUSED(vaddr);
-    UNUSED(paddr);
-    UNUSED(size);
+    size_t page = (paddr - vm->mem.begin) >> PAGE_SHIFT;
+    if (unlikely(riscv_page_is_code(vm, page))) {
+        atomic_and_uint32(&vm->machine->code_pages[page >> 5], ~(1U << (page & 31)));
+        // Other harts drop stale code upon FENCE.I
+        riscv_icache_flush_page(vm, paddr);
+#ifdef USE_JIT
+        rvjit_invalidate(&vm->jit, paddr & PAGE_PNMASK, (paddr & PAGE_PNMASK) + PAGE_SIZE);
+        riscv_jit_tlb_flush(vm);
+#endif
+    }
 }
 
 /*
@@ -416,6 +954,8 @@ static bool riscv_mmu_op(rvvm_hart_t* vm, vaddr_t addr, void* dest, uint8_t size
 {
     //rvvm_info("Hart %p tlb miss at 0x%08"PRIxXLEN, vm, addr);
     paddr_t paddr;
+    riscv_walk_t walk;
+    rvvm_mmio_dev_t* dev;
     vmptr_t ptr;
     uint32_t trap_cause;
 
@@ -427,15 +967,36 @@ static bool riscv_mmu_op(rvvm_hart_t* vm, vaddr_t addr, void* dest, uint8_t size
                riscv_mmu_op(vm, addr + part_size, ((vmptr_t)dest) + part_size, size - part_size, access);
     }
 
-    if (riscv_mmu_translate(vm, addr, &paddr, access)) {
+    if (riscv_tlb_lookup_ways(vm, addr, access)) {
+        ptr = (vmptr_t)(size_t)(riscv_tlb_way(vm, vm->tlb, addr >> PAGE_SHIFT, 0)->ptr + TLB_VADDR(addr));
+        if (access == MMU_WRITE) {
+            atomic_memcpy_relaxed(ptr, dest, size);
+        } else {
+            atomic_memcpy_relaxed(dest, ptr, size);
+        }
+        return true;
+    }
+
+    dev = riscv_mmio_tlb_lookup(vm, addr, &paddr, access);
+    if (dev) {
+        if (riscv_mmio_dev_op(vm, dev, paddr, dest, size, access)) {
+            return true;
+        }
+        riscv_trap(vm, (access == MMU_WRITE) ? TRAP_STORE_FAULT : TRAP_LOAD_FAULT, addr);
+        return false;
+    }
+
+    if (riscv_mmu_translate(vm, addr, &paddr, &walk, access)) {
         //rvvm_info("Hart %p accessing physmem at 0x%08x", vm, paddr);
         ptr = riscv_phys_translate(vm, paddr);
         if (ptr) {
-            // Physical address in main memory, cache address translation
-            riscv_tlb_put(vm, addr, ptr, access);
             if (access == MMU_WRITE) {
                 // Clear JITted blocks & flush trace cache if necessary
-                riscv_jit_flush(vm, addr, paddr, size);
+                riscv_code_flush(vm, paddr);
+            }
+            // Physical address in main memory, cache address translation
+            riscv_tlb_put(vm, addr, ptr, access, &walk);
+            if (access == MMU_WRITE) {
                 // Should we make this atomic? RVWMO expects ld/st atomicity
                 //memcpy(ptr, dest, size);
                 atomic_memcpy_relaxed(ptr, dest, size);
@@ -446,7 +1007,7 @@ static bool riscv_mmu_op(rvvm_hart_t* vm, vaddr_t addr, void* dest, uint8_t size
             return true;
         }
         // Physical address not in memory region, check MMIO
-        if (riscv_mmio_scan(vm, addr, paddr, dest, size, access)) {
+        if (riscv_mmio_scan(vm, addr, paddr, &walk, dest, size, access)) {
             return true;
         }
         // Physical memory access fault (bad physical address)
@@ -497,14 +1058,21 @@ NOINLINE vmptr_t riscv_mmu_vma_translate(rvvm_hart_t* vm, vaddr_t addr, uint8_t
 {
     //rvvm_info("Hart %p vma tlb miss at 0x%08"PRIxXLEN, vm, addr);
     paddr_t paddr;
+    riscv_walk_t walk;
     vmptr_t ptr;
     uint32_t trap_cause;
     
-    if (riscv_mmu_translate(vm, addr, &paddr, access)) {
+    if (riscv_tlb_lookup_ways(vm, addr, access)) {
+        return (vmptr_t)(size_t)(riscv_tlb_way(vm, vm->tlb, addr >> PAGE_SHIFT, 0)->ptr + TLB_VADDR(addr));
+    }
+    if (riscv_mmu_translate(vm, addr, &paddr, &walk, access)) {
         ptr = riscv_phys_translate(vm, paddr);
         if (ptr) {
+            if (access == MMU_WRITE) {
+                riscv_code_flush(vm, paddr);
+            }
             // Physical address in main memory, cache address translation
-            riscv_tlb_put(vm, addr, ptr, access);
+            riscv_tlb_put(vm, addr, ptr, access, &walk);
             return ptr;
         }
         // Physical memory access fault (bad physical address)
@@ -695,3 +1263,17 @@ NOINLINE void riscv_mmu_store_float(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 }
 
 #endif
+
+#ifdef USE_VECTOR
+
+NOINLINE bool riscv_mmu_load_buf(rvvm_hart_t* vm, vaddr_t addr, void* dest, uint8_t size)
+{
+    return riscv_mmu_op(vm, addr, dest, size, MMU_READ);
+}
+
+NOINLINE bool riscv_mmu_store_buf(rvvm_hart_t* vm, vaddr_t addr, void* src, uint8_t size)
+{
+    return riscv_mmu_op(vm, addr, src, size, MMU_WRITE);
+}
+
+#endif
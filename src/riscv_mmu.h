@@ -39,7 +39,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define PAGE_SIZE         0x1000
 #define PAGE_PNMASK       (~0xFFFULL)
 
-#define TLB_MASK          (TLB_SIZE-1)
+#define TLB_MIN_SIZE      32
+#define TLB_MAX_SIZE      65536
 #define TLB_VADDR(vaddr)  (vaddr)
 //#define TLB_VADDR(vaddr)  ((vaddr) & PAGE_MASK) // we may remove vaddr offset if needed
 
@@ -47,14 +48,32 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 bool riscv_init_ram(rvvm_ram_t* mem, paddr_t begin, paddr_t size);
 void riscv_free_ram(rvvm_ram_t* mem);
 
-// Flush the TLB (on context switch, SFENCE.VMA, etc)
+// (Re)allocate the TLB with given amount of entries, power of 2
+void riscv_tlb_init(rvvm_hart_t* vm, size_t entries);
+void riscv_tlb_free(rvvm_hart_t* vm);
+
+// Flush the TLB of all address spaces (on SFENCE.VMA, etc)
 void riscv_tlb_flush(rvvm_hart_t* vm);
 void riscv_tlb_flush_page(rvvm_hart_t* vm, vaddr_t addr);
 
+// Flush translations of a single address space (ASID)
+void riscv_tlb_flush_asid(rvvm_hart_t* vm, uint32_t asid);
+void riscv_tlb_flush_asid_page(rvvm_hart_t* vm, uint32_t asid, vaddr_t addr);
+
+// Select the TLB of current address space after satp or privilege change
+void riscv_tlb_switch(rvvm_hart_t* vm);
+
+// Drop cached device mappings after the machine MMIO list changed, the hart must be paused
+void riscv_mmio_tlb_flush(rvvm_hart_t* vm);
+
 #ifdef USE_JIT
 void riscv_jit_tlb_flush(rvvm_hart_t* vm);
 #endif
 
+// Mark physical page as containing translated or pre-decoded code, revoke write access to it
+void riscv_mark_code(rvvm_hart_t* vm, paddr_t paddr);
+bool riscv_page_is_code(rvvm_hart_t* vm, size_t page);
+
 /*
  * Non-inlined slow memory operations, perform MMU translation,
  * call MMIO handlers if needed.
@@ -88,6 +107,12 @@ NOINLINE void riscv_mmu_store_double(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 NOINLINE void riscv_mmu_store_float(rvvm_hart_t* vm, vaddr_t addr, regid_t reg);
 #endif
 
+#ifdef USE_VECTOR
+// Raw little-endian element transfers, return false if the hart trapped
+NOINLINE bool riscv_mmu_load_buf(rvvm_hart_t* vm, vaddr_t addr, void* dest, uint8_t size);
+NOINLINE bool riscv_mmu_store_buf(rvvm_hart_t* vm, vaddr_t addr, void* src, uint8_t size);
+#endif
+
 // Alignment checks / fixup
 
 static inline bool riscv_block_in_page(addr_t addr, size_t size)
@@ -116,13 +141,13 @@ static inline addr_t riscv_align_addr(addr_t addr, size_t size)
 static inline bool riscv_fetch_inst(rvvm_hart_t* vm, vaddr_t addr, uint32_t* inst)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].e == vpn)) {
-        *inst = read_uint16_le_m((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].e == vpn)) {
+        *inst = read_uint16_le_m((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         if ((*inst & 0x3) == 0x3) {
             // This is a 4-byte instruction, force tlb lookup again
             vpn = (addr + 2) >> PAGE_SHIFT;
-            if (likely(vm->tlb[vpn & TLB_MASK].e == vpn)) {
-                *inst |= ((uint32_t)read_uint16_le_m((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr + 2)))) << 16;
+            if (likely(vm->tlb[vpn & vm->tlb_mask].e == vpn)) {
+                *inst |= ((uint32_t)read_uint16_le_m((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr + 2)))) << 16;
                 return true;
             }
         } else return true;
@@ -136,8 +161,8 @@ static inline bool riscv_fetch_inst(rvvm_hart_t* vm, vaddr_t addr, uint32_t* ins
 static inline vmptr_t riscv_vma_translate_r(rvvm_hart_t* vm, vaddr_t addr)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn)) {
-        return (vmptr_t)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn)) {
+        return (vmptr_t)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr));
     }
     return riscv_mmu_vma_translate(vm, addr, MMU_READ);
 }
@@ -145,8 +170,8 @@ static inline vmptr_t riscv_vma_translate_r(rvvm_hart_t* vm, vaddr_t addr)
 static inline vmptr_t riscv_vma_translate_w(rvvm_hart_t* vm, vaddr_t addr)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn)) {
-        return (vmptr_t)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn)) {
+        return (vmptr_t)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr));
     }
     return riscv_mmu_vma_translate(vm, addr, MMU_WRITE);
 }
@@ -154,8 +179,8 @@ static inline vmptr_t riscv_vma_translate_w(rvvm_hart_t* vm, vaddr_t addr)
 static inline vmptr_t riscv_vma_translate_e(rvvm_hart_t* vm, vaddr_t addr)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].e == vpn)) {
-        return (vmptr_t)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].e == vpn)) {
+        return (vmptr_t)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr));
     }
     return riscv_mmu_vma_translate(vm, addr, MMU_EXEC);
 }
@@ -177,8 +202,8 @@ static inline vmptr_t riscv_phys_translate(rvvm_hart_t* vm, paddr_t addr)
 static inline void riscv_load_u64(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 7) == 0)) {
-        vm->registers[reg] = read_uint64_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 7) == 0)) {
+        vm->registers[reg] = read_uint64_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_u64(vm, addr, reg);
@@ -187,8 +212,8 @@ static inline void riscv_load_u64(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_u32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 3) == 0)) {
-        vm->registers[reg] = read_uint32_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 3) == 0)) {
+        vm->registers[reg] = read_uint32_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_u32(vm, addr, reg);
@@ -197,8 +222,8 @@ static inline void riscv_load_u32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_s32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 3) == 0)) {
-        vm->registers[reg] = (int32_t)read_uint32_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 3) == 0)) {
+        vm->registers[reg] = (int32_t)read_uint32_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_s32(vm, addr, reg);
@@ -207,8 +232,8 @@ static inline void riscv_load_s32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_u16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 1) == 0)) {
-        vm->registers[reg] = read_uint16_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 1) == 0)) {
+        vm->registers[reg] = read_uint16_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_u16(vm, addr, reg);
@@ -217,8 +242,8 @@ static inline void riscv_load_u16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_s16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 1) == 0)) {
-        vm->registers[reg] = (int16_t)read_uint16_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 1) == 0)) {
+        vm->registers[reg] = (int16_t)read_uint16_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_s16(vm, addr, reg);
@@ -227,8 +252,8 @@ static inline void riscv_load_s16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_u8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn)) {
-        vm->registers[reg] = read_uint8((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn)) {
+        vm->registers[reg] = read_uint8((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_u8(vm, addr, reg);
@@ -237,8 +262,8 @@ static inline void riscv_load_u8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_s8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn)) {
-        vm->registers[reg] = (int8_t)read_uint8((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn)) {
+        vm->registers[reg] = (int8_t)read_uint8((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         return;
     }
     riscv_mmu_load_s8(vm, addr, reg);
@@ -249,8 +274,8 @@ static inline void riscv_load_s8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_store_u64(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn && (addr & 7) == 0)) {
-        write_uint64_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), vm->registers[reg]);
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn && (addr & 7) == 0)) {
+        write_uint64_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), vm->registers[reg]);
         return;
     }
     riscv_mmu_store_u64(vm, addr, reg);
@@ -259,8 +284,8 @@ static inline void riscv_store_u64(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_store_u32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn && (addr & 3) == 0)) {
-        write_uint32_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), vm->registers[reg]);
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn && (addr & 3) == 0)) {
+        write_uint32_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), vm->registers[reg]);
         return;
     }
     riscv_mmu_store_u32(vm, addr, reg);
@@ -269,8 +294,8 @@ static inline void riscv_store_u32(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_store_u16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn && (addr & 1) == 0)) {
-        write_uint16_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), vm->registers[reg]);
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn && (addr & 1) == 0)) {
+        write_uint16_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), vm->registers[reg]);
         return;
     }
     riscv_mmu_store_u16(vm, addr, reg);
@@ -279,8 +304,8 @@ static inline void riscv_store_u16(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_store_u8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn)) {
-        write_uint8((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), vm->registers[reg]);
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn)) {
+        write_uint8((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), vm->registers[reg]);
         return;
     }
     riscv_mmu_store_u8(vm, addr, reg);
@@ -293,8 +318,8 @@ static inline void riscv_store_u8(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_double(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 7) == 0)) {
-        vm->fpu_registers[reg] = read_double_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 7) == 0)) {
+        vm->fpu_registers[reg] = read_double_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)));
         fpu_set_fs(vm, FS_DIRTY);
         return;
     }
@@ -304,8 +329,8 @@ static inline void riscv_load_double(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_load_float(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].r == vpn && (addr & 3) == 0)) {
-        write_float_nanbox(&vm->fpu_registers[reg], read_float_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr))));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].r == vpn && (addr & 3) == 0)) {
+        write_float_nanbox(&vm->fpu_registers[reg], read_float_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr))));
         fpu_set_fs(vm, FS_DIRTY);
         return;
     }
@@ -317,8 +342,8 @@ static inline void riscv_load_float(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 static inline void riscv_store_double(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn && (addr & 7) == 0)) {
-        write_double_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), vm->fpu_registers[reg]);
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn && (addr & 7) == 0)) {
+        write_double_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), vm->fpu_registers[reg]);
         return;
     }
     riscv_mmu_store_double(vm, addr, reg);
@@ -327,8 +352,8 @@ static inline void riscv_store_double(rvvm_hart_t* vm, vaddr_t addr, regid_t reg
 static inline void riscv_store_float(rvvm_hart_t* vm, vaddr_t addr, regid_t reg)
 {
     vaddr_t vpn = addr >> PAGE_SHIFT;
-    if (likely(vm->tlb[vpn & TLB_MASK].w == vpn && (addr & 3) == 0)) {
-        write_float_le((void*)(size_t)(vm->tlb[vpn & TLB_MASK].ptr + TLB_VADDR(addr)), read_float_nanbox(&vm->fpu_registers[reg]));
+    if (likely(vm->tlb[vpn & vm->tlb_mask].w == vpn && (addr & 3) == 0)) {
+        write_float_le((void*)(size_t)(vm->tlb[vpn & vm->tlb_mask].ptr + TLB_VADDR(addr)), read_float_nanbox(&vm->fpu_registers[reg]));
         return;
     }
     riscv_mmu_store_float(vm, addr, reg);
@@ -92,12 +92,19 @@ static void riscv_priv_system(rvvm_hart_t* vm, const uint32_t instruction)
 
     regid_t rs1 = bit_cut(instruction, 15, 5);
     regid_t rs2 = bit_cut(instruction, 20, 5);
-    UNUSED(rs1);
-    UNUSED(rs2);
     switch (instruction & RV_PRIV_S_FENCE_MASK) {
     case RV_PRIV_S_SFENCE_VMA:
         if (vm->priv_mode >= PRIVILEGE_SUPERVISOR) {
-            riscv_tlb_flush(vm);
+            // rs1 selects a virtual page, rs2 selects an address space
+            if (rs1 && rs2) {
+                riscv_tlb_flush_asid_page(vm, vm->registers[rs2], vm->registers[rs1]);
+            } else if (rs1) {
+                riscv_tlb_flush_page(vm, vm->registers[rs1]);
+            } else if (rs2) {
+                riscv_tlb_flush_asid(vm, vm->registers[rs2]);
+            } else {
+                riscv_tlb_flush(vm);
+            }
         } else {
             riscv_trap(vm, TRAP_ILL_INSTR, instruction);
         }
@@ -124,11 +131,14 @@ static void riscv_i_fence(rvvm_hart_t* vm, const uint32_t instruction)
 static void riscv_i_zifence(rvvm_hart_t* vm, const uint32_t instruction)
 {
     UNUSED(instruction);
+    // Stores from other harts may have changed pre-decoded instructions
+    riscv_icache_flush(vm);
 #ifdef USE_JIT
+    /*
+     * Stores to translated code invalidate it in the shared cache,
+     * but JTLB of this hart may still point to stale blocks
+     */
     riscv_jit_tlb_flush(vm);
-    rvjit_flush_cache(&vm->jit);
-#else
-    UNUSED(vm);
 #endif
 }
 
@@ -20,6 +20,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "rvjit_emit.h"
 #include "utils.h"
 #include "vector.h"
+#include <stdio.h>
 
 #define RVJIT_MEM_EXEC 0x1
 #define RVJIT_MEM_RDWR 0x2
@@ -197,132 +198,1384 @@ static void flush_icache(void* addr, size_t size)
 }
 #endif
 
-void rvjit_ctx_init(rvjit_block_t* block, size_t size)
+void rvjit_heap_init(rvjit_heap_t* heap, size_t size)
 {
-    block->space = 1024;
-    block->code = safe_malloc(block->space);
+    heap->size = size_to_page(size);
+    heap->region_size = heap->size / RVJIT_HEAP_REGIONS;
+    heap->curr = 0;
+    heap->tail_size = 0;
 
-    block->heap.data = rvjit_mmap(size, RVJIT_MEM_RWX);
-    block->heap.code = NULL;
-    if (block->heap.data == NULL) {
+    heap->data = rvjit_mmap(heap->size, RVJIT_MEM_RWX);
+    heap->code = NULL;
+    if (heap->data == NULL) {
         // Possible on Linux PaX (hardened) or OpenBSD
         rvvm_info("Failed to allocate RWX mapping, falling back to multi-mmap");
-        if (!rvjit_multi_mmap((void**)&block->heap.data, (void**)&block->heap.code, size)) {
+        if (!rvjit_multi_mmap((void**)&heap->data, (void**)&heap->code, heap->size)) {
             rvvm_fatal("RVJIT heap allocation failure!");
         }
-        flush_icache(block->heap.code, block->heap.size);
+        flush_icache(heap->code, heap->size);
     }
-    flush_icache(block->heap.data, block->heap.size);
+    flush_icache(heap->data, heap->size);
 
-    block->heap.size = size_to_page(size);
-    block->heap.curr = 0;
+    hashmap_init(&heap->blocks, 64);
+    hashmap_init(&heap->block_links, 64);
+    hashmap_init(&heap->pages, 64);
+    hashmap_init(&heap->spans, 16);
+    hashmap_init(&heap->contracts, 64);
+    heap->hotness = safe_calloc(RVJIT_HOT_ENTRIES, sizeof(uint32_t));
+    heap->lookup = safe_calloc(RVJIT_LOOKUP_ENTRIES, sizeof(rvjit_lookup_t));
+    heap->cache = NULL;
+    heap->stats = NULL;
+    heap->perf = NULL;
+    spin_init(&heap->lock);
+    heap->gen = 0;
+    heap->reclaim = 0;
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_init(heap->regions[i].blocks);
+        vector_init(heap->regions[i].links);
+        heap->regions[i].epoch = 0;
+    }
+}
 
-    block->rv64 = false;
+static inline uint8_t* rvjit_heap_code(rvjit_heap_t* heap)
+{
+    return heap->code ? heap->code : heap->data;
+}
 
-    hashmap_init(&block->heap.blocks, 64);
-    hashmap_init(&block->heap.block_links, 64);
-    vector_init(block->links);
+static inline rvjit_region_t* rvjit_heap_region(rvjit_heap_t* heap, size_t offset)
+{
+    return &heap->regions[offset / heap->region_size];
+}
+
+// Check that the jump site wasn't evicted along with it's region
+static inline bool rvjit_link_site_valid(rvjit_heap_t* heap, rvjit_link_site_t site)
+{
+    return rvjit_heap_region(heap, site.offset)->epoch == site.epoch;
 }
 
-static void rvjit_linker_cleanup(rvjit_block_t* block)
+static void rvjit_linker_cleanup(rvjit_heap_t* heap)
 {
-    vector_t(void*)* linked_blocks;
-    hashmap_foreach(&block->heap.block_links, k, v) {
+    vector_t(rvjit_link_site_t)* sites;
+    hashmap_foreach(&heap->block_links, k, v) {
         UNUSED(k);
-        linked_blocks = (void*)v;
-        vector_free(*linked_blocks);
-        free(linked_blocks);
+        sites = (void*)v;
+        vector_free(*sites);
+        free(sites);
     }
 }
 
+static void rvjit_pages_cleanup(rvjit_heap_t* heap)
+{
+    vector_t(paddr_t)* keys;
+    hashmap_foreach(&heap->pages, k, v) {
+        UNUSED(k);
+        keys = (void*)v;
+        vector_free(*keys);
+        free(keys);
+    }
+}
+
+// Remember block/link key in a page for invalidation
+static void rvjit_page_track(rvjit_heap_t* heap, paddr_t page, paddr_t key)
+{
+    vector_t(paddr_t)* keys = (void*)hashmap_get(&heap->pages, page & ~0xFFFULL);
+    if (!keys) {
+        keys = safe_calloc(sizeof(vector_t(paddr_t)), 1);
+        vector_init(*keys);
+        hashmap_put(&heap->pages, page & ~0xFFFULL, (size_t)keys);
+    }
+    // Recompiled blocks & repeated links reuse the same keys
+    vector_foreach(*keys, i) {
+        if (vector_at(*keys, i) == key) return;
+    }
+    vector_push_back(*keys, key);
+}
+
+static inline rvjit_lookup_t* rvjit_lookup_entry(rvjit_heap_t* heap, paddr_t phys_pc)
+{
+    return &heap->lookup[(phys_pc >> 1) & (RVJIT_LOOKUP_ENTRIES - 1)];
+}
+
+// Expects heap lock to be held, see rvjit_lookup_t
+static void rvjit_lookup_set(rvjit_heap_t* heap, paddr_t phys_pc, size_t code)
+{
+    rvjit_lookup_t* entry = rvjit_lookup_entry(heap, phys_pc);
+    atomic_add_uint32(&entry->seq, 1);
+    atomic_store_uint64(&entry->phys_pc, phys_pc);
+    atomic_store_uint64(&entry->code, code);
+    atomic_add_uint32(&entry->seq, 1);
+}
+
+static void rvjit_lookup_drop(rvjit_heap_t* heap, paddr_t phys_pc)
+{
+    if (rvjit_lookup_entry(heap, phys_pc)->phys_pc == phys_pc) {
+        rvjit_lookup_set(heap, phys_pc, 0);
+    }
+}
+
+typedef struct rvjit_perf rvjit_perf_t;
+static void rvjit_perf_load(rvjit_heap_t* heap, rvjit_func_t func, size_t size, paddr_t phys_pc, vaddr_t virt_pc);
+static void rvjit_perf_unload(rvjit_heap_t* heap, size_t id);
+static void rvjit_perf_free(rvjit_perf_t* perf);
+
+/*
+ * Drop the region blocks from lookup cache, unlink jumps into it
+ * from other regions, and invalidate jump sites inside it.
+ * The code stays in place until the region is reclaimed.
+ */
+static void rvjit_region_evict(rvjit_heap_t* heap, size_t id)
+{
+    rvjit_region_t* region = &heap->regions[id];
+    size_t code = (size_t)rvjit_heap_code(heap);
+    size_t ptr;
+    if (vector_size(region->blocks) == 0) {
+        // Nothing was placed here yet
+        return;
+    }
+
+    vector_foreach(region->blocks, i) {
+        paddr_t key = vector_at(region->blocks, i);
+        ptr = hashmap_get(&heap->blocks, key);
+        // The block might have been recompiled into another region
+        if (ptr && (ptr - code) / heap->region_size == id) {
+            hashmap_remove(&heap->blocks, key);
+            rvjit_lookup_drop(heap, key);
+            hashmap_remove(&heap->spans, key);
+            hashmap_remove(&heap->contracts, key);
+        }
+    }
+
+    vector_foreach(region->links, i) {
+        rvjit_link_site_t site = vector_at(region->links, i);
+        if (rvjit_link_site_valid(heap, site)) {
+            rvjit_linker_patch_ret(heap->data + site.offset);
+            flush_icache(rvjit_heap_code(heap) + site.offset, 8);
+            if (heap->stats) heap->stats->unchains++;
+        }
+    }
+    if (heap->stats) heap->stats->evictions++;
+    if (heap->perf) rvjit_perf_unload(heap, id);
+
+    vector_clear(region->blocks);
+    vector_clear(region->links);
+    region->epoch++;
+    atomic_store_uint32(&heap->reclaim, id + 1);
+}
+
+static void rvjit_cache_save(rvjit_cache_t* cache);
+static void rvjit_cache_free(rvjit_cache_t* cache);
+static void rvjit_stats_free(rvjit_stats_t* stats);
+
+void rvjit_heap_free(rvjit_heap_t* heap)
+{
+    if (heap->cache) {
+        rvjit_cache_save(heap->cache);
+        rvjit_cache_free(heap->cache);
+    }
+    if (heap->stats) {
+        rvjit_stats_dump(heap);
+        rvjit_stats_free(heap->stats);
+    }
+    if (heap->perf) {
+        rvjit_perf_free(heap->perf);
+    }
+    rvjit_munmap(heap->data, heap->size);
+    if (heap->code) {
+        rvjit_munmap(heap->code, heap->size);
+    }
+    rvjit_linker_cleanup(heap);
+    rvjit_pages_cleanup(heap);
+    hashmap_destroy(&heap->blocks);
+    hashmap_destroy(&heap->block_links);
+    hashmap_destroy(&heap->pages);
+    hashmap_destroy(&heap->spans);
+    hashmap_destroy(&heap->contracts);
+    free(heap->hotness);
+    free(heap->lookup);
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_free(heap->regions[i].blocks);
+        vector_free(heap->regions[i].links);
+    }
+}
+
+void rvjit_ctx_init(rvjit_block_t* block, rvjit_heap_t* heap)
+{
+    block->space = 1024;
+    block->code = safe_malloc(block->space);
+    block->heap = heap;
+    block->stats = NULL;
+    block->rv64 = false;
+    vector_init(block->links);
+}
+
 void rvjit_ctx_free(rvjit_block_t* block)
 {
-    rvjit_munmap(block->heap.data, block->heap.size);
-    rvjit_linker_cleanup(block);
-    hashmap_destroy(&block->heap.blocks);
-    hashmap_destroy(&block->heap.block_links);
     vector_free(block->links);
     free(block->code);
+    free(block->stats);
 }
 
 void rvjit_block_init(rvjit_block_t* block)
 {
     block->size = 0;
     block->linkage = true;
+    block->placed = false;
+    block->heap_gen = atomic_load_uint32(&block->heap->gen);
+    block->page_count = 0;
+    if (block->heap->stats) {
+        // Counters of a discarded block are reused, the address is baked into code
+        if (block->stats == NULL) {
+            block->stats = safe_malloc(sizeof(rvjit_block_stats_t));
+        }
+        memset(block->stats, 0, sizeof(rvjit_block_stats_t));
+    }
+#ifdef RVJIT_NATIVE_INDIRECT
+    block->ras_count = 0;
+    block->ras_pop = false;
+#endif
     vector_clear(block->links);
+    rvjit_ir_init(block);
     rvjit_emit_init(block);
 }
 
-rvjit_func_t rvjit_block_finalize(rvjit_block_t* block)
+bool rvjit_block_has_page(rvjit_block_t* block, vaddr_t vaddr)
 {
-    uint8_t* dest = block->heap.data + block->heap.curr;
-    uint8_t* code;
-    if (block->heap.code == NULL) {
-        code = dest;
-    } else {
-        code = block->heap.code + block->heap.curr;
+    if ((vaddr >> 12) == (block->virt_pc >> 12)) return true;
+    for (size_t i=0; i<block->page_count; ++i) {
+        if ((vaddr >> 12) == (block->pages[i].virt >> 12)) return true;
     }
+    return false;
+}
 
-    rvjit_emit_end(block, block->linkage);
+bool rvjit_block_add_page(rvjit_block_t* block, vaddr_t vaddr, paddr_t paddr, const void* hptr)
+{
+    if (block->page_count >= RVJIT_BLOCK_PAGES - 1) return false;
+    // Host memory isn't necessarily page-aligned
+    hptr = ((const uint8_t*)hptr) - (vaddr & 0xFFF);
+    vaddr &= ~(vaddr_t)0xFFF;
+    paddr &= ~(paddr_t)0xFFF;
 
-    if (block->heap.curr + block->size > block->heap.size) {
-        // The cache is full
-        return NULL;
+    // Guest pc is relative to block entry, which may be mapped elsewhere next time
+    rvjit_emit_page_guard(block, vaddr - block->virt_pc, (size_t)hptr);
+
+    block->pages[block->page_count].virt = vaddr;
+    block->pages[block->page_count].phys = paddr;
+    block->page_count++;
+    return true;
+}
+
+paddr_t rvjit_block_phys_pc(rvjit_block_t* block, int32_t pc_off)
+{
+    vaddr_t vaddr = block->virt_pc + pc_off;
+    if ((vaddr >> 12) == (block->virt_pc >> 12)) {
+        return block->phys_pc + pc_off;
+    }
+    for (size_t i=0; i<block->page_count; ++i) {
+        if ((vaddr >> 12) == (block->pages[i].virt >> 12)) {
+            return block->pages[i].phys | (vaddr & 0xFFF);
+        }
     }
+    return 0;
+}
 
-    memcpy(dest, block->code, block->size);
-    flush_icache(code, block->size);
-    //block->heap.curr = (block->heap.curr + block->size + 31) & ~31ULL;
-    block->heap.curr += block->size;
+/*
+ * Find space for size bytes of code at heap->curr, moving to the next
+ * region if needed. Returns false if the cache is full.
+ * Expects heap lock to be held.
+ */
+static bool rvjit_heap_reserve(rvjit_heap_t* heap, size_t size)
+{
+    size_t region, region_end;
+    // Align the block entry slot
+    heap->curr = ((heap->curr + RVJIT_BLOCK_HEADER + 7) & ~(size_t)7) - RVJIT_BLOCK_HEADER;
+    region = heap->curr / heap->region_size;
+    region_end = (region + 1) * heap->region_size;
+    if (heap->curr + size > region_end) {
+        if (heap->reclaim) {
+            // The cache is full, next region is still in use
+            return false;
+        }
+        // Move to the next region, evict the one after it ahead of time
+        region = (region + 1) % RVJIT_HEAP_REGIONS;
+        heap->curr = region * heap->region_size + ((8 - RVJIT_BLOCK_HEADER % 8) % 8);
+        rvjit_region_evict(heap, (region + 1) % RVJIT_HEAP_REGIONS);
+    }
+    return true;
+}
 
-    hashmap_put(&block->heap.blocks, block->phys_pc, (size_t)code);
+/*
+ * Copies the block code to heap->curr, registers it's exits for linking,
+ * links pending jumps into it and publishes it in the lookup cache.
+ * Expects heap lock to be held.
+ */
+static rvjit_func_t rvjit_heap_place(rvjit_heap_t* heap, paddr_t phys_pc, const uint8_t* block_code, size_t size,
+                                     const rvjit_link_t* links, size_t link_count, bool spans, size_t contract)
+{
+    size_t region = heap->curr / heap->region_size;
+    uint8_t* dest = heap->data + heap->curr;
+    uint8_t* code = rvjit_heap_code(heap) + heap->curr;
+
+    memcpy(dest, block_code, size);
+    flush_icache(code, size);
 
 #ifdef RVJIT_NATIVE_LINKER
-    vector_t(void*)* linked_blocks;
+    vector_t(rvjit_link_site_t)* sites;
+    rvjit_link_site_t site;
+    rvjit_contract_t entry;
     paddr_t k;
-    size_t v;
-    vector_foreach(block->links, i) {
-        k = vector_at(block->links, i).dest;
-        v = vector_at(block->links, i).ptr;
-        linked_blocks = (void*)hashmap_get(&block->heap.block_links, k);
-        if (!linked_blocks) {
-            linked_blocks = calloc(sizeof(vector_t(void*)), 1);
-            vector_init(*linked_blocks);
-            hashmap_put(&block->heap.block_links, k, (size_t)linked_blocks);
+    for (size_t i=0; i<link_count; ++i) {
+        if (links[i].linked) {
+            if (heap->stats) heap->stats->chains++;
+            continue;
+        }
+        k = links[i].dest;
+        site.offset = heap->curr + links[i].offset;
+        site.held = links[i].held;
+        site.epoch = heap->regions[region].epoch;
+        sites = (void*)hashmap_get(&heap->block_links, k);
+        if (!sites) {
+            sites = safe_calloc(sizeof(vector_t(rvjit_link_site_t)), 1);
+            vector_init(*sites);
+            hashmap_put(&heap->block_links, k, (size_t)sites);
         }
-        vector_push_back(*linked_blocks, (void*)v);
+        vector_push_back(*sites, site);
+        rvjit_page_track(heap, k, k);
     }
 
-    linked_blocks = (void*)hashmap_get(&block->heap.block_links, block->phys_pc);
-    if (linked_blocks) {
-        vector_foreach(*linked_blocks, i) {
-            void* jptr = vector_at(*linked_blocks, i);
-            rvjit_linker_patch_jmp(jptr, ((size_t)code) - ((size_t)jptr));
+    /*
+     * Other harts may be executing the blocks we patch here,
+     * rvjit_linker_patch_jmp() is expected to replace the ret atomically.
+     * Jumps from other regions are remembered to unlink them upon eviction.
+     */
+    sites = spans ? NULL : (void*)hashmap_get(&heap->block_links, phys_pc);
+    rvjit_contract_unpack(&entry, contract);
+    if (sites) {
+        vector_foreach(*sites, i) {
+            size_t dest = heap->curr;
+            site = vector_at(*sites, i);
+            if (!rvjit_link_site_valid(heap, site)) continue;
+            // Skip the block header if the jump site holds contract registers in place
+            if (rvjit_contract_held(&entry, site.held)) dest += RVJIT_BLOCK_HEADER;
+            rvjit_linker_patch_jmp(heap->data + site.offset, dest - site.offset);
+            flush_icache(rvjit_heap_code(heap) + site.offset, 8);
+            if (heap->stats) heap->stats->chains++;
+            if (!rvjit_heap_same_region(heap, site.offset, heap->curr)) {
+                vector_push_back(heap->regions[region].links, site);
+            }
         }
-        vector_free(*linked_blocks);
-        free(linked_blocks);
-        hashmap_remove(&block->heap.block_links, block->phys_pc);
+        vector_free(*sites);
+        free(sites);
+        hashmap_remove(&heap->block_links, phys_pc);
+    }
+
+    /*
+     * Redirect the block being replaced into this one through it's entry slot,
+     * jumps linked there are left intact. Guest registers are written back
+     * upon each exit, so this block is entered via it's header.
+     */
+    size_t prev = hashmap_get(&heap->blocks, phys_pc);
+    if (prev && RVJIT_BLOCK_SLOT) {
+        size_t slot = prev - (size_t)rvjit_heap_code(heap) + RVJIT_BLOCK_HEADER;
+        rvjit_linker_patch_slot(heap->data + slot, heap->curr - slot);
+        flush_icache(rvjit_heap_code(heap) + slot, 8);
     }
+#else
+    UNUSED(links);
+    UNUSED(link_count);
 #endif
 
+    heap->curr += size;
+
+    // Publish the block only after it's fully written
+    hashmap_put(&heap->blocks, phys_pc, (size_t)code);
+    rvjit_lookup_set(heap, phys_pc, (size_t)code);
+    vector_push_back(heap->regions[region].blocks, phys_pc);
+    rvjit_page_track(heap, phys_pc, phys_pc);
+    if (spans) {
+        hashmap_put(&heap->spans, phys_pc, 1);
+    } else {
+        hashmap_remove(&heap->spans, phys_pc);
+    }
+    if (contract) {
+        hashmap_put(&heap->contracts, phys_pc, contract);
+    } else {
+        hashmap_remove(&heap->contracts, phys_pc);
+    }
     return (rvjit_func_t)code;
 }
 
+static void rvjit_cache_record(rvjit_heap_t* heap, rvjit_block_t* block);
+
+rvjit_func_t rvjit_block_finalize(rvjit_block_t* block)
+{
+    rvjit_heap_t* heap = block->heap;
+    rvjit_func_t code;
+
+    // Lower the remaining IR, if any
+    rvjit_ir_clobber(block);
+
+    // Block epilogue depends on it's final placement, emit it under lock
+    spin_lock(&heap->lock);
+    if (block->heap_gen != heap->gen) {
+        // Guest code might have changed under us
+        block->size = 0;
+        spin_unlock(&heap->lock);
+        return NULL;
+    }
+
+    /*
+     * The epilogue size isn't known until it's emitted at the final place,
+     * reserve the largest one seen so far and check the actual size after.
+     */
+    size_t body = block->size;
+    if (!rvjit_heap_reserve(heap, body + heap->tail_size)) {
+        spin_unlock(&heap->lock);
+        return NULL;
+    }
+
+    block->placed = true;
+    rvjit_emit_end(block, block->linkage);
+
+    if (block->size - body > heap->tail_size) {
+        heap->tail_size = block->size - body;
+    }
+    if (!rvjit_heap_same_region(heap, heap->curr, heap->curr + block->size - 1)) {
+        // Overflows the region, drop it, the next attempt reserves enough
+        block->size = 0;
+        spin_unlock(&heap->lock);
+        return NULL;
+    }
+
+    if (heap->cache && block->page_count == 0 && !block->stats) {
+        // Instrumented code can't be reused without the counters
+        rvjit_cache_record(heap, block);
+    }
+
+    code = rvjit_heap_place(heap, block->phys_pc, block->code, block->size,
+                            block->links.data, vector_size(block->links), block->page_count != 0,
+                            rvjit_contract_pack(&block->contract));
+    for (size_t i=0; i<block->page_count; ++i) {
+        rvjit_page_track(heap, block->pages[i].phys, block->phys_pc);
+    }
+    if (block->stats) {
+        // Counters are owned by the heap from now on
+        block->stats->phys_pc = block->phys_pc;
+        block->stats->virt_pc = block->virt_pc;
+        block->stats->code_size = block->size;
+        block->stats->insns = block->insns;
+        block->stats->optimized = block->ir.enabled;
+        vector_push_back(heap->stats->blocks, block->stats);
+        block->stats = NULL;
+    }
+    if (heap->perf) {
+        rvjit_perf_load(heap, code, block->size, block->phys_pc, block->virt_pc);
+    }
+    spin_unlock(&heap->lock);
+
+    return code;
+}
+
+/*
+ * Counters are shared by all harts, a failed CAS only loses
+ * an increment, and never lets the counter skip a state.
+ */
+bool rvjit_block_hot(rvjit_block_t* block, paddr_t phys_pc)
+{
+    uint32_t* counter = &block->heap->hotness[(phys_pc >> 1) & (RVJIT_HOT_ENTRIES - 1)];
+    uint32_t count = atomic_load_uint32(counter);
+    if (count >= RVJIT_HOT_THRESHOLD) return true;
+    atomic_cas_uint32(counter, count, count + 1);
+    return false;
+}
+
+bool rvjit_block_sample(rvjit_block_t* block, paddr_t phys_pc)
+{
+    uint32_t* counter = &block->heap->hotness[(phys_pc >> 1) & (RVJIT_HOT_ENTRIES - 1)];
+    uint32_t count = atomic_load_uint32(counter);
+    // Samples are counted past the compilation threshold
+    if (count < RVJIT_HOT_THRESHOLD || count == RVJIT_HOT_OPTIMIZED) return false;
+    if (count + 1 < RVJIT_HOT_THRESHOLD + RVJIT_OPT_SAMPLES) {
+        atomic_cas_uint32(counter, count, count + 1);
+        return false;
+    }
+    // Only the hart which marks the entry recompiles it
+    if (!atomic_cas_uint32(counter, count, RVJIT_HOT_OPTIMIZED)) return false;
+    return rvjit_block_lookup(block, phys_pc) != NULL;
+}
+
 rvjit_func_t rvjit_block_lookup(rvjit_block_t* block, paddr_t phys_pc)
 {
-    return (rvjit_func_t)hashmap_get(&block->heap.blocks, phys_pc);
+    rvjit_heap_t* heap = block->heap;
+    rvjit_lookup_t* entry = rvjit_lookup_entry(heap, phys_pc);
+    uint32_t seq = atomic_load_uint32(&entry->seq);
+    uint64_t key = atomic_load_uint64(&entry->phys_pc);
+    uint64_t code = atomic_load_uint64(&entry->code);
+    size_t ret;
+    if (!(seq & 1) && key == phys_pc && code && atomic_load_uint32(&entry->seq) == seq) {
+        return (rvjit_func_t)(size_t)code;
+    }
+
+    spin_lock(&heap->lock);
+    ret = hashmap_get(&heap->blocks, phys_pc);
+    if (ret) rvjit_lookup_set(heap, phys_pc, ret);
+    spin_unlock(&heap->lock);
+    return (rvjit_func_t)ret;
+}
+
+void rvjit_invalidate(rvjit_block_t* block, paddr_t begin, paddr_t end)
+{
+    rvjit_heap_t* heap = block->heap;
+    vector_t(paddr_t)* keys;
+    vector_t(rvjit_link_site_t)* sites;
+    paddr_t key;
+
+    spin_lock(&heap->lock);
+    atomic_add_uint32(&heap->gen, 1);
+    if (heap->stats) heap->stats->invalidations++;
+    for (paddr_t page = begin & ~0xFFFULL; page < end; page += 0x1000) {
+        keys = (void*)hashmap_get(&heap->pages, page);
+        if (keys == NULL) continue;
+        vector_foreach(*keys, i) {
+            key = vector_at(*keys, i);
+            hashmap_remove(&heap->blocks, key);
+            rvjit_lookup_drop(heap, key);
+            hashmap_remove(&heap->spans, key);
+            hashmap_remove(&heap->contracts, key);
+            if (heap->cache) {
+                free((void*)hashmap_get(&heap->cache->blocks, key));
+                hashmap_remove(&heap->cache->blocks, key);
+            }
+            sites = (void*)hashmap_get(&heap->block_links, key);
+            if (sites) {
+                vector_free(*sites);
+                free(sites);
+                hashmap_remove(&heap->block_links, key);
+            }
+        }
+        vector_free(*keys);
+        free(keys);
+        hashmap_remove(&heap->pages, page);
+    }
+    spin_unlock(&heap->lock);
+}
+
+void rvjit_reclaim(rvjit_block_t* block)
+{
+    atomic_store_uint32(&block->heap->reclaim, 0);
 }
 
 void rvjit_flush_cache(rvjit_block_t* block)
 {
-    if (block->heap.code) {
-        flush_icache(block->heap.code, block->heap.curr);
+    rvjit_heap_t* heap = block->heap;
+    spin_lock(&heap->lock);
+    if (heap->code) {
+        flush_icache(heap->code, heap->size);
+    }
+    flush_icache(heap->data, heap->size);
+
+    hashmap_clear(&heap->blocks);
+    for (size_t i=0; i<RVJIT_LOOKUP_ENTRIES; ++i) {
+        rvjit_lookup_set(heap, i << 1, 0);
+    }
+    heap->curr = 0;
+    heap->reclaim = 0;
+    if (heap->perf) rvjit_perf_unload(heap, RVJIT_HEAP_REGIONS);
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_clear(heap->regions[i].blocks);
+        vector_clear(heap->regions[i].links);
+        heap->regions[i].epoch++;
+    }
+
+    rvjit_linker_cleanup(heap);
+    hashmap_clear(&heap->block_links);
+    rvjit_pages_cleanup(heap);
+    hashmap_clear(&heap->pages);
+    hashmap_clear(&heap->spans);
+    hashmap_clear(&heap->contracts);
+    atomic_add_uint32(&heap->gen, 1);
+    spin_unlock(&heap->lock);
+}
+
+/*
+ * Persistent block cache
+ *
+ * Records hold position-independent copies of blocks confined to a single
+ * page: exits into other blocks are reverted to patchable returns, and are
+ * linked again upon install. Blocks spanning several pages embed host
+ * pointers in their page guards and aren't recorded.
+ * The file holds a header followed by records, each with it's links & code.
+ */
+
+#define RVJIT_CACHE_MAGIC   0x434A5652 // "RVJC"
+#define RVJIT_CACHE_VERSION 5
+#define RVJIT_CACHE_RV64    0x1
+#define RVJIT_CACHE_OPT     0x2 // Compiled by the optimizing tier
+
+#define RVJIT_CACHE_FNV_BASIS 0xCBF29CE484222325ULL
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t tag;
+    uint64_t size;       // Size of the records following the header
+    uint64_t checksum;   // Over the records, then the header with this field zeroed
+} rvjit_cache_hdr_t;
+
+typedef struct {
+    paddr_t phys_pc;
+    uint64_t hash;       // Guest page contents upon compilation
+    uint64_t contract;   // Packed entry register contract
+    uint32_t flags;
+    uint32_t size;
+    uint32_t link_count;
+} rvjit_cache_rec_t;
+
+static inline size_t rvjit_cache_rec_size(const rvjit_cache_rec_t* rec)
+{
+    return sizeof(rvjit_cache_rec_t) + rec->link_count * sizeof(rvjit_link_t) + rec->size;
+}
+
+static inline rvjit_link_t* rvjit_cache_rec_links(rvjit_cache_rec_t* rec)
+{
+    return (rvjit_link_t*)(rec + 1);
+}
+
+static inline uint8_t* rvjit_cache_rec_code(rvjit_cache_rec_t* rec)
+{
+    return (uint8_t*)(rvjit_cache_rec_links(rec) + rec->link_count);
+}
+
+static inline uint32_t rvjit_cache_flags(rvjit_block_t* block)
+{
+    return block->rv64 ? RVJIT_CACHE_RV64 : 0;
+}
+
+// Returns 0 for pages outside of guest RAM
+static uint64_t rvjit_cache_hash_page(rvjit_cache_t* cache, paddr_t page)
+{
+    uint64_t hash = RVJIT_CACHE_FNV_BASIS;
+    const uint8_t* ptr;
+    if (page < cache->mem_begin || page - cache->mem_begin >= cache->mem_size) return 0;
+    ptr = cache->mem_data + (page - cache->mem_begin);
+    for (size_t i=0; i<0x1000; i+=8) {
+        hash = (hash ^ read_uint64_le_m(ptr + i)) * 0x100000001B3ULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static uint64_t rvjit_cache_checksum(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    for (size_t i=0; i<size; ++i) {
+        hash = (hash ^ ptr[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static inline size_t rvjit_cache_page_id(rvjit_cache_t* cache, paddr_t page)
+{
+    return (page - cache->mem_begin) >> 12;
+}
+
+static void rvjit_cache_put(rvjit_cache_t* cache, rvjit_cache_rec_t* rec)
+{
+    free((void*)hashmap_get(&cache->blocks, rec->phys_pc));
+    hashmap_put(&cache->blocks, rec->phys_pc, (size_t)rec);
+}
+
+// Records a block being placed, expects heap lock to be held
+static void rvjit_cache_record(rvjit_heap_t* heap, rvjit_block_t* block)
+{
+    rvjit_cache_rec_t tmp = {
+        .phys_pc = block->phys_pc,
+        .hash = rvjit_cache_hash_page(heap->cache, block->phys_pc & ~0xFFFULL),
+        .contract = rvjit_contract_pack(&block->contract),
+        .flags = rvjit_cache_flags(block) | (block->ir.enabled ? RVJIT_CACHE_OPT : 0),
+        .size = block->size,
+        .link_count = vector_size(block->links),
+    };
+    rvjit_cache_rec_t* rec = safe_malloc(rvjit_cache_rec_size(&tmp));
+    rvjit_link_t* links = rvjit_cache_rec_links(rec);
+    uint8_t* code;
+
+    *rec = tmp;
+    code = rvjit_cache_rec_code(rec);
+    memcpy(links, block->links.data, rec->link_count * sizeof(rvjit_link_t));
+    memcpy(code, block->code, rec->size);
+    for (size_t i=0; i<rec->link_count; ++i) {
+        links[i].linked = false;
+        rvjit_linker_patch_ret(code + links[i].offset);
+    }
+    rvjit_cache_put(heap->cache, rec);
+}
+
+// Returns false for blocks outside of guest RAM, which can't be verified
+static bool rvjit_cache_defer(rvjit_cache_t* cache, rvjit_cache_rec_t* rec)
+{
+    paddr_t page = rec->phys_pc & ~0xFFFULL;
+    vector_t(rvjit_cache_rec_t*)* recs;
+    size_t id;
+    if (page < cache->mem_begin || page - cache->mem_begin >= cache->mem_size) return false;
+    recs = (void*)hashmap_get(&cache->pages, page);
+    if (!recs) {
+        recs = safe_calloc(sizeof(vector_t(rvjit_cache_rec_t*)), 1);
+        vector_init(*recs);
+        hashmap_put(&cache->pages, page, (size_t)recs);
+        id = rvjit_cache_page_id(cache, page);
+        cache->pending_pages[id >> 5] |= 1U << (id & 31);
+        cache->pending++;
+    }
+    vector_push_back(*recs, rec);
+    return true;
+}
+
+// Checks the record header against the remaining file size
+static bool rvjit_cache_rec_fits(const rvjit_cache_rec_t* rec, size_t avail)
+{
+    return rec->size != 0 && rec->size <= 0x100000 && rec->link_count <= 0x1000
+        && rvjit_cache_rec_size(rec) <= avail;
+}
+
+static bool rvjit_cache_rec_valid(rvjit_cache_rec_t* rec)
+{
+    for (size_t i=0; i<rec->link_count; ++i) {
+        if (rvjit_cache_rec_links(rec)[i].offset >= rec->size) return false;
+    }
+    return true;
+}
+
+static void rvjit_cache_load(rvjit_cache_t* cache, FILE* file)
+{
+    rvjit_cache_hdr_t hdr;
+    rvjit_cache_rec_t* rec;
+    uint8_t* data;
+    uint64_t checksum;
+    size_t offset = 0, count = 0;
+    long length;
+
+    if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET)) return;
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != RVJIT_CACHE_MAGIC
+     || hdr.version != RVJIT_CACHE_VERSION || hdr.tag != cache->tag) {
+        rvvm_info("Ignoring RVJIT cache %s from another build", cache->path);
+        return;
+    }
+    if (hdr.size != (uint64_t)length - sizeof(hdr)) {
+        rvvm_warn("Ignoring truncated RVJIT cache %s", cache->path);
+        return;
+    }
+
+    data = safe_malloc(hdr.size ? hdr.size : 1);
+    checksum = hdr.checksum;
+    hdr.checksum = 0;
+    if (fread(data, 1, hdr.size, file) != hdr.size
+     || checksum != rvjit_cache_checksum(rvjit_cache_checksum(RVJIT_CACHE_FNV_BASIS, data, hdr.size), &hdr, sizeof(hdr))) {
+        rvvm_warn("Ignoring corrupted RVJIT cache %s", cache->path);
+        free(data);
+        return;
+    }
+
+    // Records are copied out, so their fields are properly aligned
+    while (offset < hdr.size) {
+        rvjit_cache_rec_t tmp;
+        size_t avail = hdr.size - offset;
+        if (avail < sizeof(tmp)) break;
+        memcpy(&tmp, data + offset, sizeof(tmp));
+        if (!rvjit_cache_rec_fits(&tmp, avail)) break;
+        rec = safe_malloc(rvjit_cache_rec_size(&tmp));
+        memcpy(rec, data + offset, rvjit_cache_rec_size(&tmp));
+        if (!rvjit_cache_rec_valid(rec)) {
+            free(rec);
+            break;
+        }
+        offset += rvjit_cache_rec_size(rec);
+        if (rvjit_cache_defer(cache, rec)) {
+            count++;
+        } else {
+            free(rec);
+        }
+    }
+    free(data);
+    rvvm_info("Loaded %u blocks from RVJIT cache %s", (uint32_t)count, cache->path);
+}
+
+static void rvjit_cache_write(rvjit_cache_hdr_t* hdr, uint64_t* checksum, const rvjit_cache_rec_t* rec, FILE* file)
+{
+    size_t size = rvjit_cache_rec_size(rec);
+    fwrite(rec, size, 1, file);
+    hdr->size += size;
+    *checksum = rvjit_cache_checksum(*checksum, rec, size);
+}
+
+static void rvjit_cache_save(rvjit_cache_t* cache)
+{
+    rvjit_cache_hdr_t hdr = {
+        .magic = RVJIT_CACHE_MAGIC,
+        .version = RVJIT_CACHE_VERSION,
+        .tag = cache->tag,
+    };
+    uint64_t checksum = RVJIT_CACHE_FNV_BASIS;
+    size_t len = strlen(cache->path);
+    char* tmp_path = safe_malloc(len + 5);
+    FILE* file;
+
+    // Write into a temporary file first, so VMs sharing the cache never see it incomplete
+    memcpy(tmp_path, cache->path, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+    file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        rvvm_warn("Failed to write RVJIT cache %s", tmp_path);
+        free(tmp_path);
+        return;
+    }
+    // Header is rewritten once the size & checksum are known
+    fwrite(&hdr, sizeof(hdr), 1, file);
+    hashmap_foreach(&cache->blocks, k, v) {
+        UNUSED(k);
+        rvjit_cache_write(&hdr, &checksum, (void*)v, file);
+    }
+    // Keep blocks from pages which weren't executed this time
+    hashmap_foreach(&cache->pages, k, v) {
+        vector_t(rvjit_cache_rec_t*)* recs = (void*)v;
+        UNUSED(k);
+        vector_foreach(*recs, i) {
+            rvjit_cache_rec_t* rec = vector_at(*recs, i);
+            if (hashmap_get(&cache->blocks, rec->phys_pc)) continue;
+            rvjit_cache_write(&hdr, &checksum, rec, file);
+        }
+    }
+    hdr.checksum = rvjit_cache_checksum(checksum, &hdr, sizeof(hdr));
+    fseek(file, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, file);
+    fclose(file);
+#ifdef _WIN32
+    remove(cache->path);
+#endif
+    if (rename(tmp_path, cache->path)) {
+        rvvm_warn("Failed to write RVJIT cache %s", cache->path);
+    }
+    free(tmp_path);
+}
+
+static void rvjit_cache_free(rvjit_cache_t* cache)
+{
+    hashmap_foreach(&cache->blocks, k, v) {
+        UNUSED(k);
+        free((void*)v);
+    }
+    hashmap_foreach(&cache->pages, k, v) {
+        vector_t(rvjit_cache_rec_t*)* recs = (void*)v;
+        UNUSED(k);
+        vector_foreach(*recs, i) {
+            free(vector_at(*recs, i));
+        }
+        vector_free(*recs);
+        free(recs);
+    }
+    hashmap_destroy(&cache->blocks);
+    hashmap_destroy(&cache->pages);
+    free(cache->pending_pages);
+    free(cache->path);
+    free(cache);
+}
+
+bool rvjit_cache_open(rvjit_heap_t* heap, const char* path, uint64_t tag, const void* mem_data, paddr_t mem_begin, size_t mem_size)
+{
+    rvjit_cache_t* cache;
+    FILE* file;
+    if (heap->cache || heap->stats) return false;
+
+    cache = safe_calloc(sizeof(rvjit_cache_t), 1);
+    cache->path = safe_malloc(strlen(path) + 1);
+    memcpy(cache->path, path, strlen(path) + 1);
+    cache->tag = tag;
+    cache->mem_data = mem_data;
+    cache->mem_begin = mem_begin;
+    cache->mem_size = mem_size;
+    hashmap_init(&cache->blocks, 64);
+    hashmap_init(&cache->pages, 16);
+    cache->pending_pages = safe_calloc(((mem_size >> 12) + 31) >> 5, sizeof(uint32_t));
+
+    file = fopen(path, "rb");
+    if (file) {
+        rvjit_cache_load(cache, file);
+        fclose(file);
+    }
+
+    spin_lock(&heap->lock);
+    if (heap->cache || heap->stats) {
+        // Lost a race with another open or instrumentation
+        spin_unlock(&heap->lock);
+        rvjit_cache_free(cache);
+        return false;
+    }
+    heap->cache = cache;
+    spin_unlock(&heap->lock);
+    return true;
+}
+
+bool rvjit_cache_pending(rvjit_block_t* block, paddr_t phys_pc)
+{
+    rvjit_cache_t* cache = block->heap->cache;
+    size_t id;
+    if (cache == NULL || atomic_load_uint32(&cache->pending) == 0) return false;
+    if (phys_pc < cache->mem_begin || phys_pc - cache->mem_begin >= cache->mem_size) return false;
+    // A stale bit is rechecked under lock by rvjit_cache_install()
+    id = rvjit_cache_page_id(cache, phys_pc);
+    return !!(atomic_load_uint32(&cache->pending_pages[id >> 5]) & (1U << (id & 31)));
+}
+
+// Places a verified record into the heap, expects heap lock to be held
+static bool rvjit_cache_place(rvjit_heap_t* heap, rvjit_cache_rec_t* rec)
+{
+    rvjit_link_t* links = rvjit_cache_rec_links(rec);
+    size_t offset, dest;
+    rvjit_func_t code;
+
+    if (!rvjit_heap_reserve(heap, rec->size)) return false;
+    offset = heap->curr;
+    if (!rvjit_heap_same_region(heap, offset, offset + rec->size - 1)) return false;
+
+    // Link to existing blocks right away, just like upon compilation
+    for (size_t i=0; i<rec->link_count; ++i) {
+        dest = hashmap_get(&heap->blocks, links[i].dest);
+        dest -= dest ? (size_t)rvjit_heap_code(heap) : 0;
+        links[i].linked = dest && rvjit_heap_same_region(heap, dest, offset)
+                       && !hashmap_get(&heap->spans, links[i].dest);
+    }
+    code = rvjit_heap_place(heap, rec->phys_pc, rvjit_cache_rec_code(rec), rec->size, links, rec->link_count, false, rec->contract);
+    if (heap->perf) rvjit_perf_load(heap, code, rec->size, rec->phys_pc, 0);
+    for (size_t i=0; i<rec->link_count; ++i) {
+        rvjit_contract_t entry;
+        if (!links[i].linked) continue;
+        dest = hashmap_get(&heap->blocks, links[i].dest) - (size_t)rvjit_heap_code(heap);
+        rvjit_contract_unpack(&entry, hashmap_get(&heap->contracts, links[i].dest));
+        if (rvjit_contract_held(&entry, links[i].held)) dest += RVJIT_BLOCK_HEADER;
+        rvjit_linker_patch_jmp(heap->data + offset + links[i].offset, dest - (offset + links[i].offset));
+        flush_icache(rvjit_heap_code(heap) + offset + links[i].offset, 8);
+    }
+    // Cached blocks are hot already
+    atomic_store_uint32(&heap->hotness[(rec->phys_pc >> 1) & (RVJIT_HOT_ENTRIES - 1)],
+        (rec->flags & RVJIT_CACHE_OPT) ? RVJIT_HOT_OPTIMIZED : RVJIT_HOT_THRESHOLD);
+    return true;
+}
+
+void rvjit_cache_install(rvjit_block_t* block, paddr_t phys_pc)
+{
+    rvjit_heap_t* heap = block->heap;
+    rvjit_cache_t* cache = heap->cache;
+    paddr_t page = phys_pc & ~0xFFFULL;
+    vector_t(rvjit_cache_rec_t*)* recs;
+    rvjit_cache_rec_t* rec;
+    size_t id;
+    // Stores to the page meanwhile are caught by heap generation
+    uint32_t gen = atomic_load_uint32(&heap->gen);
+    uint64_t hash = rvjit_cache_hash_page(cache, page);
+
+    spin_lock(&heap->lock);
+    recs = (void*)hashmap_get(&cache->pages, page);
+    if (recs == NULL || gen != heap->gen) {
+        // Installed by another context, or retried later
+        spin_unlock(&heap->lock);
+        return;
+    }
+    hashmap_remove(&cache->pages, page);
+    id = rvjit_cache_page_id(cache, page);
+    atomic_and_uint32(&cache->pending_pages[id >> 5], ~(1U << (id & 31)));
+    atomic_sub_uint32(&cache->pending, 1);
+
+    vector_foreach(*recs, i) {
+        rec = vector_at(*recs, i);
+        if (rec->hash == hash && (rec->flags & ~RVJIT_CACHE_OPT) == rvjit_cache_flags(block)
+         && !hashmap_get(&heap->blocks, rec->phys_pc) && rvjit_cache_place(heap, rec)) {
+            rvjit_cache_put(cache, rec);
+        } else {
+            free(rec);
+        }
+    }
+    vector_free(*recs);
+    free(recs);
+    spin_unlock(&heap->lock);
+}
+
+/*
+ * Instrumentation
+ */
+
+void rvjit_stats_enable(rvjit_heap_t* heap, const char* path)
+{
+    rvjit_stats_t* stats;
+    rvjit_cache_t* cache;
+    stats = safe_calloc(sizeof(rvjit_stats_t), 1);
+    stats->path = safe_malloc(strlen(path) + 1);
+    memcpy(stats->path, path, strlen(path) + 1);
+    vector_init(stats->blocks);
+
+    spin_lock(&heap->lock);
+    if (heap->stats) {
+        spin_unlock(&heap->lock);
+        rvjit_stats_free(stats);
+        return;
+    }
+    cache = heap->cache;
+    heap->cache = NULL;
+    heap->stats = stats;
+    spin_unlock(&heap->lock);
+
+    if (cache) {
+        // Cached code has no counters, and ours can't be cached
+        rvvm_warn("RVJIT cache is disabled by instrumentation");
+        rvjit_cache_free(cache);
+    }
+}
+
+static void rvjit_stats_free(rvjit_stats_t* stats)
+{
+    vector_foreach(stats->blocks, i) {
+        free(vector_at(stats->blocks, i));
+    }
+    vector_free(stats->blocks);
+    free(stats->path);
+    free(stats);
+}
+
+static int rvjit_stats_cmp(const void* a, const void* b)
+{
+    const rvjit_block_stats_t* sa = *(const rvjit_block_stats_t**)a;
+    const rvjit_block_stats_t* sb = *(const rvjit_block_stats_t**)b;
+    if (sa->execs != sb->execs) return sa->execs > sb->execs ? -1 : 1;
+    return sa->phys_pc < sb->phys_pc ? -1 : (sa->phys_pc > sb->phys_pc);
+}
+
+bool rvjit_stats_dump(rvjit_heap_t* heap)
+{
+    static const char* exit_names[RVJIT_EXITS] = {
+        "branch", "event", "indirect", "tlb", "guard", "fallback",
+    };
+    rvjit_stats_t* stats = heap->stats;
+    rvjit_block_stats_t** blocks;
+    uint64_t exits[RVJIT_EXITS] = {0};
+    uint64_t execs = 0;
+    size_t count;
+    FILE* file;
+
+    if (stats == NULL) return false;
+    file = fopen(stats->path, "w");
+    if (file == NULL) {
+        rvvm_warn("Failed to write RVJIT report %s", stats->path);
+        return false;
+    }
+
+    // Blocks may be finalized meanwhile, counters are read as is
+    spin_lock(&heap->lock);
+    count = vector_size(stats->blocks);
+    blocks = safe_calloc(count + 1, sizeof(rvjit_block_stats_t*));
+    memcpy(blocks, stats->blocks.data, count * sizeof(rvjit_block_stats_t*));
+    fprintf(file, "# RVJIT blocks: %u, chains: %"PRIu64", unchains: %"PRIu64", evictions: %"PRIu64", invalidations: %"PRIu64"\n",
+            (uint32_t)count, stats->chains, stats->unchains, stats->evictions, stats->invalidations);
+    spin_unlock(&heap->lock);
+
+    qsort(blocks, count, sizeof(rvjit_block_stats_t*), rvjit_stats_cmp);
+    for (size_t i=0; i<count; ++i) {
+        execs += blocks[i]->execs;
+        for (size_t j=0; j<RVJIT_EXITS; ++j) exits[j] += blocks[i]->exits[j];
     }
-    flush_icache(block->heap.data, block->heap.curr);
 
-    hashmap_clear(&block->heap.blocks);
-    block->heap.curr = 0;
+    fprintf(file, "# Executions: %"PRIu64", exits to dispatcher:", execs);
+    for (size_t j=0; j<RVJIT_EXITS; ++j) {
+        fprintf(file, " %s %"PRIu64, exit_names[j], exits[j]);
+    }
+    fprintf(file, "\n#\n# %-16s %-16s %6s %6s %14s", "guest_pc", "phys_pc", "insns", "size", "execs");
+    for (size_t j=0; j<RVJIT_EXITS; ++j) {
+        fprintf(file, " %10s", exit_names[j]);
+    }
+    fprintf(file, " tier\n");
 
-    rvjit_linker_cleanup(block);
-    hashmap_clear(&block->heap.block_links);
+    for (size_t i=0; i<count; ++i) {
+        rvjit_block_stats_t* block = blocks[i];
+        fprintf(file, "  %016"PRIx64" %016"PRIx64" %6u %6u %14"PRIu64, (uint64_t)block->virt_pc,
+                (uint64_t)block->phys_pc, block->insns, (uint32_t)block->code_size, block->execs);
+        for (size_t j=0; j<RVJIT_EXITS; ++j) {
+            fprintf(file, " %10"PRIu64, block->exits[j]);
+        }
+        fprintf(file, " %s\n", block->optimized ? "opt" : "base");
+    }
+    fclose(file);
+    free(blocks);
+    rvvm_info("RVJIT report written to %s", stats->path);
+    return true;
 }
+
+/*
+ * Host profiler integration
+ */
+
+#if defined(__linux__)
+
+#include <time.h>
+
+#define RVJIT_JITDUMP_MAGIC    0x4A695444
+#define RVJIT_JITDUMP_VERSION  1
+#define RVJIT_JIT_CODE_LOAD    0
+#define RVJIT_JIT_CODE_CLOSE   3
+
+#if defined(__x86_64__)
+#define RVJIT_ELF_MACH 62
+#elif defined(__i386__)
+#define RVJIT_ELF_MACH 3
+#elif defined(__aarch64__)
+#define RVJIT_ELF_MACH 183
+#elif defined(__arm__)
+#define RVJIT_ELF_MACH 40
+#elif defined(__riscv)
+#define RVJIT_ELF_MACH 243
+#else
+#define RVJIT_ELF_MACH 0
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} rvjit_jitdump_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} rvjit_jitdump_record_t;
+
+typedef struct {
+    rvjit_jitdump_record_t rec;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} rvjit_jitdump_load_t;
+
+// Live block, rewritten into the perf map
+typedef struct {
+    size_t offset;
+    size_t size;
+    paddr_t phys_pc;
+    vaddr_t virt_pc;
+} rvjit_perf_block_t;
+
+struct rvjit_perf {
+    FILE* map;
+    char map_path[64];
+    FILE* dump;
+    void* dump_mark;    // Executable mapping of the dump, makes perf record it
+    uint64_t code_index;
+    uint32_t pid;
+    vector_t(rvjit_perf_block_t) regions[RVJIT_HEAP_REGIONS];
+};
+
+// perf expects CLOCK_MONOTONIC timestamps with `perf record -k mono`
+static uint64_t rvjit_perf_timestamp(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void rvjit_perf_name(char* name, size_t size, const rvjit_perf_block_t* block)
+{
+    if (block->virt_pc) {
+        snprintf(name, size, "rvjit 0x%"PRIx64" (phys 0x%"PRIx64")",
+                 (uint64_t)block->virt_pc, (uint64_t)block->phys_pc);
+    } else {
+        // Blocks installed from the persistent cache don't know their virtual PC
+        snprintf(name, size, "rvjit phys 0x%"PRIx64, (uint64_t)block->phys_pc);
+    }
+}
+
+static void rvjit_perf_map_write(rvjit_heap_t* heap, const rvjit_perf_block_t* block)
+{
+    char name[64];
+    rvjit_perf_name(name, sizeof(name), block);
+    fprintf(heap->perf->map, "%"PRIx64" %"PRIx64" %s\n",
+            (uint64_t)(size_t)(rvjit_heap_code(heap) + block->offset), (uint64_t)block->size, name);
+}
+
+static bool rvjit_perf_dump_open(rvjit_perf_t* perf)
+{
+    char path[64];
+    rvjit_jitdump_header_t header = {
+        .magic = RVJIT_JITDUMP_MAGIC,
+        .version = RVJIT_JITDUMP_VERSION,
+        .total_size = sizeof(rvjit_jitdump_header_t),
+        .elf_mach = RVJIT_ELF_MACH,
+        .pid = perf->pid,
+        .timestamp = rvjit_perf_timestamp(),
+    };
+    int fd;
+    snprintf(path, sizeof(path), "/tmp/jit-%u.dump", perf->pid);
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) return false;
+    // perf record notices the dump by it's executable mapping
+    perf->dump_mark = mmap(NULL, 4096, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (perf->dump_mark == MAP_FAILED) {
+        perf->dump_mark = NULL;
+        close(fd);
+        return false;
+    }
+    perf->dump = fdopen(fd, "wb");
+    if (perf->dump == NULL) {
+        munmap(perf->dump_mark, 4096);
+        close(fd);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, perf->dump);
+    return true;
+}
+
+static void rvjit_perf_dump_load(rvjit_heap_t* heap, const rvjit_perf_block_t* block)
+{
+    rvjit_perf_t* perf = heap->perf;
+    uint8_t* code = rvjit_heap_code(heap) + block->offset;
+    char name[64];
+    rvjit_jitdump_load_t load = {0};
+    rvjit_perf_name(name, sizeof(name), block);
+    load.rec.id = RVJIT_JIT_CODE_LOAD;
+    load.rec.total_size = sizeof(load) + strlen(name) + 1 + block->size;
+    load.rec.timestamp = rvjit_perf_timestamp();
+    load.pid = perf->pid;
+    load.tid = perf->pid;
+    load.vma = (size_t)code;
+    load.code_addr = (size_t)code;
+    load.code_size = block->size;
+    load.code_index = perf->code_index++;
+    fwrite(&load, sizeof(load), 1, perf->dump);
+    fwrite(name, strlen(name) + 1, 1, perf->dump);
+    fwrite(heap->data + block->offset, block->size, 1, perf->dump);
+}
+
+static void rvjit_perf_load(rvjit_heap_t* heap, rvjit_func_t func, size_t size, paddr_t phys_pc, vaddr_t virt_pc)
+{
+    rvjit_perf_block_t block = {
+        .offset = (size_t)func - (size_t)rvjit_heap_code(heap),
+        .size = size,
+        .phys_pc = phys_pc,
+        .virt_pc = virt_pc,
+    };
+    vector_push_back(heap->perf->regions[block.offset / heap->region_size], block);
+    rvjit_perf_map_write(heap, &block);
+    fflush(heap->perf->map);
+    if (heap->perf->dump) {
+        rvjit_perf_dump_load(heap, &block);
+        fflush(heap->perf->dump);
+    }
+}
+
+/*
+ * Rewrite the map without blocks of unloaded regions, their code space is reused.
+ * The dump keeps old loads, perf inject orders them by timestamp.
+ */
+static void rvjit_perf_unload(rvjit_heap_t* heap, size_t id)
+{
+    rvjit_perf_t* perf = heap->perf;
+    if (id < RVJIT_HEAP_REGIONS) {
+        if (vector_size(perf->regions[id]) == 0) return;
+        vector_clear(perf->regions[id]);
+    } else for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_clear(perf->regions[i]);
+    }
+    fclose(perf->map);
+    perf->map = fopen(perf->map_path, "w");
+    if (perf->map == NULL) {
+        rvvm_fatal("Failed to rewrite perf map");
+    }
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_foreach(perf->regions[i], j) {
+            rvjit_perf_map_write(heap, &vector_at(perf->regions[i], j));
+        }
+    }
+    fflush(perf->map);
+}
+
+static void rvjit_perf_free(rvjit_perf_t* perf)
+{
+    if (perf->dump) {
+        rvjit_jitdump_record_t rec = {
+            .id = RVJIT_JIT_CODE_CLOSE,
+            .total_size = sizeof(rec),
+            .timestamp = rvjit_perf_timestamp(),
+        };
+        fwrite(&rec, sizeof(rec), 1, perf->dump);
+        fclose(perf->dump);
+        munmap(perf->dump_mark, 4096);
+    }
+    // The map stays in place for perf report
+    fclose(perf->map);
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_free(perf->regions[i]);
+    }
+    free(perf);
+}
+
+bool rvjit_perf_enable(rvjit_heap_t* heap, bool jitdump)
+{
+    rvjit_perf_t* perf;
+    if (heap->perf) return true;
+    perf = safe_calloc(sizeof(rvjit_perf_t), 1);
+    perf->pid = getpid();
+    snprintf(perf->map_path, sizeof(perf->map_path), "/tmp/perf-%u.map", perf->pid);
+    perf->map = fopen(perf->map_path, "w");
+    if (perf->map == NULL) {
+        rvvm_warn("Failed to open %s", perf->map_path);
+        free(perf);
+        return false;
+    }
+    if (jitdump && !rvjit_perf_dump_open(perf)) {
+        rvvm_warn("Failed to open jitdump");
+        fclose(perf->map);
+        free(perf);
+        return false;
+    }
+    for (size_t i=0; i<RVJIT_HEAP_REGIONS; ++i) {
+        vector_init(perf->regions[i]);
+    }
+    spin_lock(&heap->lock);
+    heap->perf = perf;
+    spin_unlock(&heap->lock);
+    return true;
+}
+
+#else
+
+bool rvjit_perf_enable(rvjit_heap_t* heap, bool jitdump)
+{
+    UNUSED(heap);
+    UNUSED(jitdump);
+    return false;
+}
+
+static void rvjit_perf_load(rvjit_heap_t* heap, rvjit_func_t func, size_t size, paddr_t phys_pc, vaddr_t virt_pc)
+{
+    UNUSED(heap);
+    UNUSED(func);
+    UNUSED(size);
+    UNUSED(phys_pc);
+    UNUSED(virt_pc);
+}
+
+static void rvjit_perf_unload(rvjit_heap_t* heap, size_t id)
+{
+    UNUSED(heap);
+    UNUSED(id);
+}
+
+static void rvjit_perf_free(rvjit_perf_t* perf)
+{
+    UNUSED(perf);
+}
+
+#endif
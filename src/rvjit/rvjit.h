@@ -24,6 +24,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "utils.h"
 #include "hashmap.h"
 #include "vector.h"
+#include "spinlock.h"
 #include <string.h>
 
 #define REG_ILL 0xFF // Register is not allocated
@@ -46,6 +47,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
     #endif
     #define RVJIT_NATIVE_64BIT 1
     #define RVJIT_NATIVE_LINKER 1
+    #define RVJIT_NATIVE_ATOMICS 1
+    #define RVJIT_NATIVE_FPU 1
+    #define RVJIT_NATIVE_BITMANIP 1
+    #define RVJIT_NATIVE_INDIRECT 1
+    #define RVJIT_NATIVE_CONTRACT 1
+    #define RVJIT_BLOCK_SLOT 5
     #define RVJIT_X86 1
 #elif defined(__i386__) || defined(_M_IX86)
     #ifdef _WIN32
@@ -59,6 +66,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
     #endif
     #define RVJIT_ABI_FASTCALL 1
     #define RVJIT_NATIVE_LINKER 1
+    #define RVJIT_BLOCK_SLOT 5
     #define RVJIT_X86 1
 #elif defined(__riscv)
     #if __riscv_xlen == 64
@@ -68,6 +76,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
     #endif
     #define RVJIT_ABI_SYSV 1
     #define RVJIT_NATIVE_LINKER 1
+    #define RVJIT_BLOCK_SLOT 4
     #define RVJIT_RISCV 1
 #elif defined(__aarch64__) || defined(_M_ARM64)
     #define RVJIT_NATIVE_64BIT 1
@@ -94,15 +103,211 @@ typedef size_t  branch_t;
 #define BRANCH_ENTRY  false
 #define BRANCH_TARGET true
 
+// Maximum amount of guest pages spanned by a single block
+#define RVJIT_BLOCK_PAGES 4
+
+// Maximum amount of calls per block which get a return stub
+#define RVJIT_RAS_SITES 8
+
+// Maximum amount of guest registers passed in host registers into linked blocks
+#define RVJIT_CONTRACT_REGS 2
+
+#ifdef RVJIT_NATIVE_CONTRACT
+// Block header holds entry loads of the contract registers, padded to fixed size
+#define RVJIT_BLOCK_HEADER (7 * RVJIT_CONTRACT_REGS)
+#else
+#define RVJIT_BLOCK_HEADER 0
+#endif
+
+/*
+ * Linking backends emit a patchable no-op past the header, it's redirected
+ * into the block recompiled by the optimizing tier. Blocks are placed so that
+ * the slot is 8-byte aligned.
+ */
+#ifndef RVJIT_BLOCK_SLOT
+#define RVJIT_BLOCK_SLOT 0
+#endif
+
+// Heap is split into regions, filled in a ring and evicted one at a time
+#define RVJIT_HEAP_REGIONS 8
+
+/*
+ * Entries are compiled once executed this many times, cold code is interpreted.
+ * Compilation itself stays on the hart thread: blocks are traced while the
+ * interpreter executes them, so there is nothing to hand to a background thread.
+ */
+#define RVJIT_HOT_THRESHOLD 16
+
+// Amount of hotness counters, power of 2
+#define RVJIT_HOT_ENTRIES 0x4000
+
+// Compiled entries hit by this many profiling samples are recompiled by the optimizing tier
+#define RVJIT_OPT_SAMPLES 4
+
+// Hotness counter value of entries recompiled by the optimizing tier
+#define RVJIT_HOT_OPTIMIZED 0xFF
+
+// Amount of lock-free lookup entries in front of the blocks hashmap, power of 2
+#define RVJIT_LOOKUP_ENTRIES 0x1000
+
+// Maximum amount of IR ops lifted before they're lowered
+#define RVJIT_IR_OPS 64
+
+// Amount of remembered memory accesses for redundant load elimination
+#define RVJIT_IR_MEM 8
+
+// Block exit to be linked with another block, offset is relative to block start
+typedef struct {
+    paddr_t dest;
+    size_t offset;
+    uint64_t held;      // Guest registers held in host registers, see rvjit_contract_held()
+    bool linked;        // Jump to an existing block was emitted directly
+} rvjit_link_t;
+
+// Guest registers expected in host registers upon entry past the block header
+typedef struct {
+    regid_t greg[RVJIT_CONTRACT_REGS];
+    regid_t hreg[RVJIT_CONTRACT_REGS];
+    size_t count;
+} rvjit_contract_t;
+
+// Patchable jump site (heap offset), valid while it's region wasn't evicted
+typedef struct {
+    size_t offset;
+    uint64_t held;
+    uint32_t epoch;
+} rvjit_link_site_t;
+
+typedef struct {
+    vector_t(paddr_t) blocks;           // Keys of blocks placed in this region
+    vector_t(rvjit_link_site_t) links;  // Jumps patched into this region from other regions
+    uint32_t epoch;                     // Incremented upon each eviction
+} rvjit_region_t;
+
+// Reasons of block exits to the dispatcher, counted by instrumented blocks
+enum {
+    RVJIT_EXIT_BRANCH,   // Direct jump to a block which isn't linked (yet)
+    RVJIT_EXIT_EVENT,    // Linked jump interrupted by a pending event
+    RVJIT_EXIT_INDIRECT, // Indirect jump missed RAS & JTLB, or a pending event
+    RVJIT_EXIT_TLB,      // Load/store TLB miss
+    RVJIT_EXIT_GUARD,    // Page guard of a block spanning several pages failed
+    RVJIT_EXIT_FALLBACK, // Instruction left to the interpreter (FPU state, NaN-boxing, conversions)
+    RVJIT_EXITS
+};
+
+// Instrumentation counters of a compiled block, updated without locking
+typedef struct {
+    uint64_t execs;
+    uint64_t exits[RVJIT_EXITS];
+    paddr_t phys_pc;
+    vaddr_t virt_pc;
+    size_t code_size;
+    uint32_t insns;
+    uint32_t links_in;   // Jumps from other blocks chained into this one
+    bool optimized;
+} rvjit_block_stats_t;
+
+typedef struct {
+    char* path;          // Report written upon heap freeing
+    vector_t(rvjit_block_stats_t*) blocks;
+    uint64_t chains;     // Jumps patched to enter other blocks
+    uint64_t unchains;   // Patched jumps reverted upon region eviction
+    uint64_t evictions;
+    uint64_t invalidations;
+} rvjit_stats_t;
+
+// Persistent block cache, see rvjit_cache_open()
+typedef struct {
+    char* path;
+    uint64_t tag;
+    const uint8_t* mem_data;  // Guest RAM, for page hashing
+    paddr_t mem_begin;
+    size_t mem_size;
+    hashmap_t blocks;         // Records of valid blocks to write out, by phys_pc
+    hashmap_t pages;          // Loaded records awaiting verification, vector per page
+    uint32_t* pending_pages;  // Bitmap of guest RAM pages in the above, checked without lock
+    uint32_t pending;         // Amount of pages awaiting verification
+} rvjit_cache_t;
+
+/*
+ * Direct-mapped block lookup entry, read without the heap lock.
+ * Writers hold the lock and keep the sequence odd while updating,
+ * readers retry under the lock if it changed meanwhile.
+ */
+typedef struct {
+    uint32_t seq;
+    uint64_t phys_pc;
+    uint64_t code;
+} rvjit_lookup_t;
+
+/*
+ * Code heap & block cache, may be shared between several
+ * JIT contexts (one per hart), all of them compiling code
+ * for the same physical address space.
+ * The lock serializes block finalization and any changes
+ * to the hashmaps, block lookup takes it only on a miss.
+ */
 typedef struct {
     uint8_t* data;
     uint8_t* code;
     size_t curr;
     size_t size;
+    size_t region_size;
+    size_t tail_size;   // Largest block epilogue emitted so far, reserved ahead of placement
     hashmap_t blocks;
     hashmap_t block_links;
+    hashmap_t pages;    // Block & link keys per physical page, for invalidation
+    hashmap_t spans;    // Blocks spanning several pages, which aren't linked into
+    hashmap_t contracts; // Nonempty entry register contracts of blocks, packed
+    uint32_t* hotness;  // Execution counters of block entries, hashed by physical PC
+    rvjit_lookup_t* lookup; // Recently looked up blocks, hashed by physical PC
+    rvjit_cache_t* cache; // Persistent block cache, NULL if disabled
+    rvjit_stats_t* stats; // Instrumentation counters, NULL if disabled
+    struct rvjit_perf* perf; // Host profiler maps, NULL if disabled
+    spinlock_t lock;
+    uint32_t gen;       // Incremented upon each invalidation
+    uint32_t reclaim;   // Evicted region waiting to be reclaimed, plus one
+    rvjit_region_t regions[RVJIT_HEAP_REGIONS];
 } rvjit_heap_t;
 
+// Lifted guest instruction, see rvjit_ir.c
+typedef struct {
+    uint8_t op;
+    regid_t rd;
+    regid_t rs1;
+    regid_t rs2;
+    int32_t imm;
+    int32_t pc_off;
+    uint32_t insns;
+} rvjit_ir_op_t;
+
+// Known guest register value along the trace
+typedef struct {
+    uint64_t value;     // Constant, or offset from block entry PC
+    uint32_t version;   // Incremented upon each write
+    uint8_t kind;
+    bool sext;          // Sign-extended from 32 bits
+} rvjit_ir_value_t;
+
+// Memory access, it's value is held in val register until either register is written
+typedef struct {
+    uint8_t op;
+    regid_t base;
+    regid_t val;
+    int32_t offset;
+    uint32_t base_version;
+    uint32_t val_version;
+} rvjit_ir_mem_t;
+
+typedef struct {
+    rvjit_ir_op_t ops[RVJIT_IR_OPS];
+    size_t count;
+    rvjit_ir_value_t regs[RVJIT_REGISTERS];
+    rvjit_ir_mem_t mem[RVJIT_IR_MEM];
+    size_t mem_count;
+    bool enabled;       // Trace is lifted into IR & optimized before lowering
+} rvjit_ir_t;
+
 typedef struct {
     size_t last_used;   // Last usage of register for LRU reclaim
     int32_t auipc_off;
@@ -111,26 +316,54 @@ typedef struct {
 } rvjit_reginfo_t;
 
 typedef struct {
-    rvjit_heap_t heap;
-    vector_t(struct {paddr_t dest; size_t ptr;}) links;
+    rvjit_heap_t* heap;
+    vector_t(rvjit_link_t) links;
     uint8_t* code;
     size_t size;
     size_t space;
     size_t hreg_mask;        // Bitmask of available non-clobbered host registers
     size_t abireclaim_mask;  // Bitmask of reclaimed abi-clobbered host registers to restore
+    size_t hreg_clobbered;   // Bitmask of host registers claimed so far, others hold their entry values
     rvjit_reginfo_t regs[RVJIT_REGISTERS];
+    rvjit_contract_t contract;
+    rvjit_ir_t ir;           // Optimizing tier state
+#ifdef RVJIT_NATIVE_FPU
+    size_t fpu_hreg_mask;    // Bitmask of available host FPU registers
+    rvjit_reginfo_t fpu_regs[RVJIT_REGISTERS];
+    bool fpu_checked;        // FPU enable check was already emitted
+#endif
+#ifdef RVJIT_NATIVE_INDIRECT
+    // Return address stack pushes, patched to point at return stubs in the epilogue
+    struct {branch_t site; int32_t pc_off;} ras_sites[RVJIT_RAS_SITES];
+    size_t ras_count;
+    bool ras_pop;            // Block ends with a function return
+#endif
     vaddr_t virt_pc;
     paddr_t phys_pc;
+    // Pages following the entry one, reached via guest translation
+    struct {vaddr_t virt; paddr_t phys;} pages[RVJIT_BLOCK_PAGES - 1];
+    size_t page_count;
     int32_t pc_off;
+    uint32_t insns;          // Guest instructions traced so far, added to instret upon exit
+    uint32_t heap_gen;
+    rvjit_block_stats_t* stats; // Counters of the block being compiled, NULL if not instrumented
     bool rv64;
+    uint8_t tlb_bits;        // Guest TLB sets are indexed by this many VPN bits
     bool linkage;
+    bool placed;             // Heap placement is final, block epilogue is being emitted
 } rvjit_block_t;
 
-// Creates JIT context, sets upper limit on cache size
-void rvjit_ctx_init(rvjit_block_t* block, size_t heap_size);
+// Creates JIT code heap, sets upper limit on cache size
+void rvjit_heap_init(rvjit_heap_t* heap, size_t heap_size);
 
-// Frees the JIT context and block cache
-// All functions generated by this context are invalid after freeing it!
+// Frees the JIT code heap and block cache, writes out the persistent cache
+// All functions generated in this heap are invalid after freeing it!
+void rvjit_heap_free(rvjit_heap_t* heap);
+
+// Creates JIT context attached to a (possibly shared) code heap
+void rvjit_ctx_init(rvjit_block_t* block, rvjit_heap_t* heap);
+
+// Frees the JIT context, the heap is left intact
 void rvjit_ctx_free(rvjit_block_t* block);
 
 // Set guest bitness
@@ -144,29 +377,191 @@ static inline void rvjit_set_rv64(rvjit_block_t* block, bool rv64)
 #endif
 }
 
+// Set guest TLB size for inline lookups, blocks compiled for another size are invalid
+static inline void rvjit_set_tlb_bits(rvjit_block_t* block, uint8_t bits)
+{
+    block->tlb_bits = bits;
+}
+
 // Creates a new block, prepares codegen
 void rvjit_block_init(rvjit_block_t* block);
 
+/*
+ * Compiles the new block with the optimizing tier: the trace is lifted into IR,
+ * optimized across guest instructions & lowered, which is slower to compile.
+ * The block replaces one already compiled at the same entry.
+ */
+static inline void rvjit_block_optimize(rvjit_block_t* block)
+{
+    block->ir.enabled = true;
+}
+
+/*
+ * Returns true if the virtual page of vaddr is already spanned by the block
+ * Other pages are attached with rvjit_block_add_page() as the trace reaches them
+ */
+bool rvjit_block_has_page(rvjit_block_t* block, vaddr_t vaddr);
+
+/*
+ * Extends the block onto another page. Emits a guard which exits the block
+ * unless vaddr page is still mapped to host page at hptr upon execution.
+ * The block is invalidated along with any of it's pages.
+ * Returns false if the block can't span any more pages.
+ */
+bool rvjit_block_add_page(rvjit_block_t* block, vaddr_t vaddr, paddr_t paddr, const void* hptr);
+
+// Returns physical address of pc_off, or 0 when it's outside of the block pages
+paddr_t rvjit_block_phys_pc(rvjit_block_t* block, int32_t pc_off);
+
 // Returns true if the block has some instructions emitted
 static inline bool rvjit_block_nonempty(rvjit_block_t* block)
 {
-    return block->size != 0;
+    return block->size > RVJIT_BLOCK_HEADER + RVJIT_BLOCK_SLOT || block->ir.count;
 }
 
-// Returns NULL when cache is full, otherwise returns a valid function pointer
-// Inserts block into the lookup cache by phys_pc key
+/*
+ * Returns NULL when cache is full, otherwise returns a valid function pointer
+ * Inserts block into the lookup cache by phys_pc key, visible to every context sharing the heap
+ * If the block was invalidated while compiling, it is discarded (left empty), NULL is returned
+ *
+ * When the block starts a new heap region, the oldest region is evicted from
+ * lookup cache & unlinked, and awaits rvjit_reclaim(). The cache is full
+ * only when the region following current one wasn't reclaimed yet.
+ */
 rvjit_func_t rvjit_block_finalize(rvjit_block_t* block);
 
+/*
+ * Counts execution of a block entry at phys_pc, returns true once it's hot enough to be compiled.
+ * Counters are shared by contexts without locking, lost updates & collisions are harmless
+ */
+bool rvjit_block_hot(rvjit_block_t* block, paddr_t phys_pc);
+
+/*
+ * Counts a profiling sample of guest execution at phys_pc, returns true once the block
+ * compiled there should be recompiled by the optimizing tier, see rvjit_block_optimize().
+ */
+bool rvjit_block_sample(rvjit_block_t* block, paddr_t phys_pc);
+
 // Looks up for compiled block by phys_pc, returns NULL when no block was found
+// Safe to call concurrently with finalization in other contexts
 rvjit_func_t rvjit_block_lookup(rvjit_block_t* block, paddr_t phys_pc);
 
-// Cleans up internal heap & lookup cache,
+/*
+ * Drops blocks from pages in physical range [begin, end) from the lookup cache,
+ * along with their pending links. Blocks are only linked to blocks within their
+ * own pages, and never into blocks spanning several pages, so no other block
+ * jumps into invalidated ones.
+ * The code itself stays in the heap until it's region is evicted,
+ * blocks being compiled from these pages are discarded upon finalization.
+ */
+void rvjit_invalidate(rvjit_block_t* block, paddr_t begin, paddr_t end);
+
+// Returns true if an evicted region awaits rvjit_reclaim()
+static inline bool rvjit_reclaim_pending(rvjit_block_t* block)
+{
+    return atomic_load_uint32(&block->heap->reclaim) != 0;
+}
+
+/*
+ * Enables persistent block cache, backed by file at path.
+ * Blocks loaded from the file are installed only after the guest page they were
+ * compiled from is verified to have the same contents, upon first execution from it.
+ * The file is written out when the heap is freed. Files with another tag are ignored,
+ * the tag should identify the build & guest context layout.
+ */
+bool rvjit_cache_open(rvjit_heap_t* heap, const char* path, uint64_t tag, const void* mem_data, paddr_t mem_begin, size_t mem_size);
+
+// Returns true if cached blocks from the page of phys_pc await verification
+bool rvjit_cache_pending(rvjit_block_t* block, paddr_t phys_pc);
+
+/*
+ * Verifies the page of phys_pc & installs it's cached blocks, or drops them if the page differs.
+ * Stores to the page should already invalidate translated code.
+ */
+void rvjit_cache_install(rvjit_block_t* block, paddr_t phys_pc);
+
+/*
+ * Enables instrumentation: blocks compiled from now on count their executions,
+ * and record exit counter address (by reason) into the hart upon each exit to
+ * the dispatcher, see rvjit_stats_exit(). The report is written to path upon
+ * heap freeing. Instrumented code isn't relocatable, so the persistent cache is unused.
+ */
+void rvjit_stats_enable(rvjit_heap_t* heap, const char* path);
+
+// Writes the report of instrumented blocks sorted by execution count, returns false on failure
+bool rvjit_stats_dump(rvjit_heap_t* heap);
+
+// Counts the exit recorded by the instrumented block which returned to the dispatcher
+static inline void rvjit_stats_exit(uint64_t** exit)
+{
+    if (unlikely(*exit)) {
+        (**exit)++;
+        *exit = NULL;
+    }
+}
+
+/*
+ * Describes compiled blocks to Linux perf: /tmp/perf-<pid>.map lists blocks live in
+ * the heap and is rewritten upon eviction or flush, so reused code space isn't
+ * misattributed. With jitdump, /tmp/jit-<pid>.dump also records each block load
+ * along with it's code, for `perf record -k mono` & `perf inject --jit`.
+ */
+bool rvjit_perf_enable(rvjit_heap_t* heap, bool jitdump);
+
+// Makes the evicted region available for new blocks
+// No context sharing the heap should hold pointers into the evicted region!
+void rvjit_reclaim(rvjit_block_t* block);
+
+// Cleans up internal heap & lookup cache
+// No context sharing the heap should be executing generated code meanwhile!
 void rvjit_flush_cache(rvjit_block_t* block);
 
 // Internal APIs
 
 void rvjit_emit_init(rvjit_block_t* block);
 void rvjit_emit_end(rvjit_block_t* block, bool link);
+void rvjit_emit_page_guard(rvjit_block_t* block, int32_t offset, size_t hptr);
+
+// Returns true if both heap offsets belong to the same region
+static inline bool rvjit_heap_same_region(rvjit_heap_t* heap, size_t a, size_t b)
+{
+    return a / heap->region_size == b / heap->region_size;
+}
+
+// Contracts are packed into heap values: count, then greg/hreg pairs
+static inline size_t rvjit_contract_pack(const rvjit_contract_t* contract)
+{
+    uint64_t ret = contract->count;
+    for (size_t i=0; i<contract->count; ++i) {
+        ret |= ((uint64_t)contract->greg[i] << (4 + i * 10)) | ((uint64_t)contract->hreg[i] << (9 + i * 10));
+    }
+    return ret;
+}
+
+static inline void rvjit_contract_unpack(rvjit_contract_t* contract, uint64_t packed)
+{
+    contract->count = packed & 0xF;
+    for (size_t i=0; i<contract->count; ++i) {
+        contract->greg[i] = (packed >> (4 + i * 10)) & 0x1F;
+        contract->hreg[i] = (packed >> (9 + i * 10)) & 0x1F;
+    }
+}
+
+/*
+ * Guest registers held by host registers at a block exit are
+ * tracked for the first 12 host registers, 5 bits each (0 if none).
+ * Returns true if the exit may enter a block past it's header.
+ */
+#define RVJIT_HELD_HREGS 12
+
+static inline bool rvjit_contract_held(const rvjit_contract_t* contract, uint64_t held)
+{
+    for (size_t i=0; i<contract->count; ++i) {
+        if (contract->hreg[i] >= RVJIT_HELD_HREGS) return false;
+        if (((held >> (contract->hreg[i] * 5)) & 0x1F) != contract->greg[i]) return false;
+    }
+    return true;
+}
 
 regid_t rvjit_reclaim_hreg(rvjit_block_t* block);
 
@@ -210,6 +605,7 @@ static inline regid_t rvjit_claim_hreg(rvjit_block_t* block)
     if (hreg == REG_ILL) {
         hreg = rvjit_reclaim_hreg(block);
     }
+    block->hreg_clobbered |= rvjit_hreg_mask(hreg);
     return hreg;
 }
 
@@ -39,11 +39,17 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // RVVM-specific configuration
 
 #define VM_REG_OFFSET(reg) offsetof(rvvm_hart_t, registers[reg])
-#define VM_TLB_OFFSET      offsetof(rvvm_hart_t, tlb)
-#define VM_TLB_MASK        (TLB_SIZE-1)
+#define VM_TLB_PTR         offsetof(rvvm_hart_t, tlb)
 #define VM_TLB_R           offsetof(rvvm_tlb_entry_t, r)
 #define VM_TLB_W           offsetof(rvvm_tlb_entry_t, w)
 #define VM_TLB_E           offsetof(rvvm_tlb_entry_t, e)
+#define VM_JIT_EXIT_OFFSET offsetof(rvvm_hart_t, jit_exit)
+
+#if defined(RVJIT_NATIVE_FPU) && defined(USE_FPU)
+#define RVJIT_FPU 1
+#define VM_FREG_OFFSET(reg) offsetof(rvvm_hart_t, fpu_registers[reg])
+#define VM_STATUS_OFFSET    offsetof(rvvm_hart_t, csr.status)
+#endif
 
 #if defined(USE_RV64) || defined(RVJIT_NATIVE_64BIT)
 #define VM_TLB_SHIFT 5
@@ -51,29 +57,90 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define VM_TLB_SHIFT 4
 #endif
 
+#ifdef RVJIT_NATIVE_INDIRECT
+#define VM_JTLB_OFFSET     offsetof(rvvm_hart_t, jtlb)
+#define VM_RAS_OFFSET      offsetof(rvvm_hart_t, ras)
+#define VM_RAS_TOP         offsetof(rvvm_hart_t, ras_top)
+#define VM_JTLB_BLOCK      offsetof(rvvm_jtlb_entry_t, block)
+#define VM_JTLB_PC         offsetof(rvvm_jtlb_entry_t, pc)
+#define VM_JTLB_SHIFT      4
+#define VM_JTLB_MASK       (TLB_SIZE-1)
+#endif
+
+// Increment 64-bit counter at a host address
+static void rvjit_counter_inc(rvjit_block_t* block, uint64_t* counter)
+{
+    regid_t addr = rvjit_claim_hreg(block);
+    regid_t cnt = rvjit_claim_hreg(block);
+    rvjit_native_setregw(block, addr, (size_t)counter);
+#ifdef RVJIT_NATIVE_64BIT
+    rvjit64_native_ld(block, cnt, addr, 0);
+    rvjit64_native_addi(block, cnt, cnt, 1);
+    rvjit64_native_sd(block, cnt, addr, 0);
+#else
+    regid_t carry = rvjit_claim_hreg(block);
+    rvjit32_native_lw(block, cnt, addr, 0);
+    rvjit32_native_addi(block, cnt, cnt, 1);
+    rvjit32_native_sw(block, cnt, addr, 0);
+    rvjit32_native_sltiu(block, carry, cnt, 1);
+    rvjit32_native_lw(block, cnt, addr, 4);
+    rvjit32_native_add(block, cnt, cnt, carry);
+    rvjit32_native_sw(block, cnt, addr, 4);
+    rvjit_free_hreg(block, carry);
+#endif
+    rvjit_free_hreg(block, cnt);
+    rvjit_free_hreg(block, addr);
+}
+
 void rvjit_emit_init(rvjit_block_t* block)
 {
     block->hreg_mask = rvjit_native_default_hregmask();
     block->abireclaim_mask = 0;
+    block->hreg_clobbered = 0;
+    block->contract.count = 0;
+#ifdef RVJIT_NATIVE_CONTRACT
+    // Contract loads are emitted into the header at finalization
+    rvjit_native_nops(block, RVJIT_BLOCK_HEADER);
+#endif
+#ifdef RVJIT_NATIVE_LINKER
+    // Patched to enter the block recompiled by the optimizing tier instead
+    rvjit_patchable_slot(block);
+#endif
     for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
         block->regs[i].hreg = REG_ILL;
         block->regs[i].last_used = 0;
         block->regs[i].flags = 0;
     }
+#ifdef RVJIT_NATIVE_FPU
+    block->fpu_hreg_mask = rvjit_native_default_fpu_hregmask();
+    block->fpu_checked = false;
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        block->fpu_regs[i].hreg = REG_ILL;
+        block->fpu_regs[i].last_used = 0;
+        block->fpu_regs[i].flags = 0;
+    }
+#endif
+    // Entries redirected by the slot count in the optimized block instead
+    if (block->stats) rvjit_counter_inc(block, &block->stats->execs);
 }
 
-static void rvjit_load_reg(rvjit_block_t* block, regid_t reg)
+static void rvjit_load_hreg(rvjit_block_t* block, regid_t hreg, regid_t reg)
 {
-    if (block->regs[reg].hreg != REG_ILL) {
 #ifdef RVJIT_NATIVE_64BIT
-        if (block->rv64) {
-            rvjit64_native_ld(block, block->regs[reg].hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
-        } else {
-            rvjit32_native_lw(block, block->regs[reg].hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
-        }
+    if (block->rv64) {
+        rvjit64_native_ld(block, hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
+    } else {
+        rvjit32_native_lw(block, hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
+    }
 #else
-        rvjit32_native_lw(block, block->regs[reg].hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
+    rvjit32_native_lw(block, hreg, VM_PTR_REG, VM_REG_OFFSET(reg));
 #endif
+}
+
+static void rvjit_load_reg(rvjit_block_t* block, regid_t reg)
+{
+    if (block->regs[reg].hreg != REG_ILL) {
+        rvjit_load_hreg(block, block->regs[reg].hreg, reg);
     }
 }
 
@@ -136,16 +203,80 @@ regid_t rvjit_reclaim_hreg(rvjit_block_t* block)
     return hreg;
 }
 
+/*
+ * Block entry register contract
+ *
+ * Guest registers which are read before any host register is clobbered
+ * are loaded in the block header instead. Directly linked blocks skip
+ * the header, and pass these registers in place. Guest registers are
+ * still written back upon each exit, so the dispatcher, indirect jumps
+ * and patched links enter through the header as usual.
+ */
+
+// Take a guest register into the block entry contract, if there's room
+static bool rvjit_contract_add(rvjit_block_t* block, regid_t greg)
+{
+#ifdef RVJIT_NATIVE_CONTRACT
+    rvjit_contract_t* contract = &block->contract;
+    regid_t hreg = block->regs[greg].hreg;
+    if (greg == RVJIT_REGISTER_ZERO || contract->count >= RVJIT_CONTRACT_REGS) return false;
+    // Callee-saved registers are pushed upon claiming
+    if (!(rvjit_native_default_hregmask() & rvjit_hreg_mask(hreg))) return false;
+    contract->greg[contract->count] = greg;
+    contract->hreg[contract->count] = hreg;
+    contract->count++;
+    return true;
+#else
+    UNUSED(block);
+    UNUSED(greg);
+    return false;
+#endif
+}
+
+/*
+ * Guest registers prefer the same host register in every block,
+ * so block exits are likely to hold the contract of the next block
+ */
+static regid_t rvjit_claim_home_hreg(rvjit_block_t* block, regid_t greg)
+{
+#ifdef RVJIT_NATIVE_CONTRACT
+    size_t default_mask = rvjit_native_default_hregmask();
+    size_t count = 0, home;
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        if (default_mask & rvjit_hreg_mask(i)) count++;
+    }
+    home = greg % count;
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        if (!(default_mask & rvjit_hreg_mask(i))) continue;
+        if (home-- == 0) {
+            if (block->hreg_mask & rvjit_hreg_mask(i)) {
+                block->hreg_mask &= ~rvjit_hreg_mask(i);
+                block->hreg_clobbered |= rvjit_hreg_mask(i);
+                return i;
+            }
+            break;
+        }
+    }
+#else
+    UNUSED(greg);
+#endif
+    return rvjit_claim_hreg(block);
+}
+
 // Maps virtual register to hardware register
 static regid_t rvjit_map_reg(rvjit_block_t* block, regid_t greg, regflags_t flags)
 {
     if (unlikely(greg >= RVJIT_REGISTERS)) {
         rvvm_fatal("Mapped RVJIT register is out of range!");
     }
+    bool entry = false;
     if (block->regs[greg].hreg == REG_ILL) {
-        regid_t hreg = rvjit_claim_hreg(block);
+        size_t clobbered = block->hreg_clobbered;
+        regid_t hreg = rvjit_claim_home_hreg(block, greg);
         block->regs[greg].hreg = hreg;
         block->regs[greg].flags = 0;
+        // Neither guest nor host register were touched since block entry
+        entry = !(clobbered & rvjit_hreg_mask(hreg)) && block->regs[greg].last_used == 0;
     }
     block->regs[greg].last_used = block->size;
 
@@ -162,11 +293,83 @@ static regid_t rvjit_map_reg(rvjit_block_t* block, regid_t greg, regflags_t flag
     }
     if ((flags & REG_SRC) && !(block->regs[greg].flags & (REG_LOADED | REG_DIRTY))) {
         block->regs[greg].flags |= REG_LOADED;
-        rvjit_load_reg(block, greg);
+        if (!entry || !rvjit_contract_add(block, greg)) {
+            rvjit_load_reg(block, greg);
+        }
     }
     return block->regs[greg].hreg;
 }
 
+#ifdef RVJIT_FPU
+
+/*
+ * FPU registers are allocated separately from the integer ones,
+ * mapped host registers hold the raw 64-bit value of the guest register.
+ */
+
+static void rvjit_fpu_save_reg(rvjit_block_t* block, regid_t reg)
+{
+    if (block->fpu_regs[reg].hreg != REG_ILL && (block->fpu_regs[reg].flags & REG_DIRTY)) {
+        rvjit_native_fsd(block, block->fpu_regs[reg].hreg, VM_PTR_REG, VM_FREG_OFFSET(reg));
+    }
+}
+
+static void rvjit_fpu_free_reg(rvjit_block_t* block, regid_t reg)
+{
+    if (block->fpu_regs[reg].hreg != REG_ILL) {
+        rvjit_fpu_save_reg(block, reg);
+        block->fpu_hreg_mask |= rvjit_hreg_mask(block->fpu_regs[reg].hreg);
+        block->fpu_regs[reg].hreg = REG_ILL;
+    }
+}
+
+static regid_t rvjit_fpu_claim_hreg(rvjit_block_t* block)
+{
+    regid_t greg = 0;
+    size_t lru = (size_t)-1;
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        if (block->fpu_hreg_mask & rvjit_hreg_mask(i)) {
+            block->fpu_hreg_mask &= ~rvjit_hreg_mask(i);
+            return i;
+        }
+    }
+    // Reclaim least recently used register mapping
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        if (block->fpu_regs[i].hreg != REG_ILL && block->fpu_regs[i].last_used < lru) {
+            lru = block->fpu_regs[i].last_used;
+            greg = i;
+        }
+    }
+    if (unlikely(lru == (size_t)-1)) {
+        rvvm_fatal("No reclaimable RVJIT FPU registers!");
+    }
+    regid_t hreg = block->fpu_regs[greg].hreg;
+    rvjit_fpu_free_reg(block, greg);
+    block->fpu_hreg_mask &= ~rvjit_hreg_mask(hreg);
+    return hreg;
+}
+
+// Maps virtual FPU register to hardware register
+static regid_t rvjit_map_freg(rvjit_block_t* block, regid_t freg, regflags_t flags)
+{
+    if (block->fpu_regs[freg].hreg == REG_ILL) {
+        block->fpu_regs[freg].hreg = rvjit_fpu_claim_hreg(block);
+        block->fpu_regs[freg].flags = 0;
+    }
+    block->fpu_regs[freg].last_used = block->size;
+
+    if (flags & REG_DST) {
+        block->fpu_regs[freg].flags |= REG_DIRTY;
+    }
+    if ((flags & REG_SRC) && !(block->fpu_regs[freg].flags & (REG_LOADED | REG_DIRTY))) {
+        block->fpu_regs[freg].flags |= REG_LOADED;
+        rvjit_native_fld(block, block->fpu_regs[freg].hreg, VM_PTR_REG, VM_FREG_OFFSET(freg));
+    }
+    return block->fpu_regs[freg].hreg;
+}
+
+#endif
+
 static void rvjit_update_vm_pc(rvjit_block_t* block)
 {
     if (block->pc_off == 0) return;
@@ -186,30 +389,406 @@ static void rvjit_update_vm_pc(rvjit_block_t* block)
     rvjit_free_hreg(block, pc);
 }
 
-static void rvjit_link_block(rvjit_block_t* block)
+static void rvjit_update_vm_instret(rvjit_block_t* block)
+{
+    if (block->insns == 0) return;
+    regid_t cnt = rvjit_claim_hreg(block);
+#ifdef RVJIT_NATIVE_64BIT
+    rvjit64_native_ld(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret));
+    rvjit64_native_addi(block, cnt, cnt, block->insns);
+    rvjit64_native_sd(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret));
+#else
+    // Propagate carry into the high word
+    regid_t carry = rvjit_claim_hreg(block);
+    rvjit32_native_lw(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret));
+    rvjit32_native_addi(block, cnt, cnt, block->insns);
+    rvjit32_native_sw(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret));
+    rvjit32_native_sltiu(block, carry, cnt, block->insns);
+    rvjit32_native_lw(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret) + 4);
+    rvjit32_native_add(block, cnt, cnt, carry);
+    rvjit32_native_sw(block, cnt, VM_PTR_REG, offsetof(rvvm_hart_t, instret) + 4);
+    rvjit_free_hreg(block, carry);
+#endif
+    rvjit_free_hreg(block, cnt);
+}
+
+/*
+ * Instrumented exits record their counter in the hart, it's incremented
+ * by the dispatcher if the block actually returns there (isn't linked)
+ */
+static void rvjit_record_exit(rvjit_block_t* block, uint8_t reason)
 {
+    if (block->stats == NULL) return;
+    regid_t addr = rvjit_claim_hreg(block);
+    rvjit_native_setregw(block, addr, (size_t)&block->stats->exits[reason]);
+#ifdef RVJIT_NATIVE_64BIT
+    rvjit64_native_sd(block, addr, VM_PTR_REG, VM_JIT_EXIT_OFFSET);
+#else
+    rvjit32_native_sw(block, addr, VM_PTR_REG, VM_JIT_EXIT_OFFSET);
+#endif
+    rvjit_free_hreg(block, addr);
+}
+
 #ifdef RVJIT_NATIVE_LINKER
-    paddr_t dest = block->phys_pc + block->pc_off;
-    size_t exit_ptr = (size_t)(block->heap.data + block->heap.curr + block->size);
-    size_t dest_block;
-    if (dest == block->phys_pc) {
-        dest_block = (size_t)(block->heap.data + block->heap.curr);
-    } else {
-        dest_block = hashmap_get(&block->heap.blocks, dest);
+
+/*
+ * Returns heap offset of the block at dest if it may be jumped into directly,
+ * otherwise returns (size_t)-1.
+ * Other contexts may place blocks until we're finalized,
+ * links to other blocks are only emitted at final placement.
+ * Only link to blocks which are evicted along with us,
+ * blocks spanning several pages are only linked to themselves.
+ */
+static size_t rvjit_link_target(rvjit_block_t* block, paddr_t dest)
+{
+    rvjit_heap_t* heap = block->heap;
+    size_t dest_ptr, dest_block;
+    if (dest == block->phys_pc) return heap->curr;
+    dest_ptr = block->placed ? hashmap_get(&heap->blocks, dest) : 0;
+    dest_block = dest_ptr - (size_t)(heap->code ? heap->code : heap->data);
+    if (dest_ptr && rvjit_heap_same_region(heap, dest_block, heap->curr)
+     && !hashmap_get(&heap->spans, dest)) {
+        return dest_block;
     }
+    return (size_t)-1;
+}
+
+#endif
 
-    if ((dest >> 12) == (block->phys_pc >> 12)) {
-        if (dest_block) {
+/*
+ * Direct jumps skip the block header when passing the register contract,
+ * other exits record guest registers they hold to be linked the same way.
+ */
+static void rvjit_link_block(rvjit_block_t* block, bool pass, uint64_t held)
+{
+#ifdef RVJIT_NATIVE_LINKER
+    rvjit_heap_t* heap = block->heap;
+    // Exits to pages which weren't attached to the block (yet) aren't linked
+    paddr_t dest = rvjit_block_phys_pc(block, block->pc_off);
+    size_t exit_ptr = heap->curr + block->size;
+    size_t dest_block = rvjit_link_target(block, dest);
+    bool found = dest_block != (size_t)-1;
+
+    if (dest) {
+        if (dest != block->phys_pc) {
+            // Jump site is tracked relative to block start until placement
+            vector_emplace_back(block->links);
+            vector_at(block->links, vector_size(block->links) - 1).dest = dest;
+            vector_at(block->links, vector_size(block->links) - 1).offset = block->size;
+            vector_at(block->links, vector_size(block->links) - 1).held = held;
+            vector_at(block->links, vector_size(block->links) - 1).linked = found;
+        }
+        if (found) {
+            if (pass) dest_block += RVJIT_BLOCK_HEADER;
             rvjit_tail_bnez(block, VM_PTR_REG, dest_block - exit_ptr);
             //rvjit_tail_jmp(block, dest_block - exit_ptr);
-        } else if (dest) {
+        } else {
             rvjit_patchable_ret(block);
-            vector_emplace_back(block->links);
-            vector_at(block->links, vector_size(block->links) - 1).dest = dest;
-            vector_at(block->links, vector_size(block->links) - 1).ptr = exit_ptr;
             return;
         }
     }
+#else
+    UNUSED(pass);
+    UNUSED(held);
+#endif
+    rvjit_native_ret(block);
+}
+
+#ifdef RVJIT_NATIVE_CONTRACT
+
+// Get contract of the block the final exit links to, if any
+static bool rvjit_link_contract(rvjit_block_t* block, rvjit_contract_t* contract)
+{
+    paddr_t dest = rvjit_block_phys_pc(block, block->pc_off);
+    if (!block->placed || !dest) return false;
+    if (dest == block->phys_pc) {
+        *contract = block->contract;
+        return true;
+    }
+    if (rvjit_link_target(block, dest) == (size_t)-1) return false;
+    rvjit_contract_unpack(contract, hashmap_get(&block->heap->contracts, dest));
+    return true;
+}
+
+/*
+ * Move guest registers into host registers expected by the linked block.
+ * Guest registers are already written back, so they are reloaded
+ * when not mapped, or when moves form a cycle.
+ */
+static void rvjit_pass_contract(rvjit_block_t* block, const rvjit_contract_t* contract)
+{
+    regid_t src[RVJIT_CONTRACT_REGS];
+    bool done[RVJIT_CONTRACT_REGS];
+    size_t left = 0;
+
+    for (size_t i=0; i<contract->count; ++i) {
+        regid_t greg = contract->greg[i];
+        block->hreg_mask &= ~rvjit_hreg_mask(contract->hreg[i]);
+        src[i] = (block->regs[greg].flags & (REG_LOADED | REG_DIRTY)) ? block->regs[greg].hreg : REG_ILL;
+        done[i] = src[i] == contract->hreg[i];
+        if (!done[i]) left++;
+    }
+
+    while (left) {
+        bool progress = false;
+        for (size_t i=0; i<contract->count; ++i) {
+            bool blocked = false;
+            if (done[i]) continue;
+            // Don't overwrite a source of pending moves
+            for (size_t j=0; j<contract->count; ++j) {
+                if (!done[j] && j != i && src[j] == contract->hreg[i]) blocked = true;
+            }
+            if (blocked) continue;
+            if (src[i] == REG_ILL) {
+                rvjit_load_hreg(block, contract->hreg[i], contract->greg[i]);
+            } else if (block->rv64) {
+                rvjit64_native_addi(block, contract->hreg[i], src[i], 0);
+            } else {
+                rvjit32_native_addi(block, contract->hreg[i], src[i], 0);
+            }
+            done[i] = true;
+            progress = true;
+            left--;
+        }
+        if (!progress) {
+            // Break the cycle by reloading one of the moved registers
+            for (size_t i=0; i<contract->count; ++i) {
+                if (!done[i]) {
+                    src[i] = REG_ILL;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Collect guest registers held in host registers at the exit,
+ * keep them intact until the jump site if possible.
+ */
+static uint64_t rvjit_exit_held(rvjit_block_t* block, const rvjit_contract_t* contract)
+{
+    size_t hreg_mask = block->hreg_mask;
+    uint64_t held = 0;
+    for (regid_t greg=1; greg<RVJIT_REGISTERS; ++greg) {
+        regid_t hreg = block->regs[greg].hreg;
+        if (hreg < RVJIT_HELD_HREGS && (block->hreg_mask & rvjit_hreg_mask(hreg))
+         && (block->regs[greg].flags & (REG_LOADED | REG_DIRTY))) {
+            held |= ((uint64_t)greg) << (hreg * 5);
+            hreg_mask &= ~rvjit_hreg_mask(hreg);
+        }
+    }
+    if (contract) {
+        // Contract moves have overwritten these, and are excluded from the mask already
+        for (size_t i=0; i<contract->count; ++i) {
+            held &= ~(((uint64_t)0x1F) << (contract->hreg[i] * 5));
+            held |= ((uint64_t)contract->greg[i]) << (contract->hreg[i] * 5);
+        }
+    }
+    if (!hreg_mask) {
+        // No scratch registers left for the exit, sacrifice one
+        for (regid_t hreg=0; hreg<RVJIT_REGISTERS; ++hreg) {
+            if (block->hreg_mask & rvjit_hreg_mask(hreg)) {
+                if (hreg < RVJIT_HELD_HREGS) held &= ~(((uint64_t)0x1F) << (hreg * 5));
+                hreg_mask = rvjit_hreg_mask(hreg);
+                break;
+            }
+        }
+    }
+    block->hreg_mask = hreg_mask;
+    return held;
+}
+
+// Fill the block header with contract register loads
+static void rvjit_emit_contract_entry(rvjit_block_t* block)
+{
+    size_t size = block->size;
+    block->size = 0;
+    for (size_t i=0; i<block->contract.count; ++i) {
+        rvjit_load_hreg(block, block->contract.hreg[i], block->contract.greg[i]);
+    }
+    if (unlikely(block->size > RVJIT_BLOCK_HEADER)) {
+        rvvm_fatal("RVJIT contract loads overflow the block header!");
+    }
+    rvjit_native_nops(block, RVJIT_BLOCK_HEADER - block->size);
+    block->size = size;
+}
+
+#endif
+
+#ifdef RVJIT_NATIVE_INDIRECT
+
+// JTLB & RAS entries hold vaddr_t regardless of guest bitness
+
+static void rvjit_load_vaddr(rvjit_block_t* block, regid_t hrds, regid_t addr, int32_t off)
+{
+#ifdef USE_RV64
+    rvjit64_native_ld(block, hrds, addr, off);
+#else
+    rvjit32_native_lw(block, hrds, addr, off);
+#endif
+}
+
+static void rvjit_store_vaddr(rvjit_block_t* block, regid_t hrs, regid_t addr, int32_t off)
+{
+#ifdef USE_RV64
+    rvjit64_native_sd(block, hrs, addr, off);
+#else
+    rvjit32_native_sw(block, hrs, addr, off);
+#endif
+}
+
+static branch_t rvjit_vaddr_bne(rvjit_block_t* block, regid_t hrs1, regid_t hrs2, branch_t handle, bool target)
+{
+#ifdef USE_RV64
+    return rvjit64_native_bne(block, hrs1, hrs2, handle, target);
+#else
+    return rvjit32_native_bne(block, hrs1, hrs2, handle, target);
+#endif
+}
+
+static inline bool rvjit_is_link_reg(regid_t reg)
+{
+    return reg == 1 || reg == 5;
+}
+
+// Push or pop the RAS, leave pointer to the pushed or popped entry in hent
+static void rvjit_ras_update(rvjit_block_t* block, regid_t hent, bool push)
+{
+    rvjit32_native_lw(block, hent, VM_PTR_REG, VM_RAS_TOP);
+    if (push) {
+        rvjit32_native_addi(block, hent, hent, 1);
+        rvjit32_native_andi(block, hent, hent, RAS_SIZE - 1);
+        rvjit32_native_sw(block, hent, VM_PTR_REG, VM_RAS_TOP);
+    } else {
+        regid_t htop = rvjit_claim_hreg(block);
+        rvjit32_native_addi(block, htop, hent, -1);
+        rvjit32_native_andi(block, htop, htop, RAS_SIZE - 1);
+        rvjit32_native_sw(block, htop, VM_PTR_REG, VM_RAS_TOP);
+        rvjit_free_hreg(block, htop);
+    }
+    rvjit64_native_slli(block, hent, hent, VM_JTLB_SHIFT);
+    rvjit64_native_add(block, hent, hent, VM_PTR_REG);
+}
+
+/*
+ * Calls push the return address along with a return stub,
+ * which is emitted in the block epilogue and linked like
+ * any other block exit. Calls past the stub limit push an
+ * entry which is never matched, to keep the stack balanced.
+ */
+static void rvjit_ras_push(rvjit_block_t* block, int32_t pc_off)
+{
+    regid_t hent = rvjit_claim_hreg(block);
+    regid_t htmp = rvjit_claim_hreg(block);
+    rvjit_ras_update(block, hent, true);
+    if (block->ras_count < RVJIT_RAS_SITES) {
+        if (block->rv64) {
+            rvjit64_native_ld(block, htmp, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+            if (pc_off) rvjit64_native_addi(block, htmp, htmp, pc_off);
+        } else {
+            rvjit32_native_lw(block, htmp, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+            if (pc_off) rvjit32_native_addi(block, htmp, htmp, pc_off);
+        }
+        rvjit_store_vaddr(block, htmp, hent, VM_RAS_OFFSET + VM_JTLB_PC);
+        block->ras_sites[block->ras_count].site = rvjit_tail_lea(block, htmp, BRANCH_NEW, BRANCH_ENTRY);
+        block->ras_sites[block->ras_count].pc_off = pc_off;
+        block->ras_count++;
+        rvjit64_native_sd(block, htmp, hent, VM_RAS_OFFSET + VM_JTLB_BLOCK);
+    } else {
+        rvjit_native_setreg32s(block, htmp, -1);
+        rvjit_store_vaddr(block, htmp, hent, VM_RAS_OFFSET + VM_JTLB_PC);
+    }
+    rvjit_free_hreg(block, htmp);
+    rvjit_free_hreg(block, hent);
+}
+
+static void rvjit_ras_drop(rvjit_block_t* block)
+{
+    regid_t hent = rvjit_claim_hreg(block);
+    rvjit_ras_update(block, hent, false);
+    rvjit_free_hreg(block, hent);
+}
+
+/*
+ * Track calls & returns by the jalr link register hints, as per
+ * the unprivileged spec: rd link only is a call (push), rs1 link only
+ * is a return (pop), both with rd != rs1 is a coroutine swap
+ * (pop, then push), and both with rd == rs1 is a call (push).
+ */
+static void rvjit_ras_hint(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t pc_off)
+{
+    bool rd_link = rvjit_is_link_reg(rds);
+    bool rs_link = rvjit_is_link_reg(rs);
+    if (rs_link && !rd_link) {
+        if (block->regs[rs].flags & REG_AUIPC) {
+            // Return address is known, just pop the entry
+            rvjit_ras_drop(block);
+        } else {
+            block->ras_pop = true;
+        }
+    } else if (rs_link && rds != rs) {
+        // The popped entry is covered by the push, predict the jump via JTLB
+        rvjit_ras_drop(block);
+        rvjit_ras_push(block, pc_off);
+    } else if (rd_link) {
+        rvjit_ras_push(block, pc_off);
+    }
+}
+
+static void rvjit_emit_ras_stubs(rvjit_block_t* block)
+{
+    int32_t pc_off = block->pc_off;
+    for (size_t i=0; i<block->ras_count; ++i) {
+        rvjit_tail_lea(block, 0, block->ras_sites[i].site, BRANCH_TARGET);
+        block->pc_off = block->ras_sites[i].pc_off;
+        rvjit_link_block(block, false, 0);
+    }
+    block->pc_off = pc_off;
+}
+
+#endif
+
+/*
+ * Jump to the block at guest PC if it's cached in the RAS or JTLB,
+ * otherwise return to the dispatcher. Interrupts are checked
+ * the same way as in block linkage.
+ */
+static void rvjit_jump_indirect(rvjit_block_t* block)
+{
+#ifdef RVJIT_NATIVE_INDIRECT
+    regid_t hpc = rvjit_claim_hreg(block);
+    regid_t hent = rvjit_claim_hreg(block);
+    regid_t htmp = rvjit_claim_hreg(block);
+    branch_t l_event, l_miss;
+
+    rvjit32_native_lw(block, htmp, VM_PTR_REG, offsetof(rvvm_hart_t, wait_event));
+    l_event = rvjit32_native_beqz(block, htmp, BRANCH_NEW, BRANCH_ENTRY);
+    rvjit_load_vaddr(block, hpc, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+
+    if (block->ras_pop) {
+        rvjit_ras_update(block, hent, false);
+        rvjit_load_vaddr(block, htmp, hent, VM_RAS_OFFSET + VM_JTLB_PC);
+        l_miss = rvjit_vaddr_bne(block, htmp, hpc, BRANCH_NEW, BRANCH_ENTRY);
+        rvjit64_native_ld(block, htmp, hent, VM_RAS_OFFSET + VM_JTLB_BLOCK);
+        rvjit_tail_jmpreg(block, htmp);
+        rvjit_vaddr_bne(block, htmp, hpc, l_miss, BRANCH_TARGET);
+    }
+
+    rvjit64_native_srli(block, hent, hpc, 1);
+    rvjit32_native_andi(block, hent, hent, VM_JTLB_MASK);
+    rvjit64_native_slli(block, hent, hent, VM_JTLB_SHIFT);
+    rvjit64_native_add(block, hent, hent, VM_PTR_REG);
+    rvjit_load_vaddr(block, htmp, hent, VM_JTLB_OFFSET + VM_JTLB_PC);
+    l_miss = rvjit_vaddr_bne(block, htmp, hpc, BRANCH_NEW, BRANCH_ENTRY);
+    rvjit64_native_ld(block, htmp, hent, VM_JTLB_OFFSET + VM_JTLB_BLOCK);
+    rvjit_tail_jmpreg(block, htmp);
+    rvjit_vaddr_bne(block, htmp, hpc, l_miss, BRANCH_TARGET);
+    rvjit32_native_beqz(block, htmp, l_event, BRANCH_TARGET);
+
+    rvjit_free_hreg(block, htmp);
+    rvjit_free_hreg(block, hent);
+    rvjit_free_hreg(block, hpc);
 #endif
     rvjit_native_ret(block);
 }
@@ -233,17 +812,48 @@ void rvjit_linker_patch_ret(void* addr)
 #endif
 }
 
-void rvjit_emit_end(rvjit_block_t* block, bool link)
+void rvjit_linker_patch_slot(void* addr, int32_t offset)
+{
+#ifdef RVJIT_NATIVE_LINKER
+    rvjit_patch_slot(addr, offset);
+#else
+    UNUSED(addr);
+    UNUSED(offset);
+#endif
+}
+
+static void rvjit_emit_exit(rvjit_block_t* block, bool link, uint8_t reason)
 {
     size_t hreg_mask = block->hreg_mask;
     size_t abireclaim_mask = block->abireclaim_mask;
     // Save allocated native registers into VM context
     for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
         rvjit_save_reg(block, i);
+#ifdef RVJIT_FPU
+        rvjit_fpu_save_reg(block, i);
+#endif
     }
 
     block->hreg_mask = rvjit_native_default_hregmask();
+#ifdef RVJIT_NATIVE_CONTRACT
+    rvjit_contract_t contract;
+    bool pass = link && rvjit_link_contract(block, &contract);
+    if (pass) rvjit_pass_contract(block, &contract);
+    uint64_t held = link ? rvjit_exit_held(block, pass ? &contract : NULL) : 0;
+#else
+    bool pass = false;
+    uint64_t held = 0;
+#endif
     rvjit_update_vm_pc(block);
+    rvjit_update_vm_instret(block);
+#ifdef RVJIT_NATIVE_LINKER
+    // Linked jumps fall through only on a pending event
+    if (link && reason == RVJIT_EXIT_BRANCH) {
+        paddr_t dest = rvjit_block_phys_pc(block, block->pc_off);
+        if (dest && rvjit_link_target(block, dest) != (size_t)-1) reason = RVJIT_EXIT_EVENT;
+    }
+#endif
+    rvjit_record_exit(block, reason);
 
     // Recover clobbered registers
     for (regid_t i=RVJIT_REGISTERS; i>0; --i) {
@@ -253,20 +863,42 @@ void rvjit_emit_end(rvjit_block_t* block, bool link)
     }
 
     if (link) {
-        rvjit_link_block(block);
+        rvjit_link_block(block, pass, held);
+    } else if (block->placed) {
+        // Indirect jump at the end of the block
+        rvjit_jump_indirect(block);
     } else {
         rvjit_native_ret(block);
     }
 
+#ifdef RVJIT_NATIVE_INDIRECT
+    if (block->placed) rvjit_emit_ras_stubs(block);
+#endif
+#ifdef RVJIT_NATIVE_CONTRACT
+    if (block->placed) rvjit_emit_contract_entry(block);
+#endif
+
     block->hreg_mask = hreg_mask;
     block->abireclaim_mask = abireclaim_mask;
 }
 
+void rvjit_emit_end(rvjit_block_t* block, bool link)
+{
+    rvjit_emit_exit(block, link, link ? RVJIT_EXIT_BRANCH : RVJIT_EXIT_INDIRECT);
+}
+
 /*
  * Important: REG_DST (destination) registers should be mapped at the end,
  * otherwise nasty errors occur, this simplifies register remapping
  */
 
+// Optimizing tier lifts the instruction into IR instead, lowering calls back here
+#define RVJIT_IR_LIFT(instr, rd, rs1, rs2, imm) \
+    if (block->ir.enabled) { \
+        rvjit_ir_lift(block, RVJIT_IR_##instr, rd, rs1, rs2, imm); \
+        return; \
+    }
+
 /*
  * ALU Register-Register intrinsics
  */
@@ -309,6 +941,7 @@ void rvjit_emit_end(rvjit_block_t* block, bool link)
 #define RVJIT32_3REG(instr) \
 void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, rs2, 0); \
     RVJIT_3REG_OP(rvjit32_native_##instr, rds, rs1, rs2); \
 }
 
@@ -316,6 +949,7 @@ void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2
 #define RVJIT64_3REG(instr) \
 void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, rs2, 0); \
     RVJIT_3REG_OP(rvjit64_native_##instr, rds, rs1, rs2); \
 }
 #else
@@ -333,6 +967,7 @@ RVJIT64_3REG(instr)
 #define RVJIT32_IMM_INC(instr) \
 void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, 0, imm); \
     RVJIT32_IMM_INC_OPTIMIZE(rds, rs1, imm); \
     RVJIT_2REG_IMM_OP(rvjit32_native_##instr, rds, rs1, imm); \
 }
@@ -341,6 +976,7 @@ void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm
 #define RVJIT64_IMM_INC(instr) \
 void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, 0, imm); \
     RVJIT64_IMM_INC_OPTIMIZE(rds, rs1, imm); \
     RVJIT_2REG_IMM_OP(rvjit64_native_##instr, rds, rs1, imm); \
 }
@@ -355,6 +991,7 @@ RVJIT64_IMM_INC(instr)
 #define RVJIT32_IMM(instr) \
 void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, 0, imm); \
     RVJIT_IMM_ZERO_OPTIMIZE(rds, rs1, imm); \
     RVJIT_2REG_IMM_OP(rvjit32_native_##instr, rds, rs1, imm); \
 }
@@ -363,6 +1000,7 @@ void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm
 #define RVJIT64_IMM(instr) \
 void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
 { \
+    RVJIT_IR_LIFT(instr, rds, rs1, 0, imm); \
     RVJIT_IMM_ZERO_OPTIMIZE(rds, rs1, imm); \
     RVJIT_2REG_IMM_OP(rvjit64_native_##instr, rds, rs1, imm); \
 }
@@ -381,6 +1019,7 @@ RVJIT64_IMM(instr)
 #define RVJIT32_BRANCH(instr) \
 void rvjit32_##instr(rvjit_block_t* block, regid_t rs1, regid_t rs2) \
 { \
+    RVJIT_IR_LIFT(instr, 0, rs1, rs2, 0); \
     regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC); \
     regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC); \
     branch_t l1 = rvjit32_native_##instr(block, hrs1, hrs2, BRANCH_NEW, BRANCH_ENTRY); \
@@ -392,6 +1031,7 @@ void rvjit32_##instr(rvjit_block_t* block, regid_t rs1, regid_t rs2) \
 #define RVJIT64_BRANCH(instr) \
 void rvjit64_##instr(rvjit_block_t* block, regid_t rs1, regid_t rs2) \
 { \
+    RVJIT_IR_LIFT(instr, 0, rs1, rs2, 0); \
     regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC); \
     regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC); \
     branch_t l1 = rvjit64_native_##instr(block, hrs1, hrs2, BRANCH_NEW, BRANCH_ENTRY); \
@@ -461,6 +1101,7 @@ RVJIT_BRANCH(bgeu)
 
 void rvjit32_li(rvjit_block_t* block, regid_t rds, int32_t imm)
 {
+    RVJIT_IR_LIFT(li, rds, 0, 0, imm);
     if (rds == RVJIT_REGISTER_ZERO) return;
     regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
     rvjit_native_setreg32(block, hrds, imm);
@@ -468,6 +1109,7 @@ void rvjit32_li(rvjit_block_t* block, regid_t rds, int32_t imm)
 
 void rvjit32_auipc(rvjit_block_t* block, regid_t rds, int32_t imm)
 {
+    RVJIT_IR_LIFT(auipc, rds, 0, 0, imm);
     if (rds == RVJIT_REGISTER_ZERO) return;
     regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
     rvjit32_native_lw(block, hrds, VM_PTR_REG, offsetof(rvvm_hart_t, registers[REGISTER_PC]));
@@ -479,8 +1121,24 @@ void rvjit32_auipc(rvjit_block_t* block, regid_t rds, int32_t imm)
     block->regs[rds].auipc_off = imm;
 }
 
+void rvjit32_jal(rvjit_block_t* block, regid_t rds, uint8_t isize)
+{
+    rvjit_ir_clobber(block);
+#ifdef RVJIT_NATIVE_INDIRECT
+    if (rvjit_is_link_reg(rds)) rvjit_ras_push(block, block->pc_off + isize);
+#endif
+    rvjit32_auipc(block, rds, isize);
+}
+
 void rvjit32_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, uint8_t isize)
 {
+    rvjit_ir_clobber(block);
+#ifdef RVJIT_NATIVE_INDIRECT
+    rvjit_ras_hint(block, rds, rs, block->pc_off + isize);
+#endif
+    // Mapping rds clears the auipc hint when rds == rs, as with call
+    bool auipc = block->regs[rs].flags & REG_AUIPC;
+    int32_t auipc_off = block->regs[rs].auipc_off;
     regid_t hrs = rvjit_map_reg(block, rs, REG_SRC);
     regid_t hjmp = rvjit_claim_hreg(block);
     rvjit32_native_addi(block, hjmp, hrs, imm);
@@ -493,8 +1151,8 @@ void rvjit32_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, ui
         }
     }
 
-    if (block->regs[rs].flags & REG_AUIPC) {
-        block->pc_off = block->regs[rs].auipc_off + imm;
+    if (auipc) {
+        block->pc_off = auipc_off + imm;
         block->linkage = true;
     } else {
         block->pc_off = 0;
@@ -511,6 +1169,7 @@ void rvjit32_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, ui
 
 void rvjit64_li(rvjit_block_t* block, regid_t rds, int32_t imm)
 {
+    RVJIT_IR_LIFT(li, rds, 0, 0, imm);
     if (rds == RVJIT_REGISTER_ZERO) return;
     regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
     rvjit_native_setreg32s(block, hrds, imm);
@@ -518,6 +1177,7 @@ void rvjit64_li(rvjit_block_t* block, regid_t rds, int32_t imm)
 
 void rvjit64_auipc(rvjit_block_t* block, regid_t rds, int32_t imm)
 {
+    RVJIT_IR_LIFT(auipc, rds, 0, 0, imm);
     if (rds == RVJIT_REGISTER_ZERO) return;
     regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
     rvjit64_native_ld(block, hrds, VM_PTR_REG, offsetof(rvvm_hart_t, registers[REGISTER_PC]));
@@ -529,9 +1189,25 @@ void rvjit64_auipc(rvjit_block_t* block, regid_t rds, int32_t imm)
     block->regs[rds].auipc_off = imm;
 }
 
-void rvjit64_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, uint8_t isize)
+void rvjit64_jal(rvjit_block_t* block, regid_t rds, uint8_t isize)
 {
-    regid_t hrs = rvjit_map_reg(block, rs, REG_SRC);
+    rvjit_ir_clobber(block);
+#ifdef RVJIT_NATIVE_INDIRECT
+    if (rvjit_is_link_reg(rds)) rvjit_ras_push(block, block->pc_off + isize);
+#endif
+    rvjit64_auipc(block, rds, isize);
+}
+
+void rvjit64_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, uint8_t isize)
+{
+    rvjit_ir_clobber(block);
+#ifdef RVJIT_NATIVE_INDIRECT
+    rvjit_ras_hint(block, rds, rs, block->pc_off + isize);
+#endif
+    // Mapping rds clears the auipc hint when rds == rs, as with call
+    bool auipc = block->regs[rs].flags & REG_AUIPC;
+    int32_t auipc_off = block->regs[rs].auipc_off;
+    regid_t hrs = rvjit_map_reg(block, rs, REG_SRC);
     regid_t hjmp = rvjit_claim_hreg(block);
     rvjit64_native_addi(block, hjmp, hrs, imm);
     if (rds != RVJIT_REGISTER_ZERO) {
@@ -543,8 +1219,8 @@ void rvjit64_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, ui
         }
     }
 
-    if (block->regs[rs].flags & REG_AUIPC) {
-        block->pc_off = block->regs[rs].auipc_off + imm;
+    if (auipc) {
+        block->pc_off = auipc_off + imm;
         block->linkage = true;
     } else {
         block->pc_off = 0;
@@ -557,6 +1233,25 @@ void rvjit64_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, ui
 
 #endif
 
+/*
+ * Compute the address of a TLB entry for the VPN into hent, clobbers htmp.
+ * Set index is cut out by shifts, so any TLB size is encodable.
+ */
+static void rvjit_tlb_entry(rvjit_block_t* block, regid_t hent, regid_t hvpn, regid_t htmp)
+{
+#ifdef RVJIT_NATIVE_64BIT
+    rvjit64_native_slli(block, hent, hvpn, 64 - block->tlb_bits);
+    rvjit64_native_srli(block, hent, hent, 64 - block->tlb_bits - VM_TLB_SHIFT);
+    rvjit64_native_ld(block, htmp, VM_PTR_REG, VM_TLB_PTR);
+    rvjit64_native_add(block, hent, hent, htmp);
+#else
+    rvjit32_native_slli(block, hent, hvpn, 32 - block->tlb_bits);
+    rvjit32_native_srli(block, hent, hent, 32 - block->tlb_bits - VM_TLB_SHIFT);
+    rvjit32_native_lw(block, htmp, VM_PTR_REG, VM_TLB_PTR);
+    rvjit32_native_add(block, hent, hent, htmp);
+#endif
+}
+
 #if defined(RVJIT_NATIVE_64BIT) && defined(USE_RV64)
 
 // Possibly may be optimized more
@@ -569,10 +1264,8 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
 
     rvjit64_native_addi(block, hvaddr, hrs, offset);
     rvjit64_native_srli(block, a3, hvaddr, 12);
-    rvjit64_native_andi(block, a2, a3, VM_TLB_MASK);
-    rvjit64_native_slli(block, a2, a2, VM_TLB_SHIFT);
-    rvjit64_native_add(block, a2, a2, VM_PTR_REG);
-    rvjit64_native_ld(block, haddr, a2, VM_TLB_OFFSET + moff);
+    rvjit_tlb_entry(block, a2, a3, haddr);
+    rvjit64_native_ld(block, haddr, a2, moff);
     if (align > 1) {
         rvjit64_native_xor(block, haddr, haddr, a3);
         rvjit64_native_andi(block, a3, hvaddr, (align - 1));
@@ -582,10 +1275,10 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
     }
     branch_t l1 = rvjit64_native_beqz(block, a3, BRANCH_NEW, BRANCH_ENTRY);
 
-    rvjit_emit_end(block, false);
+    rvjit_emit_exit(block, false, RVJIT_EXIT_TLB);
 
     rvjit64_native_beqz(block, a3, l1, BRANCH_TARGET);
-    rvjit64_native_ld(block, haddr, a2, VM_TLB_OFFSET);
+    rvjit64_native_ld(block, haddr, a2, 0);
     rvjit64_native_add(block, haddr, haddr, hvaddr);
 
     rvjit_free_hreg(block, a2);
@@ -604,14 +1297,8 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
 
     rvjit32_native_addi(block, hvaddr, hrs, offset);
     rvjit32_native_srli(block, a3, hvaddr, 12);
-    rvjit32_native_andi(block, a2, a3, VM_TLB_MASK);
-    rvjit32_native_slli(block, a2, a2, VM_TLB_SHIFT);
-#ifdef RVJIT_NATIVE_64BIT
-    rvjit64_native_add(block, a2, a2, VM_PTR_REG);
-#else
-    rvjit32_native_add(block, a2, a2, VM_PTR_REG);
-#endif
-    rvjit32_native_lw(block, haddr, a2, VM_TLB_OFFSET + moff);
+    rvjit_tlb_entry(block, a2, a3, haddr);
+    rvjit32_native_lw(block, haddr, a2, moff);
     if (align > 1) {
         rvjit32_native_xor(block, haddr, haddr, a3);
         rvjit32_native_andi(block, a3, hvaddr, (align - 1));
@@ -621,14 +1308,14 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
     }
     branch_t l1 = rvjit32_native_beqz(block, a3, BRANCH_NEW, BRANCH_ENTRY);
 
-    rvjit_emit_end(block, false);
+    rvjit_emit_exit(block, false, RVJIT_EXIT_TLB);
 
     rvjit32_native_beqz(block, a3, l1, BRANCH_TARGET);
 #ifdef RVJIT_NATIVE_64BIT
-    rvjit64_native_ld(block, haddr, a2, VM_TLB_OFFSET);
+    rvjit64_native_ld(block, haddr, a2, 0);
     rvjit64_native_add(block, haddr, haddr, hvaddr);
 #else
-    rvjit32_native_lw(block, haddr, a2, VM_TLB_OFFSET);
+    rvjit32_native_lw(block, haddr, a2, 0);
     rvjit32_native_add(block, haddr, haddr, hvaddr);
 #endif
 
@@ -639,6 +1326,67 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
 
 #endif
 
+/*
+ * Page guard for blocks spanning several pages: lookup TLB for the page
+ * at PC + offset (relative to block entry), and exit the block unless
+ * it's executable and still points to the same host page.
+ */
+void rvjit_emit_page_guard(rvjit_block_t* block, int32_t offset, size_t hptr)
+{
+    rvjit_ir_clobber(block);
+    regid_t a2 = rvjit_claim_hreg(block);
+    regid_t a3 = rvjit_claim_hreg(block);
+    regid_t hvaddr = rvjit_claim_hreg(block);
+    regid_t htmp = rvjit_claim_hreg(block);
+    branch_t l1;
+
+#ifdef RVJIT_NATIVE_64BIT
+    if (block->rv64) {
+        rvjit64_native_ld(block, hvaddr, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+        rvjit64_native_addi(block, hvaddr, hvaddr, offset);
+    } else {
+        rvjit32_native_lw(block, hvaddr, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+        rvjit32_native_addi(block, hvaddr, hvaddr, offset);
+    }
+    rvjit64_native_srli(block, a3, hvaddr, 12);
+    rvjit_tlb_entry(block, a2, a3, htmp);
+#ifdef USE_RV64
+    rvjit64_native_ld(block, htmp, a2, VM_TLB_E);
+#else
+    rvjit32_native_lw(block, htmp, a2, VM_TLB_E);
+#endif
+    rvjit64_native_xor(block, a3, a3, htmp);
+    rvjit64_native_ld(block, htmp, a2, 0);
+    rvjit64_native_add(block, htmp, htmp, hvaddr);
+    rvjit_native_setregw(block, a2, hptr);
+    rvjit64_native_xor(block, htmp, htmp, a2);
+    rvjit64_native_or(block, a3, a3, htmp);
+    l1 = rvjit64_native_beqz(block, a3, BRANCH_NEW, BRANCH_ENTRY);
+    rvjit_emit_exit(block, false, RVJIT_EXIT_GUARD);
+    rvjit64_native_beqz(block, a3, l1, BRANCH_TARGET);
+#else
+    rvjit32_native_lw(block, hvaddr, VM_PTR_REG, VM_REG_OFFSET(REGISTER_PC));
+    rvjit32_native_addi(block, hvaddr, hvaddr, offset);
+    rvjit32_native_srli(block, a3, hvaddr, 12);
+    rvjit_tlb_entry(block, a2, a3, htmp);
+    rvjit32_native_lw(block, htmp, a2, VM_TLB_E);
+    rvjit32_native_xor(block, a3, a3, htmp);
+    rvjit32_native_lw(block, htmp, a2, 0);
+    rvjit32_native_add(block, htmp, htmp, hvaddr);
+    rvjit_native_setregw(block, a2, hptr);
+    rvjit32_native_xor(block, htmp, htmp, a2);
+    rvjit32_native_or(block, a3, a3, htmp);
+    l1 = rvjit32_native_beqz(block, a3, BRANCH_NEW, BRANCH_ENTRY);
+    rvjit_emit_exit(block, false, RVJIT_EXIT_GUARD);
+    rvjit32_native_beqz(block, a3, l1, BRANCH_TARGET);
+#endif
+
+    rvjit_free_hreg(block, a2);
+    rvjit_free_hreg(block, a3);
+    rvjit_free_hreg(block, hvaddr);
+    rvjit_free_hreg(block, htmp);
+}
+
 /*
  * Load/store intrinsics
  */
@@ -646,6 +1394,7 @@ static void rvjit_tlb_lookup(rvjit_block_t* block, regid_t haddr, regid_t vaddr,
 #define RVJIT32_LDST(instr, align, store) \
 void rvjit32_##instr(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset) \
 { \
+    RVJIT_IR_LIFT(instr, dest, vaddr, 0, offset); \
     regid_t haddr = rvjit_claim_hreg(block); \
     rvjit_tlb_lookup(block, haddr, vaddr, offset, store ? VM_TLB_W : VM_TLB_R, align); \
     regid_t hdest = rvjit_map_reg(block, dest, store ? REG_SRC : REG_DST); \
@@ -657,6 +1406,7 @@ void rvjit32_##instr(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t
 #define RVJIT64_LDST(instr, align, store) \
 void rvjit64_##instr(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset) \
 { \
+    RVJIT_IR_LIFT(instr, dest, vaddr, 0, offset); \
     regid_t haddr = rvjit_claim_hreg(block); \
     rvjit_tlb_lookup(block, haddr, vaddr, offset, store ? VM_TLB_W : VM_TLB_R, align); \
     regid_t hdest = rvjit_map_reg(block, dest, store ? REG_SRC : REG_DST); \
@@ -683,3 +1433,662 @@ RVJIT_LDST(sb,   1, true)
 RVJIT_LDST(sh,   2, true)
 RVJIT_LDST(sw,   4, true)
 RVJIT64_LDST(sd, 8, true)
+
+/*
+ * Atomic intrinsics
+ */
+
+#ifdef RVJIT_NATIVE_ATOMICS
+
+#define VM_LRSC_OFFSET     offsetof(rvvm_hart_t, lrsc)
+#define VM_LRSC_CAS_OFFSET offsetof(rvvm_hart_t, lrsc_cas)
+
+// AMOs are performed on a host pointer from TLB lookup, misaligned access exits the block
+#define RVJIT32_AMO(instr) \
+void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2) \
+{ \
+    rvjit_ir_clobber(block); \
+    regid_t haddr = rvjit_claim_hreg(block); \
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 4); \
+    regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    rvjit32_native_##instr(block, hrds, haddr, hrs2); \
+    rvjit_free_hreg(block, haddr); \
+}
+
+#ifdef RVJIT_NATIVE_64BIT
+#define RVJIT64_AMO(instr) \
+void rvjit64_##instr##w(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2) \
+{ \
+    rvjit_ir_clobber(block); \
+    regid_t haddr = rvjit_claim_hreg(block); \
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 4); \
+    regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    rvjit32_native_##instr(block, hrds, haddr, hrs2); \
+    rvjit64_native_addiw(block, hrds, hrds, 0); \
+    rvjit_free_hreg(block, haddr); \
+} \
+\
+void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2) \
+{ \
+    rvjit_ir_clobber(block); \
+    regid_t haddr = rvjit_claim_hreg(block); \
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 8); \
+    regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    rvjit64_native_##instr(block, hrds, haddr, hrs2); \
+    rvjit_free_hreg(block, haddr); \
+}
+#else
+#define RVJIT64_AMO(instr)
+#endif
+
+#define RVJIT_AMO(instr) \
+RVJIT32_AMO(instr) \
+RVJIT64_AMO(instr)
+
+RVJIT_AMO(amoswap)
+RVJIT_AMO(amoadd)
+RVJIT_AMO(amoand)
+RVJIT_AMO(amoor)
+RVJIT_AMO(amoxor)
+RVJIT_AMO(amomin)
+RVJIT_AMO(amomax)
+RVJIT_AMO(amominu)
+RVJIT_AMO(amomaxu)
+
+static void rvjit_lrsc_set(rvjit_block_t* block)
+{
+    regid_t htmp = rvjit_claim_hreg(block);
+    rvjit_native_setreg32(block, htmp, 1);
+    rvjit32_native_sb(block, htmp, VM_PTR_REG, VM_LRSC_OFFSET);
+    rvjit_free_hreg(block, htmp);
+}
+
+/*
+ * SC is a CAS against the value observed by LR, skipped if there is no reservation.
+ * Reservation is invalidated regardless of SC outcome.
+ * hcmp & hres are claimed before the branch since claiming may spill registers.
+ */
+static void rvjit_sc_internal(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2, bool bits_64)
+{
+    rvjit_ir_clobber(block);
+    regid_t haddr = rvjit_claim_hreg(block);
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, bits_64 ? 8 : 4);
+    regid_t hrs2 = rvjit_map_reg(block, rs2, REG_SRC);
+    regid_t hcmp = rvjit_claim_hreg(block);
+    regid_t hres = rvjit_claim_hreg(block);
+#ifdef RVJIT_NATIVE_64BIT
+    if (block->rv64) {
+        rvjit64_native_ld(block, hcmp, VM_PTR_REG, VM_LRSC_CAS_OFFSET);
+    } else
+#endif
+    {
+        rvjit32_native_lw(block, hcmp, VM_PTR_REG, VM_LRSC_CAS_OFFSET);
+    }
+    rvjit32_native_lbu(block, hres, VM_PTR_REG, VM_LRSC_OFFSET);
+    rvjit32_native_xori(block, hres, hres, 1);
+    branch_t l1 = rvjit32_native_bnez(block, hres, BRANCH_NEW, BRANCH_ENTRY);
+#ifdef RVJIT_NATIVE_64BIT
+    if (bits_64) {
+        rvjit64_native_cas(block, hres, haddr, hcmp, hrs2);
+    } else
+#endif
+    {
+        rvjit32_native_cas(block, hres, haddr, hcmp, hrs2);
+    }
+    rvjit32_native_bnez(block, hres, l1, BRANCH_TARGET);
+
+    rvjit_native_zero_reg(block, hcmp);
+    rvjit32_native_sb(block, hcmp, VM_PTR_REG, VM_LRSC_OFFSET);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit32_native_addi(block, hrds, hres, 0);
+
+    rvjit_free_hreg(block, haddr);
+    rvjit_free_hreg(block, hcmp);
+    rvjit_free_hreg(block, hres);
+}
+
+void rvjit32_lr(rvjit_block_t* block, regid_t rds, regid_t vaddr)
+{
+    rvjit_ir_clobber(block);
+    regid_t haddr = rvjit_claim_hreg(block);
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 4);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit32_native_lw(block, hrds, haddr, 0);
+    rvjit32_native_sw(block, hrds, VM_PTR_REG, VM_LRSC_CAS_OFFSET);
+    rvjit_lrsc_set(block);
+    rvjit_free_hreg(block, haddr);
+}
+
+void rvjit32_sc(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2)
+{
+    rvjit_sc_internal(block, rds, vaddr, rs2, false);
+}
+
+#ifdef RVJIT_NATIVE_64BIT
+void rvjit64_lrw(rvjit_block_t* block, regid_t rds, regid_t vaddr)
+{
+    rvjit_ir_clobber(block);
+    regid_t haddr = rvjit_claim_hreg(block);
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 4);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit64_native_lw(block, hrds, haddr, 0);
+    rvjit64_native_sd(block, hrds, VM_PTR_REG, VM_LRSC_CAS_OFFSET);
+    rvjit_lrsc_set(block);
+    rvjit_free_hreg(block, haddr);
+}
+
+void rvjit64_scw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2)
+{
+    rvjit_sc_internal(block, rds, vaddr, rs2, false);
+}
+
+void rvjit64_lr(rvjit_block_t* block, regid_t rds, regid_t vaddr)
+{
+    rvjit_ir_clobber(block);
+    regid_t haddr = rvjit_claim_hreg(block);
+    rvjit_tlb_lookup(block, haddr, vaddr, 0, VM_TLB_W, 8);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit64_native_ld(block, hrds, haddr, 0);
+    rvjit64_native_sd(block, hrds, VM_PTR_REG, VM_LRSC_CAS_OFFSET);
+    rvjit_lrsc_set(block);
+    rvjit_free_hreg(block, haddr);
+}
+
+void rvjit64_sc(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2)
+{
+    rvjit_sc_internal(block, rds, vaddr, rs2, true);
+}
+#endif
+
+#endif
+
+/*
+ * Bitmanip intrinsics
+ */
+
+#ifdef RVJIT_NATIVE_BITMANIP
+
+bool rvjit_bitcnt_native(void)
+{
+    return rvjit_native_has_bitcnt();
+}
+
+bool rvjit_clmul_native(void)
+{
+    return rvjit_native_has_clmul();
+}
+
+// Bitmanip ops are not modeled by the optimizing tier
+#define RVJIT_2REG_OP(native_func, rds, rs1) { \
+    if (rds == RVJIT_REGISTER_ZERO) return; \
+    regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    native_func(block, hrds, hrs1); }
+
+#define RVJIT32_B_3REG(instr) \
+void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_3REG_OP(rvjit32_native_##instr, rds, rs1, rs2); \
+}
+
+#define RVJIT32_B_2REG(instr) \
+void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_2REG_OP(rvjit32_native_##instr, rds, rs1); \
+}
+
+#define RVJIT32_B_IMM(instr) \
+void rvjit32_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_2REG_IMM_OP(rvjit32_native_##instr, rds, rs1, imm); \
+}
+
+#ifdef RVJIT_NATIVE_64BIT
+#define RVJIT64_B_3REG(instr) \
+void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_3REG_OP(rvjit64_native_##instr, rds, rs1, rs2); \
+}
+
+#define RVJIT64_B_2REG(instr) \
+void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_2REG_OP(rvjit64_native_##instr, rds, rs1); \
+}
+
+#define RVJIT64_B_IMM(instr) \
+void rvjit64_##instr(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm) \
+{ \
+    rvjit_ir_clobber(block); \
+    RVJIT_2REG_IMM_OP(rvjit64_native_##instr, rds, rs1, imm); \
+}
+#else
+#define RVJIT64_B_3REG(instr)
+#define RVJIT64_B_2REG(instr)
+#define RVJIT64_B_IMM(instr)
+#endif
+
+#define RVJIT_B_3REG(instr) \
+RVJIT32_B_3REG(instr) \
+RVJIT64_B_3REG(instr)
+
+#define RVJIT_B_2REG(instr) \
+RVJIT32_B_2REG(instr) \
+RVJIT64_B_2REG(instr)
+
+#define RVJIT_B_IMM(instr) \
+RVJIT32_B_IMM(instr) \
+RVJIT64_B_IMM(instr)
+
+RVJIT_B_3REG(andn)
+RVJIT_B_3REG(orn)
+RVJIT_B_3REG(xnor)
+RVJIT_B_3REG(min)
+RVJIT_B_3REG(minu)
+RVJIT_B_3REG(max)
+RVJIT_B_3REG(maxu)
+RVJIT_B_3REG(clmul)
+RVJIT_B_3REG(clmulh)
+RVJIT_B_3REG(clmulr)
+RVJIT_B_3REG(rol)
+RVJIT_B_3REG(ror)
+RVJIT_B_3REG(sh1add)
+RVJIT_B_3REG(sh2add)
+RVJIT_B_3REG(sh3add)
+RVJIT_B_3REG(bset)
+RVJIT_B_3REG(bclr)
+RVJIT_B_3REG(binv)
+RVJIT_B_3REG(bext)
+
+RVJIT_B_2REG(clz)
+RVJIT_B_2REG(ctz)
+RVJIT_B_2REG(cpop)
+RVJIT_B_2REG(sext_b)
+RVJIT_B_2REG(sext_h)
+RVJIT_B_2REG(zext_h)
+RVJIT_B_2REG(rev8)
+
+RVJIT_B_IMM(rori)
+RVJIT_B_IMM(bseti)
+RVJIT_B_IMM(bclri)
+RVJIT_B_IMM(binvi)
+RVJIT_B_IMM(bexti)
+
+RVJIT64_B_3REG(add_uw)
+RVJIT64_B_3REG(sh1add_uw)
+RVJIT64_B_3REG(sh2add_uw)
+RVJIT64_B_3REG(sh3add_uw)
+RVJIT64_B_3REG(rolw)
+RVJIT64_B_3REG(rorw)
+
+RVJIT64_B_2REG(clzw)
+RVJIT64_B_2REG(ctzw)
+RVJIT64_B_2REG(cpopw)
+
+RVJIT64_B_IMM(roriw)
+RVJIT64_B_IMM(slli_uw)
+
+#endif
+
+/*
+ * FPU intrinsics
+ */
+
+#ifdef RVJIT_FPU
+
+// FPU register is known to hold a properly NaN-boxed single
+#define REG_NANBOX 0x8
+
+#define FPU_STATUS_FS 0x6000
+
+// Exit the block if FPU was disabled meanwhile, the interpreter raises illegal instruction
+static void rvjit_fpu_check_enabled(rvjit_block_t* block)
+{
+    if (block->fpu_checked) return;
+    block->fpu_checked = true;
+
+    regid_t htmp = rvjit_claim_hreg(block);
+    rvjit32_native_lw(block, htmp, VM_PTR_REG, VM_STATUS_OFFSET);
+    rvjit32_native_andi(block, htmp, htmp, FPU_STATUS_FS);
+    branch_t l1 = rvjit32_native_bnez(block, htmp, BRANCH_NEW, BRANCH_ENTRY);
+
+    rvjit_emit_exit(block, false, RVJIT_EXIT_FALLBACK);
+
+    rvjit32_native_bnez(block, htmp, l1, BRANCH_TARGET);
+    rvjit_free_hreg(block, htmp);
+}
+
+/*
+ * Singles which are not properly NaN-boxed should read as canonical NaN.
+ * This is rare enough to leave it to the interpreter, the check is done once
+ * per register until it's overwritten by a double.
+ */
+static void rvjit_fpu_check_nanbox(rvjit_block_t* block, regid_t freg)
+{
+    if (block->fpu_regs[freg].flags & REG_NANBOX) return;
+    if (block->fpu_regs[freg].flags & REG_DIRTY) {
+        // Check the value in VM context
+        rvjit_fpu_save_reg(block, freg);
+        block->fpu_regs[freg].flags = REG_LOADED;
+    }
+
+    regid_t htmp = rvjit_claim_hreg(block);
+    rvjit32_native_lw(block, htmp, VM_PTR_REG, VM_FREG_OFFSET(freg) + 4);
+    rvjit32_native_addi(block, htmp, htmp, 1);
+    branch_t l1 = rvjit32_native_beqz(block, htmp, BRANCH_NEW, BRANCH_ENTRY);
+
+    rvjit_emit_exit(block, false, RVJIT_EXIT_FALLBACK);
+
+    rvjit32_native_beqz(block, htmp, l1, BRANCH_TARGET);
+    rvjit_free_hreg(block, htmp);
+
+    if (block->fpu_regs[freg].hreg != REG_ILL) {
+        block->fpu_regs[freg].flags |= REG_NANBOX;
+    }
+}
+
+// Runtime checks may exit the block, so they precede any register mapping
+static void rvjit_fpu_check(rvjit_block_t* block, bool fpu_d, regid_t rs1, regid_t rs2, regid_t rs3)
+{
+    rvjit_ir_clobber(block);
+    rvjit_fpu_check_enabled(block);
+    if (!fpu_d) {
+        if (rs1 != REG_ILL) rvjit_fpu_check_nanbox(block, rs1);
+        if (rs2 != REG_ILL) rvjit_fpu_check_nanbox(block, rs2);
+        if (rs3 != REG_ILL) rvjit_fpu_check_nanbox(block, rs3);
+    }
+}
+
+// mstatus.FS is not tracked along with JIT, so there is no need to mark it dirty
+static regid_t rvjit_map_fdst(rvjit_block_t* block, regid_t freg, bool fpu_d)
+{
+    regid_t hreg = rvjit_map_freg(block, freg, REG_DST);
+    if (fpu_d) {
+        block->fpu_regs[freg].flags &= ~REG_NANBOX;
+    } else {
+        block->fpu_regs[freg].flags |= REG_NANBOX;
+    }
+    return hreg;
+}
+
+#define RVJIT_FPU_LDST(instr, fpu_d, store) \
+void rvjit_fpu_##instr(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset) \
+{ \
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL); \
+    regid_t haddr = rvjit_claim_hreg(block); \
+    rvjit_tlb_lookup(block, haddr, vaddr, offset, store ? VM_TLB_W : VM_TLB_R, fpu_d ? 8 : 4); \
+    regid_t hdest = store ? rvjit_map_freg(block, dest, REG_SRC) : rvjit_map_fdst(block, dest, fpu_d); \
+    rvjit_native_##instr(block, hdest, haddr, 0); \
+    rvjit_free_hreg(block, haddr); \
+}
+
+RVJIT_FPU_LDST(flw, false, false)
+RVJIT_FPU_LDST(fsw, false, true)
+RVJIT_FPU_LDST(fld, true,  false)
+RVJIT_FPU_LDST(fsd, true,  true)
+
+#define RVJIT_FPU_3REG_OP(native_func, fpu_d, rds, rs1, rs2) { \
+    rvjit_fpu_check(block, fpu_d, rs1, rs2, REG_ILL); \
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC); \
+    regid_t hrs2 = rvjit_map_freg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_fdst(block, rds, fpu_d); \
+    native_func(block, hrds, hrs1, hrs2); }
+
+#define RVJIT_FPU_3REG(instr) \
+void rvjit_fpu_##instr##_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    RVJIT_FPU_3REG_OP(rvjit_native_##instr##_s, false, rds, rs1, rs2); \
+} \
+\
+void rvjit_fpu_##instr##_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    RVJIT_FPU_3REG_OP(rvjit_native_##instr##_d, true, rds, rs1, rs2); \
+}
+
+RVJIT_FPU_3REG(fadd)
+RVJIT_FPU_3REG(fsub)
+RVJIT_FPU_3REG(fmul)
+RVJIT_FPU_3REG(fdiv)
+RVJIT_FPU_3REG(fsgnjn)
+RVJIT_FPU_3REG(fsgnjx)
+
+#define RVJIT_FPU_4REG_OP(native_func, fpu_d, rds, rs1, rs2, rs3) { \
+    rvjit_fpu_check(block, fpu_d, rs1, rs2, rs3); \
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC); \
+    regid_t hrs2 = rvjit_map_freg(block, rs2, REG_SRC); \
+    regid_t hrs3 = rvjit_map_freg(block, rs3, REG_SRC); \
+    regid_t hrds = rvjit_map_fdst(block, rds, fpu_d); \
+    native_func(block, hrds, hrs1, hrs2, hrs3); }
+
+#define RVJIT_FPU_4REG(instr) \
+void rvjit_fpu_##instr##_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3) \
+{ \
+    RVJIT_FPU_4REG_OP(rvjit_native_##instr##_s, false, rds, rs1, rs2, rs3); \
+} \
+\
+void rvjit_fpu_##instr##_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3) \
+{ \
+    RVJIT_FPU_4REG_OP(rvjit_native_##instr##_d, true, rds, rs1, rs2, rs3); \
+}
+
+RVJIT_FPU_4REG(fmadd)
+RVJIT_FPU_4REG(fmsub)
+RVJIT_FPU_4REG(fnmsub)
+RVJIT_FPU_4REG(fnmadd)
+
+// fmv is encoded as fsgnj with equal operands
+static void rvjit_fpu_fsgnj(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, bool fpu_d)
+{
+    rvjit_fpu_check(block, fpu_d, rs1, rs2, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrs2 = rvjit_map_freg(block, rs2, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, fpu_d);
+    if (rs1 == rs2) {
+        rvjit_native_fmv(block, hrds, hrs1);
+    } else if (fpu_d) {
+        rvjit_native_fsgnj_d(block, hrds, hrs1, hrs2);
+    } else {
+        rvjit_native_fsgnj_s(block, hrds, hrs1, hrs2);
+    }
+}
+
+void rvjit_fpu_fsgnj_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2)
+{
+    rvjit_fpu_fsgnj(block, rds, rs1, rs2, false);
+}
+
+void rvjit_fpu_fsgnj_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2)
+{
+    rvjit_fpu_fsgnj(block, rds, rs1, rs2, true);
+}
+
+void rvjit_fpu_fsqrt_s(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, false, rs1, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, false);
+    rvjit_native_fsqrt_s(block, hrds, hrs1);
+}
+
+void rvjit_fpu_fsqrt_d(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, true);
+    rvjit_native_fsqrt_d(block, hrds, hrs1);
+}
+
+// Comparisons write an integer register (even if it's zero, since they may raise flags)
+#define RVJIT_FPU_FCMP(instr) \
+void rvjit_fpu_##instr##_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    rvjit_fpu_check(block, false, rs1, rs2, REG_ILL); \
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC); \
+    regid_t hrs2 = rvjit_map_freg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    rvjit_native_##instr##_s(block, hrds, hrs1, hrs2); \
+} \
+\
+void rvjit_fpu_##instr##_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2) \
+{ \
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL); \
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC); \
+    regid_t hrs2 = rvjit_map_freg(block, rs2, REG_SRC); \
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST); \
+    rvjit_native_##instr##_d(block, hrds, hrs1, hrs2); \
+}
+
+RVJIT_FPU_FCMP(feq)
+RVJIT_FPU_FCMP(flt)
+RVJIT_FPU_FCMP(fle)
+
+// fcvt.d.s reads the raw lower half of the register, without NaN-box check
+void rvjit_fpu_fcvt_d_s(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, true);
+    rvjit_native_fcvt_d_s(block, hrds, hrs1);
+}
+
+void rvjit_fpu_fcvt_s_d(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, false);
+    rvjit_native_fcvt_s_d(block, hrds, hrs1);
+}
+
+// Integer to float conversion, unsigned 32-bit integer is zero-extended and converted as 64-bit one
+static void rvjit_fpu_fcvt_f_i(rvjit_block_t* block, regid_t rds, regid_t rs1, bool fpu_d, bool bits_64, bool is_unsigned)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC);
+    if (is_unsigned) {
+        regid_t htmp = rvjit_claim_hreg(block);
+        regid_t hrds = rvjit_map_fdst(block, rds, fpu_d);
+        rvjit32_native_addi(block, htmp, hrs1, 0);
+        rvjit_native_fcvt_f_i(block, hrds, htmp, fpu_d, true);
+        rvjit_free_hreg(block, htmp);
+    } else {
+        regid_t hrds = rvjit_map_fdst(block, rds, fpu_d);
+        rvjit_native_fcvt_f_i(block, hrds, hrs1, fpu_d, bits_64);
+    }
+}
+
+/*
+ * Float to integer conversion, invalid conversions exit the block so they are
+ * saturated by the interpreter. Unsigned 32-bit conversion is done as 64-bit one,
+ * any result out of 32-bit range is invalid.
+ */
+static void rvjit_fpu_fcvt_i_f(rvjit_block_t* block, regid_t rds, regid_t rs1, bool fpu_d, bool bits_64, bool is_unsigned, bool rtz)
+{
+    rvjit_fpu_check(block, fpu_d, rs1, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t htmp = rvjit_claim_hreg(block);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    branch_t l1;
+    if (is_unsigned) {
+        rvjit_native_fcvt_i_f(block, hrds, hrs1, fpu_d, true, rtz);
+        rvjit64_native_srli(block, htmp, hrds, 32);
+        l1 = rvjit64_native_beqz(block, htmp, BRANCH_NEW, BRANCH_ENTRY);
+        rvjit_emit_exit(block, false, RVJIT_EXIT_FALLBACK);
+        rvjit64_native_beqz(block, htmp, l1, BRANCH_TARGET);
+    } else if (bits_64) {
+        rvjit_native_fcvt_i_f(block, hrds, hrs1, fpu_d, true, rtz);
+        rvjit_native_setregw(block, htmp, 0x8000000000000000ULL);
+        l1 = rvjit64_native_bne(block, hrds, htmp, BRANCH_NEW, BRANCH_ENTRY);
+        rvjit_emit_exit(block, false, RVJIT_EXIT_FALLBACK);
+        rvjit64_native_bne(block, hrds, htmp, l1, BRANCH_TARGET);
+    } else {
+        rvjit_native_fcvt_i_f(block, hrds, hrs1, fpu_d, false, rtz);
+        rvjit_native_setreg32(block, htmp, 0x80000000U);
+        l1 = rvjit32_native_bne(block, hrds, htmp, BRANCH_NEW, BRANCH_ENTRY);
+        rvjit_emit_exit(block, false, RVJIT_EXIT_FALLBACK);
+        rvjit32_native_bne(block, hrds, htmp, l1, BRANCH_TARGET);
+    }
+    if (block->rv64 && !bits_64) {
+        rvjit64_native_addiw(block, hrds, hrds, 0);
+    }
+    rvjit_free_hreg(block, htmp);
+}
+
+#define RVJIT_FPU_FCVT(fmt, fpu_d) \
+void rvjit_fpu_fcvt_##fmt##_w(rvjit_block_t* block, regid_t rds, regid_t rs1) \
+{ \
+    rvjit_fpu_fcvt_f_i(block, rds, rs1, fpu_d, false, false); \
+} \
+\
+void rvjit_fpu_fcvt_##fmt##_wu(rvjit_block_t* block, regid_t rds, regid_t rs1) \
+{ \
+    rvjit_fpu_fcvt_f_i(block, rds, rs1, fpu_d, false, true); \
+} \
+\
+void rvjit_fpu_fcvt_##fmt##_l(rvjit_block_t* block, regid_t rds, regid_t rs1) \
+{ \
+    rvjit_fpu_fcvt_f_i(block, rds, rs1, fpu_d, true, false); \
+} \
+\
+void rvjit_fpu_fcvt_w_##fmt(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz) \
+{ \
+    rvjit_fpu_fcvt_i_f(block, rds, rs1, fpu_d, false, false, rtz); \
+} \
+\
+void rvjit_fpu_fcvt_wu_##fmt(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz) \
+{ \
+    rvjit_fpu_fcvt_i_f(block, rds, rs1, fpu_d, false, true, rtz); \
+} \
+\
+void rvjit_fpu_fcvt_l_##fmt(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz) \
+{ \
+    rvjit_fpu_fcvt_i_f(block, rds, rs1, fpu_d, true, false, rtz); \
+}
+
+RVJIT_FPU_FCVT(s, false)
+RVJIT_FPU_FCVT(d, true)
+
+// fmv.x.w reads the raw lower half of the register, sign-extended
+void rvjit_fpu_fmv_x_w(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit_native_fmv_x_f(block, hrds, hrs1, false);
+    if (block->rv64) {
+        rvjit64_native_addiw(block, hrds, hrds, 0);
+    }
+}
+
+void rvjit_fpu_fmv_w_x(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, false);
+    rvjit_native_fmv_w_x(block, hrds, hrs1);
+}
+
+void rvjit_fpu_fmv_x_d(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_freg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_reg(block, rds, REG_DST);
+    rvjit_native_fmv_x_f(block, hrds, hrs1, true);
+}
+
+void rvjit_fpu_fmv_d_x(rvjit_block_t* block, regid_t rds, regid_t rs1)
+{
+    rvjit_fpu_check(block, true, REG_ILL, REG_ILL, REG_ILL);
+    regid_t hrs1 = rvjit_map_reg(block, rs1, REG_SRC);
+    regid_t hrds = rvjit_map_fdst(block, rds, true);
+    rvjit_native_fmv_d_x(block, hrds, hrs1);
+}
+
+#endif
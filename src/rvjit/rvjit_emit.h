@@ -24,6 +24,88 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 void rvjit_linker_patch_jmp(void* addr, int32_t offset);
 void rvjit_linker_patch_ret(void* addr);
+void rvjit_linker_patch_slot(void* addr, int32_t offset);
+
+// IR ops, named after the intrinsics they are lowered to
+enum {
+    RVJIT_IR_nop,
+    // Register-register ALU
+    RVJIT_IR_add,
+    RVJIT_IR_sub,
+    RVJIT_IR_or,
+    RVJIT_IR_and,
+    RVJIT_IR_xor,
+    RVJIT_IR_sra,
+    RVJIT_IR_srl,
+    RVJIT_IR_sll,
+    RVJIT_IR_slt,
+    RVJIT_IR_sltu,
+    RVJIT_IR_mul,
+    RVJIT_IR_mulh,
+    RVJIT_IR_mulhu,
+    RVJIT_IR_mulhsu,
+    RVJIT_IR_div,
+    RVJIT_IR_divu,
+    RVJIT_IR_rem,
+    RVJIT_IR_remu,
+    RVJIT_IR_addw,
+    RVJIT_IR_subw,
+    RVJIT_IR_sraw,
+    RVJIT_IR_srlw,
+    RVJIT_IR_sllw,
+    RVJIT_IR_mulw,
+    RVJIT_IR_divw,
+    RVJIT_IR_divuw,
+    RVJIT_IR_remw,
+    RVJIT_IR_remuw,
+    // Register-immediate ALU
+    RVJIT_IR_addi,
+    RVJIT_IR_ori,
+    RVJIT_IR_andi,
+    RVJIT_IR_xori,
+    RVJIT_IR_srai,
+    RVJIT_IR_srli,
+    RVJIT_IR_slli,
+    RVJIT_IR_slti,
+    RVJIT_IR_sltiu,
+    RVJIT_IR_addiw,
+    RVJIT_IR_sraiw,
+    RVJIT_IR_srliw,
+    RVJIT_IR_slliw,
+    RVJIT_IR_li,
+    RVJIT_IR_auipc,
+    // Loads & stores, these may exit the block
+    RVJIT_IR_lb,
+    RVJIT_IR_lbu,
+    RVJIT_IR_lh,
+    RVJIT_IR_lhu,
+    RVJIT_IR_lw,
+    RVJIT_IR_lwu,
+    RVJIT_IR_ld,
+    RVJIT_IR_sb,
+    RVJIT_IR_sh,
+    RVJIT_IR_sw,
+    RVJIT_IR_sd,
+    // Exit the block unless the condition holds
+    RVJIT_IR_beq,
+    RVJIT_IR_bne,
+    RVJIT_IR_blt,
+    RVJIT_IR_bge,
+    RVJIT_IR_bltu,
+    RVJIT_IR_bgeu,
+};
+
+// Resets IR state of a new block
+void rvjit_ir_init(rvjit_block_t* block);
+
+// Records a guest instruction into IR, optimizing it against preceding ones
+void rvjit_ir_lift(rvjit_block_t* block, uint8_t op, regid_t rd, regid_t rs1, regid_t rs2, int32_t imm);
+
+// Eliminates dead writes and lowers the lifted IR into host code
+void rvjit_ir_flush(rvjit_block_t* block);
+
+// Lowers the lifted IR and forgets known values, before intrinsics not modeled by IR
+void rvjit_ir_clobber(rvjit_block_t* block);
 
 void rvjit32_add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit32_sub(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
@@ -46,6 +128,7 @@ void rvjit32_slt(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit32_sltu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit32_li(rvjit_block_t* block, regid_t rds, int32_t imm);
 void rvjit32_auipc(rvjit_block_t* block, regid_t rds, int32_t imm);
+void rvjit32_jal(rvjit_block_t* block, regid_t rds, uint8_t isize);
 void rvjit32_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, uint8_t isize);
 
 void rvjit32_sb(rvjit_block_t* block, regid_t src, regid_t vaddr, int32_t offset);
@@ -73,6 +156,60 @@ void rvjit32_divu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit32_rem(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit32_remu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 
+#ifdef RVJIT_NATIVE_ATOMICS
+void rvjit32_lr(rvjit_block_t* block, regid_t rds, regid_t vaddr);
+void rvjit32_sc(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amoswap(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amoadd(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amoand(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amoor(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amoxor(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amomin(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amomax(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amominu(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit32_amomaxu(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+#endif
+
+#ifdef RVJIT_NATIVE_BITMANIP
+// Host lowering of clz/ctz/cpop and clmul may depend on CPU features
+bool rvjit_bitcnt_native(void);
+bool rvjit_clmul_native(void);
+
+void rvjit32_andn(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_orn(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_xnor(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_min(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_minu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_max(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_maxu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_clmul(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_clmulh(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_clmulr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_rol(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_ror(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_sh1add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_sh2add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_sh3add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_bset(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_bclr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_binv(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit32_bext(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+
+void rvjit32_clz(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_ctz(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_cpop(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_sext_b(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_sext_h(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_zext_h(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit32_rev8(rvjit_block_t* block, regid_t rds, regid_t rs1);
+
+void rvjit32_rori(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit32_bseti(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit32_bclri(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit32_binvi(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit32_bexti(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+#endif
+
 
 
 void rvjit64_add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
@@ -96,6 +233,7 @@ void rvjit64_slt(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit64_sltu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit64_li(rvjit_block_t* block, regid_t rds, int32_t imm);
 void rvjit64_auipc(rvjit_block_t* block, regid_t rds, int32_t imm);
+void rvjit64_jal(rvjit_block_t* block, regid_t rds, uint8_t isize);
 void rvjit64_jalr(rvjit_block_t* block, regid_t rds, regid_t rs, int32_t imm, uint8_t isize);
 
 void rvjit64_addw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
@@ -142,4 +280,135 @@ void rvjit64_divuw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit64_remw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 void rvjit64_remuw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
 
+#ifdef RVJIT_NATIVE_ATOMICS
+void rvjit64_lrw(rvjit_block_t* block, regid_t rds, regid_t vaddr);
+void rvjit64_scw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoswapw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoaddw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoandw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoorw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoxorw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amominw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amomaxw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amominuw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amomaxuw(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+
+void rvjit64_lr(rvjit_block_t* block, regid_t rds, regid_t vaddr);
+void rvjit64_sc(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoswap(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoadd(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoand(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoor(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amoxor(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amomin(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amomax(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amominu(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+void rvjit64_amomaxu(rvjit_block_t* block, regid_t rds, regid_t vaddr, regid_t rs2);
+#endif
+
+#ifdef RVJIT_NATIVE_BITMANIP
+void rvjit64_andn(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_orn(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_xnor(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_min(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_minu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_max(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_maxu(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_clmul(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_clmulh(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_clmulr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_rol(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_ror(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh1add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh2add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh3add(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_bset(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_bclr(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_binv(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_bext(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_add_uw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh1add_uw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh2add_uw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_sh3add_uw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_rolw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit64_rorw(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+
+void rvjit64_clz(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_ctz(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_cpop(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_sext_b(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_sext_h(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_zext_h(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_rev8(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_clzw(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_ctzw(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit64_cpopw(rvjit_block_t* block, regid_t rds, regid_t rs1);
+
+void rvjit64_rori(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_bseti(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_bclri(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_binvi(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_bexti(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_roriw(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+void rvjit64_slli_uw(rvjit_block_t* block, regid_t rds, regid_t rs1, int32_t imm);
+#endif
+
+#ifdef RVJIT_NATIVE_FPU
+void rvjit_fpu_flw(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset);
+void rvjit_fpu_fsw(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset);
+void rvjit_fpu_fld(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset);
+void rvjit_fpu_fsd(rvjit_block_t* block, regid_t dest, regid_t vaddr, int32_t offset);
+
+void rvjit_fpu_fadd_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsub_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fmul_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fdiv_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnj_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnjn_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnjx_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_feq_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_flt_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fle_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fmadd_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fmsub_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fnmsub_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fnmadd_s(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fsqrt_s(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_s_w(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_s_wu(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_s_l(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_w_s(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+void rvjit_fpu_fcvt_wu_s(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+void rvjit_fpu_fcvt_l_s(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+
+void rvjit_fpu_fadd_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsub_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fmul_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fdiv_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnj_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnjn_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fsgnjx_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_feq_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_flt_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fle_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2);
+void rvjit_fpu_fmadd_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fmsub_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fnmsub_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fnmadd_d(rvjit_block_t* block, regid_t rds, regid_t rs1, regid_t rs2, regid_t rs3);
+void rvjit_fpu_fsqrt_d(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_d_w(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_d_wu(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_d_l(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_w_d(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+void rvjit_fpu_fcvt_wu_d(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+void rvjit_fpu_fcvt_l_d(rvjit_block_t* block, regid_t rds, regid_t rs1, bool rtz);
+
+void rvjit_fpu_fcvt_s_d(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fcvt_d_s(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fmv_x_w(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fmv_w_x(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fmv_x_d(rvjit_block_t* block, regid_t rds, regid_t rs1);
+void rvjit_fpu_fmv_d_x(rvjit_block_t* block, regid_t rds, regid_t rs1);
+#endif
+
 #endif
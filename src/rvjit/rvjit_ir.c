@@ -0,0 +1,658 @@
+/*
+rvjit_ir.c - RVJIT Optimizing Tier
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "rvjit_emit.h"
+
+/*
+ * Hot blocks are recompiled with intrinsics lifted into a linear IR
+ * instead of being emitted directly. Each lifted op is optimized against
+ * what is known about guest registers & memory along the trace so far:
+ * constants are folded & propagated, operations are reduced to immediate
+ * forms, redundant sign extensions & loads are removed, stores are
+ * forwarded into loads from the same address. When the IR is flushed,
+ * writes overwritten before being read are eliminated, and the remaining
+ * ops are lowered through the very same intrinsics.
+ *
+ * IR is flushed at each branch, when the op buffer is full, and before
+ * intrinsics not modeled by IR, which also drop the knowledge.
+ */
+
+#define RVJIT_IR_UNKNOWN 0
+#define RVJIT_IR_CONST   1 // Register holds a known constant
+#define RVJIT_IR_PCREL   2 // Register holds a known offset from block entry PC
+
+static inline bool rvjit_ir_is_3reg(uint8_t op)
+{
+    return op >= RVJIT_IR_add && op <= RVJIT_IR_remuw;
+}
+
+static inline bool rvjit_ir_is_imm(uint8_t op)
+{
+    return op >= RVJIT_IR_addi && op <= RVJIT_IR_slliw;
+}
+
+static inline bool rvjit_ir_is_load(uint8_t op)
+{
+    return op >= RVJIT_IR_lb && op <= RVJIT_IR_ld;
+}
+
+static inline bool rvjit_ir_is_store(uint8_t op)
+{
+    return op >= RVJIT_IR_sb && op <= RVJIT_IR_sd;
+}
+
+static inline bool rvjit_ir_is_branch(uint8_t op)
+{
+    return op >= RVJIT_IR_beq;
+}
+
+static inline uint64_t rvjit_ir_sext32(uint64_t val)
+{
+    return (uint64_t)(int64_t)(int32_t)(uint32_t)val;
+}
+
+// Register values are kept zero-extended to XLEN
+static inline uint64_t rvjit_ir_xlen(rvjit_block_t* block, uint64_t val)
+{
+    return block->rv64 ? val : (uint32_t)val;
+}
+
+static inline int64_t rvjit_ir_signed(rvjit_block_t* block, uint64_t val)
+{
+    return block->rv64 ? (int64_t)val : (int32_t)(uint32_t)val;
+}
+
+static inline bool rvjit_ir_fits_imm12(int64_t val)
+{
+    return val >= -0x800 && val < 0x800;
+}
+
+static inline bool rvjit_ir_fits_int32(int64_t val)
+{
+    return val == (int32_t)val;
+}
+
+static uint8_t rvjit_ir_ldst_size(uint8_t op)
+{
+    switch (op) {
+        case RVJIT_IR_lb:
+        case RVJIT_IR_lbu:
+        case RVJIT_IR_sb:
+            return 1;
+        case RVJIT_IR_lh:
+        case RVJIT_IR_lhu:
+        case RVJIT_IR_sh:
+            return 2;
+        case RVJIT_IR_lw:
+        case RVJIT_IR_lwu:
+        case RVJIT_IR_sw:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+static void rvjit_ir_forget(rvjit_ir_t* ir)
+{
+    for (regid_t i=0; i<RVJIT_REGISTERS; ++i) {
+        ir->regs[i].kind = RVJIT_IR_UNKNOWN;
+        ir->regs[i].value = 0;
+        ir->regs[i].sext = false;
+        ir->regs[i].version++;
+    }
+    // Zero register is always known
+    ir->regs[RVJIT_REGISTER_ZERO].kind = RVJIT_IR_CONST;
+    ir->regs[RVJIT_REGISTER_ZERO].sext = true;
+    ir->mem_count = 0;
+}
+
+static void rvjit_ir_def(rvjit_ir_t* ir, regid_t rd, uint8_t kind, uint64_t value, bool sext)
+{
+    if (rd == RVJIT_REGISTER_ZERO) return;
+    ir->regs[rd].kind = kind;
+    ir->regs[rd].value = value;
+    ir->regs[rd].sext = sext;
+    ir->regs[rd].version++;
+}
+
+static void rvjit_ir_def_const(rvjit_block_t* block, regid_t rd, uint64_t value)
+{
+    value = rvjit_ir_xlen(block, value);
+    rvjit_ir_def(&block->ir, rd, RVJIT_IR_CONST, value, rvjit_ir_sext32(value) == value);
+}
+
+static void rvjit_ir_remember(rvjit_ir_t* ir, uint8_t op, regid_t base, uint32_t base_version, int32_t offset, regid_t val)
+{
+    if (ir->mem_count == RVJIT_IR_MEM) {
+        // Forget the oldest access
+        memmove(ir->mem, ir->mem + 1, (RVJIT_IR_MEM - 1) * sizeof(rvjit_ir_mem_t));
+        ir->mem_count--;
+    }
+    ir->mem[ir->mem_count].op = op;
+    ir->mem[ir->mem_count].base = base;
+    ir->mem[ir->mem_count].val = val;
+    ir->mem[ir->mem_count].offset = offset;
+    ir->mem[ir->mem_count].base_version = base_version;
+    ir->mem[ir->mem_count].val_version = ir->regs[val].version;
+    ir->mem_count++;
+}
+
+// Evaluates an ALU op over known operands, returns false if it's not foldable
+static bool rvjit_ir_eval(rvjit_block_t* block, uint8_t op, uint64_t a, uint64_t b, uint64_t* res)
+{
+    bitcnt_t shift = b & (block->rv64 ? 63 : 31);
+    switch (op) {
+        case RVJIT_IR_add:
+        case RVJIT_IR_addi:
+            *res = a + b;
+            break;
+        case RVJIT_IR_sub:
+            *res = a - b;
+            break;
+        case RVJIT_IR_or:
+        case RVJIT_IR_ori:
+            *res = a | b;
+            break;
+        case RVJIT_IR_and:
+        case RVJIT_IR_andi:
+            *res = a & b;
+            break;
+        case RVJIT_IR_xor:
+        case RVJIT_IR_xori:
+            *res = a ^ b;
+            break;
+        case RVJIT_IR_sra:
+        case RVJIT_IR_srai:
+            *res = rvjit_ir_signed(block, a) >> shift;
+            break;
+        case RVJIT_IR_srl:
+        case RVJIT_IR_srli:
+            *res = a >> shift;
+            break;
+        case RVJIT_IR_sll:
+        case RVJIT_IR_slli:
+            *res = a << shift;
+            break;
+        case RVJIT_IR_slt:
+        case RVJIT_IR_slti:
+            *res = rvjit_ir_signed(block, a) < rvjit_ir_signed(block, b);
+            break;
+        case RVJIT_IR_sltu:
+        case RVJIT_IR_sltiu:
+            *res = a < b;
+            break;
+        case RVJIT_IR_mul:
+            *res = a * b;
+            break;
+        case RVJIT_IR_addw:
+        case RVJIT_IR_addiw:
+            *res = rvjit_ir_sext32(a + b);
+            break;
+        case RVJIT_IR_subw:
+            *res = rvjit_ir_sext32(a - b);
+            break;
+        case RVJIT_IR_sraw:
+        case RVJIT_IR_sraiw:
+            *res = rvjit_ir_sext32(((int32_t)(uint32_t)a) >> (b & 31));
+            break;
+        case RVJIT_IR_srlw:
+        case RVJIT_IR_srliw:
+            *res = rvjit_ir_sext32(((uint32_t)a) >> (b & 31));
+            break;
+        case RVJIT_IR_sllw:
+        case RVJIT_IR_slliw:
+            *res = rvjit_ir_sext32(((uint32_t)a) << (b & 31));
+            break;
+        case RVJIT_IR_mulw:
+            *res = rvjit_ir_sext32(a * b);
+            break;
+        default:
+            return false;
+    }
+    *res = rvjit_ir_xlen(block, *res);
+    return true;
+}
+
+// Whether the result of an op is sign-extended from 32 bits, given it's sources
+static bool rvjit_ir_sext_result(rvjit_ir_op_t* ins, bool sext1, bool sext2)
+{
+    switch (ins->op) {
+        case RVJIT_IR_addw:
+        case RVJIT_IR_subw:
+        case RVJIT_IR_sraw:
+        case RVJIT_IR_srlw:
+        case RVJIT_IR_sllw:
+        case RVJIT_IR_mulw:
+        case RVJIT_IR_divw:
+        case RVJIT_IR_divuw:
+        case RVJIT_IR_remw:
+        case RVJIT_IR_remuw:
+        case RVJIT_IR_addiw:
+        case RVJIT_IR_sraiw:
+        case RVJIT_IR_srliw:
+        case RVJIT_IR_slliw:
+        case RVJIT_IR_slt:
+        case RVJIT_IR_sltu:
+        case RVJIT_IR_slti:
+        case RVJIT_IR_sltiu:
+        case RVJIT_IR_lb:
+        case RVJIT_IR_lbu:
+        case RVJIT_IR_lh:
+        case RVJIT_IR_lhu:
+        case RVJIT_IR_lw:
+            return true;
+        case RVJIT_IR_or:
+        case RVJIT_IR_and:
+        case RVJIT_IR_xor:
+            return sext1 && sext2;
+        case RVJIT_IR_andi:
+            return ins->imm >= 0 || sext1;
+        case RVJIT_IR_ori:
+        case RVJIT_IR_xori:
+        case RVJIT_IR_srai:
+            return sext1;
+        case RVJIT_IR_addi:
+            return ins->imm == 0 && sext1;
+        case RVJIT_IR_srli:
+            return ins->imm > 32;
+        default:
+            return false;
+    }
+}
+
+// Rewrites a register-register op with a small constant operand into immediate form
+static void rvjit_ir_reduce(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    rvjit_ir_value_t* s1 = &block->ir.regs[ins->rs1];
+    rvjit_ir_value_t* s2 = &block->ir.regs[ins->rs2];
+    int64_t val;
+    switch (ins->op) {
+        case RVJIT_IR_add:
+        case RVJIT_IR_or:
+        case RVJIT_IR_and:
+        case RVJIT_IR_xor:
+        case RVJIT_IR_addw:
+            if (s1->kind == RVJIT_IR_CONST && s2->kind != RVJIT_IR_CONST) {
+                regid_t tmp = ins->rs1;
+                ins->rs1 = ins->rs2;
+                ins->rs2 = tmp;
+                s1 = &block->ir.regs[ins->rs1];
+                s2 = &block->ir.regs[ins->rs2];
+            }
+            break;
+    }
+    if (s2->kind != RVJIT_IR_CONST || s1->kind == RVJIT_IR_CONST) return;
+    val = rvjit_ir_signed(block, s2->value);
+    switch (ins->op) {
+        case RVJIT_IR_sub:
+        case RVJIT_IR_subw:
+            val = -val;
+            break;
+        case RVJIT_IR_sra:
+        case RVJIT_IR_srl:
+        case RVJIT_IR_sll:
+            val &= block->rv64 ? 63 : 31;
+            break;
+        case RVJIT_IR_sraw:
+        case RVJIT_IR_srlw:
+        case RVJIT_IR_sllw:
+            val &= 31;
+            break;
+    }
+    if (!rvjit_ir_fits_imm12(val)) return;
+    switch (ins->op) {
+        case RVJIT_IR_add:  ins->op = RVJIT_IR_addi;  break;
+        case RVJIT_IR_sub:  ins->op = RVJIT_IR_addi;  break;
+        case RVJIT_IR_or:   ins->op = RVJIT_IR_ori;   break;
+        case RVJIT_IR_and:  ins->op = RVJIT_IR_andi;  break;
+        case RVJIT_IR_xor:  ins->op = RVJIT_IR_xori;  break;
+        case RVJIT_IR_sra:  ins->op = RVJIT_IR_srai;  break;
+        case RVJIT_IR_srl:  ins->op = RVJIT_IR_srli;  break;
+        case RVJIT_IR_sll:  ins->op = RVJIT_IR_slli;  break;
+        case RVJIT_IR_slt:  ins->op = RVJIT_IR_slti;  break;
+        case RVJIT_IR_sltu: ins->op = RVJIT_IR_sltiu; break;
+        case RVJIT_IR_addw: ins->op = RVJIT_IR_addiw; break;
+        case RVJIT_IR_subw: ins->op = RVJIT_IR_addiw; break;
+        case RVJIT_IR_sraw: ins->op = RVJIT_IR_sraiw; break;
+        case RVJIT_IR_srlw: ins->op = RVJIT_IR_srliw; break;
+        case RVJIT_IR_sllw: ins->op = RVJIT_IR_slliw; break;
+        default: return;
+    }
+    ins->rs2 = 0;
+    ins->imm = (int32_t)val;
+}
+
+static void rvjit_ir_alu(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    rvjit_ir_t* ir = &block->ir;
+    bool rr = rvjit_ir_is_3reg(ins->op);
+    rvjit_ir_value_t s1, s2;
+    uint64_t res;
+
+    if (ins->rd == RVJIT_REGISTER_ZERO) {
+        ins->op = RVJIT_IR_nop;
+        return;
+    }
+    if (ins->op == RVJIT_IR_li) {
+        rvjit_ir_def_const(block, ins->rd, (int64_t)ins->imm);
+        return;
+    }
+    if (ins->op == RVJIT_IR_auipc) {
+        rvjit_ir_def(ir, ins->rd, RVJIT_IR_PCREL, (int64_t)ins->imm + ins->pc_off, false);
+        return;
+    }
+
+    s1 = ir->regs[ins->rs1];
+    s2 = rr ? ir->regs[ins->rs2] : ir->regs[RVJIT_REGISTER_ZERO];
+    if (s1.kind == RVJIT_IR_CONST && s2.kind == RVJIT_IR_CONST) {
+        uint64_t b = rr ? s2.value : rvjit_ir_xlen(block, (int64_t)ins->imm);
+        if (rvjit_ir_eval(block, ins->op, s1.value, b, &res)) {
+            if (rvjit_ir_fits_int32(rvjit_ir_signed(block, res))) {
+                // Known result, materialize it directly
+                ins->op = RVJIT_IR_li;
+                ins->rs1 = 0;
+                ins->rs2 = 0;
+                ins->imm = (int32_t)rvjit_ir_signed(block, res);
+            }
+            rvjit_ir_def_const(block, ins->rd, res);
+            return;
+        }
+    }
+
+    if (ins->op == RVJIT_IR_addi && s1.kind == RVJIT_IR_PCREL && (ins->imm || ins->rd != ins->rs1)) {
+        // PC-relative address, computed with a single auipc (la, call)
+        int64_t off = (int64_t)s1.value + ins->imm;
+        if (!block->rv64 || rvjit_ir_fits_int32(off)) {
+            ins->op = RVJIT_IR_auipc;
+            ins->rs1 = 0;
+            ins->imm = (int32_t)(off - ins->pc_off);
+            rvjit_ir_def(ir, ins->rd, RVJIT_IR_PCREL, off, false);
+            return;
+        }
+    }
+
+    if (rr) {
+        rvjit_ir_reduce(block, ins);
+        // Operands may have been swapped
+        s1 = ir->regs[ins->rs1];
+        s2 = ir->regs[ins->rs2];
+    }
+
+    if (block->rv64 && s1.sext && ins->imm == 0 && (ins->op == RVJIT_IR_addiw
+     || ins->op == RVJIT_IR_slliw || ins->op == RVJIT_IR_srliw || ins->op == RVJIT_IR_sraiw)) {
+        // Source is sign-extended already, sext.w is a move
+        ins->op = RVJIT_IR_addi;
+    }
+
+    if (ins->op == RVJIT_IR_addi && ins->imm == 0) {
+        // Register move, propagate whatever is known
+        if (ins->rd == ins->rs1) {
+            ins->op = RVJIT_IR_nop;
+        } else {
+            rvjit_ir_def(ir, ins->rd, s1.kind, s1.value, s1.sext);
+        }
+        return;
+    }
+
+    rvjit_ir_def(ir, ins->rd, RVJIT_IR_UNKNOWN, 0, rvjit_ir_sext_result(ins, s1.sext, s2.sext));
+}
+
+static void rvjit_ir_load(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    rvjit_ir_t* ir = &block->ir;
+    uint32_t base_version = ir->regs[ins->rs1].version;
+
+    for (size_t i=0; i<ir->mem_count; ++i) {
+        rvjit_ir_mem_t* mem = &ir->mem[i];
+        uint8_t op = RVJIT_IR_nop;
+        int32_t imm = 0;
+        if (mem->base != ins->rs1 || mem->base_version != base_version || mem->offset != ins->imm
+         || mem->val_version != ir->regs[mem->val].version) continue;
+        if (mem->op == ins->op || (mem->op == RVJIT_IR_sd && ins->op == RVJIT_IR_ld)) {
+            // Same value is already in a register
+            op = RVJIT_IR_addi;
+        } else if (mem->op == RVJIT_IR_sw && ins->op == RVJIT_IR_lw) {
+            op = block->rv64 ? RVJIT_IR_addiw : RVJIT_IR_addi;
+        } else if (mem->op == RVJIT_IR_sb && ins->op == RVJIT_IR_lbu) {
+            op = RVJIT_IR_andi;
+            imm = 0xFF;
+        } else continue;
+
+        ins->op = op;
+        ins->rs1 = mem->val;
+        ins->imm = imm;
+        rvjit_ir_alu(block, ins);
+        return;
+    }
+
+    rvjit_ir_def(ir, ins->rd, RVJIT_IR_UNKNOWN, 0, rvjit_ir_sext_result(ins, false, false));
+    if (ins->rd != RVJIT_REGISTER_ZERO && ins->rd != ins->rs1) {
+        rvjit_ir_remember(ir, ins->op, ins->rs1, base_version, ins->imm, ins->rd);
+    }
+}
+
+static void rvjit_ir_store(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    rvjit_ir_t* ir = &block->ir;
+    uint32_t base_version = ir->regs[ins->rs1].version;
+    int64_t begin = ins->imm, end = begin + rvjit_ir_ldst_size(ins->op);
+    size_t count = 0;
+
+    // Forget accesses which may alias with the store
+    for (size_t i=0; i<ir->mem_count; ++i) {
+        rvjit_ir_mem_t* mem = &ir->mem[i];
+        int64_t mem_begin = mem->offset, mem_end = mem_begin + rvjit_ir_ldst_size(mem->op);
+        if (mem->base == ins->rs1 && mem->base_version == base_version
+         && (mem_end <= begin || end <= mem_begin)) {
+            ir->mem[count++] = *mem;
+        }
+    }
+    ir->mem_count = count;
+    rvjit_ir_remember(ir, ins->op, ins->rs1, base_version, ins->imm, ins->rd);
+}
+
+static void rvjit_ir_branch(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    rvjit_ir_value_t* s1 = &block->ir.regs[ins->rs1];
+    rvjit_ir_value_t* s2 = &block->ir.regs[ins->rs2];
+    uint64_t a = s1->value, b = s2->value;
+    bool taken;
+
+    if (ins->rs1 == ins->rs2) {
+        a = b = 0;
+    } else if (s1->kind != RVJIT_IR_CONST || s2->kind != RVJIT_IR_CONST) {
+        return;
+    }
+    switch (ins->op) {
+        case RVJIT_IR_beq:  taken = a == b; break;
+        case RVJIT_IR_bne:  taken = a != b; break;
+        case RVJIT_IR_blt:  taken = rvjit_ir_signed(block, a) < rvjit_ir_signed(block, b); break;
+        case RVJIT_IR_bge:  taken = rvjit_ir_signed(block, a) >= rvjit_ir_signed(block, b); break;
+        case RVJIT_IR_bltu: taken = a < b; break;
+        default:            taken = a >= b; break;
+    }
+    // Trace continues only when the condition holds
+    if (taken) ins->op = RVJIT_IR_nop;
+}
+
+void rvjit_ir_init(rvjit_block_t* block)
+{
+    block->ir.enabled = false;
+    block->ir.count = 0;
+    rvjit_ir_forget(&block->ir);
+}
+
+void rvjit_ir_lift(rvjit_block_t* block, uint8_t op, regid_t rd, regid_t rs1, regid_t rs2, int32_t imm)
+{
+    rvjit_ir_op_t* ins;
+    if (block->ir.count == RVJIT_IR_OPS) rvjit_ir_flush(block);
+
+    ins = &block->ir.ops[block->ir.count++];
+    ins->op = op;
+    ins->rd = rd;
+    ins->rs1 = rs1;
+    ins->rs2 = rs2;
+    ins->imm = imm;
+    ins->pc_off = block->pc_off;
+    ins->insns = block->insns;
+
+    if (rvjit_ir_is_branch(op)) {
+        rvjit_ir_branch(block, ins);
+        rvjit_ir_flush(block);
+    } else if (rvjit_ir_is_store(op)) {
+        rvjit_ir_store(block, ins);
+    } else if (rvjit_ir_is_load(op)) {
+        rvjit_ir_load(block, ins);
+    } else {
+        rvjit_ir_alu(block, ins);
+    }
+}
+
+#ifdef RVJIT_NATIVE_64BIT
+#define RVJIT_IR_LOWER(instr, args) \
+    case RVJIT_IR_##instr: \
+        if (block->rv64) rvjit64_##instr args; \
+        else rvjit32_##instr args; \
+        break;
+
+#define RVJIT_IR_LOWER64(instr, args) \
+    case RVJIT_IR_##instr: \
+        rvjit64_##instr args; \
+        break;
+#else
+#define RVJIT_IR_LOWER(instr, args) \
+    case RVJIT_IR_##instr: \
+        rvjit32_##instr args; \
+        break;
+
+#define RVJIT_IR_LOWER64(instr, args)
+#endif
+
+#define RVJIT_IR_3REG(instr)     RVJIT_IR_LOWER(instr, (block, ins->rd, ins->rs1, ins->rs2))
+#define RVJIT_IR_3REG64(instr)   RVJIT_IR_LOWER64(instr, (block, ins->rd, ins->rs1, ins->rs2))
+#define RVJIT_IR_IMM(instr)      RVJIT_IR_LOWER(instr, (block, ins->rd, ins->rs1, ins->imm))
+#define RVJIT_IR_IMM64(instr)    RVJIT_IR_LOWER64(instr, (block, ins->rd, ins->rs1, ins->imm))
+#define RVJIT_IR_BRANCH(instr)   RVJIT_IR_LOWER(instr, (block, ins->rs1, ins->rs2))
+
+static void rvjit_ir_lower(rvjit_block_t* block, rvjit_ir_op_t* ins)
+{
+    switch (ins->op) {
+        RVJIT_IR_3REG(add)
+        RVJIT_IR_3REG(sub)
+        RVJIT_IR_3REG(or)
+        RVJIT_IR_3REG(and)
+        RVJIT_IR_3REG(xor)
+        RVJIT_IR_3REG(sra)
+        RVJIT_IR_3REG(srl)
+        RVJIT_IR_3REG(sll)
+        RVJIT_IR_3REG(slt)
+        RVJIT_IR_3REG(sltu)
+        RVJIT_IR_3REG(mul)
+        RVJIT_IR_3REG(mulh)
+        RVJIT_IR_3REG(mulhu)
+        RVJIT_IR_3REG(mulhsu)
+        RVJIT_IR_3REG(div)
+        RVJIT_IR_3REG(divu)
+        RVJIT_IR_3REG(rem)
+        RVJIT_IR_3REG(remu)
+        RVJIT_IR_3REG64(addw)
+        RVJIT_IR_3REG64(subw)
+        RVJIT_IR_3REG64(sraw)
+        RVJIT_IR_3REG64(srlw)
+        RVJIT_IR_3REG64(sllw)
+        RVJIT_IR_3REG64(mulw)
+        RVJIT_IR_3REG64(divw)
+        RVJIT_IR_3REG64(divuw)
+        RVJIT_IR_3REG64(remw)
+        RVJIT_IR_3REG64(remuw)
+        RVJIT_IR_IMM(addi)
+        RVJIT_IR_IMM(ori)
+        RVJIT_IR_IMM(andi)
+        RVJIT_IR_IMM(xori)
+        RVJIT_IR_IMM(srai)
+        RVJIT_IR_IMM(srli)
+        RVJIT_IR_IMM(slli)
+        RVJIT_IR_IMM(slti)
+        RVJIT_IR_IMM(sltiu)
+        RVJIT_IR_IMM64(addiw)
+        RVJIT_IR_IMM64(sraiw)
+        RVJIT_IR_IMM64(srliw)
+        RVJIT_IR_IMM64(slliw)
+        RVJIT_IR_LOWER(li, (block, ins->rd, ins->imm))
+        RVJIT_IR_LOWER(auipc, (block, ins->rd, ins->imm))
+        RVJIT_IR_IMM(lb)
+        RVJIT_IR_IMM(lbu)
+        RVJIT_IR_IMM(lh)
+        RVJIT_IR_IMM(lhu)
+        RVJIT_IR_IMM(lw)
+        RVJIT_IR_IMM64(lwu)
+        RVJIT_IR_IMM64(ld)
+        RVJIT_IR_IMM(sb)
+        RVJIT_IR_IMM(sh)
+        RVJIT_IR_IMM(sw)
+        RVJIT_IR_IMM64(sd)
+        RVJIT_IR_BRANCH(beq)
+        RVJIT_IR_BRANCH(bne)
+        RVJIT_IR_BRANCH(blt)
+        RVJIT_IR_BRANCH(bge)
+        RVJIT_IR_BRANCH(bltu)
+        RVJIT_IR_BRANCH(bgeu)
+    }
+}
+
+void rvjit_ir_flush(rvjit_block_t* block)
+{
+    rvjit_ir_t* ir = &block->ir;
+    int32_t pc_off = block->pc_off;
+    uint32_t insns = block->insns;
+    uint32_t live = -1;
+
+    // Eliminate dead writes, everything is live upon possible block exit
+    for (size_t i=ir->count; i--;) {
+        rvjit_ir_op_t* ins = &ir->ops[i];
+        if (ins->op == RVJIT_IR_nop) continue;
+        if (!rvjit_ir_is_3reg(ins->op) && !rvjit_ir_is_imm(ins->op)
+         && ins->op != RVJIT_IR_li && ins->op != RVJIT_IR_auipc) {
+            live = -1;
+        } else if (!(live & (1U << ins->rd))) {
+            ins->op = RVJIT_IR_nop;
+        } else {
+            live &= ~(1U << ins->rd);
+            live |= 1U << ins->rs1;
+            if (rvjit_ir_is_3reg(ins->op)) live |= 1U << ins->rs2;
+        }
+    }
+
+    ir->enabled = false;
+    for (size_t i=0; i<ir->count; ++i) {
+        block->pc_off = ir->ops[i].pc_off;
+        block->insns = ir->ops[i].insns;
+        rvjit_ir_lower(block, &ir->ops[i]);
+    }
+    ir->enabled = true;
+    ir->count = 0;
+    block->pc_off = pc_off;
+    block->insns = insns;
+}
+
+void rvjit_ir_clobber(rvjit_block_t* block)
+{
+    if (!block->ir.enabled) return;
+    rvjit_ir_flush(block);
+    rvjit_ir_forget(&block->ir);
+}
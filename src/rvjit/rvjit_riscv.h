@@ -352,10 +352,24 @@ static inline void rvjit_native_pop(rvjit_block_t* block, regid_t reg)
 // Set native register reg to wide imm
 static inline void rvjit_native_setregw(rvjit_block_t* block, regid_t reg, uintptr_t imm)
 {
-    UNUSED(block);
-    UNUSED(reg);
-    UNUSED(imm);
-    rvvm_fatal("Unimplemented rvjit_native_setregw for RISC-V backend");
+#ifdef RVJIT_NATIVE_64BIT
+    int64_t val = imm;
+    if (val != (int32_t)val) {
+        // Materialize the upper part, then shift in sign-extended lower 12 bits
+        int32_t low = ((int64_t)((uint64_t)val << 52)) >> 52;
+        int64_t high = (val - low) >> 12;
+        uint8_t shift = 12;
+        while (!(high & 1)) {
+            high >>= 1;
+            shift++;
+        }
+        rvjit_native_setregw(block, reg, high);
+        rvjit_riscv_i_op_internal(block, RISCV_I_SLLI, reg, reg, shift);
+        if (low) rvjit_riscv_i_op_internal(block, RISCV_I_ADDI, reg, reg, low);
+        return;
+    }
+#endif
+    rvjit_native_setreg32s(block, reg, imm);
 }
 
 // Call a function pointed to by native register
@@ -489,21 +503,35 @@ static inline void rvjit_tail_bnez(rvjit_block_t* block, regid_t addr, int32_t o
 // Patch instruction at addr into ret
 static inline void rvjit_patch_ret(void* addr)
 {
-    write_uint32_le_m(addr, 0x00008067);
+    atomic_store_uint32(addr, 0x00008067);
 }
 
 // Patch jump instruction at addr (may return false if offset cannot be encoded)
 static inline bool rvjit_patch_jmp(void* addr, int32_t offset)
 {
     if (rvjit_is_valid_jal_imm(offset)) {
-        write_uint32_le_m(addr, 0);
-        rvjit_riscv_jal_patch(addr, offset);
+        // The block may be executed by other harts, replace the instruction atomically
+        uint32_t insn = 0;
+        rvjit_riscv_jal_patch(&insn, offset);
+        atomic_store_uint32(addr, insn);
         return true;
     } else {
         return false;
     }
 }
 
+// Emit patchable NOP
+static inline void rvjit_patchable_slot(rvjit_block_t* block)
+{
+    rvjit_riscv_i_op_internal(block, RISCV_I_ADDI, RISCV_REG_ZERO, RISCV_REG_ZERO, 0);
+}
+
+// Patch the NOP at addr into a jump, it's left intact if offset cannot be encoded
+static inline void rvjit_patch_slot(void* addr, int32_t offset)
+{
+    rvjit_patch_jmp(addr, offset);
+}
+
 /*
  * RV32
  */
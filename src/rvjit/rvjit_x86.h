@@ -356,8 +356,8 @@ static inline void rvjit_x86_movzxb(rvjit_block_t* block, regid_t dest, regid_t
     rvjit_put_code(block, code + (code[0] ? 0 : 1), code[0] ? 4 : 3);
 }
 
-// x86 substitute for 3-operand add instruction
-static inline void rvjit_x86_lea_add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t hrs2, bool bits_64)
+// lea hrds, [hrs1 + (hrs2 << scale)], scale is 0-3
+static inline void rvjit_x86_lea_add_scaled(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, uint8_t scale, bool bits_64)
 {
     uint8_t code[5] = {0x00, 0x8D, 0x04, 0x00, 0x00};
     uint8_t inst_size = 3;
@@ -370,10 +370,16 @@ static inline void rvjit_x86_lea_add(rvjit_block_t* block, regid_t hrds, regid_t
         inst_size++;
     }
     code[2] |= (hrds & 0x7) << 3;
-    code[3] |= (hrs1 & 0x7) | ((hrs2 & 0x7) << 3);
+    code[3] |= (hrs1 & 0x7) | ((hrs2 & 0x7) << 3) | (scale << 6);
     rvjit_put_code(block, code + (code[0] ? 0 : 1), inst_size + (code[0] ? 1 : 0));
 }
 
+// x86 substitute for 3-operand add instruction
+static inline void rvjit_x86_lea_add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t hrs2, bool bits_64)
+{
+    rvjit_x86_lea_add_scaled(block, hrds, hrs1, hrs2, 0, bits_64);
+}
+
 static inline void rvjit_x86_3reg_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
 {
     if (hrds == hrs1) {
@@ -497,18 +503,12 @@ static inline bool rvjit_x86_has_bmi2()
      return bmi2;
 }
 
-static inline void rvjit_x86_3reg_shift_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+static inline void rvjit_x86_3reg_shift_cl_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
 {
     /* Shift by register is insane on i386, practically a 1-operand instruction,
      * with CL hardcoded as shift amount reg.
      * This function implements a proper 3-operand intrinsic.
      */
-    if (rvjit_x86_has_bmi2()) {
-        // On BMI2 hardware, we have 1:1 instruction mappings into shlx/shrx/sarx
-        rvjit_x86_vex_shift_op(block, opcode, hrds, hrs1, hrs2, bits_64);
-        return;
-    }
-
     if (hrds == hrs1) {
         if (hrs2 != X86_ECX) {
             rvjit_x86_xchg(block, X86_ECX, hrs2);
@@ -556,6 +556,16 @@ static inline void rvjit_x86_3reg_shift_op(rvjit_block_t* block, uint8_t opcode,
     }
 }
 
+static inline void rvjit_x86_3reg_shift_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    if (rvjit_x86_has_bmi2()) {
+        // On BMI2 hardware, we have 1:1 instruction mappings into shlx/shrx/sarx
+        rvjit_x86_vex_shift_op(block, opcode, hrds, hrs1, hrs2, bits_64);
+        return;
+    }
+    rvjit_x86_3reg_shift_cl_op(block, opcode, hrds, hrs1, hrs2, bits_64);
+}
+
 static inline void rvjit_native_zero_reg(rvjit_block_t* block, regid_t reg)
 {
     rvjit_x86_3reg_op(block, X86_XOR, reg, reg, reg, false);
@@ -786,6 +796,11 @@ static inline branch_t rvjit_native_jmp(rvjit_block_t* block, branch_t handle, b
 
 //#define RVJIT_FAR_BRANCHES
 
+// Block exits spill FPU registers as well, which may not fit into rel8
+#ifdef RVJIT_NATIVE_FPU
+#define RVJIT_FAR_BRANCHES
+#endif
+
 // Needs testing if we aren't violating offset constraints
 #ifdef RVJIT_FAR_BRANCHES
 #define X86_JB   0x82
@@ -1077,6 +1092,156 @@ static inline void rvjit_x86_div_rem(rvjit_block_t* block, bool rem, regid_t hrd
     if (bits_64) rvjit_free_hreg(block, cmp_reg);
 }
 
+/*
+ * Atomic internal functions
+ */
+
+#define X86_XADD     0xC1
+#define X86_CMPXCHG  0xB1
+#define X86_SETNE    0x95
+
+#define X86_CMOVB    0x42
+#define X86_CMOVA    0x47
+#define X86_CMOVL    0x4C
+#define X86_CMOVG    0x4F
+
+// Host pointers are full register width
+#ifdef RVJIT_NATIVE_64BIT
+#define X86_PTR_64 true
+#else
+#define X86_PTR_64 false
+#endif
+
+// Search for any register not clobbering the operands, caller should preserve it
+static inline regid_t rvjit_x86_scratch_reg(regid_t r1, regid_t r2, regid_t r3, regid_t r4)
+{
+    regid_t reg = X86_ECX;
+    while (reg == r1 || reg == r2 || reg == r3 || reg == r4
+        || reg == X86_ESP || reg == X86_EBP || reg == VM_PTR_REG) reg++;
+    return reg;
+}
+
+// cmov<cc> dest, src
+static inline void rvjit_x86_cmov(rvjit_block_t* block, uint8_t opcode, regid_t dest, regid_t src, bool bits_64)
+{
+    uint8_t code[4];
+    code[0] = bits_64 ? X64_REX_W : 0;
+    code[1] = 0x0F;
+    code[2] = opcode;
+    code[3] = X86_2_REGS;
+    if (dest >= X64_R8) {
+        code[0] |= X64_REX_R;
+        code[3] += (dest - X64_R8) << 3;
+    } else {
+        code[3] += dest << 3;
+    }
+    if (src >= X64_R8) {
+        code[0] |= X64_REX_B;
+        code[3] += src - X64_R8;
+    } else {
+        code[3] += src;
+    }
+    rvjit_put_code(block, code + (code[0] ? 0 : 1), code[0] ? 4 : 3);
+}
+
+// lock xadd/cmpxchg [addr], reg
+static inline void rvjit_x86_lock_op(rvjit_block_t* block, uint8_t opcode, regid_t reg, regid_t addr, bool bits_64)
+{
+    rvjit_put_code(block, "\xF0", 1); // lock prefix
+    rvjit_x86_lbhu(block, opcode, reg, addr, 0, bits_64);
+}
+
+// amoswap: X86_XCHG (implicitly locked), amoadd: X86_XADD
+static inline void rvjit_x86_amo_xchg_xadd(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t haddr, regid_t hrs2, bool bits_64)
+{
+    if (hrds != hrs2) rvjit_x86_mov(block, hrds, hrs2, bits_64);
+    if (opcode == X86_XCHG) {
+        rvjit_x86_lwdu_sbwd(block, X86_XCHG, hrds, haddr, 0, bits_64);
+    } else {
+        rvjit_x86_lock_op(block, opcode, hrds, haddr, bits_64);
+    }
+}
+
+/*
+ * Other AMOs are a lock cmpxchg loop over EAX, which holds the old value.
+ * Operation is either an ALU opcode (and/or/xor), or a cmov opcode (min/max)
+ */
+static inline void rvjit_x86_amo_cmpxchg(rvjit_block_t* block, uint8_t opcode, bool cmov, regid_t hrds, regid_t haddr, regid_t hrs2, bool bits_64)
+{
+    regid_t addr_reg = haddr;
+    regid_t s2_reg = hrs2;
+    regid_t tmp_reg = hrds;
+
+    if (hrds != X86_EAX) rvjit_native_push(block, X86_EAX);
+
+    if (haddr == X86_EAX) {
+        addr_reg = rvjit_x86_scratch_reg(X86_EAX, hrds, hrs2, hrs2);
+        rvjit_native_push(block, addr_reg);
+        rvjit_x86_mov(block, addr_reg, haddr, X86_PTR_64);
+    }
+    if (hrs2 == X86_EAX) {
+        s2_reg = rvjit_x86_scratch_reg(X86_EAX, hrds, addr_reg, addr_reg);
+        rvjit_native_push(block, s2_reg);
+        rvjit_x86_mov(block, s2_reg, hrs2, bits_64);
+    }
+    if (hrds == X86_EAX || hrds == hrs2) {
+        tmp_reg = rvjit_x86_scratch_reg(X86_EAX, hrds, addr_reg, s2_reg);
+        rvjit_native_push(block, tmp_reg);
+    }
+
+    rvjit_x86_lwdu_sbwd(block, X86_LWU_LD, X86_EAX, addr_reg, 0, bits_64);
+    branch_t l1 = rvjit_x86_branch_target(block, BRANCH_NEW);
+    rvjit_x86_mov(block, tmp_reg, X86_EAX, bits_64);
+    if (cmov) {
+        rvjit_x86_2reg_op(block, X86_CMP, X86_EAX, s2_reg, bits_64);
+        rvjit_x86_cmov(block, opcode, tmp_reg, s2_reg, bits_64);
+    } else {
+        rvjit_x86_2reg_op(block, opcode, tmp_reg, s2_reg, bits_64);
+    }
+    rvjit_x86_lock_op(block, X86_CMPXCHG, tmp_reg, addr_reg, bits_64);
+    rvjit_x86_branch_entry(block, X86_JNE, l1);
+
+    if (tmp_reg != hrds) rvjit_native_pop(block, tmp_reg);
+    if (s2_reg != hrs2) rvjit_native_pop(block, s2_reg);
+    if (addr_reg != haddr) rvjit_native_pop(block, addr_reg);
+    if (hrds != X86_EAX) {
+        rvjit_x86_mov(block, hrds, X86_EAX, bits_64);
+        rvjit_native_pop(block, X86_EAX);
+    }
+}
+
+// Store hrs2 if [addr] equals hcmp, set hrds to 0 on success, 1 otherwise
+static inline void rvjit_x86_cas(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hcmp, regid_t hrs2, bool bits_64)
+{
+    regid_t addr_reg = haddr;
+    regid_t s2_reg = hrs2;
+
+    if (hrds != X86_EAX) rvjit_native_push(block, X86_EAX);
+
+    if (haddr == X86_EAX) {
+        addr_reg = rvjit_x86_scratch_reg(X86_EAX, hrds, hcmp, hrs2);
+        rvjit_native_push(block, addr_reg);
+        rvjit_x86_mov(block, addr_reg, haddr, X86_PTR_64);
+    }
+    if (hrs2 == X86_EAX) {
+        s2_reg = rvjit_x86_scratch_reg(X86_EAX, hrds, hcmp, addr_reg);
+        rvjit_native_push(block, s2_reg);
+        rvjit_x86_mov(block, s2_reg, hrs2, bits_64);
+    }
+    if (hcmp != X86_EAX) rvjit_x86_mov(block, X86_EAX, hcmp, bits_64);
+
+    rvjit_x86_lock_op(block, X86_CMPXCHG, s2_reg, addr_reg, bits_64);
+    rvjit_x86_setcc_internal(block, X86_SETNE, X86_EAX);
+    rvjit_x86_movzxb(block, X86_EAX, X86_EAX);
+
+    if (s2_reg != hrs2) rvjit_native_pop(block, s2_reg);
+    if (addr_reg != haddr) rvjit_native_pop(block, addr_reg);
+    if (hrds != X86_EAX) {
+        rvjit_x86_mov(block, hrds, X86_EAX, false);
+        rvjit_native_pop(block, X86_EAX);
+    }
+}
+
 /*
  * Linker routines
  */
@@ -1117,6 +1282,27 @@ static inline void rvjit_patchable_ret(rvjit_block_t* block)
     rvjit_put_code(block, code, 5);
 }
 
+// Emit multi-byte NOPs of given total size
+static inline void rvjit_native_nops(rvjit_block_t* block, size_t size)
+{
+    static const uint8_t nops[9][9] = {
+        {0x90},
+        {0x66, 0x90},
+        {0x0F, 0x1F, 0x00},
+        {0x0F, 0x1F, 0x40, 0x00},
+        {0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+        {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    };
+    while (size) {
+        size_t len = size > 9 ? 9 : size;
+        rvjit_put_code(block, nops[len - 1], len);
+        size -= len;
+    }
+}
+
 // Jump if word pointed to by addr is nonzero (may emit nothing if the offset cannot be encoded)
 // Used to check interrupts in block linkage
 static inline void rvjit_tail_bnez(rvjit_block_t* block, regid_t addr, int32_t offset)
@@ -1129,6 +1315,51 @@ static inline void rvjit_tail_bnez(rvjit_block_t* block, regid_t addr, int32_t o
     rvjit_put_code(block, code, 6);
 }
 
+#ifdef RVJIT_NATIVE_INDIRECT
+
+// Jump to address held in native register
+static inline void rvjit_tail_jmpreg(rvjit_block_t* block, regid_t reg)
+{
+    uint8_t code[3];
+    if (reg < X64_R8) {
+        code[0] = 0xFF;
+        code[1] = 0xE0 + reg;
+        rvjit_put_code(block, code, 2);
+    } else {
+        code[0] = X64_REX_B;
+        code[1] = 0xFF;
+        code[2] = 0xE0 + reg - X64_R8;
+        rvjit_put_code(block, code, 3);
+    }
+}
+
+// Load address of a location in this block into native register, works like branches
+static inline branch_t rvjit_tail_lea(rvjit_block_t* block, regid_t reg, branch_t handle, bool target)
+{
+    if (target) {
+        // Patch rip-relative offset
+        write_uint32_le_m(block->code + handle + 3, block->size - handle - 7);
+        return BRANCH_NEW;
+    } else {
+        branch_t tmp = block->size;
+        uint8_t code[7];
+        code[0] = X64_REX_W;
+        code[1] = 0x8D;
+        code[2] = 0x05;
+        if (reg >= X64_R8) {
+            code[0] |= X64_REX_R;
+            code[2] |= (reg - X64_R8) << 3;
+        } else {
+            code[2] |= reg << 3;
+        }
+        write_uint32_le_m(code + 3, 0);
+        rvjit_put_code(block, code, 7);
+        return tmp;
+    }
+}
+
+#endif
+
 // Patch instruction at addr into ret
 static inline void rvjit_patch_ret(void* addr)
 {
@@ -1139,11 +1370,33 @@ static inline void rvjit_patch_ret(void* addr)
 static inline bool rvjit_patch_jmp(void* addr, int32_t offset)
 {
     uint8_t* code = (uint8_t*)addr;
-    code[0] = 0xE9;
+    // The block may be executed by other harts, place the jump opcode over ret last
     write_uint32_le_m(code + 1, ((uint32_t)offset) - 5);
+    atomic_fence();
+    code[0] = 0xE9;
     return true;
 }
 
+// Emit patchable 5-byte NOP
+static inline void rvjit_patchable_slot(rvjit_block_t* block)
+{
+    rvjit_native_nops(block, 5);
+}
+
+/*
+ * Patch the NOP at addr into a jump, it's expected to be within an aligned qword.
+ * The block may be executed by other harts, so the whole NOP is replaced by a single store.
+ */
+static inline void rvjit_patch_slot(void* addr, int32_t offset)
+{
+    uint8_t* qword = (uint8_t*)((size_t)addr & ~(size_t)7);
+    uint8_t code[8];
+    memcpy(code, qword, 8);
+    code[(uint8_t*)addr - qword] = 0xE9;
+    write_uint32_le_m(code + ((uint8_t*)addr - qword) + 1, ((uint32_t)offset) - 5);
+    atomic_store_uint64(qword, read_uint64_le_m(code));
+}
+
 /*
  * RV32
  */
@@ -1362,6 +1615,56 @@ static inline void rvjit32_native_remu(rvjit_block_t* block, regid_t hrds, regid
     rvjit_x86_divu_remu(block, true, hrds, hrs1, hrs2, false);
 }
 
+static inline void rvjit32_native_amoswap(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_xchg_xadd(block, X86_XCHG, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amoadd(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_xchg_xadd(block, X86_XADD, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amoand(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_AND, false, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amoor(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_OR, false, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amoxor(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_XOR, false, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amomin(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVG, true, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amomax(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVL, true, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amominu(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVA, true, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_amomaxu(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVB, true, hrds, haddr, hrs2, false);
+}
+
+static inline void rvjit32_native_cas(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hcmp, regid_t hrs2)
+{
+    rvjit_x86_cas(block, hrds, haddr, hcmp, hrs2, false);
+}
+
 /*
  * RV64
  */
@@ -1696,61 +1999,1122 @@ static inline void rvjit64_native_remuw(rvjit_block_t* block, regid_t hrds, regi
     rvjit_x86_movsxd(block, hrds, hrds);
 }
 
+static inline void rvjit64_native_amoswap(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_xchg_xadd(block, X86_XCHG, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amoadd(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_xchg_xadd(block, X86_XADD, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amoand(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_AND, false, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amoor(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_OR, false, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amoxor(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_XOR, false, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amomin(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVG, true, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amomax(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVL, true, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amominu(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVA, true, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_amomaxu(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hrs2)
+{
+    rvjit_x86_amo_cmpxchg(block, X86_CMOVB, true, hrds, haddr, hrs2, true);
+}
+
+static inline void rvjit64_native_cas(rvjit_block_t* block, regid_t hrds, regid_t haddr, regid_t hcmp, regid_t hrs2)
+{
+    rvjit_x86_cas(block, hrds, haddr, hcmp, hrs2, true);
+}
+
 #endif
 
 #ifdef RVJIT_NATIVE_FPU
 
-#define SSE2_MOVAPSD 0x28
-#define SSE2_FADD    0x58
+/*
+ * FPU registers are mapped onto SSE2 xmm registers, holding the raw 64-bit
+ * value of the guest register (singles are NaN-boxed). Two last usable
+ * xmm registers are reserved as a scratch space for the natives below.
+ * Arithmetic honors the MXCSR rounding mode, and raises exceptions into
+ * MXCSR sticky flags, which is exactly where the interpreter keeps fflags.
+ */
+#ifdef RVJIT_ABI_WIN64
+#define X86_XMM_REGS 6 // xmm6-xmm15 are callee-saved
+#else
+#define X86_XMM_REGS 16
+#endif
+
+#define X86_XMM_TMP1 (X86_XMM_REGS - 1)
+#define X86_XMM_TMP2 (X86_XMM_REGS - 2)
+
+#define SSE2_PREFIX_PD 0x66
+#define SSE2_PREFIX_SD 0xF2
+#define SSE2_PREFIX_SS 0xF3
+
+#define SSE2_MOVS_LOAD  0x10
+#define SSE2_MOVS_STORE 0x11
+#define SSE2_MOVAPS     0x28
+#define SSE2_CVTSI2S    0x2A
+#define SSE2_CVTTS2SI   0x2C
+#define SSE2_CVTS2SI    0x2D
+#define SSE2_UCOMIS     0x2E
+#define SSE2_FSQRT      0x51
+#define SSE2_ANDPS      0x54
+#define SSE2_ANDNPS     0x55
+#define SSE2_ORPS       0x56
+#define SSE2_XORPS      0x57
+#define SSE2_FADD       0x58
+#define SSE2_FMUL       0x59
+#define SSE2_CVTS2S     0x5A
+#define SSE2_FSUB       0x5C
+#define SSE2_FDIV       0x5E
+#define SSE2_MOVD_X_R   0x6E
+#define SSE2_PSHIFTD    0x72
+#define SSE2_PSHIFTQ    0x73
+#define SSE2_PCMPEQD    0x76
+#define SSE2_MOVD_R_X   0x7E
+#define SSE2_CMPS       0xC2
 
-static inline void rvjit_sse2_rex_prefix(rvjit_block_t* block, regid_t hrd, regid_t hrs)
+#define SSE2_PSRL 2
+#define SSE2_PSLL 6
+
+#define SSE2_CMP_EQ 0
+#define SSE2_CMP_LT 1
+#define SSE2_CMP_LE 2
+
+static inline size_t rvjit_native_default_fpu_hregmask()
 {
-    uint8_t rex = 0;
-    if (hrd >= X64_R8) rex |= X64_REX_R;
-    if (hrs >= X64_R8) rex |= X64_REX_B;
-    if (rex) rvjit_put_code(block, &rex, 1); // REX operand override prefix
+    return rvjit_hreg_mask(X86_XMM_TMP2) - 1;
 }
 
-static inline void rvjit_sse2_2reg_op_raw(rvjit_block_t* block, uint8_t opcode, regid_t hrd, regid_t hrs)
+static inline uint8_t rvjit_sse2_prefix(bool fpu_d)
 {
-    uint8_t code[3] = {0x0F, 0x00, 0xC0};
-    code[1] = opcode;
-    code[2] |= (hrs & 0x7) | ((hrd & 0x7) << 3);
-    rvjit_put_code(block, code, 3);
+    return fpu_d ? SSE2_PREFIX_SD : SSE2_PREFIX_SS;
+}
+
+// Emit [prefix] [rex] 0F opcode, reg is encoded in ModRM.reg, rm in ModRM.rm
+static inline void rvjit_sse2_opcode(rvjit_block_t* block, uint8_t prefix, uint8_t opcode, regid_t reg, regid_t rm, bool bits_64)
+{
+    uint8_t code[4];
+    size_t size = 0;
+    if (prefix) code[size++] = prefix;
+    code[size] = bits_64 ? X64_REX_W : 0;
+    if (reg >= X64_R8) code[size] |= X64_REX_R;
+    if (rm >= X64_R8) code[size] |= X64_REX_B;
+    if (code[size]) size++;
+    code[size++] = 0x0F;
+    code[size++] = opcode;
+    rvjit_put_code(block, code, size);
+}
+
+// op reg, rm (both registers)
+static inline void rvjit_sse2_2reg_op(rvjit_block_t* block, uint8_t prefix, uint8_t opcode, regid_t reg, regid_t rm, bool bits_64)
+{
+    uint8_t modrm = X86_2_REGS | ((reg & 0x7) << 3) | (rm & 0x7);
+    rvjit_sse2_opcode(block, prefix, opcode, reg, rm, bits_64);
+    rvjit_put_code(block, &modrm, 1);
+}
+
+// op reg, [addr + off]
+static inline void rvjit_sse2_mem_op(rvjit_block_t* block, uint8_t prefix, uint8_t opcode, regid_t reg, regid_t addr, int32_t off)
+{
+    rvjit_sse2_opcode(block, prefix, opcode, reg, addr, false);
+    rvjit_x86_memory_ref(block, reg, addr, off);
+}
+
+// psll/psrl xmm, imm; ext selects the operation
+static inline void rvjit_sse2_shift_op(rvjit_block_t* block, uint8_t opcode, uint8_t ext, regid_t reg, uint8_t imm)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, opcode, ext, reg, false);
+    rvjit_put_code(block, &imm, 1);
+}
+
+static inline void rvjit_sse2_movaps(rvjit_block_t* block, regid_t dest, regid_t src)
+{
+    if (dest != src) rvjit_sse2_2reg_op(block, 0, SSE2_MOVAPS, dest, src, false);
 }
 
-static inline void rvjit_sse2_movapsd(rvjit_block_t* block, regid_t dest, regid_t src, bool fpu_d)
+static inline void rvjit_sse2_ones(rvjit_block_t* block, regid_t reg)
 {
-    if (fpu_d) rvjit_put_code(block, "\x66", 1); // SSE2 movapsd prefix
-    rvjit_sse2_rex_prefix(block, dest, src);
-    rvjit_sse2_2reg_op_raw(block, SSE2_MOVAPSD, dest, src);
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_PCMPEQD, reg, reg, false);
 }
 
-static inline void rvjit_sse2_2reg_op(rvjit_block_t* block, uint8_t opcode, regid_t dest, regid_t src, bool fpu_d)
+// Sign bit mask in every lane
+static inline void rvjit_sse2_sign_mask(rvjit_block_t* block, regid_t reg, bool fpu_d)
 {
+    rvjit_sse2_ones(block, reg);
     if (fpu_d) {
-        rvjit_put_code(block, "\xF2", 1); // SSE2 Double-precision prefix
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSLL, reg, 63);
     } else {
-        rvjit_put_code(block, "\xF3", 1); // SSE2 Single-precision prefix
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTD, SSE2_PSLL, reg, 31);
     }
-    rvjit_sse2_rex_prefix(block, dest, src);
-    rvjit_sse2_2reg_op_raw(block, opcode, dest, src);
 }
 
-static inline void rvjit_sse2_3reg_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, hrs2, bool fpu_d)
+// Replace a NaN in X86_XMM_TMP1 with RISC-V canonical NaN (x86 default NaN is negative)
+static inline void rvjit_sse2_canonize_nan(rvjit_block_t* block, bool fpu_d)
 {
-    if (hrds == hrs1) {
-        rvjit_sse2_2reg_op(block, opcode, hrds, hrs2, fpu_d);
-    } else if (hrds == hrs2) {
-        // TODO: handle non-reversible operands
-        rvjit_sse2_2reg_op(block, opcode, hrds, hrs1, fpu_d);
+    size_t jmp;
+    rvjit_sse2_2reg_op(block, fpu_d ? SSE2_PREFIX_PD : 0, SSE2_UCOMIS, X86_XMM_TMP1, X86_XMM_TMP1, false);
+    rvjit_put_code(block, "\x7B\x00", 2); // jnp
+    jmp = block->size;
+    rvjit_sse2_ones(block, X86_XMM_TMP1);
+    if (fpu_d) {
+        // 0x7FF8000000000000
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSRL, X86_XMM_TMP1, 52);
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSLL, X86_XMM_TMP1, 51);
+    } else {
+        // 0x7FC00000
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTD, SSE2_PSLL, X86_XMM_TMP1, 23);
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTD, SSE2_PSRL, X86_XMM_TMP1, 1);
+    }
+    block->code[jmp - 1] = block->size - jmp;
+}
+
+// Move the result from X86_XMM_TMP1 into hrds, NaN-boxing singles
+static inline void rvjit_sse2_writeback(rvjit_block_t* block, regid_t hrds, bool fpu_d)
+{
+    if (fpu_d) {
+        rvjit_sse2_movaps(block, hrds, X86_XMM_TMP1);
+    } else {
+        rvjit_sse2_ones(block, hrds);
+        rvjit_sse2_2reg_op(block, SSE2_PREFIX_SS, SSE2_MOVS_LOAD, hrds, X86_XMM_TMP1, false);
+    }
+}
+
+static inline void rvjit_sse2_3reg_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool fpu_d)
+{
+    rvjit_sse2_movaps(block, X86_XMM_TMP1, hrs1);
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), opcode, X86_XMM_TMP1, hrs2, false);
+    rvjit_sse2_canonize_nan(block, fpu_d);
+    rvjit_sse2_writeback(block, hrds, fpu_d);
+}
+
+static inline void rvjit_sse2_2reg_fop(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, bool fpu_d)
+{
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), opcode, X86_XMM_TMP1, hrs1, false);
+    rvjit_sse2_canonize_nan(block, fpu_d);
+    rvjit_sse2_writeback(block, hrds, fpu_d);
+}
+
+// Not fused, rounds after multiplication just like the interpreter
+static inline void rvjit_sse2_fma(rvjit_block_t* block, uint8_t opcode, bool neg, regid_t hrds, regid_t hrs1, regid_t hrs2, regid_t hrs3, bool fpu_d)
+{
+    rvjit_sse2_movaps(block, X86_XMM_TMP1, hrs1);
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), SSE2_FMUL, X86_XMM_TMP1, hrs2, false);
+    if (neg) {
+        rvjit_sse2_sign_mask(block, X86_XMM_TMP2, fpu_d);
+        rvjit_sse2_2reg_op(block, 0, SSE2_XORPS, X86_XMM_TMP1, X86_XMM_TMP2, false);
+    }
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), opcode, X86_XMM_TMP1, hrs3, false);
+    rvjit_sse2_canonize_nan(block, fpu_d);
+    rvjit_sse2_writeback(block, hrds, fpu_d);
+}
+
+// Sign injection is a bitwise op, TMP2 holds the sign mask, TMP1 the sign source
+static inline void rvjit_sse2_fsgnj(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool fpu_d)
+{
+    rvjit_sse2_sign_mask(block, X86_XMM_TMP2, fpu_d);
+    rvjit_sse2_movaps(block, X86_XMM_TMP1, hrs2);
+    if (opcode == SSE2_ANDNPS) {
+        // fsgnjn: TMP1 = ~rs2 & mask
+        rvjit_sse2_2reg_op(block, 0, SSE2_ANDNPS, X86_XMM_TMP1, X86_XMM_TMP2, false);
     } else {
-        rvjit_sse2_movapsd(block, hrds, hrs1, fpu_d);
-        rvjit_sse2_2reg_op(block, opcode, hrds, hrs2, fpu_d);
+        rvjit_sse2_2reg_op(block, 0, SSE2_ANDPS, X86_XMM_TMP1, X86_XMM_TMP2, false);
     }
+    if (opcode == SSE2_XORPS) {
+        // fsgnjx: TMP1 = rs1 ^ (rs2 & mask)
+        rvjit_sse2_2reg_op(block, 0, SSE2_XORPS, X86_XMM_TMP1, hrs1, false);
+    } else {
+        // TMP1 |= rs1 & ~mask
+        rvjit_sse2_2reg_op(block, 0, SSE2_ANDNPS, X86_XMM_TMP2, hrs1, false);
+        rvjit_sse2_2reg_op(block, 0, SSE2_ORPS, X86_XMM_TMP1, X86_XMM_TMP2, false);
+    }
+    rvjit_sse2_writeback(block, hrds, fpu_d);
 }
 
-static inline void rvjit_native_fmv_s()
+// Compare into a mask, convert it into 0/1 in integer hrds
+static inline void rvjit_sse2_fcmp(rvjit_block_t* block, uint8_t pred, regid_t hrds, regid_t hrs1, regid_t hrs2, bool fpu_d)
+{
+    rvjit_sse2_movaps(block, X86_XMM_TMP1, hrs1);
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), SSE2_CMPS, X86_XMM_TMP1, hrs2, false);
+    rvjit_put_code(block, &pred, 1);
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_R_X, X86_XMM_TMP1, hrds, false);
+    rvjit_x86_neg(block, hrds, false);
+}
+
+static inline void rvjit_native_fld(rvjit_block_t* block, regid_t hrd, regid_t haddr, int32_t off)
+{
+    rvjit_sse2_mem_op(block, SSE2_PREFIX_SD, SSE2_MOVS_LOAD, hrd, haddr, off);
+}
+
+static inline void rvjit_native_fsd(rvjit_block_t* block, regid_t hrs, regid_t haddr, int32_t off)
+{
+    rvjit_sse2_mem_op(block, SSE2_PREFIX_SD, SSE2_MOVS_STORE, hrs, haddr, off);
+}
+
+static inline void rvjit_native_flw(rvjit_block_t* block, regid_t hrd, regid_t haddr, int32_t off)
+{
+    rvjit_sse2_mem_op(block, SSE2_PREFIX_SS, SSE2_MOVS_LOAD, X86_XMM_TMP1, haddr, off);
+    rvjit_sse2_writeback(block, hrd, false);
+}
+
+static inline void rvjit_native_fsw(rvjit_block_t* block, regid_t hrs, regid_t haddr, int32_t off)
+{
+    rvjit_sse2_mem_op(block, SSE2_PREFIX_SS, SSE2_MOVS_STORE, hrs, haddr, off);
+}
+
+static inline void rvjit_native_fmv(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_movaps(block, hrds, hrs1);
+}
+
+#define RVJIT_SSE2_3REG_OP(instr, opcode) \
+static inline void rvjit_native_##instr##_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_3reg_op(block, opcode, hrds, hrs1, hrs2, false); \
+} \
+\
+static inline void rvjit_native_##instr##_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_3reg_op(block, opcode, hrds, hrs1, hrs2, true); \
+}
+
+RVJIT_SSE2_3REG_OP(fadd, SSE2_FADD)
+RVJIT_SSE2_3REG_OP(fsub, SSE2_FSUB)
+RVJIT_SSE2_3REG_OP(fmul, SSE2_FMUL)
+RVJIT_SSE2_3REG_OP(fdiv, SSE2_FDIV)
+
+#define RVJIT_SSE2_FMA(instr, opcode, neg) \
+static inline void rvjit_native_##instr##_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, regid_t hrs3) \
+{ \
+    rvjit_sse2_fma(block, opcode, neg, hrds, hrs1, hrs2, hrs3, false); \
+} \
+\
+static inline void rvjit_native_##instr##_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, regid_t hrs3) \
+{ \
+    rvjit_sse2_fma(block, opcode, neg, hrds, hrs1, hrs2, hrs3, true); \
+}
+
+RVJIT_SSE2_FMA(fmadd,  SSE2_FADD, false)
+RVJIT_SSE2_FMA(fmsub,  SSE2_FSUB, false)
+RVJIT_SSE2_FMA(fnmsub, SSE2_FADD, true)
+RVJIT_SSE2_FMA(fnmadd, SSE2_FSUB, true)
+
+#define RVJIT_SSE2_FSGNJ(instr, opcode) \
+static inline void rvjit_native_##instr##_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_fsgnj(block, opcode, hrds, hrs1, hrs2, false); \
+} \
+\
+static inline void rvjit_native_##instr##_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_fsgnj(block, opcode, hrds, hrs1, hrs2, true); \
+}
+
+RVJIT_SSE2_FSGNJ(fsgnj,  SSE2_ANDPS)
+RVJIT_SSE2_FSGNJ(fsgnjn, SSE2_ANDNPS)
+RVJIT_SSE2_FSGNJ(fsgnjx, SSE2_XORPS)
+
+// feq is quiet, flt/fle are signaling, just as cmpeq/cmplt/cmple
+#define RVJIT_SSE2_FCMP(instr, pred) \
+static inline void rvjit_native_##instr##_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_fcmp(block, pred, hrds, hrs1, hrs2, false); \
+} \
+\
+static inline void rvjit_native_##instr##_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2) \
+{ \
+    rvjit_sse2_fcmp(block, pred, hrds, hrs1, hrs2, true); \
+}
+
+RVJIT_SSE2_FCMP(feq, SSE2_CMP_EQ)
+RVJIT_SSE2_FCMP(flt, SSE2_CMP_LT)
+RVJIT_SSE2_FCMP(fle, SSE2_CMP_LE)
+
+static inline void rvjit_native_fsqrt_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_fop(block, SSE2_FSQRT, hrds, hrs1, false);
+}
+
+static inline void rvjit_native_fsqrt_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_fop(block, SSE2_FSQRT, hrds, hrs1, true);
+}
+
+// cvtsd2ss
+static inline void rvjit_native_fcvt_s_d(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_SD, SSE2_CVTS2S, X86_XMM_TMP1, hrs1, false);
+    rvjit_sse2_canonize_nan(block, false);
+    rvjit_sse2_writeback(block, hrds, false);
+}
+
+// cvtss2sd
+static inline void rvjit_native_fcvt_d_s(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_SS, SSE2_CVTS2S, X86_XMM_TMP1, hrs1, false);
+    rvjit_sse2_canonize_nan(block, true);
+    rvjit_sse2_writeback(block, hrds, true);
+}
+
+// Signed integer (32 or 64 bit) to float conversion, never produces NaN
+static inline void rvjit_native_fcvt_f_i(rvjit_block_t* block, regid_t hrds, regid_t hrs1, bool fpu_d, bool bits_64)
+{
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), SSE2_CVTSI2S, X86_XMM_TMP1, hrs1, bits_64);
+    rvjit_sse2_writeback(block, hrds, fpu_d);
+}
+
+/*
+ * Float to signed integer (32 or 64 bit) conversion, either truncating or
+ * using current rounding mode. Invalid conversion yields INT_MIN (x86 integer
+ * indefinite value) instead of RISC-V saturation, caller should handle it.
+ */
+static inline void rvjit_native_fcvt_i_f(rvjit_block_t* block, regid_t hrds, regid_t hrs1, bool fpu_d, bool bits_64, bool rtz)
+{
+    rvjit_sse2_2reg_op(block, rvjit_sse2_prefix(fpu_d), rtz ? SSE2_CVTTS2SI : SSE2_CVTS2SI, hrds, hrs1, bits_64);
+}
+
+// movd/movq reg, xmm (32-bit variant zero-extends)
+static inline void rvjit_native_fmv_x_f(rvjit_block_t* block, regid_t hrds, regid_t hrs1, bool bits_64)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_R_X, hrs1, hrds, bits_64);
+}
+
+static inline void rvjit_native_fmv_w_x(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_X_R, X86_XMM_TMP1, hrs1, false);
+    rvjit_sse2_writeback(block, hrds, false);
+}
+
+static inline void rvjit_native_fmv_d_x(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_X_R, hrds, hrs1, true);
+}
+
+#endif
+
+#ifdef RVJIT_NATIVE_BITMANIP
+
+/*
+ * Bitmanip (Zba/Zbb/Zbc/Zbs) natives.
+ * Bit counting needs LZCNT/BMI1/POPCNT, carry-less multiply needs PCLMULQDQ,
+ * the emitter checks rvjit_native_has_bitcnt()/rvjit_native_has_clmul() first.
+ */
+
+#define X86_ROL       0xC0
+#define X86_ROR       0xC8
+
+#define X86_PREFIX_F3 0xF3
+#define X86_BSWAP     0xC8
+#define X86_MOVZXH    0xB7
+#define X86_MOVSXB    0xBE
+#define X86_MOVSXH    0xBF
+#define X86_POPCNT    0xB8
+#define X86_TZCNT     0xBC
+#define X86_LZCNT     0xBD
+#define X86_BT        0xA3
+#define X86_BTS       0xAB
+#define X86_BTR       0xB3
+#define X86_BTC       0xBB
+#define X86_BT_IMM    0xBA
+
+// Opcode extensions for X86_BT_IMM
+#define X86_BTS_EXT   5
+#define X86_BTR_EXT   6
+#define X86_BTC_EXT   7
+
+static inline bool rvjit_x86_has_bitcnt()
+{
+    static bool init = false, bitcnt = false;
+    if (!init) {
+        uint32_t regs[4];
+        bool lzcnt = false;
+        init = true;
+        // LZCNT lives in extended leaves, which have their own maximum
+        rvjit_x86_cpuid_internal(0x80000000, 0, regs);
+        if (regs[0] >= 0x80000001) {
+            rvjit_x86_cpuid_internal(0x80000001, 0, regs);
+            lzcnt = !!(regs[2] & 0x20);
+        }
+        rvjit_x86_cpuid(1, 0, regs);
+        bitcnt = lzcnt && !!(regs[2] & 0x800000);
+        rvjit_x86_cpuid(7, 0, regs);
+        bitcnt = bitcnt && !!(regs[1] & 0x8);
+        if (bitcnt) rvvm_info("RVJIT detected x86 LZCNT/BMI1/POPCNT extensions");
+    }
+    return bitcnt;
+}
+
+static inline bool rvjit_x86_has_pclmul()
+{
+    static bool init = false, pclmul = false;
+    if (!init) {
+        uint32_t regs[4];
+        init = true;
+        rvjit_x86_cpuid(1, 0, regs);
+        pclmul = !!(regs[2] & 0x2);
+        if (pclmul) rvvm_info("RVJIT detected x86 PCLMULQDQ extension");
+    }
+    return pclmul;
+}
+
+static inline bool rvjit_native_has_bitcnt()
+{
+    return rvjit_x86_has_bitcnt();
+}
+
+static inline bool rvjit_native_has_clmul()
+{
+#ifdef RVJIT_NATIVE_FPU
+    return rvjit_x86_has_pclmul();
+#else
+    return false;
+#endif
+}
+
+// [prefix] [rex] 0F opcode, reg is encoded in ModRM.reg, rm in ModRM.rm
+static inline void rvjit_x86_0f_2reg_op(rvjit_block_t* block, uint8_t prefix, uint8_t rex, uint8_t opcode, regid_t reg, regid_t rm)
+{
+    uint8_t code[5];
+    size_t size = 0;
+    if (prefix) code[size++] = prefix;
+    if (reg >= X64_R8) rex |= X64_REX_R;
+    if (rm >= X64_R8) rex |= X64_REX_B;
+    if (rex) code[size++] = rex;
+    code[size++] = 0x0F;
+    code[size++] = opcode;
+    code[size++] = X86_2_REGS | ((reg & 0x7) << 3) | (rm & 0x7);
+    rvjit_put_code(block, code, size);
+}
+
+// Bitwise NOT of a register
+static inline void rvjit_x86_not(rvjit_block_t* block, regid_t reg, bool bits_64)
+{
+    uint8_t code[3];
+    code[0] = bits_64 ? X64_REX_W : 0;
+    code[1] = 0xF7;
+    if (reg >= X64_R8) {
+        code[0] |= X64_REX_B;
+        code[2] = 0xD0 + reg - X64_R8;
+    } else {
+        code[2] = 0xD0 + reg;
+    }
+    rvjit_put_code(block, code + (code[0] ? 0 : 1), 2 + (code[0] ? 1 : 0));
+}
+
+// Byte-swap a register
+static inline void rvjit_x86_bswap(rvjit_block_t* block, regid_t reg, bool bits_64)
+{
+    uint8_t code[3];
+    code[0] = bits_64 ? X64_REX_W : 0;
+    code[1] = 0x0F;
+    if (reg >= X64_R8) {
+        code[0] |= X64_REX_B;
+        code[2] = X86_BSWAP + reg - X64_R8;
+    } else {
+        code[2] = X86_BSWAP + reg;
+    }
+    rvjit_put_code(block, code + (code[0] ? 0 : 1), 2 + (code[0] ? 1 : 0));
+}
+
+// movzx/movsx from 8/16 bit src, sil/dil need an empty REX prefix for byte access
+static inline void rvjit_x86_movx(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, bool bits_64)
+{
+    uint8_t rex = bits_64 ? X64_REX_W : 0;
+    if (opcode == X86_MOVSXB && hrs1 > X86_EBX) rex |= 0x40;
+    rvjit_x86_0f_2reg_op(block, 0, rex, opcode, hrds, hrs1);
+}
+
+// Orthogonal 3-operand rorx from BMI2 extension
+static inline void rvjit_x86_rorx(rvjit_block_t* block, regid_t hrds, regid_t hrs1, uint8_t imm, bool bits_64)
+{
+    uint8_t code[6] = {0xC4, 0x43, 0x7B, 0xF0, 0xC0, 0x00};
+    if (bits_64) code[2] |= X86_VEX_W;
+    if (hrds < X64_R8) code[1] |= X86_VEX_RI;
+    if (hrs1 < X64_R8) code[1] |= X86_VEX_BI;
+    code[4] |= (hrs1 & 0x7) | ((hrds & 0x7) << 3);
+    code[5] = imm;
+    rvjit_put_code(block, code, 6);
+}
+
+static inline void rvjit_x86_rori(rvjit_block_t* block, regid_t hrds, regid_t hrs1, uint8_t imm, bool bits_64)
+{
+    if (hrds != hrs1 && imm && rvjit_x86_has_bmi2()) {
+        rvjit_x86_rorx(block, hrds, hrs1, imm, bits_64);
+    } else {
+        rvjit_x86_2reg_imm_shift_op(block, X86_ROR, hrds, hrs1, imm, bits_64);
+    }
+}
+
+// andn/orn/xnor, the second operand is inverted
+static inline void rvjit_x86_3reg_inv_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    if (opcode == X86_XOR) {
+        // xnor is commutative, ~(a ^ b)
+        rvjit_x86_3reg_op(block, X86_XOR, hrds, hrs1, hrs2, bits_64);
+        rvjit_x86_not(block, hrds, bits_64);
+    } else if (hrds == hrs1) {
+        if (opcode == X86_AND) {
+            // a & ~b -> (a | b) ^ b
+            rvjit_x86_2reg_op(block, X86_OR, hrds, hrs2, bits_64);
+            rvjit_x86_2reg_op(block, X86_XOR, hrds, hrs2, bits_64);
+        } else {
+            // a | ~b -> ~(~a & b)
+            rvjit_x86_not(block, hrds, bits_64);
+            rvjit_x86_2reg_op(block, X86_AND, hrds, hrs2, bits_64);
+            rvjit_x86_not(block, hrds, bits_64);
+        }
+    } else {
+        if (hrds != hrs2) rvjit_x86_mov(block, hrds, hrs2, bits_64);
+        rvjit_x86_not(block, hrds, bits_64);
+        rvjit_x86_2reg_op(block, opcode, hrds, hrs1, bits_64);
+    }
+}
+
+// min/max: rs2_cc selects rs2 when rs1 loses, rs1_cc selects rs1 when rs1 wins
+static inline void rvjit_x86_minmax(rvjit_block_t* block, uint8_t rs2_cc, uint8_t rs1_cc, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    rvjit_x86_2reg_op(block, X86_CMP, hrs1, hrs2, bits_64);
+    if (hrds == hrs2) {
+        rvjit_x86_cmov(block, rs1_cc, hrds, hrs1, bits_64);
+    } else {
+        if (hrds != hrs1) rvjit_x86_mov(block, hrds, hrs1, bits_64);
+        rvjit_x86_cmov(block, rs2_cc, hrds, hrs2, bits_64);
+    }
+}
+
+// sh1add/sh2add/sh3add: (rs1 << scale) + rs2
+static inline void rvjit_x86_shadd(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, uint8_t scale, bool bits_64)
+{
+    rvjit_x86_lea_add_scaled(block, hrds, hrs2, hrs1, scale, bits_64);
+}
+
+// bts/btr/btc by register, bit index is taken modulo operand size
+static inline void rvjit_x86_3reg_bit_op(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    uint8_t rex = bits_64 ? X64_REX_W : 0;
+    if (hrds == hrs2 && hrds != hrs1) {
+        // Bit index is overwritten by the source, go through a scratch register
+        regid_t htmp = rvjit_x86_scratch_reg(hrds, hrs1, hrs2, hrs2);
+        rvjit_native_push(block, htmp);
+        rvjit_x86_mov(block, htmp, hrs1, bits_64);
+        rvjit_x86_0f_2reg_op(block, 0, rex, opcode, hrs2, htmp);
+        rvjit_x86_mov(block, hrds, htmp, bits_64);
+        rvjit_native_pop(block, htmp);
+    } else {
+        if (hrds != hrs1) rvjit_x86_mov(block, hrds, hrs1, bits_64);
+        rvjit_x86_0f_2reg_op(block, 0, rex, opcode, hrs2, hrds);
+    }
+}
+
+static inline void rvjit_x86_2reg_imm_bit_op(rvjit_block_t* block, uint8_t ext, regid_t hrds, regid_t hrs1, uint8_t imm, bool bits_64)
+{
+    if (hrds != hrs1) rvjit_x86_mov(block, hrds, hrs1, bits_64);
+    rvjit_x86_0f_2reg_op(block, 0, bits_64 ? X64_REX_W : 0, X86_BT_IMM, ext, hrds);
+    rvjit_put_code(block, &imm, 1);
+}
+
+// bext: bt + setc, same structure as slt
+static inline void rvjit_x86_bext(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    if (hrds != hrs1 && hrds != hrs2) rvjit_native_zero_reg(block, hrds);
+    rvjit_x86_0f_2reg_op(block, 0, bits_64 ? X64_REX_W : 0, X86_BT, hrs2, hrs1);
+    rvjit_x86_setcc(block, X86_SETB, hrds);
+    if (hrds == hrs1 || hrds == hrs2) rvjit_x86_2reg_imm_op(block, X86_AND_IMM, hrds, hrds, 0xFF, false);
+}
+
+static inline void rvjit_x86_bexti(rvjit_block_t* block, regid_t hrds, regid_t hrs1, uint8_t imm, bool bits_64)
+{
+    rvjit_x86_2reg_imm_shift_op(block, X86_SRL, hrds, hrs1, imm, bits_64);
+    rvjit_x86_r_imm_op(block, X86_AND_IMM, hrds, 1, false);
+}
+
+static inline void rvjit_x86_bitcnt(rvjit_block_t* block, uint8_t opcode, regid_t hrds, regid_t hrs1, bool bits_64)
+{
+    rvjit_x86_0f_2reg_op(block, X86_PREFIX_F3, bits_64 ? X64_REX_W : 0, opcode, hrds, hrs1);
+}
+
+static inline void rvjit_x86_rev8(rvjit_block_t* block, regid_t hrds, regid_t hrs1, bool bits_64)
+{
+    if (hrds != hrs1) rvjit_x86_mov(block, hrds, hrs1, bits_64);
+    rvjit_x86_bswap(block, hrds, bits_64);
+}
+
+#ifdef RVJIT_NATIVE_FPU
+
+#define SSE2_PSHIFTDQ   0x73
+#define SSE2_PSRLDQ     3
+#define SSE2_POR        0xEB
+
+/*
+ * Carry-less multiply borrows the scratch xmm registers of the FPU natives.
+ * Product of the operands is left in X86_XMM_TMP1, high half in the upper lane.
+ */
+static inline void rvjit_x86_pclmul(rvjit_block_t* block, regid_t hrs1, regid_t hrs2, bool bits_64)
+{
+    uint8_t code[3] = {0x44, 0x00, 0x00};
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_X_R, X86_XMM_TMP1, hrs1, bits_64);
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_X_R, X86_XMM_TMP2, hrs2, bits_64);
+    // pclmulqdq xmm_tmp1, xmm_tmp2, 0
+    rvjit_sse2_opcode(block, SSE2_PREFIX_PD, 0x3A, X86_XMM_TMP1, X86_XMM_TMP2, false);
+    code[1] = X86_2_REGS | ((X86_XMM_TMP1 & 0x7) << 3) | (X86_XMM_TMP2 & 0x7);
+    rvjit_put_code(block, code, 3);
+}
+
+// clmul: low half, clmulh: high half, clmulr: bits [2 * XLEN - 2 : XLEN - 1]
+static inline void rvjit_x86_clmul(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, uint8_t shift, bool bits_64)
+{
+    rvjit_x86_pclmul(block, hrs1, hrs2, bits_64);
+    if (!bits_64) {
+        // 64-bit product fits into the lower lane
+        if (shift) rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSRL, X86_XMM_TMP1, shift);
+    } else if (shift == 64) {
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTDQ, SSE2_PSRLDQ, X86_XMM_TMP1, 8);
+    } else if (shift) {
+        // Combine (lo >> 63) | (hi << 1)
+        rvjit_sse2_movaps(block, X86_XMM_TMP2, X86_XMM_TMP1);
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSRL, X86_XMM_TMP1, 63);
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTQ, SSE2_PSLL, X86_XMM_TMP2, 1);
+        rvjit_sse2_shift_op(block, SSE2_PSHIFTDQ, SSE2_PSRLDQ, X86_XMM_TMP2, 8);
+        rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_POR, X86_XMM_TMP1, X86_XMM_TMP2, false);
+    }
+    rvjit_sse2_2reg_op(block, SSE2_PREFIX_PD, SSE2_MOVD_R_X, X86_XMM_TMP1, hrds, bits_64);
+}
+
+#else
+
+static inline void rvjit_x86_clmul(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, uint8_t shift, bool bits_64)
+{
+    // Never emitted, see rvjit_native_has_clmul()
+    UNUSED(block);
+    UNUSED(hrds);
+    UNUSED(hrs1);
+    UNUSED(hrs2);
+    UNUSED(shift);
+    UNUSED(bits_64);
+}
+
+#endif
+
+/*
+ * RV32
+ */
+static inline void rvjit32_native_andn(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_AND, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_orn(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_OR, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_xnor(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_XOR, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_min(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVG, X86_CMOVL, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_minu(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVA, X86_CMOVB, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_max(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVL, X86_CMOVG, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_maxu(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVB, X86_CMOVA, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_clmul(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 0, false);
+}
+
+static inline void rvjit32_native_clmulh(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 32, false);
+}
+
+static inline void rvjit32_native_clmulr(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 31, false);
+}
+
+static inline void rvjit32_native_rol(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROL, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_ror(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROR, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_sh1add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 1, false);
+}
+
+static inline void rvjit32_native_sh2add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 2, false);
+}
+
+static inline void rvjit32_native_sh3add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 3, false);
+}
+
+static inline void rvjit32_native_bset(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTS, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_bclr(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTR, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_binv(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTC, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_bext(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_bext(block, hrds, hrs1, hrs2, false);
+}
+
+static inline void rvjit32_native_clz(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_LZCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_ctz(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_TZCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_cpop(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_POPCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_sext_b(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVSXB, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_sext_h(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVSXH, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_zext_h(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVZXH, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_rev8(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_rev8(block, hrds, hrs1, false);
+}
+
+static inline void rvjit32_native_rori(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_rori(block, hrds, hrs1, imm, false);
+}
+
+static inline void rvjit32_native_bseti(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTS_EXT, hrds, hrs1, imm, false);
+}
+
+static inline void rvjit32_native_bclri(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTR_EXT, hrds, hrs1, imm, false);
+}
+
+static inline void rvjit32_native_binvi(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTC_EXT, hrds, hrs1, imm, false);
+}
+
+static inline void rvjit32_native_bexti(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_bexti(block, hrds, hrs1, imm, false);
+}
+
+/*
+ * RV64
+ */
+#ifdef RVJIT_NATIVE_64BIT
+static inline void rvjit64_native_andn(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_AND, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_orn(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_OR, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_xnor(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_inv_op(block, X86_XOR, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_min(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVG, X86_CMOVL, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_minu(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVA, X86_CMOVB, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_max(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVL, X86_CMOVG, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_maxu(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_minmax(block, X86_CMOVB, X86_CMOVA, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_clmul(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 0, true);
+}
+
+static inline void rvjit64_native_clmulh(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 64, true);
+}
+
+static inline void rvjit64_native_clmulr(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_clmul(block, hrds, hrs1, hrs2, 63, true);
+}
+
+static inline void rvjit64_native_rol(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROL, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_ror(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROR, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_rolw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROL, hrds, hrs1, hrs2, false);
+    rvjit_x86_movsxd(block, hrds, hrds);
+}
+
+static inline void rvjit64_native_rorw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_shift_cl_op(block, X86_ROR, hrds, hrs1, hrs2, false);
+    rvjit_x86_movsxd(block, hrds, hrds);
+}
+
+static inline void rvjit64_native_sh1add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 1, true);
+}
+
+static inline void rvjit64_native_sh2add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 2, true);
+}
+
+static inline void rvjit64_native_sh3add(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd(block, hrds, hrs1, hrs2, 3, true);
+}
+
+// add.uw/shNadd.uw: (zext32(rs1) << scale) + rs2
+static inline void rvjit_x86_shadd_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2, uint8_t scale)
+{
+    if (hrds == hrs2) {
+        // Zero-extension would clobber rs2, go through a scratch register
+        regid_t htmp = rvjit_x86_scratch_reg(hrds, hrs1, hrs2, hrs2);
+        rvjit_native_push(block, htmp);
+        rvjit_x86_mov(block, htmp, hrs1, false);
+        rvjit_x86_lea_add_scaled(block, hrds, hrs2, htmp, scale, true);
+        rvjit_native_pop(block, htmp);
+    } else {
+        // 32-bit mov zero-extends
+        rvjit_x86_mov(block, hrds, hrs1, false);
+        rvjit_x86_lea_add_scaled(block, hrds, hrs2, hrds, scale, true);
+    }
+}
+
+static inline void rvjit64_native_add_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd_uw(block, hrds, hrs1, hrs2, 0);
+}
+
+static inline void rvjit64_native_sh1add_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd_uw(block, hrds, hrs1, hrs2, 1);
+}
+
+static inline void rvjit64_native_sh2add_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd_uw(block, hrds, hrs1, hrs2, 2);
+}
+
+static inline void rvjit64_native_sh3add_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_shadd_uw(block, hrds, hrs1, hrs2, 3);
+}
+
+static inline void rvjit64_native_bset(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTS, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_bclr(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTR, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_binv(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_3reg_bit_op(block, X86_BTC, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_bext(rvjit_block_t* block, regid_t hrds, regid_t hrs1, regid_t hrs2)
+{
+    rvjit_x86_bext(block, hrds, hrs1, hrs2, true);
+}
+
+static inline void rvjit64_native_clz(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_LZCNT, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_ctz(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_TZCNT, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_cpop(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_POPCNT, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_clzw(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_LZCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit64_native_ctzw(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_TZCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit64_native_cpopw(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_bitcnt(block, X86_POPCNT, hrds, hrs1, false);
+}
+
+static inline void rvjit64_native_sext_b(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVSXB, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_sext_h(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVSXH, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_zext_h(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_movx(block, X86_MOVZXH, hrds, hrs1, false);
+}
+
+static inline void rvjit64_native_rev8(rvjit_block_t* block, regid_t hrds, regid_t hrs1)
+{
+    rvjit_x86_rev8(block, hrds, hrs1, true);
+}
+
+static inline void rvjit64_native_rori(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_rori(block, hrds, hrs1, imm, true);
+}
+
+static inline void rvjit64_native_roriw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    if (imm) {
+        rvjit_x86_rori(block, hrds, hrs1, imm, false);
+        rvjit_x86_movsxd(block, hrds, hrds);
+    } else {
+        rvjit_x86_movsxd(block, hrds, hrs1);
+    }
+}
+
+static inline void rvjit64_native_slli_uw(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_mov(block, hrds, hrs1, false);
+    if (imm) rvjit_x86_shift_op(block, X86_SLL, hrds, imm, true);
+}
+
+static inline void rvjit64_native_bseti(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTS_EXT, hrds, hrs1, imm, true);
+}
+
+static inline void rvjit64_native_bclri(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTR_EXT, hrds, hrs1, imm, true);
+}
+
+static inline void rvjit64_native_binvi(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_2reg_imm_bit_op(block, X86_BTC_EXT, hrds, hrs1, imm, true);
+}
+
+static inline void rvjit64_native_bexti(rvjit_block_t* block, regid_t hrds, regid_t hrs1, int32_t imm)
+{
+    rvjit_x86_bexti(block, hrds, hrs1, imm, true);
+}
+#endif
 
 #endif
 
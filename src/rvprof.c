@@ -0,0 +1,266 @@
+/*
+rvprof.c - Guest PC sampling profiler
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "rvprof.h"
+#include "riscv_hart.h"
+#include "riscv_mmu.h"
+#include "elf_load.h"
+#include "atomics.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t pc;
+    uint64_t satp;
+    uint8_t priv;
+} rvprof_sample_t;
+
+/*
+ * Single producer (hart), single consumer (profiler thread) ring,
+ * the hart drops samples instead of waiting when it's full
+ */
+typedef struct {
+    rvprof_sample_t samples[RVPROF_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+} rvprof_ring_t;
+
+// Aggregated sample, unused while count is zero
+typedef struct {
+    rvprof_sample_t key;
+    uint64_t count;
+} rvprof_entry_t;
+
+typedef struct {
+    char* stack;
+    uint64_t count;
+} rvprof_line_t;
+
+struct rvprof {
+    rvvm_machine_t* machine;
+    char* path;
+    elf_symtab_t symtab;
+    thread_handle_t thread;
+    uint32_t running;
+    rvprof_ring_t* rings;
+    size_t ring_count;
+    rvprof_entry_t* entries;
+    size_t entries_size;
+    size_t entries_used;
+    uint64_t samples;
+};
+
+static const char* rvprof_priv_names[PRIVILEGES_MAX] = {
+    "user", "supervisor", "hypervisor", "machine",
+};
+
+static size_t rvprof_hash(const rvprof_sample_t* sample)
+{
+    uint64_t hash = (sample->pc ^ (sample->satp * 0x9E3779B97F4A7C15ULL) ^ sample->priv);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return hash ^ (hash >> 32);
+}
+
+static void rvprof_insert(rvprof_t* prof, const rvprof_sample_t* sample, uint64_t count)
+{
+    if (prof->entries_used * 2 >= prof->entries_size) {
+        // Rehash into a twice larger table
+        rvprof_entry_t* old = prof->entries;
+        size_t old_size = prof->entries_size;
+        prof->entries_size = old_size ? old_size * 2 : 1024;
+        prof->entries = safe_calloc(prof->entries_size, sizeof(rvprof_entry_t));
+        prof->entries_used = 0;
+        for (size_t i=0; i<old_size; ++i) {
+            if (old[i].count) rvprof_insert(prof, &old[i].key, old[i].count);
+        }
+        free(old);
+    }
+
+    size_t mask = prof->entries_size - 1;
+    for (size_t i = rvprof_hash(sample) & mask;; i = (i + 1) & mask) {
+        rvprof_entry_t* entry = &prof->entries[i];
+        if (entry->count == 0) {
+            entry->key = *sample;
+            entry->count = count;
+            prof->entries_used++;
+            return;
+        }
+        if (entry->key.pc == sample->pc && entry->key.satp == sample->satp
+         && entry->key.priv == sample->priv) {
+            entry->count += count;
+            return;
+        }
+    }
+}
+
+static void rvprof_drain(rvprof_t* prof)
+{
+    for (size_t i=0; i<prof->ring_count; ++i) {
+        rvprof_ring_t* ring = &prof->rings[i];
+        uint32_t head = atomic_load_uint32(&ring->head);
+        uint32_t tail = ring->tail;
+        while (tail != head) {
+            rvprof_insert(prof, &ring->samples[tail % RVPROF_RING_SIZE], 1);
+            prof->samples++;
+            tail++;
+        }
+        atomic_store_uint32(&ring->tail, tail);
+    }
+}
+
+void rvprof_sample(rvvm_hart_t* vm)
+{
+    rvprof_t* prof = vm->machine->profiler;
+    if (prof == NULL || vm->csr.hartid >= prof->ring_count) return;
+    rvprof_ring_t* ring = &prof->rings[vm->csr.hartid];
+    uint32_t head = ring->head;
+    if (head - atomic_load_uint32(&ring->tail) >= RVPROF_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    rvprof_sample_t* sample = &ring->samples[head % RVPROF_RING_SIZE];
+    sample->pc = vm->registers[REGISTER_PC];
+    sample->satp = vm->mmu_mode ? ((((uint64_t)vm->mmu_mode) << 60) | (vm->root_page_table >> PAGE_SHIFT)) : 0;
+    sample->priv = vm->priv_mode;
+    atomic_store_uint32(&ring->head, head + 1);
+}
+
+static void* rvprof_thread(void* arg)
+{
+    rvprof_t* prof = arg;
+    rvvm_machine_t* machine = prof->machine;
+    while (atomic_load_uint32(&prof->running)) {
+        sleep_ms(RVPROF_PERIOD_MS);
+        if (!atomic_load_uint32(&prof->running)) break;
+        if (atomic_load_uint32(&machine->running)) {
+            // Harts take the sample at the next dispatch exit
+            vector_foreach(machine->harts, i) {
+                riscv_hart_queue_event(&vector_at(machine->harts, i), EXT_EVENT_PROFILE);
+            }
+        }
+        rvprof_drain(prof);
+    }
+    return arg;
+}
+
+static int rvprof_line_cmp(const void* a, const void* b)
+{
+    return strcmp(((const rvprof_line_t*)a)->stack, ((const rvprof_line_t*)b)->stack);
+}
+
+static void rvprof_write(rvprof_t* prof)
+{
+    rvprof_line_t* lines = safe_calloc(prof->entries_used + 1, sizeof(rvprof_line_t));
+    size_t count = 0, merged = 0;
+    uint32_t dropped = 0;
+    char buffer[512];
+
+    // Fold each sampled location into "privilege;[address space;]symbol"
+    for (size_t i=0; i<prof->entries_size; ++i) {
+        const rvprof_entry_t* entry = &prof->entries[i];
+        if (entry->count == 0) continue;
+        const elf_symbol_t* sym = elf_symtab_lookup(&prof->symtab, entry->key.pc);
+        const char* priv = entry->key.priv < PRIVILEGES_MAX ? rvprof_priv_names[entry->key.priv] : "unknown";
+        int len = snprintf(buffer, sizeof(buffer), "%s;", priv);
+        if (entry->key.priv == PRIVILEGE_USER && entry->key.satp) {
+            len += snprintf(buffer + len, sizeof(buffer) - len, "satp_%"PRIx64";", entry->key.satp);
+        }
+        if (sym) {
+            snprintf(buffer + len, sizeof(buffer) - len, "%s", sym->name);
+        } else {
+            snprintf(buffer + len, sizeof(buffer) - len, "0x%"PRIx64, entry->key.pc);
+        }
+        lines[count].stack = safe_malloc(strlen(buffer) + 1);
+        strcpy(lines[count].stack, buffer);
+        lines[count].count = entry->count;
+        count++;
+    }
+
+    // Merge locations resolving to the same symbol
+    qsort(lines, count, sizeof(rvprof_line_t), rvprof_line_cmp);
+    for (size_t i=0; i<count; ++i) {
+        if (merged && strcmp(lines[merged - 1].stack, lines[i].stack) == 0) {
+            lines[merged - 1].count += lines[i].count;
+            free(lines[i].stack);
+        } else {
+            lines[merged++] = lines[i];
+        }
+    }
+
+    FILE* file = fopen(prof->path, "wb");
+    if (file == NULL) {
+        rvvm_error("Cannot open profile output %s", prof->path);
+    }
+    for (size_t i=0; i<merged; ++i) {
+        if (file) fprintf(file, "%s %"PRIu64"\n", lines[i].stack, lines[i].count);
+        free(lines[i].stack);
+    }
+    free(lines);
+    if (file) fclose(file);
+
+    for (size_t i=0; i<prof->ring_count; ++i) {
+        dropped += prof->rings[i].dropped;
+    }
+    rvvm_info("Profile written to %s: %"PRIu64" samples, %u dropped", prof->path, prof->samples, dropped);
+}
+
+rvprof_t* rvprof_create(rvvm_machine_t* machine, const char* path, const char* symbols)
+{
+    rvprof_t* prof = safe_calloc(sizeof(rvprof_t), 1);
+    if (symbols && !elf_load_symbols(&prof->symtab, symbols)) {
+        free(prof);
+        return NULL;
+    }
+    prof->machine = machine;
+    prof->path = safe_malloc(strlen(path) + 1);
+    strcpy(prof->path, path);
+    prof->ring_count = vector_size(machine->harts);
+    prof->rings = safe_calloc(prof->ring_count, sizeof(rvprof_ring_t));
+    return prof;
+}
+
+void rvprof_free(rvprof_t* prof)
+{
+    rvprof_stop(prof);
+    elf_symtab_free(&prof->symtab);
+    free(prof->entries);
+    free(prof->rings);
+    free(prof->path);
+    free(prof);
+}
+
+void rvprof_start(rvprof_t* prof)
+{
+    if (prof->thread) return;
+    atomic_store_uint32(&prof->running, true);
+    prof->thread = thread_create(rvprof_thread, prof);
+}
+
+void rvprof_stop(rvprof_t* prof)
+{
+    if (prof->thread == NULL) return;
+    atomic_store_uint32(&prof->running, false);
+    thread_signal_membarrier(prof->thread);
+    thread_join(prof->thread);
+    prof->thread = NULL;
+    // Samples still in flight are picked up on the next stop
+    rvprof_drain(prof);
+    rvprof_write(prof);
+}
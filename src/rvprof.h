@@ -0,0 +1,47 @@
+/*
+rvprof.h - Guest PC sampling profiler
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RVPROF_H
+#define RVPROF_H
+
+#include "rvvm.h"
+
+// Sampling period of the profiler thread
+#define RVPROF_PERIOD_MS 1
+// Per-hart sample ring, drained by the profiler thread each period
+#define RVPROF_RING_SIZE 256
+
+typedef struct rvprof rvprof_t;
+
+/*
+ * Samples PC, privilege mode and satp of each hart periodically,
+ * writes them to path in folded stack format (flamegraph.pl, speedscope).
+ * Symbols are loaded from ELF or System.map, may be NULL.
+ */
+rvprof_t* rvprof_create(rvvm_machine_t* machine, const char* path, const char* symbols);
+void rvprof_free(rvprof_t* prof);
+
+// Profiler thread lifetime follows the machine
+void rvprof_start(rvprof_t* prof);
+// Stops sampling and writes the accumulated profile
+void rvprof_stop(rvprof_t* prof);
+
+// Called by the hart upon EXT_EVENT_PROFILE
+void rvprof_sample(rvvm_hart_t* vm);
+
+#endif
@@ -19,18 +19,59 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "rvvm.h"
 #include "riscv_hart.h"
 #include "riscv_mmu.h"
+#include "riscv_csr.h"
+#include "riscv_cpu.h"
+#include "rvprof.h"
 #include "vector.h"
 #include "utils.h"
 #include "mem_ops.h"
 #include "threading.h"
 #include "spinlock.h"
 
+/*
+ * Full V (Zve64d) needs widening/narrowing FP ops and vfrec7/vfrsqrt7,
+ * which are missing, so only the embedded integer subset is advertised
+ */
+#ifdef USE_VECTOR
+#define RISCV_ISA_ZVE "_zve64x_zvl128b"
+#else
+#define RISCV_ISA_ZVE ""
+#endif
+
+// Bitmanip & scalar crypto (Zkn, Zks) are always available
+#define RISCV_ISA_Z "_zba_zbb_zbc_zbkb_zbkc_zbkx_zbs_zknd_zkne_zknh_zksed_zksh"
+
+// NAPOT translation contiguity (64K pages), only for RV64 page tables
+#define RISCV_ISA_S64 "_svnapot"
+
 static spinlock_t global_lock;
 static vector_t(rvvm_machine_t*) global_machines = {0};
 
 static thread_handle_t builtin_eventloop_thread;
 static bool builtin_eventloop_enabled;
 
+/*
+ * Harts may notify each other until they stop, so every hart is
+ * asked to pause before any of the threads is joined.
+ */
+static void rvvm_pause_harts(rvvm_machine_t* machine)
+{
+    vector_foreach(machine->harts, i) {
+        riscv_hart_queue_pause(&vector_at(machine->harts, i));
+    }
+#ifdef USE_JIT
+    // Wait for reclaim requests racing with the pause
+    spin_lock(&machine->jit_reclaim_lock);
+    spin_unlock(&machine->jit_reclaim_lock);
+#endif
+    vector_foreach(machine->harts, i) {
+        thread_join(vector_at(machine->harts, i).thread);
+    }
+#ifdef USE_JIT
+    riscv_jit_reclaim_paused(machine);
+#endif
+}
+
 static void* builtin_eventloop(void* arg)
 {
     rvvm_machine_t* machine;
@@ -45,9 +86,8 @@ static void* builtin_eventloop(void* arg)
             machine = vector_at(global_machines, m);
             if (!atomic_load_uint32(&machine->running)) {
                 // The machine was shut down
-                vector_foreach(machine->harts, i) {
-                    riscv_hart_pause(&vector_at(machine->harts, i));
-                }
+                if (machine->profiler) rvprof_stop(machine->profiler);
+                rvvm_pause_harts(machine);
                 vector_erase(global_machines, m);
                 
                 if (vector_size(global_machines) == 0) {
@@ -148,17 +188,17 @@ static void rvvm_init_fdt(rvvm_machine_t* machine)
 #ifdef USE_RV64
         if (vector_at(machine->harts, i).rv64) {
 #ifdef USE_FPU
-            fdt_node_add_prop_str(cpu, "riscv,isa", "rv64imafdcsu");
+            fdt_node_add_prop_str(cpu, "riscv,isa", "rv64imafdcsu" RISCV_ISA_Z RISCV_ISA_ZVE RISCV_ISA_S64);
 #else
-            fdt_node_add_prop_str(cpu, "riscv,isa", "rv64imacsu");
+            fdt_node_add_prop_str(cpu, "riscv,isa", "rv64imacsu" RISCV_ISA_Z RISCV_ISA_ZVE RISCV_ISA_S64);
 #endif
             fdt_node_add_prop_str(cpu, "mmu-type", "riscv,sv39");
         } else {
 #endif
 #ifdef USE_FPU
-            fdt_node_add_prop_str(cpu, "riscv,isa", "rv32imafdcsu");
+            fdt_node_add_prop_str(cpu, "riscv,isa", "rv32imafdcsu" RISCV_ISA_Z RISCV_ISA_ZVE);
 #else
-            fdt_node_add_prop_str(cpu, "riscv,isa", "rv32imacsu");
+            fdt_node_add_prop_str(cpu, "riscv,isa", "rv32imacsu" RISCV_ISA_Z RISCV_ISA_ZVE);
 #endif
             fdt_node_add_prop_str(cpu, "mmu-type", "riscv,sv32");
 #ifdef USE_RV64
@@ -184,6 +224,30 @@ static void rvvm_init_fdt(rvvm_machine_t* machine)
     fdt_node_add_child(cpu_map, cluster);
     fdt_node_add_child(cpus, cpu_map);
     
+    // Describe mhpmevent selectors for the SBI PMU extension
+    uint32_t hpm_counters = 0xFFFFFFF8;
+    uint32_t hpm_event_counters[] = {
+        HPM_SEL_DTLB_LOAD_MISS,  HPM_SEL_DTLB_LOAD_MISS,  hpm_counters,
+        HPM_SEL_DTLB_STORE_MISS, HPM_SEL_DTLB_STORE_MISS, hpm_counters,
+        HPM_SEL_ITLB_MISS,       HPM_SEL_ITLB_MISS,       hpm_counters,
+    };
+    uint32_t hpm_event_selectors[] = {
+        HPM_SEL_DTLB_LOAD_MISS,  0, HPM_SEL_DTLB_LOAD_MISS,
+        HPM_SEL_DTLB_STORE_MISS, 0, HPM_SEL_DTLB_STORE_MISS,
+        HPM_SEL_ITLB_MISS,       0, HPM_SEL_ITLB_MISS,
+    };
+    uint32_t hpm_raw_counters[] = {
+        0, HPM_SEL_MMIO,     0xFFFFFFFF, 0xFFFFFFFF, hpm_counters,
+        0, HPM_SEL_TRAP,     0xFFFFFFFF, 0xFFFFFFFF, hpm_counters,
+        0, HPM_SEL_JIT_EXIT, 0xFFFFFFFF, 0xFFFFFFFF, hpm_counters,
+    };
+    struct fdt_node* pmu = fdt_node_create("pmu");
+    fdt_node_add_prop_str(pmu, "compatible", "riscv,pmu");
+    fdt_node_add_prop_cells(pmu, "riscv,event-to-mhpmcounters", hpm_event_counters, 9);
+    fdt_node_add_prop_cells(pmu, "riscv,event-to-mhpmevent", hpm_event_selectors, 9);
+    fdt_node_add_prop_cells(pmu, "riscv,raw-event-to-mhpmcounters", hpm_raw_counters, 15);
+    fdt_node_add_child(machine->fdt, pmu);
+    
     struct fdt_node* soc = fdt_node_create("soc");
     fdt_node_add_prop_u32(soc, "#address-cells", 2);
     fdt_node_add_prop_u32(soc, "#size-cells", 2);
@@ -234,12 +298,18 @@ PUBLIC rvvm_machine_t* rvvm_create_machine(paddr_t mem_base, size_t mem_size, si
     rvtimer_init(&machine->timer, 10000000); // 10 MHz timer
     vector_init(machine->harts);
     vector_init(machine->mmio);
+    vector_init(machine->mmio_sorted);
+#ifdef USE_JIT
+    // 16M JIT cache shared between all harts
+    rvjit_heap_init(&machine->jit_heap, 16 << 20);
+    spin_init(&machine->jit_reclaim_lock);
+#endif
+    machine->code_pages = safe_calloc(((mem_size >> PAGE_SHIFT) + 31) >> 5, sizeof(uint32_t));
     for (size_t i=0; i<hart_count; ++i) {
         vector_emplace_back(machine->harts);
         vm = &vector_at(machine->harts, i);
-        riscv_hart_init(vm, rv64);
+        riscv_hart_init(vm, machine, rv64);
         vm->timer = machine->timer;
-        vm->machine = machine;
         vm->mem = machine->mem;
         // a0 register & mhartid csr contain hart ID
         vm->csr.hartid = i;
@@ -269,6 +339,85 @@ PUBLIC bool rvvm_read_ram(rvvm_machine_t* machine, void* dest, paddr_t src, size
     return true;
 }
 
+PUBLIC bool rvvm_set_jit_cache(rvvm_machine_t* machine, const char* path)
+{
+#ifdef USE_JIT
+    // Tag the cache with host build, so foreign code is never loaded
+    uint64_t tag = sizeof(rvvm_hart_t);
+    // Inline TLB lookups depend on it's size
+    tag ^= (uint64_t)vector_at(machine->harts, 0).tlb_mask << 32;
+    for (const char* ver = VERSION " " __DATE__ " " __TIME__; *ver; ++ver) {
+        tag = (tag ^ (uint8_t)*ver) * 0x100000001B3ULL;
+    }
+    return rvjit_cache_open(&machine->jit_heap, path, tag, machine->mem.data,
+                            machine->mem.begin, machine->mem.size);
+#else
+    UNUSED(machine);
+    UNUSED(path);
+    return false;
+#endif
+}
+
+PUBLIC bool rvvm_set_tlb_size(rvvm_machine_t* machine, size_t entries)
+{
+    if (machine->running || entries < TLB_MIN_SIZE || entries > TLB_MAX_SIZE || (entries & (entries - 1))) {
+        return false;
+    }
+#ifdef USE_JIT
+    // Cached code was compiled for the previous size
+    if (machine->jit_heap.cache) return false;
+#endif
+    vector_foreach(machine->harts, i) {
+        riscv_tlb_init(&vector_at(machine->harts, i), entries);
+    }
+#ifdef USE_JIT
+    rvjit_flush_cache(&vector_at(machine->harts, 0).jit);
+#endif
+    return true;
+}
+
+PUBLIC bool rvvm_enable_jit_stats(rvvm_machine_t* machine, const char* path)
+{
+#ifdef USE_JIT
+    if (machine->running) return false;
+    rvjit_stats_enable(&machine->jit_heap, path);
+    return true;
+#else
+    UNUSED(machine);
+    UNUSED(path);
+    return false;
+#endif
+}
+
+PUBLIC bool rvvm_dump_jit_stats(rvvm_machine_t* machine)
+{
+#ifdef USE_JIT
+    return rvjit_stats_dump(&machine->jit_heap);
+#else
+    UNUSED(machine);
+    return false;
+#endif
+}
+
+PUBLIC bool rvvm_enable_jit_perf(rvvm_machine_t* machine, bool jitdump)
+{
+#ifdef USE_JIT
+    if (machine->running) return false;
+    return rvjit_perf_enable(&machine->jit_heap, jitdump);
+#else
+    UNUSED(machine);
+    UNUSED(jitdump);
+    return false;
+#endif
+}
+
+PUBLIC bool rvvm_enable_profiler(rvvm_machine_t* machine, const char* path, const char* symbols)
+{
+    if (machine->running || machine->profiler) return false;
+    machine->profiler = rvprof_create(machine, path, symbols);
+    return machine->profiler != NULL;
+}
+
 PUBLIC void rvvm_start_machine(rvvm_machine_t* machine)
 {
     if (machine->running) return;
@@ -279,6 +428,7 @@ PUBLIC void rvvm_start_machine(rvvm_machine_t* machine)
     vector_foreach(machine->harts, i) {
         riscv_hart_spawn(&vector_at(machine->harts, i));
     }
+    if (machine->profiler) rvprof_start(machine->profiler);
     register_machine(machine);
 }
 
@@ -286,9 +436,9 @@ PUBLIC void rvvm_pause_machine(rvvm_machine_t* machine)
 {
     if (!machine->running) return;
     machine->running = false;
-    vector_foreach(machine->harts, i) {
-        riscv_hart_pause(&vector_at(machine->harts, i));
-    }
+    // Harts must stay alive while the profiler notifies them
+    if (machine->profiler) rvprof_stop(machine->profiler);
+    rvvm_pause_harts(machine);
     deregister_machine(machine);
 }
 
@@ -308,8 +458,17 @@ PUBLIC void rvvm_free_machine(rvvm_machine_t* machine)
             free(dev->data);
     }
     
+    vector_foreach(machine->harts, i) {
+        riscv_hart_free(&vector_at(machine->harts, i));
+    }
+#ifdef USE_JIT
+    rvjit_heap_free(&machine->jit_heap);
+#endif
+    if (machine->profiler) rvprof_free(machine->profiler);
+    free(machine->code_pages);
     vector_free(machine->harts);
     vector_free(machine->mmio);
+    vector_free(machine->mmio_sorted);
     riscv_free_ram(&machine->mem);
 #ifdef USE_FDT
     fdt_node_free(machine->fdt);
@@ -317,6 +476,37 @@ PUBLIC void rvvm_free_machine(rvvm_machine_t* machine)
     free(machine);
 }
 
+/*
+ * Insertion sort in place, so harts looking up devices meanwhile
+ * always see valid handles, and validate the found device range
+ */
+static void rvvm_sort_mmio(rvvm_machine_t* machine)
+{
+    size_t handle, j;
+    for (size_t i=1; i<vector_size(machine->mmio_sorted); ++i) {
+        handle = vector_at(machine->mmio_sorted, i);
+        for (j=i; j>0; --j) {
+            if (vector_at(machine->mmio, vector_at(machine->mmio_sorted, j-1)).begin <= vector_at(machine->mmio, handle).begin) break;
+            vector_at(machine->mmio_sorted, j) = vector_at(machine->mmio_sorted, j-1);
+        }
+        vector_at(machine->mmio_sorted, j) = handle;
+    }
+}
+
+/*
+ * Devices may only be attached or detached while the harts are paused,
+ * pointers into the MMIO vector cached by their MMIO TLBs are dropped here
+ */
+static void rvvm_update_mmio(rvvm_machine_t* machine)
+{
+    spin_lock(&global_lock);
+    rvvm_sort_mmio(machine);
+    spin_unlock(&global_lock);
+    vector_foreach(machine->harts, i) {
+        riscv_mmio_tlb_flush(&vector_at(machine->harts, i));
+    }
+}
+
 PUBLIC rvvm_mmio_dev_t* rvvm_get_mmio(rvvm_machine_t *machine, rvvm_mmio_handle_t handle)
 {
     if (handle < 0 || (size_t)handle >= vector_size(machine->mmio)) {
@@ -331,10 +521,14 @@ PUBLIC rvvm_mmio_handle_t rvvm_attach_mmio(rvvm_machine_t* machine, const rvvm_m
     rvvm_mmio_dev_t* dev;
     if (machine->running) return RVVM_INVALID_MMIO;
 
+    spin_lock(&global_lock);
     vector_push_back(machine->mmio, *mmio);
     rvvm_mmio_handle_t ret = vector_size(machine->mmio) - 1;
     dev = &vector_at(machine->mmio, ret);
     dev->machine = machine;
+    vector_push_back(machine->mmio_sorted, (size_t)ret);
+    spin_unlock(&global_lock);
+    rvvm_update_mmio(machine);
     rvvm_info("Attached MMIO device at 0x%08"PRIxXLEN", type \"%s\"", dev->begin, dev->type ? dev->type->name : "null");
     return ret;
 }
@@ -351,6 +545,26 @@ PUBLIC void rvvm_detach_mmio(rvvm_machine_t* machine, paddr_t mmio_addr)
             dev->begin = dev->end = 0;
         }
     }
+    rvvm_update_mmio(machine);
+}
+
+PUBLIC void rvvm_remap_mmio(rvvm_machine_t* machine, rvvm_mmio_handle_t handle, paddr_t addr)
+{
+    rvvm_mmio_dev_t* dev = rvvm_get_mmio(machine, handle);
+    if (dev == NULL) return;
+    paddr_t size = dev->end - dev->begin;
+    /* must be atomic... */
+    dev->begin = addr;
+    dev->end = addr + size;
+    /* ...up to this point. But no way to make it... */
+    /*
+     * Called from hart threads (PCI BAR writes), so MMIO TLBs can't be
+     * flushed here. The vector isn't reallocated, and cached mappings
+     * are checked against the device range upon each lookup.
+     */
+    spin_lock(&global_lock);
+    rvvm_sort_mmio(machine);
+    spin_unlock(&global_lock);
 }
 
 PUBLIC void rvvm_enable_builtin_eventloop(bool enabled)
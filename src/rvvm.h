@@ -42,7 +42,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #endif
 
 #define RVVM_ABI_VERSION 2
-#define TLB_SIZE         256  // Always nonzero, power of 2 (32, 64..)
+#define TLB_SIZE         256  // Default TLB sets & JTLB size, power of 2 (32, 64..)
+#define TLB_WAYS         2    // TLB associativity, only the first way is probed inline
+#define TLB_CONTEXTS     8    // Address spaces (ASIDs) with a TLB kept across satp writes
+#define STLB_SIZE        16   // Superpage TLB entries, fully associative
+#define PWC_SIZE         64   // Page walk cache entries, power of 2
+#define MMIO_TLB_SIZE    16   // Cached device mappings per hart, power of 2
+#define RAS_SIZE         16   // JIT return address stack depth, power of 2
+#define ICACHE_PAGES     16   // Pre-decoded physical pages per hart, power of 2
 
 enum
 {
@@ -85,6 +92,9 @@ enum
 
 #define FPU_REGISTERS_MAX REGISTERS_MAX
 
+#define VECTOR_REGISTERS_MAX 32
+#define VECTOR_REG_SIZE      16   // VLEN / 8, VLEN = 128
+
 enum
 {
     PRIVILEGE_USER,
@@ -94,6 +104,20 @@ enum
     PRIVILEGES_MAX
 };
 
+// Emulator events counted by mhpmcounters, see riscv_csr.c
+enum
+{
+    HPM_EVENT_DTLB_LOAD_MISS,
+    HPM_EVENT_DTLB_STORE_MISS,
+    HPM_EVENT_ITLB_MISS,
+    HPM_EVENT_MMIO,
+    HPM_EVENT_TRAP,
+    HPM_EVENT_JIT_EXIT,
+    HPM_EVENTS
+};
+
+#define HPM_COUNTERS 32
+
 #define INTERRUPT_USOFTWARE    0x0
 #define INTERRUPT_SSOFTWARE    0x1
 #define INTERRUPT_MSOFTWARE    0x3
@@ -107,6 +131,8 @@ enum
 // Internal events delivered to the hart
 #define EXT_EVENT_TIMER        0x1 // Check timecmp for irq
 #define EXT_EVENT_PAUSE        0x2 // Pause the hart in a consistent state
+#define EXT_EVENT_JIT_RECLAIM  0x4 // Leave JIT code, acknowledge shared cache reclaim
+#define EXT_EVENT_PROFILE      0x8 // Push a PC sample to the profiler
 
 #define TRAP_INSTR_MISALIGN    0x0
 #define TRAP_INSTR_FETCH       0x1
@@ -131,15 +157,55 @@ typedef struct rvvm_mmio_dev_t rvvm_mmio_dev_t;
 typedef int rvvm_mmio_handle_t;
 #define RVVM_INVALID_MMIO (-1)
 
+typedef struct rvvm_icache_entry_t rvvm_icache_entry_t;
+
 typedef void (*riscv_inst_t)(rvvm_hart_t *vm, const uint32_t instruction);
 typedef void (*riscv_inst_c_t)(rvvm_hart_t *vm, const uint16_t instruction);
+typedef void (*riscv_inst_fast_t)(rvvm_hart_t *vm, const rvvm_icache_entry_t* entry);
 
 // Decoder moved to hart struct, allows to switch extensions per-hart
 typedef struct {
     riscv_inst_t opcodes[512];
     riscv_inst_c_t opcodes_c[32];
+    // Extracts operands of common instructions into a fast handler entry
+    void (*predecode)(rvvm_hart_t* vm, rvvm_icache_entry_t* entry);
+    // Merges common pairs of pre-decoded instructions into a single handler
+    bool (*fuse)(rvvm_icache_entry_t* entry, const rvvm_icache_entry_t* next);
 } rvvm_decoder_t;
 
+/*
+ * Pre-decoded instruction cache, keeps handlers & operands
+ * of instructions in recently executed physical pages (2-byte granularity).
+ * Entries are valid while their generation matches the page,
+ * so a page is dropped without clearing it.
+ */
+struct rvvm_icache_entry_t {
+    riscv_inst_fast_t func;
+    union {
+        riscv_inst_t handler;
+        riscv_inst_c_t handler_c;
+    };
+    uint32_t instruction;
+    uint32_t gen;
+    int32_t imm;
+    uint8_t rds;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t size;
+};
+
+typedef struct {
+    size_t page; // Page index in RAM, -1 if empty
+    uint32_t gen;
+    uint32_t flushes; // Stores to the page since it was placed
+    rvvm_icache_entry_t insn[2048];
+} rvvm_icache_page_t;
+
+typedef struct {
+    rvvm_icache_page_t pages[ICACHE_PAGES];
+    uint32_t gen;
+} rvvm_icache_t;
+
 /* 
  * Address translation cache
  * In future, it would be nice to verify if cache-line alignment
@@ -161,6 +227,28 @@ typedef struct {
 #endif
 } rvvm_tlb_entry_t;
 
+// Superpage translation, looked up on a TLB miss before walking
+typedef struct {
+    vaddr_t vaddr;
+    vaddr_t mask;
+    paddr_t paddr;
+    // Ops which passed the page walk, none if the entry is unused
+    uint8_t access;
+    uint8_t ctx;
+    bool global;
+} rvvm_stlb_entry_t;
+
+// Non-leaf PTE, lets the page walk skip upper levels
+typedef struct {
+    // Virtual address bits above shift, which select this page table
+    vaddr_t prefix;
+    paddr_t pagetable;
+    // Zero if the entry is unused
+    uint8_t shift;
+    uint8_t ctx;
+    bool global;
+} rvvm_pwc_entry_t;
+
 #ifdef USE_JIT
 typedef struct {
     // Pointer to code block
@@ -219,7 +307,7 @@ typedef struct {
     // Physical address of the page mapped to the device
     paddr_t phys;
     // The device itself
-    const rvvm_mmio_dev_t* mmio;
+    rvvm_mmio_dev_t* mmio;
 } rvvm_mmio_tlb_t;
 
 struct rvvm_hart_t {
@@ -228,17 +316,41 @@ struct rvvm_hart_t {
 #ifdef USE_FPU
     double fpu_registers[FPU_REGISTERS_MAX];
 #endif
+    // Retired instructions, JIT blocks add their length upon exit
+    uint64_t instret;
+#ifdef USE_JIT
+    // Exit counter of the last instrumented JIT block, see rvjit_stats_enable()
+    uint64_t* jit_exit;
+#endif
     
-    // We want short offsets from vmptr to tlb
-    rvvm_tlb_entry_t tlb[TLB_SIZE];
+    // TLB_WAYS arrays of tlb_mask + 1 sets of the current address space, see riscv_tlb_init()
+    rvvm_tlb_entry_t* tlb;
+    size_t tlb_mask;
 #ifdef USE_JIT
     rvvm_jtlb_entry_t jtlb[TLB_SIZE];
+    // Return address stack, holds return stubs of calling blocks
+    rvvm_jtlb_entry_t ras[RAS_SIZE];
+    uint32_t ras_top;
 #endif
     rvvm_decoder_t decoder;
+    rvvm_icache_t* icache;
     rvvm_ram_t mem;
     rvvm_machine_t* machine;
     paddr_t root_page_table;
+    uint32_t asid;
     uint8_t mmu_mode;
+    // TLBs of recent address spaces, context 0 is bare translation, see riscv_tlb_switch()
+    rvvm_tlb_entry_t* tlb_ctx;
+    uint32_t tlb_ctx_tag[TLB_CONTEXTS];
+    uint32_t tlb_ctx_used[TLB_CONTEXTS];
+    // Widest superpage offset mask ever cached per context
+    vaddr_t tlb_ctx_smask[TLB_CONTEXTS];
+    uint32_t tlb_ctx_stamp;
+    uint8_t tlb_ctx_cur;
+    uint8_t stlb_next;
+    rvvm_stlb_entry_t stlb[STLB_SIZE];
+    rvvm_pwc_entry_t pwc[PWC_SIZE];
+    rvvm_mmio_tlb_t mmio_tlb[MMIO_TLB_SIZE];
     uint8_t priv_mode;
     bool rv64;
     bool trap;
@@ -258,9 +370,25 @@ struct rvvm_hart_t {
         maxlen_t tval[PRIVILEGES_MAX];
         maxlen_t ip;
         maxlen_t fcsr;
+#ifdef USE_VECTOR
+        maxlen_t vstart;
+        maxlen_t vl;
+        maxlen_t vtype;
+        maxlen_t vcsr;
+#endif
+        uint32_t counteren[PRIVILEGES_MAX];
+        uint32_t countinhibit;
+        uint32_t hpmevent[HPM_COUNTERS];
+        // Offset from the event count, or frozen value while inhibited
+        uint64_t hpmcounter[HPM_COUNTERS];
     } csr;
+    uint64_t hpm_events[HPM_EVENTS];
     maxlen_t lrsc_cas;
     bool lrsc;
+#ifdef USE_VECTOR
+    // Register groups are contiguous, so LMUL > 1 simply spans next registers
+    uint8_t vector_registers[VECTOR_REGISTERS_MAX][VECTOR_REG_SIZE];
+#endif
 #ifdef USE_JIT
     rvjit_block_t jit;
     bool jit_enabled;
@@ -283,9 +411,23 @@ struct rvvm_machine_t {
     rvvm_ram_t mem;
     vector_t(rvvm_hart_t) harts;
     vector_t(rvvm_mmio_dev_t) mmio;
+    // Device handles sorted by address, for a binary search
+    vector_t(size_t) mmio_sorted;
     rvtimer_t timer;
     uint32_t running;
     bool needs_reset;
+#ifdef USE_JIT
+    // JIT code cache shared between harts
+    rvjit_heap_t jit_heap;
+    // Nonzero while a cache reclaim waits for harts to acknowledge it
+    uint32_t jit_reclaim_acks;
+    // Serializes reclaim requests against pausing the harts
+    spinlock_t jit_reclaim_lock;
+#endif
+    // Bitmap of RAM pages containing translated or pre-decoded code
+    uint32_t* code_pages;
+    // Guest PC sampler, NULL unless enabled
+    struct rvprof* profiler;
 #ifdef USE_FDT
     // Root fdt node for device tree generation
     struct fdt_node* fdt;
@@ -299,6 +441,40 @@ PUBLIC rvvm_machine_t* rvvm_create_machine(paddr_t mem_base, size_t mem_size, si
 PUBLIC bool rvvm_write_ram(rvvm_machine_t* machine, paddr_t dest, const void* src, size_t size);
 PUBLIC bool rvvm_read_ram(rvvm_machine_t* machine, void* dest, paddr_t src, size_t size);
 
+/*
+ * Keeps translated JIT blocks in a file between runs, verified against
+ * guest memory before use. Returns false if JIT is unavailable.
+ */
+PUBLIC bool rvvm_set_jit_cache(rvvm_machine_t* machine, const char* path);
+
+/*
+ * Resizes TLB of each hart, entries should be a power of 2 in 32-65536 range.
+ * Should be called before opening the JIT cache, which holds code for a given
+ * TLB size. Returns false on invalid size or if the machine is running.
+ */
+PUBLIC bool rvvm_set_tlb_size(rvvm_machine_t* machine, size_t entries);
+
+/*
+ * Instruments JIT blocks with execution & exit counters, the report of hot blocks
+ * is written to path upon freeing the machine, or by rvvm_dump_jit_stats().
+ * Disables the JIT cache. Returns false if JIT is unavailable.
+ */
+PUBLIC bool rvvm_enable_jit_stats(rvvm_machine_t* machine, const char* path);
+PUBLIC bool rvvm_dump_jit_stats(rvvm_machine_t* machine);
+
+/*
+ * Describes JIT blocks to Linux perf via /tmp/perf-<pid>.map, and with jitdump
+ * also /tmp/jit-<pid>.dump for `perf inject --jit`. Should be enabled before
+ * starting the machine. Returns false if JIT or perf maps are unavailable.
+ */
+PUBLIC bool rvvm_enable_jit_perf(rvvm_machine_t* machine, bool jitdump);
+
+/*
+ * Samples guest PCs while the machine runs, writes folded stacks
+ * to path each time it's paused. Symbols (ELF or System.map) are optional.
+ */
+PUBLIC bool rvvm_enable_profiler(rvvm_machine_t* machine, const char* path, const char* symbols);
+
 // Spawns CPU threads and continues VM execution
 PUBLIC void rvvm_start_machine(rvvm_machine_t* machine);
 // Stops the CPUs, everything is frozen upon return
@@ -310,6 +486,8 @@ PUBLIC void rvvm_free_machine(rvvm_machine_t* machine);
 PUBLIC rvvm_mmio_handle_t rvvm_attach_mmio(rvvm_machine_t* machine, const rvvm_mmio_dev_t* mmio);
 PUBLIC void rvvm_detach_mmio(rvvm_machine_t* machine, paddr_t mmio_addr);
 PUBLIC rvvm_mmio_dev_t* rvvm_get_mmio(rvvm_machine_t *machine, rvvm_mmio_handle_t handle);
+// Move the device to another address, may be called by devices at runtime (PCI BARs)
+PUBLIC void rvvm_remap_mmio(rvvm_machine_t* machine, rvvm_mmio_handle_t handle, paddr_t addr);
 
 /*
  * Allows to disable the internal eventloop thread and
@@ -30,6 +30,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #undef PRIx64
 #define PRIx64 "I64x"
 #endif
+#if defined(_WIN32) && defined(PRIu64)
+#undef PRIu64
+#define PRIu64 "I64u"
+#endif
 
 #ifdef __SIZEOF_INT128__
 #define INT128_SUPPORT 1
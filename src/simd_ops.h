@@ -0,0 +1,359 @@
+/*
+simd_ops.h - Host SIMD kernels
+Copyright (C) 2021  LekKit <github.com/LekKit>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMD_OPS_H
+#define SIMD_OPS_H
+
+#include "rvvm_types.h"
+#include "compiler.h"
+#include <string.h>
+
+/*
+ * Elementwise kernels over packed little-endian integer arrays,
+ * used by the vector interpreter (and reusable by a JIT fallback).
+ *
+ * Kernels process as many whole 16-byte chunks as possible and return
+ * the amount of bytes done, the caller handles the remainder itself.
+ * An unsupported operation simply returns 0.
+ */
+
+#if defined(HOST_LITTLE_ENDIAN) && (defined(__x86_64__) || defined(_M_AMD64) || \
+    (defined(__i386__) && defined(__SSE2__)))
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#if defined(GNU_EXTS) && !defined(__INTEL_COMPILER)
+// AVX2 kernels are compiled separately and selected at runtime
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(HOST_LITTLE_ENDIAN) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+enum {
+    SIMD_ADD,
+    SIMD_SUB,
+    SIMD_RSUB, // b - a
+    SIMD_AND,
+    SIMD_OR,
+    SIMD_XOR,
+    SIMD_MINU,
+    SIMD_MIN,
+    SIMD_MAXU,
+    SIMD_MAX,
+};
+
+// Copy a contiguous block, src and dst must not overlap
+static inline void simd_copy(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    size_t done = 0;
+#if defined(SIMD_SSE2)
+    for (; done + 32 <= size; done += 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(s + done));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(s + done + 16));
+        _mm_storeu_si128((__m128i*)(d + done), lo);
+        _mm_storeu_si128((__m128i*)(d + done + 16), hi);
+    }
+    for (; done + 16 <= size; done += 16) {
+        _mm_storeu_si128((__m128i*)(d + done), _mm_loadu_si128((const __m128i*)(s + done)));
+    }
+#elif defined(SIMD_NEON)
+    for (; done + 16 <= size; done += 16) {
+        vst1q_u8(d + done, vld1q_u8(s + done));
+    }
+#endif
+    if (done < size) memcpy(d + done, s + done, size - done);
+}
+
+#ifdef SIMD_SSE2
+
+static inline __m128i simd_sse2_select(__m128i mask, __m128i x, __m128i y)
+{
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+// There is no unsigned compare in SSE2, flip sign bits to compare as signed
+static inline __m128i simd_sse2_cmpgt(__m128i x, __m128i y, uint8_t esize, bool sign)
+{
+    switch (esize) {
+        case 1:
+            if (!sign) {
+                x = _mm_xor_si128(x, _mm_set1_epi8((char)0x80));
+                y = _mm_xor_si128(y, _mm_set1_epi8((char)0x80));
+            }
+            return _mm_cmpgt_epi8(x, y);
+        case 2:
+            if (!sign) {
+                x = _mm_xor_si128(x, _mm_set1_epi16((short)0x8000));
+                y = _mm_xor_si128(y, _mm_set1_epi16((short)0x8000));
+            }
+            return _mm_cmpgt_epi16(x, y);
+        default:
+            if (!sign) {
+                x = _mm_xor_si128(x, _mm_set1_epi32((int)0x80000000U));
+                y = _mm_xor_si128(y, _mm_set1_epi32((int)0x80000000U));
+            }
+            return _mm_cmpgt_epi32(x, y);
+    }
+}
+
+static inline __m128i simd_sse2_add(__m128i x, __m128i y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return _mm_add_epi8(x, y);
+        case 2: return _mm_add_epi16(x, y);
+        case 4: return _mm_add_epi32(x, y);
+        default: return _mm_add_epi64(x, y);
+    }
+}
+
+static inline __m128i simd_sse2_sub(__m128i x, __m128i y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return _mm_sub_epi8(x, y);
+        case 2: return _mm_sub_epi16(x, y);
+        case 4: return _mm_sub_epi32(x, y);
+        default: return _mm_sub_epi64(x, y);
+    }
+}
+
+static inline size_t simd_sse2_int_op(uint8_t op, uint8_t esize, uint8_t* dst, const uint8_t* a,
+                                      const uint8_t* b, bool b_splat, size_t size, size_t done)
+{
+    // No 64-bit compares in SSE2
+    if (op >= SIMD_MINU && esize == 8) return done;
+    for (; done + 16 <= size; done += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + done));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + (b_splat ? 0 : done)));
+        __m128i vr;
+        switch (op) {
+            case SIMD_ADD:  vr = simd_sse2_add(va, vb, esize); break;
+            case SIMD_SUB:  vr = simd_sse2_sub(va, vb, esize); break;
+            case SIMD_RSUB: vr = simd_sse2_sub(vb, va, esize); break;
+            case SIMD_AND:  vr = _mm_and_si128(va, vb); break;
+            case SIMD_OR:   vr = _mm_or_si128(va, vb); break;
+            case SIMD_XOR:  vr = _mm_xor_si128(va, vb); break;
+            case SIMD_MINU: vr = simd_sse2_select(simd_sse2_cmpgt(va, vb, esize, false), vb, va); break;
+            case SIMD_MIN:  vr = simd_sse2_select(simd_sse2_cmpgt(va, vb, esize, true), vb, va); break;
+            case SIMD_MAXU: vr = simd_sse2_select(simd_sse2_cmpgt(va, vb, esize, false), va, vb); break;
+            case SIMD_MAX:  vr = simd_sse2_select(simd_sse2_cmpgt(va, vb, esize, true), va, vb); break;
+            default: return done;
+        }
+        _mm_storeu_si128((__m128i*)(dst + done), vr);
+    }
+    return done;
+}
+
+#endif
+
+#ifdef SIMD_AVX2
+
+#define SIMD_AVX2_TARGET __attribute__((target("avx2")))
+
+static inline bool simd_has_avx2(void)
+{
+    static int has_avx2 = -1;
+    if (unlikely(has_avx2 < 0)) {
+        __builtin_cpu_init();
+        has_avx2 = !!__builtin_cpu_supports("avx2");
+    }
+    return has_avx2;
+}
+
+SIMD_AVX2_TARGET static inline __m256i simd_avx2_add(__m256i x, __m256i y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return _mm256_add_epi8(x, y);
+        case 2: return _mm256_add_epi16(x, y);
+        case 4: return _mm256_add_epi32(x, y);
+        default: return _mm256_add_epi64(x, y);
+    }
+}
+
+SIMD_AVX2_TARGET static inline __m256i simd_avx2_sub(__m256i x, __m256i y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return _mm256_sub_epi8(x, y);
+        case 2: return _mm256_sub_epi16(x, y);
+        case 4: return _mm256_sub_epi32(x, y);
+        default: return _mm256_sub_epi64(x, y);
+    }
+}
+
+SIMD_AVX2_TARGET static inline __m256i simd_avx2_minmax(__m256i x, __m256i y, uint8_t esize, uint8_t op)
+{
+    switch (esize) {
+        case 1:
+            switch (op) {
+                case SIMD_MINU: return _mm256_min_epu8(x, y);
+                case SIMD_MIN:  return _mm256_min_epi8(x, y);
+                case SIMD_MAXU: return _mm256_max_epu8(x, y);
+                default:        return _mm256_max_epi8(x, y);
+            }
+        case 2:
+            switch (op) {
+                case SIMD_MINU: return _mm256_min_epu16(x, y);
+                case SIMD_MIN:  return _mm256_min_epi16(x, y);
+                case SIMD_MAXU: return _mm256_max_epu16(x, y);
+                default:        return _mm256_max_epi16(x, y);
+            }
+        case 4:
+            switch (op) {
+                case SIMD_MINU: return _mm256_min_epu32(x, y);
+                case SIMD_MIN:  return _mm256_min_epi32(x, y);
+                case SIMD_MAXU: return _mm256_max_epu32(x, y);
+                default:        return _mm256_max_epi32(x, y);
+            }
+        default: {
+            __m256i xs = x, ys = y;
+            if (op == SIMD_MINU || op == SIMD_MAXU) {
+                __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+                xs = _mm256_xor_si256(x, bias);
+                ys = _mm256_xor_si256(y, bias);
+            }
+            __m256i gt = _mm256_cmpgt_epi64(xs, ys);
+            if (op == SIMD_MINU || op == SIMD_MIN) {
+                return _mm256_blendv_epi8(x, y, gt);
+            } else {
+                return _mm256_blendv_epi8(y, x, gt);
+            }
+        }
+    }
+}
+
+SIMD_AVX2_TARGET static inline size_t simd_avx2_int_op(uint8_t op, uint8_t esize, uint8_t* dst, const uint8_t* a,
+                                                const uint8_t* b, bool b_splat, size_t size)
+{
+    size_t done = 0;
+    for (; done + 32 <= size; done += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + done));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + (b_splat ? 0 : done)));
+        __m256i vr;
+        switch (op) {
+            case SIMD_ADD:  vr = simd_avx2_add(va, vb, esize); break;
+            case SIMD_SUB:  vr = simd_avx2_sub(va, vb, esize); break;
+            case SIMD_RSUB: vr = simd_avx2_sub(vb, va, esize); break;
+            case SIMD_AND:  vr = _mm256_and_si256(va, vb); break;
+            case SIMD_OR:   vr = _mm256_or_si256(va, vb); break;
+            case SIMD_XOR:  vr = _mm256_xor_si256(va, vb); break;
+            case SIMD_MINU:
+            case SIMD_MIN:
+            case SIMD_MAXU:
+            case SIMD_MAX:  vr = simd_avx2_minmax(va, vb, esize, op); break;
+            default: return done;
+        }
+        _mm256_storeu_si256((__m256i*)(dst + done), vr);
+    }
+    return done;
+}
+
+#endif
+
+#ifdef SIMD_NEON
+
+static inline uint8x16_t simd_neon_add(uint8x16_t x, uint8x16_t y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return vaddq_u8(x, y);
+        case 2: return vreinterpretq_u8_u16(vaddq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+        case 4: return vreinterpretq_u8_u32(vaddq_u32(vreinterpretq_u32_u8(x), vreinterpretq_u32_u8(y)));
+        default: return vreinterpretq_u8_u64(vaddq_u64(vreinterpretq_u64_u8(x), vreinterpretq_u64_u8(y)));
+    }
+}
+
+static inline uint8x16_t simd_neon_sub(uint8x16_t x, uint8x16_t y, uint8_t esize)
+{
+    switch (esize) {
+        case 1: return vsubq_u8(x, y);
+        case 2: return vreinterpretq_u8_u16(vsubq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+        case 4: return vreinterpretq_u8_u32(vsubq_u32(vreinterpretq_u32_u8(x), vreinterpretq_u32_u8(y)));
+        default: return vreinterpretq_u8_u64(vsubq_u64(vreinterpretq_u64_u8(x), vreinterpretq_u64_u8(y)));
+    }
+}
+
+#define SIMD_NEON_MINMAX(fn, x, y, esize) \
+    (esize == 1 ? fn##_u8(x, y) : \
+    esize == 2 ? vreinterpretq_u8_u16(fn##_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y))) : \
+    vreinterpretq_u8_u32(fn##_u32(vreinterpretq_u32_u8(x), vreinterpretq_u32_u8(y))))
+
+#define SIMD_NEON_SMINMAX(fn, x, y, esize) \
+    (esize == 1 ? vreinterpretq_u8_s8(fn##_s8(vreinterpretq_s8_u8(x), vreinterpretq_s8_u8(y))) : \
+    esize == 2 ? vreinterpretq_u8_s16(fn##_s16(vreinterpretq_s16_u8(x), vreinterpretq_s16_u8(y))) : \
+    vreinterpretq_u8_s32(fn##_s32(vreinterpretq_s32_u8(x), vreinterpretq_s32_u8(y))))
+
+static inline size_t simd_neon_int_op(uint8_t op, uint8_t esize, uint8_t* dst, const uint8_t* a,
+                                      const uint8_t* b, bool b_splat, size_t size, size_t done)
+{
+    // No 64-bit min/max in NEON
+    if (op >= SIMD_MINU && esize == 8) return done;
+    for (; done + 16 <= size; done += 16) {
+        uint8x16_t va = vld1q_u8(a + done);
+        uint8x16_t vb = vld1q_u8(b + (b_splat ? 0 : done));
+        uint8x16_t vr;
+        switch (op) {
+            case SIMD_ADD:  vr = simd_neon_add(va, vb, esize); break;
+            case SIMD_SUB:  vr = simd_neon_sub(va, vb, esize); break;
+            case SIMD_RSUB: vr = simd_neon_sub(vb, va, esize); break;
+            case SIMD_AND:  vr = vandq_u8(va, vb); break;
+            case SIMD_OR:   vr = vorrq_u8(va, vb); break;
+            case SIMD_XOR:  vr = veorq_u8(va, vb); break;
+            case SIMD_MINU: vr = SIMD_NEON_MINMAX(vminq, va, vb, esize); break;
+            case SIMD_MIN:  vr = SIMD_NEON_SMINMAX(vminq, va, vb, esize); break;
+            case SIMD_MAXU: vr = SIMD_NEON_MINMAX(vmaxq, va, vb, esize); break;
+            case SIMD_MAX:  vr = SIMD_NEON_SMINMAX(vmaxq, va, vb, esize); break;
+            default: return done;
+        }
+        vst1q_u8(dst + done, vr);
+    }
+    return done;
+}
+
+#endif
+
+/*
+ * dst[i] = a[i] op b[i] for elements of esize bytes.
+ * If b_splat is set, b points to a single 32-byte pattern
+ * repeating the same scalar in every element.
+ */
+static inline size_t simd_int_op(uint8_t op, uint8_t esize, uint8_t* dst, const uint8_t* a,
+                                 const uint8_t* b, bool b_splat, size_t size)
+{
+    size_t done = 0;
+#ifdef SIMD_AVX2
+    if (simd_has_avx2()) done = simd_avx2_int_op(op, esize, dst, a, b, b_splat, size);
+#endif
+#if defined(SIMD_SSE2)
+    done = simd_sse2_int_op(op, esize, dst, a, b, b_splat, size, done);
+#elif defined(SIMD_NEON)
+    done = simd_neon_int_op(op, esize, dst, a, b, b_splat, size, done);
+#else
+    UNUSED(op);
+    UNUSED(esize);
+    UNUSED(dst);
+    UNUSED(a);
+    UNUSED(b);
+    UNUSED(b_splat);
+    UNUSED(size);
+#endif
+    return done;
+}
+
+#endif